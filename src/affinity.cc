@@ -0,0 +1,294 @@
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/filter.h>
+
+#include "src/affinity.h"
+
+namespace bangnet {
+
+namespace {
+
+// From linux/mempolicy.h, which is not meant for user space.
+const int kMpolPreferred = 1;
+const int kMpolBind = 2;
+const unsigned int kMpolMfMove = 1 << 1;
+
+// Nodes a node mask holds.
+const int kMaxNodes = 1024;
+
+const int kSoIncomingCpu = 49;
+const int kSoAttachReuseportCbpf = 51;
+
+// Reads a small file, like a sysfs attribute. Returns false if it does not
+// exist.
+bool ReadFile(const string& path, string* contents) {
+  std::ifstream in(path.c_str());
+  if (!in)
+    return false;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  *contents = ss.str();
+  return true;
+}
+
+struct NodeMask {
+  explicit NodeMask(int node) {
+    memset(bits, 0, sizeof(bits));
+    bits[node / 64] |= 1ull << (node % 64);
+  }
+
+  uint64_t bits[kMaxNodes / 64];
+};
+
+}  // namespace
+
+bool ParseCpuList(const string& list, vector<int>* cpus) {
+  cpus->clear();
+  stringstream ss(list);
+  string range;
+  while (std::getline(ss, range, ',')) {
+    size_t b = range.find_first_not_of(" \t\n");
+    size_t e = range.find_last_not_of(" \t\n");
+    if (b == string::npos)
+      continue;
+    range = range.substr(b, e - b + 1);
+    char* end;
+    long lo = strtol(range.c_str(), &end, 10);
+    long hi = lo;
+    if (*end == '-')
+      hi = strtol(end + 1, &end, 10);
+    if (*end || end == range.c_str() || lo < 0 || hi < lo)
+      return false;
+    for (long c = lo; c <= hi; ++c)
+      cpus->push_back((int)c);
+  }
+  return true;
+}
+
+int NodeOfCpu(int cpu) {
+  ostringstream path;
+  path << "/sys/devices/system/cpu/cpu" << cpu;
+  DIR* dir = opendir(path.str().c_str());
+  if (!dir)
+    return 0;
+  int node = 0;
+  while (struct dirent* e = readdir(dir)) {
+    if (strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' &&
+        e->d_name[4] <= '9') {
+      node = atoi(e->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+int NumNodes() {
+  string online;
+  vector<int> nodes;
+  if (!ReadFile("/sys/devices/system/node/online", &online) ||
+      !ParseCpuList(online, &nodes) || nodes.empty())
+    return 1;
+  return nodes.back() + 1;
+}
+
+int CurrentCpu() {
+  return sched_getcpu();
+}
+
+bool PinThreadToCpu(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err) {
+    LOG(ERROR) << "Unable to pin thread to cpu " << cpu << ": "
+               << strerror(err);
+    return false;
+  }
+  return true;
+}
+
+bool SetThreadNode(int node) {
+  if (node < 0 || node >= kMaxNodes)
+    return false;
+  NodeMask mask(node);
+  if (syscall(SYS_set_mempolicy, kMpolPreferred, mask.bits,
+              kMaxNodes + 1) < 0) {
+    LOG(WARNING) << "Unable to prefer memory of node " << node << ": "
+                 << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool BindMemoryToNode(void* addr, size_t len, int node) {
+  if (node < 0 || node >= kMaxNodes)
+    return false;
+  uintptr_t page = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = (uintptr_t)addr & ~(page - 1);
+  uintptr_t end = ((uintptr_t)addr + len + page - 1) & ~(page - 1);
+  NodeMask mask(node);
+  if (syscall(SYS_mbind, (void*)begin, end - begin, kMpolBind, mask.bits,
+              kMaxNodes + 1, kMpolMfMove) < 0) {
+    LOG(WARNING) << "Unable to bind memory to node " << node << ": "
+                 << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+vector<int> ParseQueueIrqs(const string& interrupts, const string& device) {
+  vector<int> irqs;
+  stringstream ss(interrupts);
+  string line;
+  string prefix = device + "-";
+  while (std::getline(ss, line)) {
+    size_t colon = line.find(':');
+    size_t last = line.find_last_of(" \t");
+    if (colon == string::npos || last == string::npos)
+      continue;
+    char* end;
+    long irq = strtol(line.c_str(), &end, 10);
+    if (end != line.c_str() + colon)
+      continue;
+    // Transmit only and control interrupts are not queues frames land on.
+    string name = line.substr(last + 1);
+    if (name.compare(0, prefix.size(), prefix) != 0 ||
+        name.find("config") != string::npos ||
+        name.find("-tx-") != string::npos ||
+        name.find("output") != string::npos)
+      continue;
+    irqs.push_back((int)irq);
+  }
+  return irqs;
+}
+
+vector<int> QueueIrqCpus(const string& device) {
+  vector<int> cpus;
+  string interrupts;
+  if (!ReadFile("/proc/interrupts", &interrupts))
+    return cpus;
+  vector<int> irqs = ParseQueueIrqs(interrupts, device);
+  for (size_t i = 0; i < irqs.size(); ++i) {
+    ostringstream dir;
+    dir << "/proc/irq/" << irqs[i] << "/";
+    string list;
+    vector<int> affinity;
+    if ((ReadFile(dir.str() + "effective_affinity_list", &list) ||
+         ReadFile(dir.str() + "smp_affinity_list", &list)) &&
+        ParseCpuList(list, &affinity) && !affinity.empty())
+      cpus.push_back(affinity[0]);
+    else
+      cpus.push_back(-1);
+  }
+  return cpus;
+}
+
+int MatchQueue(const vector<int>& queue_cpus, int cpu, int index) {
+  if (queue_cpus.empty())
+    return -1;
+  for (size_t q = 0; q < queue_cpus.size(); ++q) {
+    if (queue_cpus[q] == cpu)
+      return (int)q;
+  }
+  int node = NodeOfCpu(cpu);
+  // Spread the workers of a node over the queues of the node.
+  vector<int> local;
+  for (size_t q = 0; q < queue_cpus.size(); ++q) {
+    if (queue_cpus[q] >= 0 && NodeOfCpu(queue_cpus[q]) == node)
+      local.push_back((int)q);
+  }
+  if (!local.empty())
+    return local[index % local.size()];
+  return index % queue_cpus.size();
+}
+
+bool SteerReuseportByCpu(int fd, unsigned int sockets) {
+  if (!sockets)
+    return false;
+  struct sock_filter code[] = {
+    // A = cpu % sockets, the index of the socket in the group.
+    {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t)(SKF_AD_OFF + SKF_AD_CPU)},
+    {BPF_ALU | BPF_MOD | BPF_K, 0, 0, sockets},
+    {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog prog;
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+  if (setsockopt(fd, SOL_SOCKET, kSoAttachReuseportCbpf, &prog,
+                 sizeof(prog)) < 0) {
+    LOG(ERROR) << "Unable to steer socket by cpu: " << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool SetIncomingCpu(int fd, int cpu) {
+  if (setsockopt(fd, SOL_SOCKET, kSoIncomingCpu, &cpu, sizeof(cpu)) < 0) {
+    LOG(ERROR) << "Unable to set the incoming cpu of a socket: "
+               << strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+WorkerGroup::WorkerGroup(const string& name, const vector<int>& cpus,
+                         const string& device)
+    : name_(name), stop_(false), running_(false) {
+  vector<int> queue_cpus;
+  if (!device.empty())
+    queue_cpus = QueueIrqCpus(device);
+  for (size_t i = 0; i < cpus.size(); ++i) {
+    Worker* w = new Worker;
+    w->index_ = (int)i;
+    w->cpu_ = cpus[i];
+    w->node_ = NodeOfCpu(cpus[i]);
+    w->queue_ = MatchQueue(queue_cpus, cpus[i], (int)i);
+    w->stop_ = &stop_;
+    workers_.push_back(w);
+    LOG(INFO) << name_ << ": worker " << i << " on cpu " << w->cpu_
+              << ", node " << w->node_ << ", queue " << w->queue_;
+  }
+}
+
+WorkerGroup::~WorkerGroup() {
+  Stop();
+  for (size_t i = 0; i < workers_.size(); ++i)
+    delete workers_[i];
+}
+
+void WorkerGroup::Run(Worker* worker, WorkerFunction fn, void* arg) {
+  PinThreadToCpu(worker->cpu_);
+  // Single node hosts have nothing to prefer.
+  if (NumNodes() > 1)
+    SetThreadNode(worker->node_);
+  fn(worker, arg);
+}
+
+void WorkerGroup::Start(WorkerFunction fn, void* arg) {
+  CHECK(!running_) << name_ << " started twice";
+  running_ = true;
+  stop_ = false;
+  for (size_t i = 0; i < workers_.size(); ++i)
+    workers_[i]->thread_ = std::thread(Run, workers_[i], fn, arg);
+}
+
+void WorkerGroup::Stop() {
+  if (!running_)
+    return;
+  stop_ = true;
+  for (size_t i = 0; i < workers_.size(); ++i)
+    workers_[i]->thread_.join();
+  running_ = false;
+}
+
+}  // namespace bangnet
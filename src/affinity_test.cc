@@ -0,0 +1,115 @@
+#include "src/affinity.h"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "src/buffer_pool.h"
+
+namespace bangnet {
+namespace {
+
+TEST(AffinityTest, ParsesCpuLists) {
+  vector<int> cpus;
+  EXPECT_TRUE(ParseCpuList("0-3,8,10-11\n", &cpus));
+  int expected[] = {0, 1, 2, 3, 8, 10, 11};
+  EXPECT_EQ(vector<int>(expected, expected + 7), cpus);
+  EXPECT_TRUE(ParseCpuList("", &cpus));
+  EXPECT_TRUE(cpus.empty());
+  EXPECT_FALSE(ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(ParseCpuList("a", &cpus));
+}
+
+TEST(AffinityTest, ParsesQueueIrqs) {
+  const char* interrupts =
+      "           CPU0       CPU1\n"
+      " 24:          1          0  IO-APIC   5-edge      ACPI:Ged\n"
+      " 40:          0          0  PCI-MSI 1-edge      eth0\n"
+      " 41:        100          0  PCI-MSI 2-edge      eth0-TxRx-0\n"
+      " 42:          0        100  PCI-MSI 3-edge      eth0-TxRx-1\n"
+      " 43:          0        100  PCI-MSI 4-edge      eth1-TxRx-0\n"
+      " 44:          0          0  PCI-MSI 5-edge      virtio0-config\n"
+      " 45:          0          9  PCI-MSI 6-edge      virtio0-input.0\n"
+      " 46:          0          9  PCI-MSI 7-edge      virtio0-output.0\n"
+      "NMI:          0          0   Non-maskable interrupts\n";
+  vector<int> irqs = ParseQueueIrqs(interrupts, "eth0");
+  ASSERT_EQ(2u, irqs.size());
+  EXPECT_EQ(41, irqs[0]);
+  EXPECT_EQ(42, irqs[1]);
+  irqs = ParseQueueIrqs(interrupts, "virtio0");
+  ASSERT_EQ(1u, irqs.size());
+  EXPECT_EQ(45, irqs[0]);
+}
+
+TEST(AffinityTest, MatchesQueues) {
+  vector<int> queue_cpus;
+  EXPECT_EQ(-1, MatchQueue(queue_cpus, 0, 0));
+  queue_cpus.push_back(2);
+  queue_cpus.push_back(0);
+  EXPECT_EQ(1, MatchQueue(queue_cpus, 0, 0));
+  EXPECT_EQ(0, MatchQueue(queue_cpus, 2, 1));
+}
+
+TEST(AffinityTest, PinsThreads) {
+  EXPECT_GE(NumNodes(), 1);
+  EXPECT_EQ(0, NodeOfCpu(0));
+  ASSERT_TRUE(PinThreadToCpu(0));
+  EXPECT_EQ(0, CurrentCpu());
+}
+
+TEST(AffinityTest, SteersSockets) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  ASSERT_GE(fd, 0);
+  int one = 1;
+  ASSERT_EQ(0, setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)));
+  EXPECT_TRUE(SteerReuseportByCpu(fd, 2));
+  EXPECT_TRUE(SetIncomingCpu(fd, 0));
+  close(fd);
+}
+
+TEST(AffinityTest, BindsPoolsToNodes) {
+  BufferPool pool(2048, 64);
+  // Kernels without NUMA support refuse, which is fine on such hosts.
+  if (pool.BindToNode(0)) {
+    Buffer* b = pool.Get();
+    b->data()[0] = 1;
+    b->Unref();
+  }
+  EXPECT_EQ(64u, pool.available());
+}
+
+struct Seen {
+  std::atomic<int> runs;
+  int cpu[4];
+};
+
+void RecordCpu(Worker* worker, void* arg) {
+  Seen* seen = (Seen*)arg;
+  seen->cpu[worker->index()] = CurrentCpu();
+  ++seen->runs;
+  while (!worker->stopping())
+    usleep(100);
+}
+
+TEST(WorkerGroupTest, RunsPinnedWorkers) {
+  vector<int> cpus(2, 0);
+  WorkerGroup group("workers", cpus, "");
+  ASSERT_EQ(2, group.size());
+  EXPECT_EQ(0, group.worker(1)->cpu());
+  EXPECT_EQ(0, group.worker(1)->node());
+  EXPECT_EQ(-1, group.worker(1)->queue());
+
+  Seen seen;
+  seen.runs = 0;
+  group.Start(RecordCpu, &seen);
+  while (seen.runs < 2)
+    usleep(100);
+  group.Stop();
+  EXPECT_EQ(0, seen.cpu[0]);
+  EXPECT_EQ(0, seen.cpu[1]);
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,110 @@
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "src/arena.h"
+
+namespace bangnet {
+
+namespace {
+
+const size_t kSmallPage = 4096;
+const size_t kHugePage = 2ul << 20;
+const size_t kGiantPage = 1ul << 30;
+
+// From linux/mman.h, missing in older libcs.
+const int kMapHugeShift = 26;
+
+inline size_t RoundUp(size_t n, size_t to) {
+  return (n + to - 1) & ~(to - 1);
+}
+
+// Maps len bytes of hugetlb pages of page bytes, null if there are none.
+void* MapHugetlb(size_t len, size_t page) {
+  int log2 = page == kGiantPage ? 30 : 21;
+  void* p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                 (log2 << kMapHugeShift), -1, 0);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+}  // namespace
+
+Arena::Arena(size_t chunk_size, ArenaPages pages)
+    : chunk_size_(chunk_size ? chunk_size : kHugePage), pages_(pages),
+      next_(NULL), end_(NULL), reserved_(0), used_(0), huge_reserved_(0) {}
+
+Arena::~Arena() {
+  for (size_t i = 0; i < regions_.size(); ++i)
+    munmap(regions_[i].base, regions_[i].len);
+}
+
+void Arena::Reserve(size_t len) {
+  if (len < chunk_size_)
+    len = chunk_size_;
+  void* p = NULL;
+  bool huge = false;
+
+  // Huge pages for regions of at least half a page, so small arenas do not
+  // waste most of one.
+  if (pages_ == ARENA_PAGES_HUGE && len >= kGiantPage / 2) {
+    len = RoundUp(len, kGiantPage);
+    p = MapHugetlb(len, kGiantPage);
+  }
+  if (!p && pages_ == ARENA_PAGES_HUGE && len >= kHugePage / 2) {
+    len = RoundUp(len, kHugePage);
+    p = MapHugetlb(len, kHugePage);
+  }
+  huge = p != NULL;
+
+  if (!p) {
+    len = RoundUp(len, kSmallPage);
+    bool thp = pages_ == ARENA_PAGES_HUGE && len >= kHugePage;
+    // Transparent huge pages need 2MB aligned memory, so map a page more
+    // and trim the ends.
+    size_t map_len = thp ? len + kHugePage : len;
+    unsigned char* m = (unsigned char*)mmap(NULL, map_len,
+                                            PROT_READ | PROT_WRITE,
+                                            MAP_PRIVATE | MAP_ANONYMOUS,
+                                            -1, 0);
+    CHECK(m != MAP_FAILED) << "Unable to reserve " << len
+                           << " bytes: " << strerror(errno);
+    p = m;
+    if (thp) {
+      unsigned char* aligned = (unsigned char*)RoundUp((size_t)m, kHugePage);
+      if (aligned > m)
+        munmap(m, aligned - m);
+      munmap(aligned + len, m + map_len - (aligned + len));
+      p = aligned;
+      huge = madvise(p, len, MADV_HUGEPAGE) == 0;
+    } else if (pages_ == ARENA_PAGES_SMALL) {
+      madvise(p, len, MADV_NOHUGEPAGE);
+    }
+  }
+
+  Region r;
+  r.base = p;
+  r.len = len;
+  regions_.push_back(r);
+  next_ = (unsigned char*)p;
+  end_ = next_ + len;
+  reserved_ += len;
+  if (huge)
+    huge_reserved_ += len;
+}
+
+void* Arena::Allocate(size_t len, size_t align) {
+  if (!len)
+    len = 1;
+  unsigned char* p = (unsigned char*)RoundUp((size_t)next_, align);
+  if (!next_ || p + len > end_) {
+    // The rest of the current region is left unused.
+    Reserve(len + align);
+    p = (unsigned char*)RoundUp((size_t)next_, align);
+  }
+  next_ = p + len;
+  used_ += len;
+  return p;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,82 @@
+#ifndef BANGNET_ARENA_H_
+#define BANGNET_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <type_traits>
+
+#include "src/common.h"
+
+namespace bangnet {
+
+// Pages an arena is backed by.
+enum ArenaPages {
+  // 1GB or 2MB hugetlb pages if the host reserved some, else transparent
+  // huge pages, else 4KB pages.
+  ARENA_PAGES_HUGE,
+  // 4KB pages only, to compare against.
+  ARENA_PAGES_SMALL
+};
+
+// Memory for datapath structures, like buffer pools and lookup tables,
+// reserved in large regions of huge pages so lookups spread over a large
+// table do not miss the TLB on every frame. Allocations are carved out of
+// the regions and only given back when the arena goes away, so nothing on
+// the frame path allocates or frees. Not thread safe, arenas are filled
+// while the datapath is set up.
+class Arena {
+public:
+  // Regions are reserved chunk_size bytes at a time, or as large as a
+  // larger allocation needs.
+  explicit Arena(size_t chunk_size, ArenaPages pages = ARENA_PAGES_HUGE);
+  ~Arena();
+
+  // Returns len bytes aligned to align, a power of 2 up to the page size,
+  // zeroed. Dies if the host is out of memory.
+  void* Allocate(size_t len, size_t align = 64);
+
+  // Allocates and default constructs n objects. They are never destroyed,
+  // so T must not need to be.
+  template <typename T>
+  T* NewArray(size_t n) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "arena objects are never destroyed");
+    T* p = (T*)Allocate(sizeof(T) * n, alignof(T) > 64 ? alignof(T) : 64);
+    for (size_t i = 0; i < n; ++i)
+      new (p + i) T();
+    return p;
+  }
+
+  // Bytes reserved and handed out.
+  size_t reserved() const { return reserved_; }
+  size_t used() const { return used_; }
+
+  // Bytes reserved in hugetlb pages, or madvised for transparent huge
+  // pages, which the kernel backs with huge pages when it has them.
+  size_t huge_reserved() const { return huge_reserved_; }
+
+private:
+  struct Region {
+    void* base;
+    size_t len;
+  };
+
+  void Reserve(size_t len);
+
+  size_t chunk_size_;
+  ArenaPages pages_;
+  vector<Region> regions_;
+  unsigned char* next_;
+  unsigned char* end_;
+  size_t reserved_;
+  size_t used_;
+  size_t huge_reserved_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_ARENA_H_
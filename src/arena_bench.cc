@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "src/arena.h"
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/switch.h"
+
+namespace bangnet {
+namespace {
+
+// Counts the dTLB load misses of the calling thread, where the cpu and the
+// kernel expose them.
+class DtlbCounter {
+public:
+  DtlbCounter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                  (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  ~DtlbCounter() {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool ok() const { return fd_ >= 0; }
+
+  uint64_t Read() const {
+    uint64_t v = 0;
+    if (fd_ < 0 || read(fd_, &v, sizeof(v)) != sizeof(v))
+      return 0;
+    return v;
+  }
+
+private:
+  int fd_;
+};
+
+// Share of the mapping holding addr backed by huge pages, from smaps.
+double HugeShare(const void* addr) {
+  std::ifstream in("/proc/self/smaps");
+  string line;
+  bool inside = false;
+  double size = 0, huge = 0;
+  while (std::getline(in, line)) {
+    unsigned long lo, hi;
+    if (sscanf(line.c_str(), "%lx-%lx ", &lo, &hi) == 2 &&
+        line.find(':') > line.find(' ')) {
+      if (inside)
+        break;
+      inside = (unsigned long)addr >= lo && (unsigned long)addr < hi;
+      continue;
+    }
+    unsigned long kb;
+    if (inside && sscanf(line.c_str(), "Size: %lu kB", &kb) == 1)
+      size = kb;
+    if (inside && (sscanf(line.c_str(), "AnonHugePages: %lu kB", &kb) == 1 ||
+                   sscanf(line.c_str(), "Private_Hugetlb: %lu kB", &kb) == 1))
+      huge += kb;
+  }
+  return size > 0 ? huge / size : 0;
+}
+
+// Looks up random macs in a mac table of entries, its memory on small or
+// huge pages, the access pattern of a switch with many hosts behind it.
+BenchResult RunMacTableBench(ArenaPages pages, unsigned int entries,
+                             uint64_t duration_ms) {
+  // One region for the whole table, found in smaps by a byte before it.
+  Arena arena((size_t)entries * 32, pages);
+  const void* probe = arena.Allocate(1);
+  MacTable table(entries, ~0ull, &arena);
+  unsigned char mac[6] = {0x02, 0, 0, 0, 0, 0};
+  for (unsigned int i = 0; i < entries; ++i) {
+    memcpy(mac + 2, &i, 4);
+    table.Learn(mac, i & 63, 1);
+  }
+  double huge = HugeShare(probe);
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "mac-lookup/%s/%uk",
+           pages == ARENA_PAGES_HUGE ? "huge" : "4k", entries / 1024);
+  result.name = name;
+  DtlbCounter dtlb;
+  uint64_t misses0 = dtlb.Read();
+  uint32_t x = 1;
+  int64_t sum = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    for (int i = 0; i < 4096; ++i) {
+      x = x * 1103515245u + 12345u;
+      unsigned int k = (x >> 4) % entries;
+      memcpy(mac + 2, &k, 4);
+      sum += table.Lookup(mac, 2);
+    }
+    result.packets += 4096;
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  if (dtlb.ok())
+    result.AddExtra("dtlb/lookup",
+                    (double)(dtlb.Read() - misses0) / result.packets);
+  result.AddExtra("huge%", 100 * huge);
+  if (sum < 0)
+    LOG(INFO) << "unexpected miss";
+  return result;
+}
+
+BENCHMARK(Arena) {
+  unsigned int sizes[] = {64 * 1024, 4 * 1024 * 1024};
+  for (int s = 0; s < 2; ++s) {
+    results->push_back(RunMacTableBench(ARENA_PAGES_SMALL, sizes[s],
+                                        options.duration_ms));
+    results->push_back(RunMacTableBench(ARENA_PAGES_HUGE, sizes[s],
+                                        options.duration_ms));
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,73 @@
+#include "src/arena.h"
+
+#include <stdint.h>
+
+#include <gtest/gtest.h>
+
+#include "src/buffer_pool.h"
+
+namespace bangnet {
+namespace {
+
+struct Pair {
+  Pair() : a(1), b(2) {}
+  int a;
+  int b;
+};
+
+TEST(ArenaTest, CarvesAlignedZeroedRegions) {
+  Arena arena(64 * 1024, ARENA_PAGES_SMALL);
+  EXPECT_EQ(0u, arena.reserved());
+  unsigned char* p = (unsigned char*)arena.Allocate(100);
+  EXPECT_EQ(0u, (uintptr_t)p % 64);
+  for (int i = 0; i < 100; ++i)
+    EXPECT_EQ(0, p[i]);
+  unsigned char* q = (unsigned char*)arena.Allocate(10, 4096);
+  EXPECT_EQ(0u, (uintptr_t)q % 4096);
+  EXPECT_GE(q, p + 100);
+  EXPECT_EQ(64u * 1024, arena.reserved());
+  EXPECT_EQ(110u, arena.used());
+  EXPECT_EQ(0u, arena.huge_reserved());
+
+  Pair* pairs = arena.NewArray<Pair>(3);
+  EXPECT_EQ(1, pairs[2].a);
+  EXPECT_EQ(2, pairs[2].b);
+}
+
+TEST(ArenaTest, GrowsByRegions) {
+  Arena arena(4096, ARENA_PAGES_SMALL);
+  arena.Allocate(4000);
+  // Does not fit the first region, nor the chunk size.
+  unsigned char* p = (unsigned char*)arena.Allocate(10000);
+  p[9999] = 1;
+  EXPECT_GE(arena.reserved(), 4096u + 10000);
+}
+
+TEST(ArenaTest, PrefersHugePages) {
+  Arena arena(4ul << 20);
+  unsigned char* p = (unsigned char*)arena.Allocate(3ul << 20, 2ul << 20);
+  p[0] = 1;
+  p[(3ul << 20) - 1] = 1;
+  EXPECT_GE(arena.reserved(), 4ul << 20);
+  // Hugetlb or transparent huge pages, unless the kernel has neither.
+  EXPECT_EQ(arena.reserved(), arena.huge_reserved());
+}
+
+TEST(ArenaTest, BacksBufferPools) {
+  Arena arena(1 << 20);
+  BufferPool a(2048, 16, BufferPool::kDefaultHeadroom, &arena);
+  size_t reserved = arena.reserved();
+  BufferPool b(2048, 16, BufferPool::kDefaultHeadroom, &arena);
+  // Both fit the first region.
+  EXPECT_EQ(reserved, arena.reserved());
+  Buffer* x = a.Get();
+  Buffer* y = b.Get();
+  EXPECT_EQ(&a, x->pool());
+  EXPECT_EQ(&b, y->pool());
+  x->Unref();
+  y->Unref();
+  EXPECT_EQ(16u, a.available());
+}
+
+}  // namespace
+}  // namespace bangnet
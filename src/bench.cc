@@ -0,0 +1,73 @@
+#include <stdio.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+
+namespace bangnet {
+
+void BenchResult::AddExtra(const string& key, double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.3f", value);
+  extra.push_back(make_pair(key, string(buf)));
+}
+
+int StageClock::AddStage(const string& name) {
+  names_.push_back(name);
+  cycles_.push_back(0);
+  return (int)names_.size() - 1;
+}
+
+void StageClock::Fill(BenchResult* result) const {
+  for (size_t i = 0; i < names_.size(); ++i) {
+    double ns = result->packets == 0 ? 0 :
+        cycles_[i] * CycleClock::ns_per_cycle() / result->packets;
+    result->stage_ns.push_back(make_pair(names_[i], ns));
+  }
+}
+
+BenchRegistry* BenchRegistry::Instance() {
+  static BenchRegistry* registry = new BenchRegistry();
+  return registry;
+}
+
+void BenchRegistry::Register(const char* name, BenchFunction fn) {
+  benches_.push_back(make_pair(string(name), fn));
+}
+
+int BenchRegistry::RunAll(const BenchOptions& options, const string& filter) {
+  int run = 0;
+  for (size_t i = 0; i < benches_.size(); ++i) {
+    if (benches_[i].first.find(filter) == string::npos)
+      continue;
+    printf("[ %s ]\n", benches_[i].first.c_str());
+    fflush(stdout);
+    vector<BenchResult> results;
+    benches_[i].second(options, &results);
+    for (size_t j = 0; j < results.size(); ++j)
+      PrintBenchResult(results[j]);
+    ++run;
+  }
+  return run;
+}
+
+void PrintBenchResult(const BenchResult& r) {
+  printf("  %-32s %8.3f Mpps %8.3f Gbps", r.name.c_str(), r.Mpps(), r.Gbps());
+  if (r.latency.count > 0) {
+    printf("  p50 %llu p99 %llu p999 %llu ns",
+           (unsigned long long)r.latency.Percentile(0.5),
+           (unsigned long long)r.latency.Percentile(0.99),
+           (unsigned long long)r.latency.Percentile(0.999));
+  }
+  if (!r.stage_ns.empty()) {
+    printf("  |");
+    for (size_t i = 0; i < r.stage_ns.size(); ++i)
+      printf(" %s %.1f", r.stage_ns[i].first.c_str(), r.stage_ns[i].second);
+    printf(" ns/pkt");
+  }
+  for (size_t i = 0; i < r.extra.size(); ++i)
+    printf("  %s %s", r.extra[i].first.c_str(), r.extra[i].second.c_str());
+  printf("\n");
+  fflush(stdout);
+}
+
+}  // namespace bangnet
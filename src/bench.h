@@ -0,0 +1,115 @@
+#ifndef BANGNET_BENCH_H_
+#define BANGNET_BENCH_H_
+
+#include <stdint.h>
+
+#include "src/common.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+// Options shared by all benchmarks, set from the command line of the bench
+// binary, see bench_main.cc.
+struct BenchOptions {
+  BenchOptions() : duration_ms(1000), flows(1024), burst(32) {
+    frame_sizes.push_back(64);
+    frame_sizes.push_back(512);
+    frame_sizes.push_back(1514);
+  }
+
+  // How long each measurement runs.
+  uint64_t duration_ms;
+
+  // Whole frame sizes to measure, link header included.
+  vector<unsigned int> frame_sizes;
+
+  // Number of distinct flows the generator spreads frames over.
+  unsigned int flows;
+
+  // Frames per burst.
+  unsigned int burst;
+};
+
+// Result of one measurement.
+struct BenchResult {
+  BenchResult() : packets(0), bytes(0), seconds(0) {}
+
+  string name;
+  uint64_t packets;
+  uint64_t bytes;
+  double seconds;
+
+  // Nanoseconds per packet spent in each stage, in pipeline order.
+  vector<pair<string, double> > stage_ns;
+
+  // Per packet latency in nanoseconds, may be empty.
+  HistogramSnapshot latency;
+
+  // Other figures a benchmark wants to show, like a compression ratio.
+  vector<pair<string, string> > extra;
+
+  double Mpps() const { return seconds > 0 ? packets / seconds / 1e6 : 0; }
+  double Gbps() const { return seconds > 0 ? bytes * 8 / seconds / 1e9 : 0; }
+
+  void AddExtra(const string& key, double value);
+};
+
+// Accumulates cycles spent per stage and turns them into ns per packet.
+class StageClock {
+public:
+  // Returns the index of a new stage.
+  int AddStage(const string& name);
+
+  inline void Add(int stage, uint64_t cycles) { cycles_[stage] += cycles; }
+
+  void Fill(BenchResult* result) const;
+
+private:
+  vector<string> names_;
+  vector<uint64_t> cycles_;
+};
+
+typedef void (*BenchFunction)(const BenchOptions& options,
+                              vector<BenchResult>* results);
+
+// All benchmarks linked into the bench binary.
+class BenchRegistry {
+public:
+  static BenchRegistry* Instance();
+
+  void Register(const char* name, BenchFunction fn);
+
+  // Runs every benchmark whose name contains filter, printing each result.
+  // Returns the number of benchmarks run.
+  int RunAll(const BenchOptions& options, const string& filter);
+
+private:
+  vector<pair<string, BenchFunction> > benches_;
+};
+
+struct BenchRegistrar {
+  BenchRegistrar(const char* name, BenchFunction fn) {
+    BenchRegistry::Instance()->Register(name, fn);
+  }
+};
+
+// Prints a result as one line.
+void PrintBenchResult(const BenchResult& result);
+
+// Defines a benchmark, like a gtest TEST:
+//
+//   BENCHMARK(Loopback) {
+//     BenchResult r;
+//     ...
+//     results->push_back(r);
+//   }
+#define BENCHMARK(name)                                                \
+  static void Bench_##name(const BenchOptions& options,                \
+                           vector<BenchResult>* results);              \
+  static BenchRegistrar bench_registrar_##name(#name, Bench_##name);   \
+  static void Bench_##name(const BenchOptions& options,                \
+                           vector<BenchResult>* results)
+
+}  // namespace bangnet
+
+#endif  // BANGNET_BENCH_H_
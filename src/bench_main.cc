@@ -0,0 +1,73 @@
+// Runs the benchmarks linked in, see `make bench`. Flags:
+//
+//   --filter=NAME        only run benchmarks whose name contains NAME
+//   --duration_ms=N      length of each measurement
+//   --sizes=64,512,1514  whole frame sizes, 42 to 65549 bytes
+//   --flows=N            flows the generator spreads frames over
+//   --burst=N            frames per burst
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/pktgen.h"
+
+using namespace bangnet;
+
+namespace {
+
+bool FlagValue(const char* arg, const char* name, const char** value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+    return false;
+  *value = arg + len + 1;
+  return true;
+}
+
+// Smallest frame benchmarks build, the ethernet, ipv4 and udp headers.
+const unsigned int kMinFrameLen = 14 + 20 + 8;
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  string filter;
+
+  for (int i = 1; i < argc; ++i) {
+    const char* v;
+    if (FlagValue(argv[i], "--filter", &v)) {
+      filter = v;
+    } else if (FlagValue(argv[i], "--duration_ms", &v)) {
+      options.duration_ms = strtoull(v, NULL, 10);
+    } else if (FlagValue(argv[i], "--flows", &v)) {
+      options.flows = (unsigned int)strtoul(v, NULL, 10);
+    } else if (FlagValue(argv[i], "--burst", &v)) {
+      options.burst = (unsigned int)strtoul(v, NULL, 10);
+    } else if (FlagValue(argv[i], "--sizes", &v)) {
+      options.frame_sizes.clear();
+      stringstream ss(v);
+      string size;
+      while (getline(ss, size, ',')) {
+        unsigned long n = strtoul(size.c_str(), NULL, 10);
+        if (n < kMinFrameLen || n > PacketGenerator::kMaxFrameSize) {
+          fprintf(stderr, "Frame size %s not in [%u, %u]\n", size.c_str(),
+                  kMinFrameLen, PacketGenerator::kMaxFrameSize);
+          return 1;
+        }
+        options.frame_sizes.push_back((unsigned int)n);
+      }
+    } else {
+      fprintf(stderr, "Unknown flag %s\n", argv[i]);
+      return 1;
+    }
+  }
+  if (options.burst == 0)
+    options.burst = 1;
+  if (options.flows == 0)
+    options.flows = 1;
+
+  CycleClock::Calibrate(50 * 1000 * 1000);
+  int run = BenchRegistry::Instance()->RunAll(options, filter);
+  return run > 0 ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#include <string.h>
+
+#include "src/buffer_device.h"
+
+namespace bangnet {
+
+bool BufferDevice::WriteFrame(const void* frame, unsigned int len) {
+  FrameSlot slot;
+  slot.data = (unsigned char*)frame;
+  slot.len = len;
+  slot.cap = len;
+  return WriteBurst(&slot, 1) == 1;
+}
+
+int BufferDevice::WriteBurst(const FrameSlot* frames, int n) {
+  if (!IsOpen() || n <= 0)
+    return 0;
+  Buffer* buffers[64];
+  int sent = 0;
+  while (n > 0) {
+    int m = pool()->GetBurst(buffers, n < 64 ? n : 64);
+    if (!m) {
+      CountTxDrops(n);
+      break;
+    }
+    for (int i = 0; i < m; ++i) {
+      unsigned int len = frames[i].len;
+      // Oversized frames are dropped by WriteBuffers().
+      memcpy(buffers[i]->data(), frames[i].data,
+             len < buffers[i]->capacity() ? len : buffers[i]->capacity());
+      buffers[i]->set_len(len);
+    }
+    sent += WriteBuffers(buffers, m);
+    frames += m;
+    n -= m;
+  }
+  return sent;
+}
+
+unsigned int BufferDevice::ReadFrame(void* buf, unsigned int cap) {
+  FrameSlot frame;
+  frame.data = (unsigned char*)buf;
+  frame.cap = cap;
+  frame.len = 0;
+  while (IsOpen()) {
+    if (TryReadBurst(&frame, 1))
+      return frame.len;
+    if (!Wait(-1))
+      return 0;
+  }
+  return 0;
+}
+
+int BufferDevice::ReadBurst(FrameSlot* frames, int n) {
+  if (n <= 0 || !Wait(-1))
+    return 0;
+  return TryReadBurst(frames, n);
+}
+
+}  // namespace bangnet
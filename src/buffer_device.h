@@ -0,0 +1,48 @@
+#ifndef BANGNET_BUFFER_DEVICE_H_
+#define BANGNET_BUFFER_DEVICE_H_
+
+#include <stdint.h>
+
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/frame_device.h"
+
+namespace bangnet {
+
+// A device which moves frames in buffers of its own pool, in memory shared
+// with the kernel, like AF_XDP and vhost-net. Backends read and write
+// buffers, the frame calls copy through them.
+class BufferDevice : public FrameDevice {
+public:
+  // Buffers frames are received into and sent from.
+  virtual BufferPool* pool() const = 0;
+
+  // Reads up to n received frames without blocking or copying, each in a
+  // buffer of pool() with a reference for the caller.
+  virtual int ReadBuffers(Buffer** buffers, int n) = 0;
+
+  // Sends n frames and takes over the caller's reference to each. Frames
+  // in buffers of other pools are copied, oversized ones dropped. Returns
+  // the number sent.
+  virtual int WriteBuffers(Buffer** buffers, int n) = 0;
+
+  // Frames are copied into buffers of pool() and sent with WriteBuffers().
+  bool WriteFrame(const void* frame, unsigned int len);
+  int WriteBurst(const FrameSlot* frames, int n);
+
+  // Block in Wait(), then read like TryReadBurst().
+  unsigned int ReadFrame(void* buf, unsigned int cap);
+  int ReadBurst(FrameSlot* frames, int n);
+
+protected:
+  // Waits up to timeout_ms, -1 for ever, for frames to read. Returns false
+  // if none came or the device closed.
+  virtual bool Wait(int timeout_ms) = 0;
+
+  // Counts n frames dropped before WriteBuffers(), for want of buffers.
+  virtual void CountTxDrops(uint64_t n) = 0;
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_BUFFER_DEVICE_H_
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+
+#include <new>
+
+#include "src/affinity.h"
+#include "src/buffer_pool.h"
+
+namespace bangnet {
+
+BufferPool::BufferPool(unsigned int buffer_size, unsigned int count,
+                       unsigned int headroom, Arena* arena)
+    : buffer_size_(buffer_size),
+      headroom_(headroom),
+      count_(count),
+      arena_(NULL),
+      nfree_(0) {
+  lock_.clear();
+
+  // Each buffer starts on a cache line.
+  size_t stride = ((size_t)headroom + buffer_size + 63) & ~(size_t)63;
+  stride_ = stride;
+  memory_len_ = stride * count;
+  if (!arena) {
+    arena_ = new Arena(memory_len_ + count * (sizeof(Buffer) +
+                                              sizeof(Buffer*)) + 4096 + 256);
+    arena = arena_;
+  }
+  memory_ = (unsigned char*)arena->Allocate(memory_len_, 4096);
+  buffers_ = (Buffer*)arena->Allocate(count * sizeof(Buffer));
+  free_ = (Buffer**)arena->Allocate(count * sizeof(Buffer*));
+  for (unsigned int i = 0; i < count; ++i) {
+    Buffer* b = new (&buffers_[i]) Buffer;
+    b->pool_ = this;
+    b->head_ = memory_ + stride * i;
+    b->cap_ = headroom + buffer_size;
+    b->refs_.store(0, std::memory_order_relaxed);
+    free_[nfree_++] = b;
+  }
+}
+
+BufferPool::~BufferPool() {
+  delete arena_;
+}
+
+bool BufferPool::BindToNode(int node) {
+  return BindMemoryToNode(memory_, memory_len_, node);
+}
+
+Buffer* BufferPool::Get() {
+  Buffer* b = 0;
+  GetBurst(&b, 1);
+  return b;
+}
+
+int BufferPool::GetBurst(Buffer** buffers, int n) {
+  Lock();
+  int got = 0;
+  while (got < n && nfree_ > 0)
+    buffers[got++] = free_[--nfree_];
+  Unlock();
+
+  for (int i = 0; i < got; ++i) {
+    buffers[i]->Reset();
+    buffers[i]->refs_.store(1, std::memory_order_relaxed);
+  }
+  return got;
+}
+
+void BufferPool::Put(Buffer* b) {
+  Lock();
+  free_[nfree_++] = b;
+  Unlock();
+}
+
+unsigned int BufferPool::available() const {
+  Lock();
+  unsigned int n = nfree_;
+  Unlock();
+  return n;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,165 @@
+#ifndef BANGNET_BUFFER_POOL_H_
+#define BANGNET_BUFFER_POOL_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "src/arena.h"
+#include "src/common.h"
+
+namespace bangnet {
+
+class BufferPool;
+
+// A fixed size frame buffer owned by a BufferPool. Buffers are reference
+// counted, so one frame can be handed to several consumers without copies,
+// and keep headroom in front of the data so headers can be prepended in
+// place.
+class Buffer {
+public:
+  unsigned char* data() { return head_ + off_; }
+  const unsigned char* data() const { return head_ + off_; }
+
+  unsigned int len() const { return len_; }
+  void set_len(unsigned int len) { len_ = len; }
+
+  // Bytes free in front of and behind the data.
+  unsigned int headroom() const { return off_; }
+  unsigned int tailroom() const { return cap_ - off_ - len_; }
+
+  // Bytes the data may grow to from its current start.
+  unsigned int capacity() const { return cap_ - off_; }
+
+  // Grows the data by n bytes at the front, returns the new start.
+  unsigned char* Push(unsigned int n) {
+    off_ -= n;
+    len_ += n;
+    return data();
+  }
+
+  // Strips n bytes from the front, returns the new start.
+  unsigned char* Pull(unsigned int n) {
+    off_ += n;
+    len_ -= n;
+    return data();
+  }
+
+  // Empties the buffer and restores the default headroom.
+  void Reset();
+
+  // Sets the data to len bytes at off from the start of the buffer, where
+  // a device wrote a frame.
+  void SetData(unsigned int off, unsigned int len) {
+    off_ = off;
+    len_ = len;
+  }
+
+  BufferPool* pool() const { return pool_; }
+
+  void Ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+  // Drops a reference, the last one returns the buffer to its pool.
+  void Unref();
+
+  uint32_t refs() const { return refs_.load(std::memory_order_relaxed); }
+
+private:
+  friend class BufferPool;
+
+  Buffer() {}
+
+  BufferPool* pool_;
+  unsigned char* head_;
+  uint32_t cap_;
+  uint32_t off_;
+  uint32_t len_;
+  std::atomic<uint32_t> refs_;
+};
+
+// A pool of equally sized buffers, all allocated up front so the datapath
+// never touches the heap.
+class BufferPool {
+public:
+  // Default bytes kept in front of the data, room for encapsulation.
+  static const unsigned int kDefaultHeadroom = 128;
+
+  // Creates count buffers holding buffer_size bytes of data each, plus
+  // headroom, carved out of arena, or out of an arena of the pool's own
+  // if it is null.
+  BufferPool(unsigned int buffer_size, unsigned int count,
+             unsigned int headroom = kDefaultHeadroom, Arena* arena = NULL);
+  ~BufferPool();
+
+  // Returns a buffer with one reference, or null if the pool is empty.
+  Buffer* Get();
+
+  // Gets up to n buffers, returns how many.
+  int GetBurst(Buffer** buffers, int n);
+
+  unsigned int buffer_size() const { return buffer_size_; }
+  unsigned int headroom() const { return headroom_; }
+  unsigned int count() const { return count_; }
+
+  // Buffers currently in the pool.
+  unsigned int available() const;
+
+  // The memory buffers are carved from, page aligned so devices can share
+  // it with the kernel, and the bytes from one buffer's start to the next.
+  unsigned char* memory() const { return memory_; }
+  size_t memory_len() const { return memory_len_; }
+  size_t stride() const { return stride_; }
+
+  // Returns the buffer holding the byte at offset of memory().
+  Buffer* BufferAt(size_t offset) { return &buffers_[offset / stride_]; }
+
+  // Offset of the start of b in memory().
+  size_t OffsetOf(const Buffer* b) const { return (b - buffers_) * stride_; }
+
+  // Moves the buffer memory to a NUMA node, the one of the worker using
+  // the pool. Pools created by the worker itself are there already.
+  bool BindToNode(int node);
+
+private:
+  friend class Buffer;
+
+  void Put(Buffer* b);
+
+  void Lock() const {
+    while (lock_.test_and_set(std::memory_order_acquire))
+      ;
+  }
+  void Unlock() const { lock_.clear(std::memory_order_release); }
+
+  unsigned int buffer_size_;
+  unsigned int headroom_;
+  unsigned int count_;
+
+  // The arena the pool owns, if it was not given one.
+  Arena* arena_;
+  Buffer* buffers_;
+  unsigned char* memory_;
+  size_t memory_len_;
+  size_t stride_;
+
+  // Stack of free buffers.
+  mutable std::atomic_flag lock_;
+  Buffer** free_;
+  unsigned int nfree_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(BufferPool);
+};
+
+inline void Buffer::Reset() {
+  off_ = pool_->headroom();
+  len_ = 0;
+}
+
+inline void Buffer::Unref() {
+  if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    pool_->Put(this);
+}
+
+}  // namespace bangnet
+
+#endif  // BANGNET_BUFFER_POOL_H_
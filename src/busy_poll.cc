@@ -0,0 +1,152 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "src/busy_poll.h"
+#include "src/clock.h"
+
+namespace bangnet {
+
+namespace {
+
+// Devices tried between two clock reads while spinning.
+const int kSpinBatch = 4;
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+}  // namespace
+
+BusyPoller::BusyPoller(const string& name, const BusyPollOptions& options)
+    : name_(name), options_(options), next_(0),
+      spin_ns_(options.busy_poll ? options.min_spin_ns : 0) {
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  CHECK_GE(epfd_, 0) << "Unable to create epoll instance: "
+                     << strerror(errno);
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.frames = r->NewCounter("bangnet_poll_frames_total",
+      "Frames read by the poller.", labels);
+  metrics_.spin_ns = r->NewCounter("bangnet_poll_spin_ns_total",
+      "Nanoseconds spent spinning on idle devices.", labels);
+  metrics_.spin_hits = r->NewCounter("bangnet_poll_spin_hits_total",
+      "Bursts found while spinning, each a wakeup saved.", labels);
+  metrics_.blocks = r->NewCounter("bangnet_poll_blocks_total",
+      "Times the poller blocked in epoll_wait.", labels);
+  metrics_.spin_limit_ns = r->NewGauge("bangnet_poll_spin_limit_ns",
+      "Current spin before blocking.", labels);
+  metrics_.spin_limit_ns->Set(spin_ns_);
+}
+
+BusyPoller::~BusyPoller() {
+  ::close(epfd_);
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+bool BusyPoller::Add(FrameDevice* device) {
+  if (devices_.size() >= (size_t)kMaxDevices || device->fd() < 0)
+    return false;
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = devices_.size();
+  if (epoll_ctl(epfd_, EPOLL_CTL_ADD, device->fd(), &ev) < 0) {
+    LOG(ERROR) << "Unable to poll " << device->device_name() << ": "
+               << strerror(errno);
+    return false;
+  }
+  devices_.push_back(device);
+  return true;
+}
+
+int BusyPoller::TryRead(FrameSlot* frames, int n, int* source) {
+  for (size_t i = 0; i < devices_.size(); ++i) {
+    size_t d = next_;
+    if (++next_ == devices_.size())
+      next_ = 0;
+    int got = devices_[d]->TryReadBurst(frames, n);
+    if (got > 0) {
+      *source = (int)d;
+      metrics_.frames->Add(got);
+      return got;
+    }
+  }
+  return 0;
+}
+
+void BusyPoller::Adapt(uint64_t blocked_ns, bool woken) {
+  if (!options_.busy_poll)
+    return;
+  if (woken && blocked_ns < options_.max_spin_ns) {
+    spin_ns_ *= 2;
+    if (spin_ns_ > options_.max_spin_ns)
+      spin_ns_ = options_.max_spin_ns;
+  } else {
+    spin_ns_ /= 2;
+    if (spin_ns_ < options_.min_spin_ns)
+      spin_ns_ = options_.min_spin_ns;
+  }
+  metrics_.spin_limit_ns->Set(spin_ns_);
+}
+
+int BusyPoller::ReadBurst(FrameSlot* frames, int n, int timeout_ms,
+                          int* source) {
+  if (devices_.empty() || n <= 0)
+    return 0;
+  int got = TryRead(frames, n, source);
+  if (got)
+    return got;
+
+  uint64_t start = MonotonicNs();
+  uint64_t now = start;
+  uint64_t timeout_ns = timeout_ms < 0 ? ~0ull : timeout_ms * 1000000ull;
+  if (spin_ns_) {
+    uint64_t spin = spin_ns_ < timeout_ns ? spin_ns_ : timeout_ns;
+    while (now - start < spin) {
+      for (int i = 0; i < kSpinBatch; ++i) {
+        got = TryRead(frames, n, source);
+        if (got) {
+          metrics_.spin_ns->Add(MonotonicNs() - start);
+          metrics_.spin_hits->Increment();
+          return got;
+        }
+        CpuRelax();
+      }
+      now = MonotonicNs();
+    }
+    metrics_.spin_ns->Add(now - start);
+    if (now - start >= timeout_ns)
+      return 0;
+  }
+
+  while (true) {
+    int wait_ms = -1;
+    if (timeout_ms >= 0) {
+      uint64_t left = timeout_ns - (now - start);
+      wait_ms = (int)((left + 999999) / 1000000);
+    }
+    struct epoll_event events[kMaxDevices];
+    uint64_t t0 = MonotonicNs();
+    metrics_.blocks->Increment();
+    int ready = epoll_wait(epfd_, events, kMaxDevices, wait_ms);
+    now = MonotonicNs();
+    if (ready < 0 && errno != EINTR) {
+      LOG(ERROR) << "epoll_wait failed: " << strerror(errno);
+      return 0;
+    }
+    Adapt(now - t0, ready > 0);
+    if (ready > 0) {
+      got = TryRead(frames, n, source);
+      if (got)
+        return got;
+    }
+    if (timeout_ms >= 0 && now - start >= timeout_ns)
+      return 0;
+  }
+}
+
+}  // namespace bangnet
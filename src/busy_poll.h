@@ -0,0 +1,79 @@
+#ifndef BANGNET_BUSY_POLL_H_
+#define BANGNET_BUSY_POLL_H_
+
+#include <stdint.h>
+
+#include "src/common.h"
+#include "src/frame_device.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+struct BusyPollOptions {
+  BusyPollOptions()
+      : busy_poll(false), min_spin_ns(5000), max_spin_ns(200000) {}
+
+  // Whether reads spin on the devices before blocking. Off, they block in
+  // epoll_wait() right away, which costs a wakeup of tens of microseconds
+  // per burst but no cpu while idle.
+  bool busy_poll;
+
+  // Bounds of the time spent spinning before blocking. The spin doubles
+  // each time frames came while blocked for less than max_spin_ns, as
+  // spinning longer would have caught them, and halves each time the
+  // thread blocked for longer, like halt polling of idle vcpus. A busy
+  // link is spun on, a quiet one costs min_spin_ns per wakeup.
+  uint64_t min_spin_ns;
+  uint64_t max_spin_ns;
+};
+
+// Reads bursts from a set of devices for one thread, blocking or busy
+// polling. A busy polling thread wants a core of its own, see WorkerGroup.
+// Not thread safe.
+class BusyPoller {
+public:
+  // Max devices polled.
+  static const int kMaxDevices = 16;
+
+  // name labels the metrics.
+  BusyPoller(const string& name, const BusyPollOptions& options);
+  ~BusyPoller();
+
+  // Adds a device to read from, not owned. Returns false if there are
+  // kMaxDevices already or it has no descriptor.
+  bool Add(FrameDevice* device);
+
+  // Reads up to n frames from the next device with frames waiting, round
+  // robin, and sets source to its index. Waits up to timeout_ms, -1 for no
+  // limit. Returns the frames read, 0 on timeout.
+  int ReadBurst(FrameSlot* frames, int n, int timeout_ms, int* source);
+
+  // Current spin before blocking.
+  uint64_t spin_ns() const { return spin_ns_; }
+
+private:
+  int TryRead(FrameSlot* frames, int n, int* source);
+  // Adapts the spin to a wait which blocked for blocked_ns.
+  void Adapt(uint64_t blocked_ns, bool woken);
+
+  string name_;
+  BusyPollOptions options_;
+  vector<FrameDevice*> devices_;
+  int epfd_;
+  size_t next_;
+  uint64_t spin_ns_;
+
+  struct Metrics {
+    Counter* frames;
+    Counter* spin_ns;
+    Counter* spin_hits;
+    Counter* blocks;
+    Gauge* spin_limit_ns;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(BusyPoller);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_BUSY_POLL_H_
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+#include <thread>
+
+#include "src/bench.h"
+#include "src/busy_poll.h"
+#include "src/clock.h"
+#include "src/loopback_device.h"
+#include "src/pktgen.h"
+
+namespace bangnet {
+namespace {
+
+// Sends a stamped frame every interval_us from another thread and reads
+// them with a poller, blocking or busy polling. Reports the send to read
+// latency and the cpu the reading thread used, in % of a core.
+BenchResult RunPollBench(bool busy, unsigned int interval_us,
+                         unsigned int frame_size, uint64_t duration_ms) {
+  LoopbackDevice* tx;
+  LoopbackDevice* rx;
+  LoopbackDevice::CreatePair(kMaxMtu, &tx, &rx);
+  BusyPollOptions options;
+  options.busy_poll = busy;
+  BusyPoller poller("bench", options);
+  poller.Add(rx);
+
+  std::atomic<bool> done(false);
+  std::thread sender([&] {
+    PktgenOptions gen_options;
+    gen_options.frame_size = frame_size;
+    PacketGenerator gen(gen_options);
+    vector<unsigned char> data(frame_size);
+    FrameSlot frame;
+    frame.data = &data[0];
+    frame.cap = frame_size;
+    uint64_t next = MonotonicNs();
+    uint64_t end = next + duration_ms * 1000000ull;
+    while (next < end) {
+      next += interval_us * 1000ull;
+      struct timespec ts;
+      ts.tv_sec = next / 1000000000ull;
+      ts.tv_nsec = next % 1000000000ull;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+      gen.Fill(&frame, 1, CycleCount());
+      tx->WriteBurst(&frame, 1);
+    }
+    done = true;
+  });
+
+  const int kBurst = 32;
+  vector<unsigned char> mem(kBurst * (frame_size + 64));
+  FrameSlot frames[kBurst];
+  for (int i = 0; i < kBurst; ++i) {
+    frames[i].data = &mem[i * (frame_size + 64)];
+    frames[i].cap = frame_size + 64;
+  }
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "poll/%s/every%uus/%uB",
+           busy ? "busy" : "block", interval_us, frame_size);
+  result.name = name;
+  Histogram latency;
+  uint64_t start = MonotonicNs();
+  uint64_t cpu0 = ThreadCpuNs();
+  while (!done) {
+    int source;
+    int got = poller.ReadBurst(frames, kBurst, 10, &source);
+    uint64_t now = CycleCount();
+    for (int i = 0; i < got; ++i) {
+      uint64_t seq, stamp;
+      if (PacketGenerator::Parse(frames[i].data, frames[i].len, &seq,
+                                 &stamp)) {
+        latency.Record((uint64_t)((now - stamp) *
+                                  CycleClock::ns_per_cycle()));
+      }
+      result.bytes += frames[i].len;
+    }
+    result.packets += got;
+  }
+  uint64_t cpu = ThreadCpuNs() - cpu0;
+  sender.join();
+
+  result.seconds = (MonotonicNs() - start) / 1e9;
+  result.latency = latency.Snapshot();
+  result.AddExtra("cpu%", 100.0 * cpu / (result.seconds * 1e9));
+  result.AddExtra("spin_us", poller.spin_ns() / 1000.0);
+  delete tx;
+  delete rx;
+  return result;
+}
+
+BENCHMARK(BusyPoll) {
+  // Loaded and quiet links, in both modes.
+  unsigned int intervals[] = {20, 1000};
+  for (int i = 0; i < 2; ++i) {
+    for (int busy = 0; busy < 2; ++busy) {
+      results->push_back(RunPollBench(busy, intervals[i], 64,
+                                      options.duration_ms));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
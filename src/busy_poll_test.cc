@@ -0,0 +1,108 @@
+#include "src/busy_poll.h"
+
+#include <unistd.h>
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "src/clock.h"
+#include "src/loopback_device.h"
+
+namespace bangnet {
+namespace {
+
+class BusyPollTest : public ::testing::Test {
+protected:
+  BusyPollTest() {
+    LoopbackDevice::CreatePair(1500, &a_, &b_);
+    LoopbackDevice::CreatePair(1500, &c_, &d_);
+    for (int i = 0; i < 4; ++i) {
+      frames_[i].data = mem_[i];
+      frames_[i].cap = sizeof(mem_[i]);
+    }
+  }
+
+  ~BusyPollTest() {
+    delete a_;
+    delete b_;
+    delete c_;
+    delete d_;
+  }
+
+  LoopbackDevice* a_;
+  LoopbackDevice* b_;
+  LoopbackDevice* c_;
+  LoopbackDevice* d_;
+  unsigned char mem_[4][64];
+  FrameSlot frames_[4];
+};
+
+TEST_F(BusyPollTest, TryReadDoesNotBlock) {
+  EXPECT_EQ(0, b_->TryReadBurst(frames_, 4));
+  EXPECT_TRUE(a_->WriteFrame("one", 3));
+  EXPECT_TRUE(a_->WriteFrame("two", 3));
+  EXPECT_EQ(2, b_->TryReadBurst(frames_, 4));
+  EXPECT_EQ(3u, frames_[1].len);
+  EXPECT_EQ(0, memcmp("two", frames_[1].data, 3));
+  EXPECT_EQ(0, b_->TryReadBurst(frames_, 4));
+}
+
+TEST_F(BusyPollTest, ReadsDevicesRoundRobin) {
+  for (int spin = 0; spin < 2; ++spin) {
+    BusyPollOptions options;
+    options.busy_poll = spin;
+    BusyPoller poller("poll", options);
+    ASSERT_TRUE(poller.Add(b_));
+    ASSERT_TRUE(poller.Add(d_));
+
+    int source = -1;
+    uint64_t start = MonotonicNs();
+    EXPECT_EQ(0, poller.ReadBurst(frames_, 4, 5, &source));
+    EXPECT_GE(MonotonicNs() - start, 5000000u);
+
+    EXPECT_TRUE(a_->WriteFrame("ab", 2));
+    EXPECT_TRUE(c_->WriteFrame("cd", 2));
+    EXPECT_TRUE(a_->WriteFrame("ab", 2));
+    int got[2] = {0, 0};
+    for (int i = 0; i < 2; ++i) {
+      int n = poller.ReadBurst(frames_, 4, 100, &source);
+      ASSERT_TRUE(source == 0 || source == 1);
+      got[source] += n;
+    }
+    EXPECT_EQ(2, got[0]);
+    EXPECT_EQ(1, got[1]);
+    EXPECT_EQ(0, poller.ReadBurst(frames_, 4, 0, &source));
+  }
+}
+
+TEST_F(BusyPollTest, AdaptsSpin) {
+  BusyPollOptions options;
+  options.busy_poll = true;
+  options.min_spin_ns = 1000;
+  options.max_spin_ns = 1000000000;
+  BusyPoller poller("poll", options);
+  ASSERT_TRUE(poller.Add(b_));
+  EXPECT_EQ(1000u, poller.spin_ns());
+
+  // Frames which come soon after blocking grow the spin.
+  for (int i = 0; i < 3; ++i) {
+    std::thread writer([this] {
+      usleep(2000);
+      a_->WriteFrame("x", 1);
+    });
+    int source;
+    EXPECT_EQ(1, poller.ReadBurst(frames_, 4, 1000, &source));
+    writer.join();
+  }
+  EXPECT_GE(poller.spin_ns(), 8000u);
+
+  // Idle waits shrink it back.
+  int source;
+  for (int i = 0; i < 8; ++i)
+    poller.ReadBurst(frames_, 4, 1, &source);
+  EXPECT_EQ(1000u, poller.spin_ns());
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,717 @@
+// Frames are captured in the pcapng format, which is described here:
+// https://github.com/pcapng/pcapng
+//
+// Each capture point is written as its own interface description block, so
+// tools like wireshark show the point a frame was taken at as the interface.
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#include "src/capture.h"
+#include "src/clock.h"
+#include "src/mac.h"
+
+namespace bangnet {
+
+namespace {
+
+const uint16_t kEtherTypeVlan = 0x8100;
+const uint16_t kEtherTypeQinQ = 0x88a8;
+const uint16_t kEtherTypeIPv4 = 0x0800;
+const uint16_t kEtherTypeIPv6 = 0x86dd;
+
+// Filter instructions.
+enum {
+  OP_AND = 0,
+  OP_OR,
+  OP_NOT,
+  OP_ETHER_HOST,
+  OP_ETHER_PROTO,
+  OP_VLAN,
+  OP_IP_PROTO,
+  OP_HOST4,
+  OP_HOST6,
+  OP_PORT,
+  OP_GREATER,
+  OP_LESS
+};
+
+// Direction of an address or port primitive.
+enum {
+  DIR_ANY = 0,
+  DIR_SRC = 1,
+  DIR_DST = 2
+};
+
+// Max length of a filter program, also bounds the evaluation stack.
+const size_t kMaxFilterInsns = 64;
+
+// Layer offsets of a frame, found once per match.
+struct FrameLayout {
+  uint16_t ethertype;
+  int vlan;
+  unsigned int l3;
+  int l4_proto;
+  unsigned int l4;
+};
+
+void ParseLayout(const unsigned char* f, unsigned int len, FrameLayout* l) {
+  l->ethertype = 0;
+  l->vlan = -1;
+  l->l3 = 0;
+  l->l4_proto = -1;
+  l->l4 = 0;
+  if (len < 14)
+    return;
+
+  unsigned int off = 12;
+  uint16_t type = (uint16_t)(f[off] << 8 | f[off + 1]);
+  while ((type == kEtherTypeVlan || type == kEtherTypeQinQ) &&
+         off + 6 <= len) {
+    if (l->vlan < 0)
+      l->vlan = (f[off + 2] << 8 | f[off + 3]) & 0xfff;
+    off += 4;
+    type = (uint16_t)(f[off] << 8 | f[off + 1]);
+  }
+  l->ethertype = type;
+  l->l3 = off + 2;
+
+  if (type == kEtherTypeIPv4 && l->l3 + 20 <= len) {
+    unsigned int ihl = (f[l->l3] & 0xf) * 4;
+    l->l4_proto = f[l->l3 + 9];
+    l->l4 = l->l3 + ihl;
+  } else if (type == kEtherTypeIPv6 && l->l3 + 40 <= len) {
+    l->l4_proto = f[l->l3 + 6];
+    l->l4 = l->l3 + 40;
+  }
+}
+
+bool ParseNumber(const string& s, uint32_t* out) {
+  if (s.empty())
+    return false;
+  char* end = 0;
+  unsigned long v = strtoul(s.c_str(), &end, 0);
+  if (*end != '\0')
+    return false;
+  *out = (uint32_t)v;
+  return true;
+}
+
+vector<string> Tokenize(const string& expr) {
+  vector<string> toks;
+  string cur;
+  for (size_t i = 0; i < expr.size(); ++i) {
+    char c = expr[i];
+    if (c == ' ' || c == '\t' || c == '(' || c == ')') {
+      if (!cur.empty())
+        toks.push_back(cur);
+      cur.clear();
+      if (c == '(' || c == ')')
+        toks.push_back(string(1, c));
+    } else {
+      cur.push_back(c);
+    }
+  }
+  if (!cur.empty())
+    toks.push_back(cur);
+  return toks;
+}
+
+inline uint32_t Pad4(uint32_t n) { return (n + 3) & ~3u; }
+
+// Appends little pieces of a pcapng block in host byte order.
+void PutU16(string* b, uint16_t v) { b->append((const char*)&v, 2); }
+void PutU32(string* b, uint32_t v) { b->append((const char*)&v, 4); }
+
+void PutOption(string* b, uint16_t code, const void* data, uint16_t len) {
+  PutU16(b, code);
+  PutU16(b, len);
+  b->append((const char*)data, len);
+  b->append(Pad4(len) - len, '\0');
+}
+
+// Fixes the two length fields of a finished block.
+void CloseBlock(string* b) {
+  uint32_t len = (uint32_t)b->size() + 4;
+  memcpy(&(*b)[4], &len, 4);
+  PutU32(b, len);
+}
+
+}  // namespace
+
+const char* CapturePointName(CapturePoint point) {
+  switch (point) {
+    case CAPTURE_TAP_GET:
+      return "tap-get";
+    case CAPTURE_TAP_PUT:
+      return "tap-put";
+    case CAPTURE_PRE_ENCRYPT:
+      return "pre-encrypt";
+    default:
+      return "unknown";
+  }
+}
+
+bool CaptureFilter::Compile(const string& expr) {
+  prog_.clear();
+  vector<string> toks = Tokenize(expr);
+  if (toks.empty())
+    return true;
+
+  size_t pos = 0;
+  if (!ParseOr(toks, &pos) || pos != toks.size() ||
+      prog_.size() > kMaxFilterInsns) {
+    prog_.clear();
+    return false;
+  }
+  return true;
+}
+
+bool CaptureFilter::ParseOr(const vector<string>& toks, size_t* pos) {
+  if (!ParseAnd(toks, pos))
+    return false;
+  while (*pos < toks.size() && (toks[*pos] == "or" || toks[*pos] == "||")) {
+    ++*pos;
+    if (!ParseAnd(toks, pos))
+      return false;
+    Insn insn = {OP_OR, 0, {0}};
+    prog_.push_back(insn);
+  }
+  return true;
+}
+
+bool CaptureFilter::ParseAnd(const vector<string>& toks, size_t* pos) {
+  if (!ParseUnary(toks, pos))
+    return false;
+  while (*pos < toks.size() && (toks[*pos] == "and" || toks[*pos] == "&&")) {
+    ++*pos;
+    if (!ParseUnary(toks, pos))
+      return false;
+    Insn insn = {OP_AND, 0, {0}};
+    prog_.push_back(insn);
+  }
+  return true;
+}
+
+bool CaptureFilter::ParseUnary(const vector<string>& toks, size_t* pos) {
+  if (*pos >= toks.size())
+    return false;
+  if (toks[*pos] == "not" || toks[*pos] == "!") {
+    ++*pos;
+    if (!ParseUnary(toks, pos))
+      return false;
+    Insn insn = {OP_NOT, 0, {0}};
+    prog_.push_back(insn);
+    return true;
+  }
+  if (toks[*pos] == "(") {
+    ++*pos;
+    if (!ParseOr(toks, pos))
+      return false;
+    if (*pos >= toks.size() || toks[*pos] != ")")
+      return false;
+    ++*pos;
+    return true;
+  }
+  return ParsePrimitive(toks, pos);
+}
+
+bool CaptureFilter::ParsePrimitive(const vector<string>& toks, size_t* pos) {
+  Insn insn = {0, 0, {0}};
+  const string& t = toks[(*pos)++];
+  bool has_next = *pos < toks.size();
+
+  if (t == "ether") {
+    if (!has_next || *pos + 1 >= toks.size())
+      return false;
+    const string& what = toks[(*pos)++];
+    const string& value = toks[(*pos)++];
+    if (what == "proto") {
+      insn.op = OP_ETHER_PROTO;
+      if (!ParseNumber(value, &insn.arg))
+        return false;
+    } else {
+      insn.op = OP_ETHER_HOST;
+      if (what == "host")
+        insn.arg = DIR_ANY;
+      else if (what == "src")
+        insn.arg = DIR_SRC;
+      else if (what == "dst")
+        insn.arg = DIR_DST;
+      else
+        return false;
+      MacAddress mac;
+      if (!mac.FromString(value.c_str()))
+        return false;
+      memcpy(insn.bytes, mac.data(), 6);
+    }
+  } else if (t == "arp" || t == "ip" || t == "ip6") {
+    insn.op = OP_ETHER_PROTO;
+    insn.arg = t == "arp" ? 0x0806 : (t == "ip" ? kEtherTypeIPv4 :
+                                                   kEtherTypeIPv6);
+  } else if (t == "vlan") {
+    insn.op = OP_VLAN;
+    insn.arg = 0xffffffff;
+    if (has_next && ParseNumber(toks[*pos], &insn.arg))
+      ++*pos;
+  } else if (t == "tcp" || t == "udp" || t == "icmp" || t == "icmp6") {
+    insn.op = OP_IP_PROTO;
+    insn.arg = t == "tcp" ? 6 : (t == "udp" ? 17 : (t == "icmp" ? 1 : 58));
+  } else if (t == "greater" || t == "less") {
+    insn.op = t == "greater" ? OP_GREATER : OP_LESS;
+    if (!has_next || !ParseNumber(toks[(*pos)++], &insn.arg))
+      return false;
+  } else if (t == "src" || t == "dst" || t == "host" || t == "port") {
+    uint32_t dir = DIR_ANY;
+    string kind = t;
+    if (t == "src" || t == "dst") {
+      dir = t == "src" ? DIR_SRC : DIR_DST;
+      if (!has_next)
+        return false;
+      kind = "host";
+      if (toks[*pos] == "host" || toks[*pos] == "port")
+        kind = toks[(*pos)++];
+    }
+    if (*pos >= toks.size())
+      return false;
+    const string& value = toks[(*pos)++];
+    if (kind == "port") {
+      insn.op = OP_PORT;
+      if (!ParseNumber(value, &insn.arg) || insn.arg > 65535)
+        return false;
+      insn.arg |= dir << 16;
+    } else if (inet_pton(AF_INET, value.c_str(), insn.bytes) == 1) {
+      insn.op = OP_HOST4;
+      insn.arg = dir;
+    } else if (inet_pton(AF_INET6, value.c_str(), insn.bytes) == 1) {
+      insn.op = OP_HOST6;
+      insn.arg = dir;
+    } else {
+      return false;
+    }
+  } else {
+    return false;
+  }
+
+  prog_.push_back(insn);
+  return true;
+}
+
+bool CaptureFilter::Match(const unsigned char* f, unsigned int len) const {
+  if (prog_.empty())
+    return true;
+
+  FrameLayout l;
+  ParseLayout(f, len, &l);
+
+  bool stack[kMaxFilterInsns];
+  int sp = 0;
+  for (size_t i = 0; i < prog_.size(); ++i) {
+    const Insn& insn = prog_[i];
+    bool r = false;
+    switch (insn.op) {
+      case OP_AND:
+        --sp;
+        stack[sp - 1] = stack[sp - 1] && stack[sp];
+        continue;
+      case OP_OR:
+        --sp;
+        stack[sp - 1] = stack[sp - 1] || stack[sp];
+        continue;
+      case OP_NOT:
+        stack[sp - 1] = !stack[sp - 1];
+        continue;
+      case OP_ETHER_HOST:
+        if (len >= 14) {
+          bool dst = memcmp(f, insn.bytes, 6) == 0;
+          bool src = memcmp(f + 6, insn.bytes, 6) == 0;
+          r = insn.arg == DIR_SRC ? src :
+              (insn.arg == DIR_DST ? dst : (src || dst));
+        }
+        break;
+      case OP_ETHER_PROTO:
+        r = len >= 14 && l.ethertype == insn.arg;
+        break;
+      case OP_VLAN:
+        r = l.vlan >= 0 && (insn.arg == 0xffffffff ||
+                            (uint32_t)l.vlan == insn.arg);
+        break;
+      case OP_IP_PROTO:
+        r = l.l4_proto == (int)insn.arg;
+        break;
+      case OP_HOST4:
+        if (l.ethertype == kEtherTypeIPv4 && l.l4_proto >= 0) {
+          bool src = memcmp(f + l.l3 + 12, insn.bytes, 4) == 0;
+          bool dst = memcmp(f + l.l3 + 16, insn.bytes, 4) == 0;
+          r = insn.arg == DIR_SRC ? src :
+              (insn.arg == DIR_DST ? dst : (src || dst));
+        }
+        break;
+      case OP_HOST6:
+        if (l.ethertype == kEtherTypeIPv6 && l.l4_proto >= 0) {
+          bool src = memcmp(f + l.l3 + 8, insn.bytes, 16) == 0;
+          bool dst = memcmp(f + l.l3 + 24, insn.bytes, 16) == 0;
+          r = insn.arg == DIR_SRC ? src :
+              (insn.arg == DIR_DST ? dst : (src || dst));
+        }
+        break;
+      case OP_PORT:
+        if ((l.l4_proto == 6 || l.l4_proto == 17) && l.l4 + 4 <= len) {
+          uint32_t port = insn.arg & 0xffff;
+          uint32_t dir = insn.arg >> 16;
+          bool src = (uint32_t)(f[l.l4] << 8 | f[l.l4 + 1]) == port;
+          bool dst = (uint32_t)(f[l.l4 + 2] << 8 | f[l.l4 + 3]) == port;
+          r = dir == DIR_SRC ? src : (dir == DIR_DST ? dst : (src || dst));
+        }
+        break;
+      case OP_GREATER:
+        r = len >= insn.arg;
+        break;
+      case OP_LESS:
+        r = len <= insn.arg;
+        break;
+    }
+    stack[sp++] = r;
+  }
+  return sp == 1 && stack[0];
+}
+
+// A single producer single consumer byte ring of variable sized records.
+// Positions grow forever, the offset in the ring is the position masked.
+class CaptureRing {
+public:
+  struct Record {
+    // Bytes this record takes in the ring, header included.
+    uint32_t size;
+    uint16_t point;
+    uint16_t skip;
+    uint32_t caplen;
+    uint32_t orig_len;
+    uint64_t ts_ns;
+  };
+
+  explicit CaptureRing(unsigned int size)
+      : head_(0), tail_(0), dropped_(0) {
+    size_ = 4096;
+    while (size_ < size)
+      size_ <<= 1;
+    data_ = new unsigned char[size_];
+  }
+
+  ~CaptureRing() { delete[] data_; }
+
+  // Producer side.
+  void Push(CapturePoint point, uint64_t ts, const void* frame,
+            unsigned int caplen, unsigned int orig_len) {
+    uint32_t need = (sizeof(Record) + caplen + 7) & ~7u;
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    uint32_t off = (uint32_t)(head & (size_ - 1));
+    uint32_t contiguous = size_ - off;
+    uint32_t total = contiguous < need ? contiguous + need : need;
+
+    if (need > size_ / 2 || total > size_ - (head - tail)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+
+    if (contiguous < need) {
+      // Not enough room till the end, skip to the ring start.
+      if (contiguous >= sizeof(Record)) {
+        Record* skip = (Record*)(data_ + off);
+        skip->size = contiguous;
+        skip->skip = 1;
+      }
+      head += contiguous;
+      off = 0;
+    }
+
+    Record* r = (Record*)(data_ + off);
+    r->size = need;
+    r->point = (uint16_t)point;
+    r->skip = 0;
+    r->caplen = caplen;
+    r->orig_len = orig_len;
+    r->ts_ns = ts;
+    memcpy(r + 1, frame, caplen);
+    head_.store(head + need, std::memory_order_release);
+  }
+
+  // Consumer side, returns the next record or null if the ring is empty.
+  const Record* Peek() {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    while (tail < head) {
+      uint32_t off = (uint32_t)(tail & (size_ - 1));
+      uint32_t contiguous = size_ - off;
+      const Record* r = (const Record*)(data_ + off);
+      if (contiguous < sizeof(Record) || r->skip) {
+        tail += contiguous;
+        tail_.store(tail, std::memory_order_release);
+        continue;
+      }
+      return r;
+    }
+    return 0;
+  }
+
+  void Pop(const Record* r) {
+    tail_.store(tail_.load(std::memory_order_relaxed) + r->size,
+                std::memory_order_release);
+  }
+
+  uint64_t dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+private:
+  unsigned char* data_;
+  uint32_t size_;
+
+  // Producer and consumer positions live on their own cache lines.
+  char pad0_[64];
+  std::atomic<uint64_t> head_;
+  char pad1_[64];
+  std::atomic<uint64_t> tail_;
+  char pad2_[64];
+  std::atomic<uint64_t> dropped_;
+};
+
+std::atomic<unsigned int> Capture::active_points(0);
+
+Capture* Capture::Instance() {
+  static Capture* capture = new Capture();
+  return capture;
+}
+
+Capture::Capture()
+    : stop_(false),
+      running_(false),
+      ring_count_(0),
+      fd_(-1),
+      map_((unsigned char*)0),
+      map_offset_(0),
+      map_used_(0),
+      file_size_(0),
+      frames_written_(0) {
+  memset(rings_, 0, sizeof(rings_));
+}
+
+Capture::~Capture() {
+  Stop();
+}
+
+bool Capture::Start(const CaptureOptions& options) {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (running_)
+    return false;
+
+  options_ = options;
+  if (options_.snaplen == 0 || options_.snaplen > kMaxFrameLen)
+    options_.snaplen = kMaxFrameLen;
+  long page = sysconf(_SC_PAGESIZE);
+  options_.file_chunk = (options_.file_chunk + page - 1) & ~(page - 1);
+  if (options_.file_chunk == 0)
+    options_.file_chunk = page;
+
+  if (!filter_.Compile(options_.filter)) {
+    LOG(ERROR) << "Invalid capture filter: " << options_.filter;
+    return false;
+  }
+
+  fd_ = open(options_.path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Unable to open capture file " << options_.path;
+    return false;
+  }
+  map_ = (unsigned char*)0;
+  map_offset_ = 0;
+  map_used_ = 0;
+  file_size_ = 0;
+  frames_written_ = 0;
+  WriteHeader();
+
+  stop_ = false;
+  running_ = true;
+  writer_ = std::thread(&Capture::WriterLoop, this);
+  active_points.store(options_.points & ((1u << CAPTURE_POINT_COUNT) - 1),
+                      std::memory_order_release);
+
+  LOG(INFO) << "Capture started to " << options_.path;
+  return true;
+}
+
+void Capture::Stop() {
+  std::lock_guard<std::mutex> lock(mu_);
+  if (!running_)
+    return;
+
+  active_points.store(0, std::memory_order_release);
+  stop_ = true;
+  writer_.join();
+  running_ = false;
+
+  if (map_)
+    munmap(map_, options_.file_chunk);
+  map_ = (unsigned char*)0;
+  if (ftruncate(fd_, (off_t)file_size_) < 0)
+    LOG(WARNING) << "Unable to truncate capture file";
+  ::close(fd_);
+  fd_ = -1;
+
+  LOG(INFO) << "Capture stopped, " << frames_written() << " frames written, "
+            << frames_dropped() << " dropped";
+}
+
+void Capture::Record(CapturePoint point, const void* frame,
+                     unsigned int len) {
+  if (!filter_.Match((const unsigned char*)frame, len))
+    return;
+
+  CaptureRing* ring = ThreadRing();
+  if (!ring)
+    return;
+
+  unsigned int caplen = len < options_.snaplen ? len : options_.snaplen;
+  ring->Push(point, RealtimeNs(), frame, caplen, len);
+}
+
+uint64_t Capture::frames_dropped() const {
+  uint64_t n = 0;
+  unsigned int count = ring_count_.load(std::memory_order_acquire);
+  for (unsigned int i = 0; i < count; ++i)
+    n += rings_[i]->dropped();
+  return n;
+}
+
+CaptureRing* Capture::ThreadRing() {
+  static thread_local CaptureRing* ring = 0;
+  if (BN_LIKELY(ring != 0))
+    return ring;
+
+  // First frame of this thread, this is done once.
+  std::lock_guard<std::mutex> lock(mu_);
+  unsigned int count = ring_count_.load(std::memory_order_relaxed);
+  if (count >= kMaxRings)
+    return 0;
+  ring = new CaptureRing(options_.ring_bytes);
+  rings_[count] = ring;
+  ring_count_.store(count + 1, std::memory_order_release);
+  return ring;
+}
+
+void Capture::WriterLoop() {
+  while (!stop_.load(std::memory_order_acquire)) {
+    if (!DrainRings())
+      usleep(1000);
+  }
+  DrainRings();
+}
+
+bool Capture::DrainRings() {
+  bool any = false;
+  unsigned int count = ring_count_.load(std::memory_order_acquire);
+  for (unsigned int i = 0; i < count; ++i) {
+    CaptureRing* ring = rings_[i];
+    const CaptureRing::Record* r;
+    while ((r = ring->Peek()) != 0) {
+      // Enhanced packet block.
+      uint32_t hdr[7];
+      uint32_t padded = Pad4(r->caplen);
+      hdr[0] = 0x00000006;
+      hdr[1] = 32 + padded;
+      hdr[2] = r->point;
+      hdr[3] = (uint32_t)(r->ts_ns >> 32);
+      hdr[4] = (uint32_t)r->ts_ns;
+      hdr[5] = r->caplen;
+      hdr[6] = r->orig_len;
+      static const unsigned char zeros[4] = {0, 0, 0, 0};
+      bool ok = Append(hdr, sizeof(hdr)) && Append(r + 1, r->caplen) &&
+                Append(zeros, padded - r->caplen) && Append(&hdr[1], 4);
+      ring->Pop(r);
+      if (!ok)
+        return false;
+      ++frames_written_;
+      any = true;
+    }
+  }
+  return any;
+}
+
+bool Capture::MapChunk() {
+  if (map_) {
+    munmap(map_, options_.file_chunk);
+    map_offset_ += options_.file_chunk;
+    map_used_ = 0;
+  }
+  map_ = (unsigned char*)0;
+  if (ftruncate(fd_, (off_t)(map_offset_ + options_.file_chunk)) < 0)
+    return false;
+  void* p = mmap(NULL, options_.file_chunk, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd_, (off_t)map_offset_);
+  if (p == MAP_FAILED) {
+    LOG(ERROR) << "Unable to map capture file";
+    return false;
+  }
+  map_ = (unsigned char*)p;
+  return true;
+}
+
+bool Capture::Append(const void* data, size_t len) {
+  const unsigned char* p = (const unsigned char*)data;
+  while (len > 0) {
+    if (!map_ || map_used_ == options_.file_chunk) {
+      if (!MapChunk())
+        return false;
+    }
+    size_t n = options_.file_chunk - map_used_;
+    if (n > len)
+      n = len;
+    memcpy(map_ + map_used_, p, n);
+    map_used_ += n;
+    file_size_ += n;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+void Capture::WriteHeader() {
+  // Section header block.
+  string b;
+  PutU32(&b, 0x0A0D0D0A);
+  PutU32(&b, 0);
+  PutU32(&b, 0x1A2B3C4D);
+  PutU16(&b, 1);
+  PutU16(&b, 0);
+  PutU32(&b, 0xffffffff);
+  PutU32(&b, 0xffffffff);
+  PutOption(&b, 4, "bangnet", 7);
+  PutOption(&b, 0, "", 0);
+  CloseBlock(&b);
+  Append(b.data(), b.size());
+
+  // One interface description block per capture point, ids match the
+  // CapturePoint values.
+  for (int i = 0; i < CAPTURE_POINT_COUNT; ++i) {
+    string name = CapturePointName((CapturePoint)i);
+    unsigned char tsresol = 9;
+    b.clear();
+    PutU32(&b, 0x00000001);
+    PutU32(&b, 0);
+    PutU16(&b, 1);  // LINKTYPE_ETHERNET
+    PutU16(&b, 0);
+    PutU32(&b, options_.snaplen);
+    PutOption(&b, 2, name.data(), (uint16_t)name.size());
+    PutOption(&b, 9, &tsresol, 1);
+    PutOption(&b, 0, "", 0);
+    CloseBlock(&b);
+    Append(b.data(), b.size());
+  }
+}
+
+}  // namespace bangnet
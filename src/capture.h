@@ -0,0 +1,175 @@
+#ifndef BANGNET_CAPTURE_H_
+#define BANGNET_CAPTURE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "src/common.h"
+#include "src/frame_device.h"
+
+namespace bangnet {
+
+// Named points in the frame pipeline where frames can be captured.
+enum CapturePoint {
+  // Right after a frame was read from the tap device.
+  CAPTURE_TAP_GET = 0,
+  // Right before a frame is written to the tap device.
+  CAPTURE_TAP_PUT,
+  // Right before a frame is handed to the encryption stage.
+  CAPTURE_PRE_ENCRYPT,
+  CAPTURE_POINT_COUNT
+};
+
+// Returns a printable name of a capture point, like "tap-get".
+const char* CapturePointName(CapturePoint point);
+
+// A small BPF-like filter over ethernet frames. Supported primitives:
+//
+//   ether host|src|dst XX:XX:XX:XX:XX:XX    ether proto N
+//   arp  ip  ip6  vlan [N]  tcp  udp  icmp  icmp6
+//   host|src|dst A.B.C.D                    port|src port|dst port N
+//   greater|less N
+//
+// combined with `and`, `or`, `not` and parentheses. An empty expression
+// matches every frame.
+class CaptureFilter {
+public:
+  CaptureFilter() {}
+
+  // Compiles an expression, returns false and keeps the filter empty if
+  // it can not be parsed.
+  bool Compile(const string& expr);
+
+  // Returns true if this frame passes the filter.
+  bool Match(const unsigned char* frame, unsigned int len) const;
+
+  bool empty() const { return prog_.empty(); }
+
+private:
+  struct Insn {
+    int op;
+    uint32_t arg;
+    unsigned char bytes[16];
+  };
+
+  bool ParseOr(const vector<string>& toks, size_t* pos);
+  bool ParseAnd(const vector<string>& toks, size_t* pos);
+  bool ParseUnary(const vector<string>& toks, size_t* pos);
+  bool ParsePrimitive(const vector<string>& toks, size_t* pos);
+
+  // Postfix program, evaluated on a small stack of booleans.
+  vector<Insn> prog_;
+};
+
+// Options used when starting a capture session.
+struct CaptureOptions {
+  CaptureOptions()
+      : snaplen(kMaxFrameLen),
+        points((1u << CAPTURE_POINT_COUNT) - 1),
+        ring_bytes(1 << 20),
+        file_chunk(4 << 20) {}
+
+  // Output pcapng file.
+  string path;
+
+  // Filter expression, see CaptureFilter.
+  string filter;
+
+  // Max bytes kept of each frame.
+  unsigned int snaplen;
+
+  // Bitmask of enabled CapturePoint.
+  unsigned int points;
+
+  // Size of the ring each producing thread owns.
+  unsigned int ring_bytes;
+
+  // The output file is grown and mapped by this many bytes at a time.
+  unsigned int file_chunk;
+};
+
+class CaptureRing;
+
+// In-process frame capture. Frames are copied into a lock-free ring owned
+// by the producing thread, a background writer drains all rings and appends
+// them as pcapng blocks to a memory-mapped file.
+class Capture {
+public:
+  // Returns the process wide capture.
+  static Capture* Instance();
+
+  // Starts capturing into options.path, returns false on error.
+  bool Start(const CaptureOptions& options);
+
+  // Stops capturing, flushes all pending frames and closes the file.
+  void Stop();
+
+  bool running() const { return running_; }
+
+  // Copies a frame into the calling thread's ring, slow path of
+  // CaptureFrame() below.
+  void Record(CapturePoint point, const void* frame, unsigned int len);
+
+  // Frames written to the file so far.
+  uint64_t frames_written() const { return frames_written_.load(); }
+
+  // Frames lost because a ring was full.
+  uint64_t frames_dropped() const;
+
+  // Bitmask of points being captured, zero when capture is off.
+  static std::atomic<unsigned int> active_points;
+
+private:
+  Capture();
+  ~Capture();
+
+  CaptureRing* ThreadRing();
+  void WriterLoop();
+  bool DrainRings();
+  bool Append(const void* data, size_t len);
+  bool MapChunk();
+  void WriteHeader();
+
+  std::mutex mu_;
+  std::thread writer_;
+  std::atomic<bool> stop_;
+  bool running_;
+
+  CaptureOptions options_;
+  CaptureFilter filter_;
+
+  // Max number of threads that can produce frames.
+  static const unsigned int kMaxRings = 128;
+
+  // All rings ever created, rings are never freed since a thread may
+  // still hold a pointer to its own.
+  CaptureRing* rings_[kMaxRings];
+  std::atomic<unsigned int> ring_count_;
+
+  // Memory mapped output file.
+  int fd_;
+  unsigned char* map_;
+  uint64_t map_offset_;
+  size_t map_used_;
+  uint64_t file_size_;
+
+  std::atomic<uint64_t> frames_written_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Capture);
+};
+
+// Captures a frame at a pipeline point. Costs one predictable branch when
+// capture is off.
+inline void CaptureFrame(CapturePoint point, const void* frame,
+                         unsigned int len) {
+  if (BN_UNLIKELY(Capture::active_points.load(std::memory_order_relaxed) &
+                  (1u << point)))
+    Capture::Instance()->Record(point, frame, len);
+}
+
+}  // namespace bangnet
+
+#endif  // BANGNET_CAPTURE_H_
@@ -0,0 +1,139 @@
+#include "src/capture.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+// Builds an ethernet + ipv4 + udp frame.
+vector<unsigned char> UdpFrame(uint16_t sport, uint16_t dport) {
+  vector<unsigned char> f(14 + 20 + 8 + 16, 0);
+  const unsigned char dst[6] = {0x02, 0, 0, 0, 0, 0x02};
+  const unsigned char src[6] = {0x02, 0, 0, 0, 0, 0x01};
+  memcpy(&f[0], dst, 6);
+  memcpy(&f[6], src, 6);
+  f[12] = 0x08;
+  f[14] = 0x45;
+  f[14 + 9] = 17;
+  const unsigned char sip[4] = {10, 0, 0, 1};
+  const unsigned char dip[4] = {10, 0, 0, 2};
+  memcpy(&f[14 + 12], sip, 4);
+  memcpy(&f[14 + 16], dip, 4);
+  f[34] = sport >> 8;
+  f[35] = sport & 0xff;
+  f[36] = dport >> 8;
+  f[37] = dport & 0xff;
+  return f;
+}
+
+TEST(CaptureFilterTest, EmptyMatchesAll) {
+  CaptureFilter filter;
+  ASSERT_TRUE(filter.Compile(""));
+  vector<unsigned char> f = UdpFrame(1000, 53);
+  EXPECT_TRUE(filter.Match(&f[0], f.size()));
+}
+
+TEST(CaptureFilterTest, Primitives) {
+  vector<unsigned char> f = UdpFrame(1000, 53);
+  CaptureFilter filter;
+
+  ASSERT_TRUE(filter.Compile("udp and dst port 53"));
+  EXPECT_TRUE(filter.Match(&f[0], f.size()));
+  ASSERT_TRUE(filter.Compile("udp and src port 53"));
+  EXPECT_FALSE(filter.Match(&f[0], f.size()));
+  ASSERT_TRUE(filter.Compile("src host 10.0.0.1 and not tcp"));
+  EXPECT_TRUE(filter.Match(&f[0], f.size()));
+  ASSERT_TRUE(filter.Compile("arp or (ip and host 10.0.0.9)"));
+  EXPECT_FALSE(filter.Match(&f[0], f.size()));
+  ASSERT_TRUE(filter.Compile("ether src 02:00:00:00:00:01"));
+  EXPECT_TRUE(filter.Match(&f[0], f.size()));
+  ASSERT_TRUE(filter.Compile("vlan"));
+  EXPECT_FALSE(filter.Match(&f[0], f.size()));
+  ASSERT_TRUE(filter.Compile("greater 100"));
+  EXPECT_FALSE(filter.Match(&f[0], f.size()));
+}
+
+TEST(CaptureFilterTest, InvalidExpression) {
+  CaptureFilter filter;
+  EXPECT_FALSE(filter.Compile("udp and"));
+  EXPECT_FALSE(filter.Compile("(tcp"));
+  EXPECT_FALSE(filter.Compile("port http"));
+  EXPECT_TRUE(filter.empty());
+}
+
+TEST(CaptureTest, WritesPcapng) {
+  char path[] = "/tmp/bangnet_capture_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+
+  CaptureOptions options;
+  options.path = path;
+  options.filter = "udp";
+  options.snaplen = 40;
+  options.file_chunk = 4096;
+  ASSERT_TRUE(Capture::Instance()->Start(options));
+
+  vector<unsigned char> f = UdpFrame(1000, 53);
+  for (int i = 0; i < 200; ++i)
+    CaptureFrame(CAPTURE_TAP_GET, &f[0], f.size());
+  vector<unsigned char> arp(60, 0);
+  arp[12] = 0x08;
+  arp[13] = 0x06;
+  CaptureFrame(CAPTURE_TAP_PUT, &arp[0], arp.size());
+  Capture::Instance()->Stop();
+  EXPECT_EQ(200u, Capture::Instance()->frames_written());
+
+  // Capture is off, nothing more is recorded.
+  CaptureFrame(CAPTURE_TAP_GET, &f[0], f.size());
+
+  FILE* fp = fopen(path, "rb");
+  ASSERT_TRUE(fp != NULL);
+  vector<unsigned char> data;
+  unsigned char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(fp);
+  unlink(path);
+
+  // Walk all blocks.
+  size_t off = 0;
+  int shb = 0, idb = 0, epb = 0;
+  while (off + 12 <= data.size()) {
+    uint32_t type, len, trailer;
+    memcpy(&type, &data[off], 4);
+    memcpy(&len, &data[off + 4], 4);
+    ASSERT_EQ(0u, len % 4);
+    ASSERT_LE(off + len, data.size());
+    memcpy(&trailer, &data[off + len - 4], 4);
+    EXPECT_EQ(len, trailer);
+    if (type == 0x0A0D0D0A) {
+      ++shb;
+    } else if (type == 1) {
+      ++idb;
+    } else if (type == 6) {
+      uint32_t iface, caplen, orig_len;
+      memcpy(&iface, &data[off + 8], 4);
+      memcpy(&caplen, &data[off + 20], 4);
+      memcpy(&orig_len, &data[off + 24], 4);
+      EXPECT_EQ((uint32_t)CAPTURE_TAP_GET, iface);
+      EXPECT_EQ(40u, caplen);
+      EXPECT_EQ(f.size(), orig_len);
+      ++epb;
+    }
+    off += len;
+  }
+  EXPECT_EQ(data.size(), off);
+  EXPECT_EQ(1, shb);
+  EXPECT_EQ(CAPTURE_POINT_COUNT, idb);
+  EXPECT_EQ(200, epb);
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,206 @@
+#include <string.h>
+#include <arpa/inet.h>
+#include <immintrin.h>
+
+#include "src/checksum.h"
+#include "src/cpu.h"
+#include "src/frame_view.h"
+
+namespace bangnet {
+
+namespace {
+
+uint32_t ChecksumScalar(const void* data, unsigned int len, uint32_t sum) {
+  const unsigned char* p = (const unsigned char*)data;
+  uint64_t acc = sum;
+
+  // Eight bytes at a time, the carries pile up in the top half.
+  while (len >= 8) {
+    uint32_t a, b;
+    memcpy(&a, p, 4);
+    memcpy(&b, p + 4, 4);
+    acc += a;
+    acc += b;
+    p += 8;
+    len -= 8;
+  }
+  while (len >= 2) {
+    uint16_t w;
+    memcpy(&w, p, 2);
+    acc += w;
+    p += 2;
+    len -= 2;
+  }
+  if (len) {
+    // The odd byte is the first half of a word padded with zero.
+    uint16_t w = 0;
+    memcpy(&w, p, 1);
+    acc += w;
+  }
+
+  acc = (acc & 0xffffffffull) + (acc >> 32);
+  acc = (acc & 0xffffffffull) + (acc >> 32);
+  uint32_t r = (uint32_t)acc;
+  r = (r & 0xffff) + (r >> 16);
+  return r;
+}
+
+// Folds two lanes of 64 bit sums into a 32 bit one's complement sum.
+inline uint32_t FoldLanes(uint64_t a, uint64_t b, uint32_t sum) {
+  uint64_t acc = sum;
+  acc += a & 0xffffffffull;
+  acc += a >> 32;
+  acc += b & 0xffffffffull;
+  acc += b >> 32;
+  acc = (acc & 0xffffffffull) + (acc >> 32);
+  acc = (acc & 0xffffffffull) + (acc >> 32);
+  return (uint32_t)acc;
+}
+
+__attribute__((target("sse2")))
+uint32_t ChecksumSse2(const void* data, unsigned int len, uint32_t sum) {
+  const unsigned char* p = (const unsigned char*)data;
+  __m128i mask = _mm_set1_epi64x(0xffffffffll);
+  __m128i a = _mm_setzero_si128();
+  __m128i b = _mm_setzero_si128();
+  unsigned int i = 0;
+  // 32 bit words added to 64 bit lanes, which no packet overflows.
+  for (; i + 32 <= len; i += 32) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(p + i));
+    __m128i y = _mm_loadu_si128((const __m128i*)(p + i + 16));
+    a = _mm_add_epi64(a, _mm_and_si128(x, mask));
+    b = _mm_add_epi64(b, _mm_srli_epi64(x, 32));
+    a = _mm_add_epi64(a, _mm_and_si128(y, mask));
+    b = _mm_add_epi64(b, _mm_srli_epi64(y, 32));
+  }
+  a = _mm_add_epi64(a, b);
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, a);
+  return ChecksumScalar(p + i, len - i, FoldLanes(lanes[0], lanes[1], sum));
+}
+
+__attribute__((target("avx2")))
+uint32_t ChecksumAvx2(const void* data, unsigned int len, uint32_t sum) {
+  const unsigned char* p = (const unsigned char*)data;
+  __m256i mask = _mm256_set1_epi64x(0xffffffffll);
+  __m256i a = _mm256_setzero_si256();
+  __m256i b = _mm256_setzero_si256();
+  unsigned int i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(p + i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(p + i + 32));
+    a = _mm256_add_epi64(a, _mm256_and_si256(x, mask));
+    b = _mm256_add_epi64(b, _mm256_srli_epi64(x, 32));
+    a = _mm256_add_epi64(a, _mm256_and_si256(y, mask));
+    b = _mm256_add_epi64(b, _mm256_srli_epi64(y, 32));
+  }
+  a = _mm256_add_epi64(a, b);
+  __m128i h = _mm_add_epi64(_mm256_castsi256_si128(a),
+                            _mm256_extracti128_si256(a, 1));
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, h);
+  return ChecksumScalar(p + i, len - i, FoldLanes(lanes[0], lanes[1], sum));
+}
+
+typedef uint32_t (*ChecksumFunction)(const void*, unsigned int, uint32_t);
+
+// Feature the cpu needs for each ChecksumKernel, and its function.
+const CpuFeature kKernelNeeds[] = {CPU_BASELINE, CPU_SSE2, CPU_AVX2};
+const ChecksumFunction kKernels[] = {ChecksumScalar, ChecksumSse2,
+                                     ChecksumAvx2};
+const int kKernelCount = sizeof(kKernels) / sizeof(kKernels[0]);
+
+ChecksumKernel active_kernel =
+    (ChecksumKernel)BestCpuKernel(kKernelNeeds, kKernelCount);
+ChecksumFunction checksum = kKernels[active_kernel];
+
+// Below this the vector loop does not run, or not long enough to pay for
+// folding the lanes.
+const unsigned int kMinVectorLen = 128;
+
+// Checksum of the transport header and payload of an unfragmented packet,
+// 0 if right.
+uint16_t TransportChecksum(const FrameView& v) {
+  unsigned int len = v.l3_end() - v.l4_offset();
+  uint8_t proto = v.ip_proto();
+  uint32_t sum = 0;
+  if (v.Has(FRAME_IPV4)) {
+    if (proto != IPPROTO_ICMP)
+      sum = PseudoHeaderSum4(&v.ipv4()->saddr, &v.ipv4()->daddr, proto, len);
+  } else {
+    sum = PseudoHeaderSum6(&v.ipv6()->ip6_src, &v.ipv6()->ip6_dst, proto,
+                           len);
+  }
+  return ChecksumFold(ChecksumPartial(v.data() + v.l4_offset(), len, sum));
+}
+
+}  // namespace
+
+uint32_t ChecksumPartial(const void* data, unsigned int len, uint32_t sum) {
+  if (len < kMinVectorLen)
+    return ChecksumScalar(data, len, sum);
+  return checksum(data, len, sum);
+}
+
+ChecksumKernel checksum_kernel() {
+  return active_kernel;
+}
+
+bool SetChecksumKernel(ChecksumKernel kernel) {
+  if ((unsigned int)kernel >= (unsigned int)kKernelCount ||
+      !CpuSupports(kKernelNeeds[kernel]))
+    return false;
+  active_kernel = kernel;
+  checksum = kKernels[kernel];
+  return true;
+}
+
+uint16_t ChecksumUpdate(uint16_t check, const void* old_data,
+                        const void* new_data, unsigned int len) {
+  // ~m summed is the negated sum of m, ChecksumFold() negates as it folds.
+  uint32_t sum = (uint16_t)~check;
+  sum += ChecksumFold(ChecksumScalar(old_data, len, 0));
+  return ChecksumFold(ChecksumScalar(new_data, len, sum));
+}
+
+uint32_t PseudoHeaderSum4(const void* src, const void* dst, uint8_t proto,
+                          unsigned int len) {
+  uint32_t sum = ChecksumPartial(src, 4, 0);
+  sum = ChecksumPartial(dst, 4, sum);
+  uint16_t w[2];
+  w[0] = htons(proto);
+  w[1] = htons((uint16_t)len);
+  return ChecksumPartial(w, 4, sum);
+}
+
+uint32_t PseudoHeaderSum6(const void* src, const void* dst, uint8_t proto,
+                          unsigned int len) {
+  uint32_t sum = ChecksumPartial(src, 16, 0);
+  sum = ChecksumPartial(dst, 16, sum);
+  uint32_t w[2];
+  w[0] = htonl(len);
+  w[1] = htonl(proto);
+  return ChecksumPartial(w, 8, sum);
+}
+
+int VerifyChecksumBurst(const FrameView* views, int n, bool* ok) {
+  int passed = 0;
+  for (int i = 0; i < n; ++i) {
+    const FrameView& v = views[i];
+    bool good = true;
+    if (v.Has(FRAME_IPV4))
+      good = InetChecksum(v.ipv4(), v.ipv4()->ihl * 4) == 0;
+    if (good && !v.Has(FRAME_FRAGMENT) &&
+        (v.layers() & (FRAME_TCP | FRAME_UDP | FRAME_ICMP))) {
+      // No checksum, allowed over ipv4 only.
+      bool none = v.Has(FRAME_UDP) && v.Has(FRAME_IPV4) &&
+                  v.udp()->check == 0;
+      good = none || TransportChecksum(v) == 0;
+    }
+    ok[i] = good;
+    passed += good;
+  }
+  return passed;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,93 @@
+#ifndef BANGNET_CHECKSUM_H_
+#define BANGNET_CHECKSUM_H_
+
+#include <stdint.h>
+
+namespace bangnet {
+
+class FrameView;
+
+// Internet checksum (RFC 1071) helpers. Sums are taken over 16 bit words
+// loaded in host order and the result is stored the same way, which gives
+// the right bytes on the wire on either endianness.
+
+// Adds data to a running 32 bit one's complement sum. The sum is the same
+// whatever the alignment of data, a run of bytes at an odd offset of a
+// packet must be summed on its own and byte swapped though.
+uint32_t ChecksumPartial(const void* data, unsigned int len, uint32_t sum);
+
+// Implementations of ChecksumPartial(). The SIMD ones add 32 bit words
+// into 64 bit lanes, 16 or 32 bytes at a time, so nothing carries until
+// the lanes are folded at the end.
+enum ChecksumKernel {
+  CHECKSUM_KERNEL_SCALAR,
+  CHECKSUM_KERNEL_SSE2,
+  CHECKSUM_KERNEL_AVX2
+};
+
+// The kernel in use, the fastest the cpu supports unless set.
+ChecksumKernel checksum_kernel();
+
+// Returns false if the cpu does not support kernel.
+bool SetChecksumKernel(ChecksumKernel kernel);
+
+// Folds a running sum to 16 bits and inverts it, ready to store.
+inline uint16_t ChecksumFold(uint32_t sum) {
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return (uint16_t)~sum;
+}
+
+// Returns the checksum of data, like for an ipv4 header.
+inline uint16_t InetChecksum(const void* data, unsigned int len) {
+  return ChecksumFold(ChecksumPartial(data, len, 0));
+}
+
+// Incremental updates for rewritten headers, RFC 1624 eqn. 3:
+// HC' = ~(~HC + ~m + m'). Checksums and fields are as loaded from the
+// frame, like the rest. A udp checksum of 0 means none and is left alone
+// by the caller.
+
+// Returns check updated for a 16 bit field changed from old_value.
+inline uint16_t ChecksumUpdate16(uint16_t check, uint16_t old_value,
+                                 uint16_t new_value) {
+  uint32_t sum = (uint16_t)~check;
+  sum += (uint16_t)~old_value;
+  sum += new_value;
+  return ChecksumFold(sum);
+}
+
+// Same for a 32 bit field, like an ipv4 address or a sequence number.
+inline uint16_t ChecksumUpdate32(uint16_t check, uint32_t old_value,
+                                 uint32_t new_value) {
+  uint32_t sum = (uint16_t)~check;
+  sum += (uint16_t)~old_value;
+  sum += (uint16_t)~(old_value >> 16);
+  sum += (uint16_t)new_value;
+  sum += (uint16_t)(new_value >> 16);
+  return ChecksumFold(sum);
+}
+
+// Same for len bytes at an even offset changed from old_data to new_data,
+// like an ipv6 address.
+uint16_t ChecksumUpdate(uint16_t check, const void* old_data,
+                        const void* new_data, unsigned int len);
+
+// Returns the running sum of an ipv4 pseudo header, addresses in network
+// order, for tcp, udp checksums.
+uint32_t PseudoHeaderSum4(const void* src, const void* dst, uint8_t proto,
+                          unsigned int len);
+
+// Same for ipv6, which icmpv6 uses as well.
+uint32_t PseudoHeaderSum6(const void* src, const void* dst, uint8_t proto,
+                          unsigned int len);
+
+// Verifies the checksums of a burst of parsed frames: the ipv4 header,
+// and the tcp, udp, icmp or icmpv6 one of unfragmented packets. Sets ok[i]
+// to whether frame i passed, frames without them pass, as do the headers
+// that did not parse. Returns the number of frames that passed.
+int VerifyChecksumBurst(const FrameView* views, int n, bool* ok);
+
+}  // namespace bangnet
+
+#endif  // BANGNET_CHECKSUM_H_
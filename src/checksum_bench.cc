@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/checksum.h"
+#include "src/clock.h"
+#include "src/frame_view.h"
+
+namespace bangnet {
+namespace {
+
+const char* kKernelNames[] = {"scalar", "sse2", "avx2"};
+
+void AddGBps(BenchResult* result) {
+  result->AddExtra("GB/s", result->seconds > 0
+                               ? result->bytes / result->seconds / 1e9 : 0);
+}
+
+// ChecksumPartial() over a packet sized region with each kernel.
+BenchResult RunKernelBench(ChecksumKernel kernel, unsigned int size,
+                           uint64_t duration_ms) {
+  vector<unsigned char> data(size);
+  for (unsigned int i = 0; i < size; ++i)
+    data[i] = (unsigned char)(i * 7);
+  ChecksumKernel saved = checksum_kernel();
+  SetChecksumKernel(kernel);
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "checksum/%s/%uB", kKernelNames[kernel],
+           size);
+  result.name = name;
+  uint32_t sum = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    for (int i = 0; i < 1024; ++i)
+      sum = ChecksumPartial(&data[0], size, sum);
+    result.packets += 1024;
+    result.bytes += 1024ull * size;
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  if (sum == 0x12345678)
+    LOG(INFO) << "unexpected sum";
+  AddGBps(&result);
+  SetChecksumKernel(saved);
+  return result;
+}
+
+// VerifyChecksumBurst() over bursts of parsed udp frames of size.
+BenchResult RunVerifyBench(unsigned int size, unsigned int burst,
+                           uint64_t duration_ms) {
+  vector<vector<unsigned char> > frames(burst,
+                                        vector<unsigned char>(size));
+  vector<FrameSlot> slots(burst);
+  unsigned int len = size - 34;
+  for (unsigned int i = 0; i < burst; ++i) {
+    unsigned char* f = &frames[i][0];
+    for (unsigned int j = 0; j < size; ++j)
+      f[j] = (unsigned char)(i + j * 3);
+    f[12] = 0x08;
+    f[13] = 0x00;
+    f[14] = 0x45;
+    f[16] = (unsigned char)((len + 20) >> 8);
+    f[17] = (unsigned char)(len + 20);
+    f[20] = f[21] = 0;
+    f[23] = IPPROTO_UDP;
+    memset(f + 24, 0, 2);
+    uint16_t c = InetChecksum(f + 14, 20);
+    memcpy(f + 24, &c, 2);
+    f[38] = (unsigned char)(len >> 8);
+    f[39] = (unsigned char)len;
+    memset(f + 40, 0, 2);
+    c = ChecksumFold(ChecksumPartial(
+        f + 34, len, PseudoHeaderSum4(f + 26, f + 30, IPPROTO_UDP, len)));
+    memcpy(f + 40, &c, 2);
+    slots[i].data = f;
+    slots[i].len = size;
+  }
+  vector<FrameView> views(burst);
+  ParseBurst(&slots[0], burst, &views[0]);
+  bool ok[256];
+  CHECK_LE(burst, 256u);
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "verify-burst/%s/%uB",
+           kKernelNames[checksum_kernel()], size);
+  result.name = name;
+  uint64_t passed = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    for (int i = 0; i < 64; ++i)
+      passed += VerifyChecksumBurst(&views[0], burst, ok);
+    result.packets += 64 * burst;
+    result.bytes += 64ull * burst * size;
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  CHECK_EQ(passed, result.packets);
+  AddGBps(&result);
+  return result;
+}
+
+// Rewrites the ttl of an ipv4 header, fixing its checksum incrementally or
+// recomputing it.
+BenchResult RunUpdateBench(bool incremental, uint64_t duration_ms) {
+  unsigned char ip[20];
+  for (int i = 0; i < 20; ++i)
+    ip[i] = (unsigned char)(i * 13);
+  memset(ip + 10, 0, 2);
+  uint16_t check = InetChecksum(ip, 20);
+  memcpy(ip + 10, &check, 2);
+
+  BenchResult result;
+  result.name = incremental ? "ttl-update/rfc1624" : "ttl-update/full";
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    for (int i = 0; i < 4096; ++i) {
+      uint16_t old_word, new_word;
+      memcpy(&old_word, ip + 8, 2);
+      --ip[8];
+      if (incremental) {
+        memcpy(&new_word, ip + 8, 2);
+        memcpy(&check, ip + 10, 2);
+        check = ChecksumUpdate16(check, old_word, new_word);
+      } else {
+        memset(ip + 10, 0, 2);
+        check = InetChecksum(ip, 20);
+      }
+      memcpy(ip + 10, &check, 2);
+    }
+    result.packets += 4096;
+    result.bytes += 4096 * 20;
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  CHECK_EQ(0, InetChecksum(ip, 20));
+  return result;
+}
+
+BENCHMARK(Checksum) {
+  vector<unsigned int> sizes = options.frame_sizes;
+  sizes.push_back(9000);
+  ChecksumKernel kernels[] = {CHECKSUM_KERNEL_SCALAR, CHECKSUM_KERNEL_SSE2,
+                              CHECKSUM_KERNEL_AVX2};
+  for (int k = 0; k < 3; ++k) {
+    ChecksumKernel saved = checksum_kernel();
+    if (!SetChecksumKernel(kernels[k]))
+      continue;
+    SetChecksumKernel(saved);
+    for (size_t i = 0; i < sizes.size(); ++i)
+      results->push_back(
+          RunKernelBench(kernels[k], sizes[i], options.duration_ms));
+  }
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    results->push_back(
+        RunVerifyBench(sizes[i], options.burst, options.duration_ms));
+  }
+  results->push_back(RunUpdateBench(false, options.duration_ms));
+  results->push_back(RunUpdateBench(true, options.duration_ms));
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,172 @@
+#include "src/checksum.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <gtest/gtest.h>
+
+#include "src/frame_view.h"
+
+namespace bangnet {
+namespace {
+
+// Sum of the 16 bit words of data, a word at a time.
+uint16_t ReferenceChecksum(const unsigned char* data, unsigned int len,
+                           uint32_t sum) {
+  uint64_t acc = sum;
+  for (unsigned int i = 0; i < len; i += 2) {
+    uint16_t w = 0;
+    memcpy(&w, data + i, i + 1 < len ? 2 : 1);
+    acc += w;
+  }
+  while (acc >> 16)
+    acc = (acc & 0xffff) + (acc >> 16);
+  return (uint16_t)~acc;
+}
+
+TEST(ChecksumTest, KernelsAgree) {
+  unsigned char data[2100];
+  uint32_t x = 1;
+  for (unsigned int i = 0; i < sizeof(data); ++i) {
+    x = x * 1103515245u + 12345u;
+    data[i] = (unsigned char)(x >> 24);
+  }
+  // Runs of 0xff carry the most.
+  memset(data + 1500, 0xff, 600);
+  ChecksumKernel saved = checksum_kernel();
+  ChecksumKernel kernels[] = {CHECKSUM_KERNEL_SCALAR, CHECKSUM_KERNEL_SSE2,
+                              CHECKSUM_KERNEL_AVX2};
+  unsigned int lens[] = {0, 1, 7, 20, 63, 127, 128, 129, 191, 1000, 1499,
+                         2000};
+  for (int k = 0; k < 3; ++k) {
+    if (!SetChecksumKernel(kernels[k]))
+      continue;
+    for (unsigned int off = 0; off < 4; ++off) {
+      for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+        EXPECT_EQ(ReferenceChecksum(data + off, lens[l], 0x1234ffff),
+                  ChecksumFold(ChecksumPartial(data + off, lens[l],
+                                               0x1234ffff)))
+            << "kernel " << k << " offset " << off << " len " << lens[l];
+      }
+    }
+    EXPECT_EQ(ReferenceChecksum(data + 1500, 600, 0),
+              InetChecksum(data + 1500, 600));
+  }
+  SetChecksumKernel(saved);
+}
+
+TEST(ChecksumTest, UpdatesIncrementally) {
+  unsigned char ip[40];
+  for (int i = 0; i < 40; ++i)
+    ip[i] = (unsigned char)(i * 37 + 11);
+  uint16_t check = InetChecksum(ip, 40);
+
+  // The ttl and protocol word.
+  uint16_t old16, new16;
+  memcpy(&old16, ip + 8, 2);
+  ip[8] -= 1;
+  memcpy(&new16, ip + 8, 2);
+  check = ChecksumUpdate16(check, old16, new16);
+  EXPECT_EQ(InetChecksum(ip, 40), check);
+
+  // An ipv4 address.
+  uint32_t old32, new32;
+  memcpy(&old32, ip + 12, 4);
+  memcpy(ip + 12, "\x0a\x00\x00\x01", 4);
+  memcpy(&new32, ip + 12, 4);
+  check = ChecksumUpdate32(check, old32, new32);
+  EXPECT_EQ(InetChecksum(ip, 40), check);
+
+  // An ipv6 address.
+  unsigned char old_addr[16], new_addr[16];
+  memcpy(old_addr, ip + 24, 16);
+  memset(new_addr, 0xff, 16);
+  memcpy(ip + 24, new_addr, 16);
+  check = ChecksumUpdate(check, old_addr, new_addr, 16);
+  EXPECT_EQ(InetChecksum(ip, 40), check);
+}
+
+// Writes an ethernet frame of an ip packet of proto with len bytes of
+// transport header and payload, with right checksums, returns its length.
+unsigned int BuildFrame(unsigned char* f, bool v6, uint8_t proto,
+                        unsigned int len) {
+  memset(f, 0, 54 + len);
+  unsigned int l4;
+  uint32_t sum = 0;
+  if (v6) {
+    f[12] = 0x86;
+    f[13] = 0xdd;
+    f[14] = 0x60;
+    f[18] = (unsigned char)(len >> 8);
+    f[19] = (unsigned char)len;
+    f[20] = proto;
+    f[21] = 64;
+    f[37] = 1;
+    f[53] = 2;
+    l4 = 54;
+    sum = PseudoHeaderSum6(f + 22, f + 38, proto, len);
+  } else {
+    f[12] = 0x08;
+    f[14] = 0x45;
+    f[16] = (unsigned char)((len + 20) >> 8);
+    f[17] = (unsigned char)(len + 20);
+    f[22] = 64;
+    f[23] = proto;
+    f[29] = 1;
+    f[33] = 2;
+    uint16_t c = InetChecksum(f + 14, 20);
+    memcpy(f + 24, &c, 2);
+    l4 = 34;
+    if (proto != IPPROTO_ICMP)
+      sum = PseudoHeaderSum4(f + 26, f + 30, proto, len);
+  }
+  for (unsigned int i = 8; i < len; ++i)
+    f[l4 + i] = (unsigned char)(i * 3);
+  if (proto == IPPROTO_TCP)
+    f[l4 + 12] = 0x50;
+  if (proto == IPPROTO_UDP) {
+    f[l4 + 4] = (unsigned char)(len >> 8);
+    f[l4 + 5] = (unsigned char)len;
+  }
+  // Where the checksum of each goes.
+  unsigned int at = proto == IPPROTO_TCP ? 16 : proto == IPPROTO_UDP ? 6 : 2;
+  memset(f + l4 + at, 0, 2);
+  uint16_t c = ChecksumFold(ChecksumPartial(f + l4, len, sum));
+  memcpy(f + l4 + at, &c, 2);
+  return l4 + len;
+}
+
+TEST(ChecksumTest, VerifiesBursts) {
+  unsigned char frames[8][1600];
+  FrameSlot slots[8];
+  slots[0].len = BuildFrame(frames[0], false, IPPROTO_TCP, 1000);
+  slots[1].len = BuildFrame(frames[1], true, IPPROTO_UDP, 501);
+  slots[2].len = BuildFrame(frames[2], false, IPPROTO_ICMP, 64);
+  slots[3].len = BuildFrame(frames[3], true, IPPROTO_ICMPV6, 64);
+  // Udp over ipv4 without a checksum, and arp.
+  slots[4].len = BuildFrame(frames[4], false, IPPROTO_UDP, 100);
+  memset(frames[4] + 40, 0, 2);
+  memset(frames[5], 0, 60);
+  frames[5][12] = 0x08;
+  frames[5][13] = 0x06;
+  slots[5].len = 60;
+  // A bad payload and a bad ipv4 header.
+  slots[6].len = BuildFrame(frames[6], true, IPPROTO_TCP, 1400);
+  frames[6][700] ^= 1;
+  slots[7].len = BuildFrame(frames[7], false, IPPROTO_UDP, 300);
+  frames[7][22] -= 1;
+  for (int i = 0; i < 8; ++i)
+    slots[i].data = frames[i];
+
+  FrameView views[8];
+  ASSERT_EQ(8, ParseBurst(slots, 8, views));
+  bool ok[8];
+  EXPECT_EQ(6, VerifyChecksumBurst(views, 8, ok));
+  for (int i = 0; i < 6; ++i)
+    EXPECT_TRUE(ok[i]) << i;
+  EXPECT_FALSE(ok[6]);
+  EXPECT_FALSE(ok[7]);
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,9 @@
+#include "src/clock.h"
+
+namespace bangnet {
+
+double CycleClock::ns_per_cycle_ = 1.0;
+uint64_t CycleClock::base_cycles_ = 0;
+uint64_t CycleClock::base_ns_ = 0;
+
+}  // namespace bangnet
@@ -0,0 +1,80 @@
+#ifndef BANGNET_CLOCK_H_
+#define BANGNET_CLOCK_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace bangnet {
+
+// Returns CLOCK_MONOTONIC in nanoseconds.
+inline uint64_t MonotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Returns CLOCK_REALTIME in nanoseconds since the epoch.
+inline uint64_t RealtimeNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Returns the cpu time used by the calling thread in nanoseconds.
+inline uint64_t ThreadCpuNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Returns the cpu time stamp counter, or monotonic nanoseconds where there
+// is no such counter.
+inline uint64_t CycleCount() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return MonotonicNs();
+#endif
+}
+
+// Converts CycleCount() values to nanoseconds. The counter is assumed to be
+// invariant, which holds on every x86 cpu of the last decade.
+class CycleClock {
+public:
+  // Measures the counter frequency against CLOCK_MONOTONIC for about
+  // `calibrate_ns`, done once at startup.
+  static void Calibrate(uint64_t calibrate_ns) {
+    uint64_t t0 = MonotonicNs();
+    uint64_t c0 = CycleCount();
+    uint64_t t1;
+    do {
+      t1 = MonotonicNs();
+    } while (t1 - t0 < calibrate_ns);
+    uint64_t c1 = CycleCount();
+    ns_per_cycle_ = c1 > c0 ? (double)(t1 - t0) / (c1 - c0) : 1.0;
+    base_cycles_ = c1;
+    base_ns_ = t1;
+  }
+
+  // Nanoseconds a cycle takes, 1.0 before Calibrate().
+  static double ns_per_cycle() { return ns_per_cycle_; }
+
+  // Converts a CycleCount() value to MonotonicNs() time.
+  static uint64_t ToMonotonicNs(uint64_t cycles) {
+    return base_ns_ + (int64_t)((int64_t)(cycles - base_cycles_) *
+                                ns_per_cycle_);
+  }
+
+private:
+  static double ns_per_cycle_;
+  static uint64_t base_cycles_;
+  static uint64_t base_ns_;
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_CLOCK_H_
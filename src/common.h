@@ -15,6 +15,15 @@
 #include <fstream>
 #include <iostream>
 
+// Branch prediction hints for the frame path.
+#define BN_LIKELY(x) __builtin_expect(!!(x), 1)
+#define BN_UNLIKELY(x) __builtin_expect(!!(x), 0)
+
+// Disallow the copy constructor and operator= functions.
+#define BN_DISALLOW_COPY_AND_ASSIGN(classname) \
+  classname(const classname&);                 \
+  classname& operator=(const classname&)
+
 namespace bangnet {
   using std::fstream;
   using std::ios;
@@ -0,0 +1,451 @@
+#include <math.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include "src/clock.h"
+#include "src/compress.h"
+#include "src/frame_device.h"
+
+namespace bangnet {
+
+namespace {
+
+// LZ4 block format limits: matches are at least 4 bytes, reach back up to
+// 64KB, and the last 5 bytes of a block are literals, so no match starts
+// within the last 12.
+const unsigned int kMinMatch = 4;
+const unsigned int kMaxOffset = 65535;
+const unsigned int kLastLiterals = 5;
+const unsigned int kMatchLimit = 12;
+
+// Longest window either codec looks back, the deflate one.
+const unsigned int kMaxDictionary = 32768;
+
+inline uint32_t Read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint32_t Hash(uint32_t v, int bits) {
+  return (v * 2654435761u) >> (32 - bits);
+}
+
+// Bytes a and b have in common, up to max.
+inline unsigned int CommonPrefix(const unsigned char* a,
+                                 const unsigned char* b, unsigned int max) {
+  unsigned int n = 0;
+  while (n + 8 <= max) {
+    uint64_t x, y;
+    memcpy(&x, a + n, 8);
+    memcpy(&y, b + n, 8);
+    if (x != y)
+      return n + (__builtin_ctzll(x ^ y) >> 3);
+    n += 8;
+  }
+  while (n < max && a[n] == b[n])
+    ++n;
+  return n;
+}
+
+// Writes a length continuing a token nibble: 255s, then the rest.
+inline unsigned char* WriteLength(unsigned char* op, unsigned int n) {
+  while (n >= 255) {
+    *op++ = 255;
+    n -= 255;
+  }
+  *op++ = (unsigned char)n;
+  return op;
+}
+
+// Writes a sequence of literals, then a match unless offset is 0. Returns
+// the new end, or null if it would pass end.
+unsigned char* WriteSequence(unsigned char* op, unsigned char* end,
+                             const unsigned char* lit, unsigned int nlit,
+                             unsigned int offset, unsigned int mlen) {
+  // Token, literal length bytes, literals, offset and match length bytes.
+  unsigned int need = 1 + nlit / 255 + 1 + nlit + 2 + mlen / 255 + 1;
+  if ((unsigned int)(end - op) < need)
+    return 0;
+  unsigned char* token = op++;
+  *token = (unsigned char)((nlit < 15 ? nlit : 15) << 4);
+  if (nlit >= 15)
+    op = WriteLength(op, nlit - 15);
+  memcpy(op, lit, nlit);
+  op += nlit;
+  if (!offset)
+    return op;
+  *op++ = (unsigned char)offset;
+  *op++ = (unsigned char)(offset >> 8);
+  mlen -= kMinMatch;
+  *token |= (unsigned char)(mlen < 15 ? mlen : 15);
+  if (mlen >= 15)
+    op = WriteLength(op, mlen - 15);
+  return op;
+}
+
+// Reads a length continuing a token nibble, false if it runs past end.
+inline bool ReadLength(const unsigned char** ip, const unsigned char* end,
+                       unsigned int* n) {
+  unsigned char b;
+  do {
+    if (*ip >= end)
+      return false;
+    b = *(*ip)++;
+    *n += b;
+  } while (b == 255);
+  return true;
+}
+
+// c * log2(c) of each count a sample of 256 bytes can have.
+struct CLog2C {
+  CLog2C() {
+    v[0] = 0;
+    for (int c = 1; c <= 256; ++c)
+      v[c] = c * log2((double)c);
+  }
+  double v[257];
+};
+
+}  // namespace
+
+Lz4Encoder::Lz4Encoder(const unsigned char* dict, unsigned int dict_len)
+    : dict_(dict), dict_len_(dict_len), epoch_(1) {
+  if (dict_len_ > kMaxOffset) {
+    dict_ += dict_len_ - kMaxOffset;
+    dict_len_ = kMaxOffset;
+  }
+  dict_table_.assign(1 << kHashBits, 0);
+  table_.assign(1 << kHashBits, 0);
+  for (unsigned int p = 0; p + kMinMatch <= dict_len_; ++p)
+    dict_table_[Hash(Read32(dict_ + p), kHashBits)] = p + 1;
+}
+
+unsigned int Lz4Encoder::Compress(const unsigned char* src, unsigned int len,
+                                  unsigned char* dst, unsigned int cap) {
+  if (++epoch_ == 0) {
+    table_.assign(table_.size(), 0);
+    epoch_ = 1;
+  }
+  uint64_t epoch = (uint64_t)epoch_ << 32;
+
+  // Positions are counted from the start of the dictionary, as if src
+  // followed it.
+  unsigned char* op = dst;
+  unsigned char* end = dst + cap;
+  unsigned int anchor = 0;
+  unsigned int i = 0;
+  unsigned int match_end = len > kLastLiterals ? len - kLastLiterals : 0;
+  while (len > kMatchLimit && i < len - kMatchLimit) {
+    uint32_t seq = Read32(src + i);
+    uint32_t h = Hash(seq, kHashBits);
+    unsigned int pos = dict_len_ + i;
+    uint64_t e = table_[h];
+    table_[h] = epoch | pos;
+
+    unsigned int c;
+    if ((e & ~0xffffffffull) == epoch)
+      c = (unsigned int)e;
+    else if (dict_table_[h])
+      c = dict_table_[h] - 1;
+    else
+      c = pos;
+    unsigned int mlen = 0;
+    if (c < pos && pos - c <= kMaxOffset) {
+      if (c >= dict_len_) {
+        const unsigned char* m = src + (c - dict_len_);
+        if (Read32(m) == seq)
+          mlen = CommonPrefix(m, src + i, match_end - i);
+      } else if (Read32(dict_ + c) == seq) {
+        // Matches may run off the end of the dictionary into src.
+        unsigned int n = dict_len_ - c;
+        mlen = CommonPrefix(dict_ + c, src + i,
+                            n < match_end - i ? n : match_end - i);
+        if (mlen == n)
+          mlen += CommonPrefix(src, src + i + n, match_end - i - n);
+      }
+    }
+    if (mlen < kMinMatch) {
+      // Step faster through data which does not match.
+      i += 1 + ((i - anchor) >> 6);
+      continue;
+    }
+
+    op = WriteSequence(op, end, src + anchor, i - anchor, pos - c, mlen);
+    if (!op)
+      return 0;
+    i += mlen;
+    anchor = i;
+    // The match end is likely to start another one.
+    if (i - 2 + kMatchLimit < len) {
+      h = Hash(Read32(src + i - 2), kHashBits);
+      table_[h] = epoch | (dict_len_ + i - 2);
+    }
+  }
+
+  op = WriteSequence(op, end, src + anchor, len - anchor, 0, 0);
+  return op ? (unsigned int)(op - dst) : 0;
+}
+
+unsigned int Lz4Decompress(const unsigned char* src, unsigned int len,
+                           const unsigned char* dict, unsigned int dict_len,
+                           unsigned char* dst, unsigned int cap) {
+  const unsigned char* ip = src;
+  const unsigned char* end = src + len;
+  unsigned int op = 0;
+  while (ip < end) {
+    unsigned int token = *ip++;
+    unsigned int nlit = token >> 4;
+    if (nlit == 15 && !ReadLength(&ip, end, &nlit))
+      return 0;
+    if (nlit > (unsigned int)(end - ip) || nlit > cap - op)
+      return 0;
+    memcpy(dst + op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == end)
+      return op;
+
+    if (end - ip < 2)
+      return 0;
+    unsigned int offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    unsigned int mlen = token & 15;
+    if (mlen == 15 && !ReadLength(&ip, end, &mlen))
+      return 0;
+    mlen += kMinMatch;
+    if (!offset || mlen > cap - op)
+      return 0;
+
+    if (offset > op) {
+      // The match starts in the dictionary.
+      unsigned int back = offset - op;
+      if (back > dict_len)
+        return 0;
+      unsigned int n = back < mlen ? back : mlen;
+      memcpy(dst + op, dict + dict_len - back, n);
+      op += n;
+      mlen -= n;
+    }
+    unsigned char* d = dst + op;
+    const unsigned char* m = d - offset;
+    if (offset >= mlen) {
+      memcpy(d, m, mlen);
+    } else {
+      // Overlapping, the match repeats the last offset bytes.
+      for (unsigned int k = 0; k < mlen; ++k)
+        d[k] = m[k];
+    }
+    op += mlen;
+  }
+  // A block ends with literals.
+  return 0;
+}
+
+double EstimateEntropy(const unsigned char* data, unsigned int len) {
+  static const CLog2C clog2c;
+  if (len == 0)
+    return 0;
+
+  unsigned int n = len < 256 ? len : 256;
+  unsigned int stride = len / n;
+  unsigned int counts[256];
+  memset(counts, 0, sizeof(counts));
+  for (unsigned int i = 0; i < n; ++i)
+    ++counts[data[i * stride]];
+  double sum = 0;
+  for (int b = 0; b < 256; ++b)
+    sum += clog2c.v[counts[b]];
+  return log2((double)n) - sum / n;
+}
+
+Compressor::Compressor(const string& name, BufferPool* pool,
+                       const CompressionOptions& options)
+    : name_(name), pool_(pool), options_(options),
+      dict_(options.dictionary.size() > kMaxDictionary ?
+            options.dictionary.substr(options.dictionary.size() -
+                                      kMaxDictionary) :
+            options.dictionary),
+      lz4_((const unsigned char*)dict_.data(), dict_.size()),
+      scratch_(Lz4CompressBound(kMaxFrameLen)), deflate_(0), inflate_(0),
+      bytes_in_(0), bytes_out_(0), cycles_(0) {
+  if (options_.codec == COMPRESS_DEFLATE) {
+    deflate_ = new z_stream;
+    memset(deflate_, 0, sizeof(*deflate_));
+    // Raw deflate, the header carries what a zlib header would.
+    CHECK_EQ(Z_OK, deflateInit2(deflate_, options_.level, Z_DEFLATED, -15, 8,
+                                Z_DEFAULT_STRATEGY));
+  }
+
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.compressed = r->NewCounter("bangnet_compress_frames_total",
+      "Frames sent compressed.", labels);
+  metrics_.entropy_skipped = r->NewCounter(
+      "bangnet_compress_entropy_skipped_total",
+      "Frames sent as is because they looked incompressible.", labels);
+  metrics_.incompressible = r->NewCounter(
+      "bangnet_compress_incompressible_total",
+      "Frames sent as is because they did not shrink.", labels);
+  metrics_.bytes_in = r->NewCounter("bangnet_compress_bytes_in_total",
+      "Bytes of frames into the compressor.", labels);
+  metrics_.bytes_out = r->NewCounter("bangnet_compress_bytes_out_total",
+      "Bytes of frames out of the compressor, headers included.", labels);
+  metrics_.errors = r->NewCounter("bangnet_compress_errors_total",
+      "Frames dropped as malformed or for lack of room.", labels);
+  metrics_.ratio = r->NewGauge("bangnet_compress_ratio_permille",
+      "Bytes in per byte out, times 1000.", labels);
+  metrics_.cycles_per_byte = r->NewGauge(
+      "bangnet_compress_millicycles_per_byte",
+      "Compression cycles per byte in, times 1000.", labels);
+}
+
+Compressor::~Compressor() {
+  if (deflate_) {
+    deflateEnd(deflate_);
+    delete deflate_;
+  }
+  if (inflate_) {
+    inflateEnd(inflate_);
+    delete inflate_;
+  }
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+unsigned int Compressor::Compress(const unsigned char* src,
+                                  unsigned int len) {
+  // Output only fits if it is smaller than the frame, which a frame of 0
+  // or 1 byte never is.
+  if (len < 2)
+    return 0;
+  unsigned int cap = len - 1;
+  if (options_.codec == COMPRESS_LZ4)
+    return lz4_.Compress(src, len, &scratch_[0], cap);
+  if (options_.codec != COMPRESS_DEFLATE)
+    return 0;
+
+  deflateReset(deflate_);
+  if (!dict_.empty())
+    deflateSetDictionary(deflate_, (const Bytef*)dict_.data(), dict_.size());
+  deflate_->next_in = (Bytef*)src;
+  deflate_->avail_in = len;
+  deflate_->next_out = &scratch_[0];
+  deflate_->avail_out = cap;
+  if (deflate(deflate_, Z_FINISH) != Z_STREAM_END)
+    return 0;
+  return cap - deflate_->avail_out;
+}
+
+unsigned int Compressor::Inflate(const unsigned char* src, unsigned int len,
+                                 unsigned char* dst, unsigned int cap) {
+  if (!inflate_) {
+    inflate_ = new z_stream;
+    memset(inflate_, 0, sizeof(*inflate_));
+    CHECK_EQ(Z_OK, inflateInit2(inflate_, -15));
+  }
+  inflateReset(inflate_);
+  if (!dict_.empty())
+    inflateSetDictionary(inflate_, (const Bytef*)dict_.data(), dict_.size());
+  inflate_->next_in = (Bytef*)src;
+  inflate_->avail_in = len;
+  inflate_->next_out = dst;
+  inflate_->avail_out = cap;
+  if (inflate(inflate_, Z_FINISH) != Z_STREAM_END)
+    return 0;
+  return cap - inflate_->avail_out;
+}
+
+int Compressor::CompressBurst(Buffer** frames, int n) {
+  uint64_t c0 = CycleCount();
+  uint64_t in = 0, out = 0;
+  int kept = 0;
+  for (int i = 0; i < n; ++i) {
+    Buffer* b = frames[i];
+    if (b->headroom() < kCompressionHeaderLen) {
+      metrics_.errors->Increment();
+      b->Unref();
+      continue;
+    }
+
+    unsigned int len = b->len();
+    uint32_t codec = COMPRESS_NONE;
+    if (len >= options_.min_size) {
+      if (EstimateEntropy(b->data(), len) > options_.max_entropy) {
+        metrics_.entropy_skipped->Increment();
+      } else {
+        unsigned int clen = Compress(b->data(), len);
+        if (clen) {
+          memcpy(b->data(), &scratch_[0], clen);
+          b->set_len(clen);
+          codec = options_.codec;
+          metrics_.compressed->Increment();
+        } else {
+          metrics_.incompressible->Increment();
+        }
+      }
+    }
+    uint32_t h = htonl((codec << 24) | len);
+    memcpy(b->Push(kCompressionHeaderLen), &h, kCompressionHeaderLen);
+    in += len;
+    out += b->len();
+    frames[kept++] = b;
+  }
+
+  cycles_ += CycleCount() - c0;
+  bytes_in_ += in;
+  bytes_out_ += out;
+  metrics_.bytes_in->Add(in);
+  metrics_.bytes_out->Add(out);
+  if (bytes_out_)
+    metrics_.ratio->Set(bytes_in_ * 1000 / bytes_out_);
+  if (bytes_in_)
+    metrics_.cycles_per_byte->Set(cycles_ * 1000 / bytes_in_);
+  return kept;
+}
+
+Buffer* Compressor::Decompress(Buffer* frame) {
+  if (frame->len() < kCompressionHeaderLen) {
+    metrics_.errors->Increment();
+    frame->Unref();
+    return 0;
+  }
+  uint32_t h;
+  memcpy(&h, frame->data(), kCompressionHeaderLen);
+  h = ntohl(h);
+  unsigned int codec = h >> 24;
+  unsigned int len = h & 0xffffff;
+  frame->Pull(kCompressionHeaderLen);
+  if (codec == COMPRESS_NONE && frame->len() == len)
+    return frame;
+
+  Buffer* out = 0;
+  if (len <= kMaxFrameLen && (codec == COMPRESS_LZ4 ||
+                              codec == COMPRESS_DEFLATE))
+    out = pool_->Get();
+  if (!out || out->capacity() < len) {
+    metrics_.errors->Increment();
+    if (out)
+      out->Unref();
+    frame->Unref();
+    return 0;
+  }
+
+  unsigned int n;
+  if (codec == COMPRESS_LZ4)
+    n = Lz4Decompress(frame->data(), frame->len(),
+                      (const unsigned char*)dict_.data(), dict_.size(),
+                      out->data(), len);
+  else
+    n = Inflate(frame->data(), frame->len(), out->data(), len);
+  frame->Unref();
+  if (n != len) {
+    metrics_.errors->Increment();
+    out->Unref();
+    return 0;
+  }
+  out->set_len(len);
+  return out;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,158 @@
+#ifndef BANGNET_COMPRESS_H_
+#define BANGNET_COMPRESS_H_
+
+#include <stdint.h>
+
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/metrics.h"
+
+struct z_stream_s;
+
+namespace bangnet {
+
+// Optional payload compression of frames sent to a peer, for underlay links
+// where bandwidth is scarcer than cpu. It runs on bursts of frames read
+// from the device, before they are fragmented and encapsulated.
+
+enum CompressionCodec {
+  // Frame sent as is.
+  COMPRESS_NONE = 0,
+  // LZ4 block format, fast and cheap to decompress.
+  COMPRESS_LZ4 = 1,
+  // Raw deflate, slower and tighter.
+  COMPRESS_DEFLATE = 2
+};
+
+// Every frame starts with this header once through the compressor, in
+// network byte order: the codec in the top byte and the length of the
+// original frame in the others.
+const unsigned int kCompressionHeaderLen = 4;
+
+// Compressed size of len bytes in the worst case.
+inline unsigned int Lz4CompressBound(unsigned int len) {
+  return len + len / 255 + 16;
+}
+
+// Compresses into the LZ4 block format, with matches reaching back into a
+// dictionary, the bytes assumed to precede every input. The dictionary is
+// hashed once, and the match table of an input is invalidated by bumping
+// an epoch rather than clearing it, so small frames cost no setup.
+class Lz4Encoder {
+public:
+  // dict is not copied and must outlive the encoder. Only the last 64KB
+  // are reachable.
+  Lz4Encoder(const unsigned char* dict, unsigned int dict_len);
+
+  // Compresses src into dst, returns the compressed length or 0 if it does
+  // not fit cap.
+  unsigned int Compress(const unsigned char* src, unsigned int len,
+                        unsigned char* dst, unsigned int cap);
+
+private:
+  static const int kHashBits = 12;
+
+  const unsigned char* dict_;
+  unsigned int dict_len_;
+  // Dictionary position plus one of each hash, 0 for none.
+  vector<uint32_t> dict_table_;
+  // Epoch in the high half and position in the low half.
+  vector<uint64_t> table_;
+  uint32_t epoch_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Lz4Encoder);
+};
+
+// Decompresses an LZ4 block compressed with the same dict. Returns the
+// decompressed length, or 0 if the block is malformed or over cap.
+unsigned int Lz4Decompress(const unsigned char* src, unsigned int len,
+                           const unsigned char* dict, unsigned int dict_len,
+                           unsigned char* dst, unsigned int cap);
+
+// Estimates the entropy of data in bits per byte, 0 to 8, from the byte
+// histogram of up to 256 bytes sampled across it. Random and encrypted data
+// scores above 7 on the sample, text and headers well below.
+double EstimateEntropy(const unsigned char* data, unsigned int len);
+
+struct CompressionOptions {
+  CompressionOptions()
+      : codec(COMPRESS_LZ4), level(1), min_size(128), max_entropy(7.0) {}
+
+  // Codec of frames which do compress.
+  CompressionCodec codec;
+
+  // Deflate level, 1 to 9.
+  int level;
+
+  // Bytes both peers prime the codec with, like typical headers of the
+  // traffic, so even small frames find matches. Both ends must use the same
+  // one. Only the last 32KB are used, and deflate hashes it again for every
+  // frame, so with deflate it should be a few KB.
+  string dictionary;
+
+  // Smaller frames are not worth compressing.
+  unsigned int min_size;
+
+  // Frames whose sample scores more bits per byte, likely compressed or
+  // encrypted already, are sent as is without trying.
+  double max_entropy;
+};
+
+// Compresses frames sent to one peer and decompresses those it sends. Not
+// thread safe.
+class Compressor {
+public:
+  // Decompressed frames are written to buffers of pool, which must hold the
+  // largest frame. name labels the metrics.
+  Compressor(const string& name, BufferPool* pool,
+             const CompressionOptions& options);
+  ~Compressor();
+
+  // Compresses a burst of frames in place and prepends the header to each,
+  // in their headroom. Frames which are small, look incompressible or do not
+  // shrink keep their data. Frames without headroom for the header are
+  // dropped. Returns the frames left, packed at the front.
+  int CompressBurst(Buffer** frames, int n);
+
+  // Restores a frame of the peer, taking the caller's reference. Returns
+  // the frame with a reference for the caller, or null if it is malformed.
+  Buffer* Decompress(Buffer* frame);
+
+private:
+  // Compresses len bytes of src into scratch_ with the codec, returns the
+  // length or 0 if it did not shrink.
+  unsigned int Compress(const unsigned char* src, unsigned int len);
+
+  unsigned int Inflate(const unsigned char* src, unsigned int len,
+                       unsigned char* dst, unsigned int cap);
+
+  string name_;
+  BufferPool* pool_;
+  CompressionOptions options_;
+  string dict_;
+  Lz4Encoder lz4_;
+  vector<unsigned char> scratch_;
+  z_stream_s* deflate_;
+  z_stream_s* inflate_;
+  uint64_t bytes_in_;
+  uint64_t bytes_out_;
+  uint64_t cycles_;
+
+  struct Metrics {
+    Counter* compressed;
+    Counter* entropy_skipped;
+    Counter* incompressible;
+    Counter* bytes_in;
+    Counter* bytes_out;
+    Counter* errors;
+    // Bytes in per byte out, and compress cycles per byte in, times 1000.
+    Gauge* ratio;
+    Gauge* cycles_per_byte;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Compressor);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_COMPRESS_H_
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/compress.h"
+#include "src/frame_device.h"
+
+namespace bangnet {
+namespace {
+
+enum PayloadKind {
+  PAYLOAD_TEXT,
+  PAYLOAD_RANDOM
+};
+
+// Fills frames with json like text or random bytes, the two ends of what a
+// tenant sends: plain http and logs, or tls.
+void FillPayload(PayloadKind kind, unsigned int seed, unsigned char* data,
+                 unsigned int len) {
+  if (kind == PAYLOAD_RANDOM) {
+    uint32_t x = seed * 2654435761u + 1;
+    for (unsigned int i = 0; i < len; ++i) {
+      x = x * 1103515245u + 12345u;
+      data[i] = (unsigned char)(x >> 24);
+    }
+    return;
+  }
+  unsigned int off = 0;
+  char line[128];
+  while (off < len) {
+    int n = snprintf(line, sizeof(line),
+                     "{\"host\": \"node-%u\", \"status\": %u, \"bytes\": %u}\n",
+                     seed % 17, 200 + seed % 3, seed * 7919 % 100000);
+    unsigned int c = len - off < (unsigned int)n ? len - off : n;
+    memcpy(data + off, line, c);
+    off += c;
+    ++seed;
+  }
+}
+
+// Compresses bursts of frames and decompresses them again, reporting the
+// ratio and the cycles per byte of each direction.
+BenchResult RunCompressBench(CompressionCodec codec, PayloadKind kind,
+                             bool dictionary, unsigned int frame_size,
+                             unsigned int burst, uint64_t duration_ms) {
+  BufferPool pool(kMaxFrameLen, 2 * burst + 2);
+  CompressionOptions options;
+  options.codec = codec;
+  if (dictionary) {
+    vector<unsigned char> dict(4096);
+    FillPayload(PAYLOAD_TEXT, 1000, &dict[0], dict.size());
+    options.dictionary.assign(dict.begin(), dict.end());
+  }
+  Compressor tx("bench-tx", &pool, options);
+  Compressor rx("bench-rx", &pool, options);
+  vector<unsigned char> frame(frame_size);
+
+  StageClock stages;
+  int fill_stage = stages.AddStage("fill");
+  int compress_stage = stages.AddStage("compress");
+  int decompress_stage = stages.AddStage("decompress");
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "%s/%s%s/%uB",
+           codec == COMPRESS_LZ4 ? "lz4" : "deflate",
+           kind == PAYLOAD_TEXT ? "text" : "random",
+           dictionary ? "+dict" : "", frame_size);
+  result.name = name;
+  uint64_t wire_bytes = 0, compress_cycles = 0;
+  unsigned int seed = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+
+  while (now < end) {
+    uint64_t c0 = CycleCount();
+    Buffer* bufs[64];
+    for (unsigned int i = 0; i < burst; ++i) {
+      bufs[i] = pool.Get();
+      FillPayload(kind, seed++, bufs[i]->data(), frame_size);
+      bufs[i]->set_len(frame_size);
+    }
+    uint64_t c1 = CycleCount();
+    int n = tx.CompressBurst(bufs, burst);
+    uint64_t c2 = CycleCount();
+    for (int i = 0; i < n; ++i) {
+      wire_bytes += bufs[i]->len();
+      Buffer* b = rx.Decompress(bufs[i]);
+      CHECK(b && b->len() == frame_size);
+      b->Unref();
+    }
+    uint64_t c3 = CycleCount();
+    stages.Add(fill_stage, c1 - c0);
+    stages.Add(compress_stage, c2 - c1);
+    stages.Add(decompress_stage, c3 - c2);
+    compress_cycles += c2 - c1;
+    result.packets += n;
+    result.bytes += (uint64_t)n * frame_size;
+    now = MonotonicNs();
+  }
+
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+  result.AddExtra("ratio", (double)result.bytes / wire_bytes);
+  result.AddExtra("cycles/B", (double)compress_cycles / result.bytes);
+  return result;
+}
+
+BENCHMARK(Compression) {
+  unsigned int burst = options.burst < 64 ? options.burst : 64;
+  if (!burst)
+    burst = 1;
+  for (size_t i = 0; i < options.frame_sizes.size(); ++i) {
+    unsigned int size = options.frame_sizes[i];
+    if (size > kMaxFrameLen)
+      continue;
+    CompressionCodec codecs[] = {COMPRESS_LZ4, COMPRESS_DEFLATE};
+    for (int c = 0; c < 2; ++c) {
+      results->push_back(RunCompressBench(codecs[c], PAYLOAD_TEXT, false,
+                                          size, burst, options.duration_ms));
+      results->push_back(RunCompressBench(codecs[c], PAYLOAD_TEXT, true,
+                                          size, burst, options.duration_ms));
+      // Skipped by the entropy probe, the cost of trying is the probe.
+      results->push_back(RunCompressBench(codecs[c], PAYLOAD_RANDOM, false,
+                                          size, burst, options.duration_ms));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,187 @@
+#include "src/compress.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "src/frame_device.h"
+
+namespace bangnet {
+namespace {
+
+// Text like a log line or a json body, which compresses well.
+string TextPayload(unsigned int len, unsigned int seed) {
+  string s;
+  char line[128];
+  while (s.size() < len) {
+    snprintf(line, sizeof(line),
+             "{\"host\": \"node-%u\", \"status\": %u, \"path\": \"/api/v1/"
+             "items/%u\"}\n", seed % 17, 200 + seed % 3, seed * 7919 % 1000);
+    s += line;
+    ++seed;
+  }
+  s.resize(len);
+  return s;
+}
+
+// Like encrypted traffic.
+string RandomPayload(unsigned int len, uint32_t seed) {
+  string s(len, 0);
+  for (unsigned int i = 0; i < len; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    s[i] = (char)(seed >> 24);
+  }
+  return s;
+}
+
+// Compresses and decompresses data with LZ4, returns the compressed size.
+unsigned int Lz4RoundTrip(const string& data, const string& dict) {
+  const unsigned char* d = (const unsigned char*)dict.data();
+  Lz4Encoder encoder(d, dict.size());
+  vector<unsigned char> c(Lz4CompressBound(data.size()));
+  unsigned int n = encoder.Compress((const unsigned char*)data.data(),
+                                    data.size(), &c[0], c.size());
+  EXPECT_GT(n, 0u);
+  vector<unsigned char> out(data.size());
+  EXPECT_EQ(data.size(), Lz4Decompress(&c[0], n, d, dict.size(), &out[0],
+                                       out.size()));
+  EXPECT_EQ(0, memcmp(data.data(), &out[0], data.size()));
+  return n;
+}
+
+TEST(Lz4Test, RoundTrips) {
+  unsigned int sizes[] = {1, 12, 13, 64, 1500, 9000, 65535};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    EXPECT_LT(Lz4RoundTrip(TextPayload(sizes[i], i), ""),
+              Lz4CompressBound(sizes[i]));
+    Lz4RoundTrip(RandomPayload(sizes[i], i), "");
+  }
+  // Long runs, matches overlapping their own output.
+  EXPECT_LT(Lz4RoundTrip(string(5000, 'a'), ""), 50u);
+}
+
+TEST(Lz4Test, UsesDictionary) {
+  string dict = TextPayload(4096, 0);
+  string frame = TextPayload(200, 3);
+  unsigned int without = Lz4RoundTrip(frame, "");
+  unsigned int with = Lz4RoundTrip(frame, dict);
+  EXPECT_LT(with, without / 2);
+
+  // Matches running from the end of the dictionary into the frame.
+  Lz4RoundTrip(dict.substr(4000) + frame, dict);
+}
+
+TEST(Lz4Test, RejectsMalformed) {
+  string data = TextPayload(1000, 1);
+  Lz4Encoder encoder(0, 0);
+  vector<unsigned char> c(Lz4CompressBound(data.size()));
+  unsigned int n = encoder.Compress((const unsigned char*)data.data(),
+                                    data.size(), &c[0], c.size());
+  vector<unsigned char> out(data.size());
+  // Truncated, over capacity, and reaching before the output.
+  EXPECT_EQ(0u, Lz4Decompress(&c[0], n - 1, 0, 0, &out[0], out.size()));
+  EXPECT_EQ(0u, Lz4Decompress(&c[0], n, 0, 0, &out[0], out.size() - 1));
+  unsigned char bad[] = {0x10, 'a', 0x08, 0x00, 0x00};
+  EXPECT_EQ(0u, Lz4Decompress(bad, sizeof(bad), 0, 0, &out[0], out.size()));
+  // Not enough output room for the compressed form.
+  EXPECT_EQ(0u, encoder.Compress((const unsigned char*)data.data(),
+                                 data.size(), &c[0], 10));
+}
+
+TEST(EntropyTest, SeparatesTextFromRandom) {
+  string text = TextPayload(1500, 0);
+  string random = RandomPayload(1500, 0);
+  EXPECT_LT(EstimateEntropy((const unsigned char*)text.data(), text.size()),
+            6.0);
+  EXPECT_GT(EstimateEntropy((const unsigned char*)random.data(),
+                            random.size()), 7.0);
+  EXPECT_EQ(0.0, EstimateEntropy((const unsigned char*)"aaaa", 4));
+}
+
+class CompressorTest : public ::testing::TestWithParam<CompressionCodec> {
+protected:
+  CompressorTest() : pool_(kMaxFrameLen, 16) {}
+
+  Buffer* Frame(const string& data) {
+    Buffer* b = pool_.Get();
+    memcpy(b->data(), data.data(), data.size());
+    b->set_len(data.size());
+    return b;
+  }
+
+  BufferPool pool_;
+};
+
+TEST_P(CompressorTest, RoundTripsBursts) {
+  CompressionOptions options;
+  options.codec = GetParam();
+  options.dictionary = TextPayload(2048, 100);
+  Compressor tx("tx", &pool_, options), rx("rx", &pool_, options);
+
+  string payloads[] = {TextPayload(1500, 0), RandomPayload(1500, 1),
+                       TextPayload(64, 2), TextPayload(9000, 3)};
+  Buffer* frames[4];
+  for (int i = 0; i < 4; ++i)
+    frames[i] = Frame(payloads[i]);
+  ASSERT_EQ(4, tx.CompressBurst(frames, 4));
+
+  // Text shrinks, random and small frames only gain the header.
+  EXPECT_LT(frames[0]->len(), 750u);
+  EXPECT_EQ(1500 + kCompressionHeaderLen, frames[1]->len());
+  EXPECT_EQ(64 + kCompressionHeaderLen, frames[2]->len());
+  EXPECT_LT(frames[3]->len(), 4500u);
+
+  for (int i = 0; i < 4; ++i) {
+    Buffer* b = rx.Decompress(frames[i]);
+    ASSERT_TRUE(b != 0);
+    ASSERT_EQ(payloads[i].size(), b->len());
+    EXPECT_EQ(0, memcmp(payloads[i].data(), b->data(), b->len()));
+    b->Unref();
+  }
+  EXPECT_EQ(16u, pool_.available());
+}
+
+TEST_P(CompressorTest, DropsMalformed) {
+  CompressionOptions options;
+  options.codec = GetParam();
+  Compressor c("test", &pool_, options);
+
+  Buffer* b = Frame(TextPayload(1000, 0));
+  ASSERT_EQ(1, c.CompressBurst(&b, 1));
+  b->set_len(b->len() - 3);
+  EXPECT_TRUE(c.Decompress(b) == 0);
+
+  // Uncompressed frames must have their stated length.
+  EXPECT_TRUE(c.Decompress(Frame(string("\x00\x00\x00\x09short", 9))) == 0);
+  EXPECT_TRUE(c.Decompress(Frame("ab")) == 0);
+  EXPECT_EQ(16u, pool_.available());
+}
+
+TEST_P(CompressorTest, KeepsTinyFrames) {
+  CompressionOptions options;
+  options.codec = GetParam();
+  options.min_size = 0;
+  Compressor tx("tx", &pool_, options), rx("rx", &pool_, options);
+
+  // Nothing this small can shrink, it is sent as is.
+  string payloads[] = {"", "a", "ab"};
+  Buffer* frames[3];
+  for (int i = 0; i < 3; ++i)
+    frames[i] = Frame(payloads[i]);
+  ASSERT_EQ(3, tx.CompressBurst(frames, 3));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(payloads[i].size() + kCompressionHeaderLen, frames[i]->len());
+    Buffer* b = rx.Decompress(frames[i]);
+    ASSERT_TRUE(b != 0);
+    EXPECT_EQ(payloads[i].size(), b->len());
+    b->Unref();
+  }
+  EXPECT_EQ(16u, pool_.available());
+}
+
+INSTANTIATE_TEST_CASE_P(Codecs, CompressorTest,
+                        ::testing::Values(COMPRESS_LZ4, COMPRESS_DEFLATE));
+
+}  // namespace
+}  // namespace bangnet
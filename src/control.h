@@ -0,0 +1,20 @@
+#ifndef BANGNET_CONTROL_H_
+#define BANGNET_CONTROL_H_
+
+namespace bangnet {
+
+// Types of the control messages peers exchange over the underlay, the
+// first byte of each. They share one channel, so every kind of message
+// has its own value and a parser only accepts its own.
+enum ControlMessageType {
+  // Path mtu discovery, see pmtu.h.
+  PMTU_PROBE = 1,
+  PMTU_PROBE_ACK = 2,
+  // Path rtt and loss probes, see multipath.h.
+  PATH_PROBE = 3,
+  PATH_PROBE_ACK = 4
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_CONTROL_H_
@@ -0,0 +1,28 @@
+#include "src/cpu.h"
+
+namespace bangnet {
+
+bool CpuSupports(CpuFeature feature) {
+  // Needed when called before the constructors of libgcc ran.
+  __builtin_cpu_init();
+  switch (feature) {
+    case CPU_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case CPU_SSSE3:
+      return __builtin_cpu_supports("ssse3");
+    case CPU_AVX2:
+      return __builtin_cpu_supports("avx2");
+    default:
+      return true;
+  }
+}
+
+int BestCpuKernel(const CpuFeature* needs, int n) {
+  for (int k = n - 1; k > 0; --k) {
+    if (CpuSupports(needs[k]))
+      return k;
+  }
+  return 0;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,26 @@
+#ifndef BANGNET_CPU_H_
+#define BANGNET_CPU_H_
+
+namespace bangnet {
+
+// Instruction set extensions vector kernels are picked by at runtime.
+enum CpuFeature {
+  // What every x86-64 cpu has, for the plain kernels.
+  CPU_BASELINE,
+  CPU_SSE2,
+  CPU_SSSE3,
+  CPU_AVX2
+};
+
+// Returns true if the cpu supports feature. Safe to call from static
+// initializers.
+bool CpuSupports(CpuFeature feature);
+
+// Picks among n kernels numbered from the plain one, 0, to the fastest,
+// kernel k needing the feature needs[k]. Returns the fastest the cpu
+// supports.
+int BestCpuKernel(const CpuFeature* needs, int n);
+
+}  // namespace bangnet
+
+#endif  // BANGNET_CPU_H_
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "src/bench.h"
+#include "src/packet_device.h"
+#include "src/pktgen.h"
+#include "src/tap.h"
+#include "src/vhost_net.h"
+#include "src/xdp_device.h"
+
+namespace bangnet {
+namespace {
+
+// Read frames in place, releasing those of the previous call.
+int PeekPacket(FrameDevice* rx, FrameSlot* frames, int n) {
+  PacketDevice* dev = (PacketDevice*)rx;
+  dev->Release();
+  return dev->PeekBurst(frames, n);
+}
+
+int PeekXdp(FrameDevice* rx, FrameSlot* frames, int n) {
+  XdpDevice* dev = (XdpDevice*)rx;
+  dev->Release();
+  return dev->PeekBurst(frames, n);
+}
+
+bool Run(const string& command) {
+  return system((command + " 2>/dev/null").c_str()) == 0;
+}
+
+// Frame rates through the kernel between two ends, for each device
+// backend: taps on a bridge, the path of a bangnet tap, the same taps moved
+// by vhost-net where the host has it, and packet and xdp devices on a veth
+// pair, copying frames out or reading them in place.
+// Needs root.
+BENCHMARK(Devices) {
+  if (geteuid() != 0 || access("/dev/net/tun", R_OK | W_OK) != 0) {
+    printf("  skipped, needs root and /dev/net/tun\n");
+    return;
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "bnb%d", (int)getpid());
+  string a = string(name) + "a", b = string(name) + "b", br = name;
+  if (!PacketDevice::CreateVethPair(a, b)) {
+    printf("  skipped, unable to create veth pair\n");
+    return;
+  }
+
+  // The generator's destination is unknown to the bridge, which floods
+  // frames from one tap to the other.
+  const unsigned char bits_a[6] = {0x02, 0x62, 0x67, 0, 0, 0x0a};
+  const unsigned char bits_b[6] = {0x02, 0x62, 0x67, 0, 0, 0x0b};
+  Tap tap_a((MacAddress(bits_a)));
+  Tap tap_b((MacAddress(bits_b)));
+  bool bridged = Run("/sbin/ip link add " + br + " type bridge") &&
+                 Run("/sbin/ip link set " + tap_a.device_name() +
+                     " master " + br) &&
+                 Run("/sbin/ip link set " + tap_b.device_name() +
+                     " master " + br) &&
+                 Run("/sbin/ip link set " + br + " up");
+
+  for (size_t i = 0; i < options.frame_sizes.size(); ++i) {
+    PktgenOptions pktgen;
+    pktgen.frame_size = options.frame_sizes[i];
+    pktgen.flows = options.flows;
+    pktgen.burst = options.burst;
+    if (pktgen.frame_size > 1514)
+      continue;
+
+    double tap_mpps = 0;
+    if (bridged) {
+      snprintf(name, sizeof(name), "tap-bridge/%uB", pktgen.frame_size);
+      BenchResult r = RunStreamBench(name, &tap_a, &tap_b, NULL, pktgen,
+                                     options.duration_ms);
+      tap_mpps = r.Mpps();
+      results->push_back(r);
+    }
+    if (bridged && VhostNet::Available()) {
+      VhostNet tx(&tap_a, VhostNetOptions());
+      VhostNet rx(&tap_b, VhostNetOptions());
+      if (tx.IsOpen() && rx.IsOpen()) {
+        snprintf(name, sizeof(name), "tap-vhost-bridge/%uB",
+                 pktgen.frame_size);
+        BenchResult r = RunStreamBench(name, &tx, &rx, NULL, pktgen,
+                                       options.duration_ms);
+        if (tap_mpps > 0)
+          r.AddExtra("mpps-vs-tap", r.Mpps() / tap_mpps);
+        results->push_back(r);
+      }
+    }
+
+    // One backend on the veth pair at a time, an xdp program on it would
+    // take the frames of the packet devices.
+    vector<BenchResult> rows;
+    {
+      PacketDevice tx(a, PacketDeviceOptions());
+      PacketDevice rx(b, PacketDeviceOptions());
+      snprintf(name, sizeof(name), "packet/%uB", pktgen.frame_size);
+      rows.push_back(RunStreamBench(name, &tx, &rx, NULL, pktgen,
+                                    options.duration_ms));
+      snprintf(name, sizeof(name), "packet-peek/%uB", pktgen.frame_size);
+      rows.push_back(RunStreamBench(name, &tx, &rx, PeekPacket, pktgen,
+                                    options.duration_ms));
+    }
+    {
+      XdpDevice tx(a, XdpDeviceOptions());
+      XdpDevice rx(b, XdpDeviceOptions());
+      if (tx.IsOpen() && rx.IsOpen()) {
+        const char* mode = rx.native() ? "xdp" : "xdp-generic";
+        snprintf(name, sizeof(name), "%s/%uB", mode, pktgen.frame_size);
+        rows.push_back(RunStreamBench(name, &tx, &rx, NULL, pktgen,
+                                      options.duration_ms));
+        snprintf(name, sizeof(name), "%s-peek/%uB", mode, pktgen.frame_size);
+        rows.push_back(RunStreamBench(name, &tx, &rx, PeekXdp, pktgen,
+                                      options.duration_ms));
+      }
+    }
+    for (size_t j = 0; j < rows.size(); ++j) {
+      if (tap_mpps > 0)
+        rows[j].AddExtra("mpps-vs-tap", rows[j].Mpps() / tap_mpps);
+      results->push_back(rows[j]);
+    }
+  }
+
+  if (bridged)
+    Run("/sbin/ip link del " + br);
+  PacketDevice::DeleteVethPair(a);
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,610 @@
+#include <math.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <immintrin.h>
+
+#include "src/cpu.h"
+#include "src/fec.h"
+
+namespace bangnet {
+
+namespace {
+
+// Log and exp tables of GF(2^8), and the products of every constant with
+// the 16 low and 16 high nibbles, which the kernels look up.
+struct GfTables {
+  GfTables() {
+    unsigned int x = 1;
+    for (int i = 0; i < 255; ++i) {
+      exp[i] = exp[i + 255] = (uint8_t)x;
+      log[x] = (uint8_t)i;
+      x <<= 1;
+      if (x & 0x100)
+        x ^= 0x11d;
+    }
+    log[0] = 0;
+    for (int c = 0; c < 256; ++c) {
+      for (int n = 0; n < 16; ++n) {
+        nibbles[c][0][n] = Mul(c, n);
+        nibbles[c][1][n] = Mul(c, n << 4);
+      }
+    }
+  }
+
+  uint8_t Mul(unsigned int a, unsigned int b) const {
+    if (!a || !b)
+      return 0;
+    return exp[log[a] + log[b]];
+  }
+
+  uint8_t Inv(unsigned int a) const { return exp[255 - log[a]]; }
+
+  uint8_t exp[510];
+  uint8_t log[256];
+  uint8_t nibbles[256][2][16] __attribute__((aligned(16)));
+};
+
+const GfTables& Gf() {
+  static const GfTables tables;
+  return tables;
+}
+
+// The Cauchy matrix 1 / (x_j + y_i) with x_j = j and y_i = kMaxFecParity +
+// i, every column divided by its first row.
+struct CauchyMatrix {
+  CauchyMatrix() {
+    const GfTables& gf = Gf();
+    for (int i = 0; i < kMaxFecData; ++i) {
+      uint8_t first = gf.Inv(kMaxFecParity + i);
+      for (int j = 0; j < kMaxFecParity; ++j) {
+        uint8_t c = gf.Inv(j ^ (kMaxFecParity + i));
+        v[j][i] = gf.Mul(c, gf.Inv(first));
+      }
+    }
+  }
+
+  uint8_t v[kMaxFecParity][kMaxFecData];
+};
+
+void XorScalar(unsigned char* dst, const unsigned char* src, unsigned int n) {
+  unsigned int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t a, b;
+    memcpy(&a, dst + i, 8);
+    memcpy(&b, src + i, 8);
+    a ^= b;
+    memcpy(dst + i, &a, 8);
+  }
+  for (; i < n; ++i)
+    dst[i] ^= src[i];
+}
+
+void MulAddScalar(unsigned char* dst, const unsigned char* src, uint8_t c,
+                  unsigned int n) {
+  const uint8_t* lo = Gf().nibbles[c][0];
+  const uint8_t* hi = Gf().nibbles[c][1];
+  for (unsigned int i = 0; i < n; ++i)
+    dst[i] ^= lo[src[i] & 15] ^ hi[src[i] >> 4];
+}
+
+__attribute__((target("ssse3")))
+void MulAddSsse3(unsigned char* dst, const unsigned char* src, uint8_t c,
+                 unsigned int n) {
+  __m128i lo = _mm_load_si128((const __m128i*)Gf().nibbles[c][0]);
+  __m128i hi = _mm_load_si128((const __m128i*)Gf().nibbles[c][1]);
+  __m128i mask = _mm_set1_epi8(0x0f);
+  unsigned int i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i l = _mm_and_si128(s, mask);
+    __m128i h = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+    __m128i p = _mm_xor_si128(_mm_shuffle_epi8(lo, l),
+                              _mm_shuffle_epi8(hi, h));
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+    _mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(d, p));
+  }
+  MulAddScalar(dst + i, src + i, c, n - i);
+}
+
+__attribute__((target("avx2")))
+void MulAddAvx2(unsigned char* dst, const unsigned char* src, uint8_t c,
+                unsigned int n) {
+  __m256i lo = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i*)Gf().nibbles[c][0]));
+  __m256i hi = _mm256_broadcastsi128_si256(
+      _mm_load_si128((const __m128i*)Gf().nibbles[c][1]));
+  __m256i mask = _mm256_set1_epi8(0x0f);
+  unsigned int i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)(src + i));
+    __m256i l = _mm256_and_si256(s, mask);
+    __m256i h = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+    __m256i p = _mm256_xor_si256(_mm256_shuffle_epi8(lo, l),
+                                 _mm256_shuffle_epi8(hi, h));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst + i));
+    _mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(d, p));
+  }
+  MulAddScalar(dst + i, src + i, c, n - i);
+}
+
+typedef void (*MulAddFunction)(unsigned char*, const unsigned char*, uint8_t,
+                               unsigned int);
+
+// Indexed by GfKernel, the feature each kernel needs and its function.
+const CpuFeature kKernelNeeds[] = {CPU_BASELINE, CPU_SSSE3, CPU_AVX2};
+const MulAddFunction kKernels[] = {MulAddScalar, MulAddSsse3,
+                                   MulAddAvx2};
+const int kKernelCount = sizeof(kKernels) / sizeof(kKernels[0]);
+
+GfKernel active_kernel =
+    (GfKernel)BestCpuKernel(kKernelNeeds, kKernelCount);
+MulAddFunction mul_add = kKernels[active_kernel];
+
+// Probability of more than m of n packets lost, each with probability p.
+double LossTail(int n, int m, double p) {
+  double ok = 0;
+  double choose = 1;
+  for (int i = 0; i <= m && i <= n; ++i) {
+    ok += choose * pow(p, i) * pow(1 - p, n - i);
+    choose = choose * (n - i) / (i + 1);
+  }
+  return ok < 1 ? 1 - ok : 0;
+}
+
+}  // namespace
+
+uint8_t GfMul(uint8_t a, uint8_t b) {
+  return Gf().Mul(a, b);
+}
+
+uint8_t GfInv(uint8_t a) {
+  return a ? Gf().Inv(a) : 0;
+}
+
+void GfMulAdd(unsigned char* dst, const unsigned char* src, uint8_t c,
+              unsigned int n) {
+  if (c == 0)
+    return;
+  if (c == 1)
+    XorScalar(dst, src, n);
+  else
+    mul_add(dst, src, c, n);
+}
+
+GfKernel gf_kernel() {
+  return active_kernel;
+}
+
+bool SetGfKernel(GfKernel kernel) {
+  if ((unsigned int)kernel >= (unsigned int)kKernelCount ||
+      !CpuSupports(kKernelNeeds[kernel]))
+    return false;
+  active_kernel = kernel;
+  mul_add = kKernels[kernel];
+  return true;
+}
+
+uint8_t FecCoefficient(int j, int i) {
+  static const CauchyMatrix matrix;
+  return matrix.v[j][i];
+}
+
+void ChooseFecParams(double loss, const FecOptions& options, int* k, int* m) {
+  *k = options.max_k;
+  *m = 0;
+  if (LossTail(*k, 0, loss) <= options.target_loss)
+    return;
+  // For each m the largest k which makes it is the cheapest.
+  double best = 0;
+  for (int mm = 1; mm <= options.max_m; ++mm) {
+    for (int kk = options.max_k; kk >= 1; --kk) {
+      double overhead = (double)mm / kk;
+      if (best && overhead >= best)
+        break;
+      if (LossTail(kk + mm, mm, loss) <= options.target_loss) {
+        best = overhead;
+        *k = kk;
+        *m = mm;
+        break;
+      }
+    }
+  }
+  if (!best) {
+    // Out of reach, protect as much as allowed.
+    *k = 1;
+    *m = options.max_m;
+  }
+}
+
+FecEncoder::FecEncoder(const string& name, BufferPool* pool,
+                       const FecOptions& options)
+    : name_(name), pool_(pool), options_(options), k_(options.k),
+      m_(options.m), next_k_(options.k), next_m_(options.m), group_(0),
+      count_(0), parity_len_(0), deadline_(0) {
+  memset(parity_, 0, sizeof(parity_));
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.frames = r->NewCounter("bangnet_fec_frames_total",
+      "Frames sent with FEC.", labels);
+  metrics_.parity = r->NewCounter("bangnet_fec_parity_total",
+      "Parity packets sent.", labels);
+  metrics_.drops = r->NewCounter("bangnet_fec_encode_drops_total",
+      "Frames without room for the header, or groups without parity for "
+      "lack of buffers.", labels);
+  metrics_.k = r->NewGauge("bangnet_fec_k", "Frames per FEC group.", labels);
+  metrics_.m = r->NewGauge("bangnet_fec_m", "Parity packets per FEC group.",
+                           labels);
+  metrics_.k->Set(k_);
+  metrics_.m->Set(m_);
+}
+
+FecEncoder::~FecEncoder() {
+  for (int j = 0; j < kMaxFecParity; ++j) {
+    if (parity_[j])
+      parity_[j]->Unref();
+  }
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+int FecEncoder::Encode(Buffer* frame, uint64_t now_ns, Buffer** out) {
+  unsigned int len = frame->len();
+  if (frame->headroom() < kFecHeaderLen || len + 2 > pool_->buffer_size()) {
+    metrics_.drops->Increment();
+    frame->Unref();
+    return -1;
+  }
+
+  if (count_ == 0) {
+    k_ = next_k_;
+    m_ = next_m_;
+    metrics_.k->Set(k_);
+    metrics_.m->Set(m_);
+    for (int j = 0; j < m_; ++j) {
+      parity_[j] = pool_->Get();
+      if (!parity_[j]) {
+        // The group goes without parity.
+        metrics_.drops->Increment();
+        for (int i = 0; i < j; ++i) {
+          parity_[i]->Unref();
+          parity_[i] = 0;
+        }
+        m_ = 0;
+        break;
+      }
+    }
+    parity_len_ = 0;
+    deadline_ = now_ns + options_.group_timeout_ns;
+  }
+
+  // Symbols are the frame behind its length, padded with zeros.
+  unsigned int sym_len = len + 2;
+  if (sym_len > parity_len_) {
+    for (int j = 0; j < m_; ++j)
+      memset(parity_[j]->data() + parity_len_, 0, sym_len - parity_len_);
+    parity_len_ = sym_len;
+  }
+  unsigned char prefix[2] = {(unsigned char)(len >> 8), (unsigned char)len};
+  for (int j = 0; j < m_; ++j) {
+    uint8_t c = FecCoefficient(j, count_);
+    GfMulAdd(parity_[j]->data(), prefix, c, 2);
+    GfMulAdd(parity_[j]->data() + 2, frame->data(), c, len);
+  }
+
+  FecHeader h;
+  h.group = htonl(group_);
+  h.index = (uint8_t)count_;
+  h.k = (uint8_t)k_;
+  h.m = (uint8_t)m_;
+  h.flags = 0;
+  memcpy(frame->Push(kFecHeaderLen), &h, kFecHeaderLen);
+  metrics_.frames->Increment();
+  if (++count_ < k_)
+    return 0;
+  return CloseGroup(out);
+}
+
+int FecEncoder::Poll(uint64_t now_ns, Buffer** out) {
+  if (!count_ || now_ns < deadline_)
+    return 0;
+  return CloseGroup(out);
+}
+
+int FecEncoder::CloseGroup(Buffer** out) {
+  for (int j = 0; j < m_; ++j) {
+    Buffer* b = parity_[j];
+    parity_[j] = 0;
+    b->set_len(parity_len_);
+    FecHeader h;
+    h.group = htonl(group_);
+    h.index = (uint8_t)(count_ + j);
+    h.k = (uint8_t)count_;
+    h.m = (uint8_t)m_;
+    h.flags = FEC_PARITY;
+    memcpy(b->Push(kFecHeaderLen), &h, kFecHeaderLen);
+    out[j] = b;
+  }
+  metrics_.parity->Add(m_);
+  ++group_;
+  count_ = 0;
+  return m_;
+}
+
+void FecEncoder::OnPeerLoss(double loss) {
+  if (!options_.adaptive)
+    return;
+  int k, m;
+  ChooseFecParams(loss, options_, &k, &m);
+  if (k != next_k_ || m != next_m_) {
+    LOG(INFO) << name_ << ": loss " << loss << ", fec " << next_k_ << "+"
+              << next_m_ << " -> " << k << "+" << m;
+    next_k_ = k;
+    next_m_ = m;
+  }
+}
+
+FecDecoder::FecDecoder(const string& name, BufferPool* pool,
+                       unsigned int groups, uint64_t timeout_ns)
+    : name_(name), pool_(pool), timeout_ns_(timeout_ns), loss_(0) {
+  Group empty;
+  memset(&empty, 0, sizeof(empty));
+  groups_.assign(groups ? groups : 1, empty);
+
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.frames = r->NewCounter("bangnet_fec_received_total",
+      "Frames received with FEC.", labels);
+  metrics_.recovered = r->NewCounter("bangnet_fec_recovered_total",
+      "Lost frames rebuilt from parity.", labels);
+  metrics_.lost = r->NewCounter("bangnet_fec_lost_total",
+      "Frames lost for good, with too few packets of their group.", labels);
+  metrics_.errors = r->NewCounter("bangnet_fec_errors_total",
+      "Malformed or duplicate packets.", labels);
+  metrics_.surplus = r->NewCounter("bangnet_fec_surplus_total",
+      "Parity packets which arrived after every frame of their group.",
+      labels);
+  metrics_.loss = r->NewGauge("bangnet_fec_loss_ppm",
+      "Moving average of frames lost before recovery, per million.", labels);
+}
+
+FecDecoder::~FecDecoder() {
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    if (groups_[i].used && !groups_[i].done)
+      Finish(&groups_[i]);
+  }
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+void FecDecoder::Finish(Group* g) {
+  if (!g->k) {
+    memset(g, 0, sizeof(*g));
+    return;
+  }
+  uint64_t mask = g->k == 64 ? ~0ull : (1ull << g->k) - 1;
+  int received = __builtin_popcountll(g->received & mask);
+  int delivered = __builtin_popcountll(g->delivered & mask);
+  metrics_.lost->Add(g->k - delivered);
+  loss_ += ((double)(g->k - received) / g->k - loss_) / 16;
+  metrics_.loss->Set((int64_t)(loss_ * 1e6));
+
+  for (int i = 0; i < kMaxFecData; ++i) {
+    if (g->data[i].buffer)
+      g->data[i].buffer->Unref();
+  }
+  for (int j = 0; j < kMaxFecParity; ++j) {
+    if (g->parity[j].buffer)
+      g->parity[j].buffer->Unref();
+  }
+  uint32_t id = g->id;
+  memset(g, 0, sizeof(*g));
+  g->id = id;
+  g->used = true;
+  g->done = true;
+}
+
+FecDecoder::Group* FecDecoder::Lookup(uint32_t id, uint64_t now_ns) {
+  Group* g = &groups_[id % groups_.size()];
+  if (g->used && g->id == id)
+    return g;
+  // Packets of groups older than the one in the slot are late.
+  if (g->used && (int32_t)(id - g->id) < 0)
+    return 0;
+  if (g->used && !g->done)
+    Finish(g);
+  memset(g, 0, sizeof(*g));
+  g->id = id;
+  g->used = true;
+  g->deadline = now_ns + timeout_ns_;
+  return g;
+}
+
+void FecDecoder::Expire(uint64_t now_ns) {
+  for (size_t i = 0; i < groups_.size(); ++i) {
+    Group* g = &groups_[i];
+    if (g->used && !g->done && g->deadline <= now_ns)
+      Finish(g);
+  }
+}
+
+int FecDecoder::Decode(Buffer* packet, uint64_t now_ns, Buffer** out) {
+  FecHeader h;
+  if (packet->len() < kFecHeaderLen) {
+    metrics_.errors->Increment();
+    packet->Unref();
+    return 0;
+  }
+  memcpy(&h, packet->data(), kFecHeaderLen);
+  bool parity = h.flags & FEC_PARITY;
+  int index = parity ? h.index - h.k : h.index;
+  if (h.k == 0 || h.k > kMaxFecData || h.m > kMaxFecParity || index < 0 ||
+      index >= (parity ? h.m : h.k)) {
+    metrics_.errors->Increment();
+    packet->Unref();
+    return 0;
+  }
+
+  Group* g = Lookup(ntohl(h.group), now_ns);
+  if (g && g->done && parity) {
+    // Parity the group did not need, every frame already got through.
+    metrics_.surplus->Increment();
+    packet->Unref();
+    return 0;
+  }
+  Symbol* s = g ? (parity ? &g->parity[index] : &g->data[index]) : 0;
+  if (!g || g->done || s->buffer || (g->closed && !parity && index >= g->k) ||
+      (parity && g->closed && g->k != h.k)) {
+    // Late, duplicate or inconsistent.
+    metrics_.errors->Increment();
+    packet->Unref();
+    return 0;
+  }
+
+  packet->Pull(kFecHeaderLen);
+  s->buffer = packet;
+  s->data = packet->data();
+  s->len = packet->len();
+  int n = 0;
+  if (parity) {
+    g->k = h.k;
+    g->closed = true;
+    ++g->nparity;
+  } else {
+    if (!g->closed && h.k > g->k)
+      g->k = h.k;
+    g->received |= 1ull << index;
+    g->delivered |= 1ull << index;
+    ++g->ndata;
+    // The group keeps a reference to rebuild others with.
+    packet->Ref();
+    out[n++] = packet;
+    metrics_.frames->Increment();
+  }
+
+  n += Recover(g, out + n);
+  uint64_t mask = g->k == 64 ? ~0ull : (1ull << g->k) - 1;
+  if (g->closed && (g->delivered & mask) == mask)
+    Finish(g);
+  return n;
+}
+
+int FecDecoder::Recover(Group* g, Buffer** out) {
+  if (!g->closed)
+    return 0;
+  int lost[kMaxFecParity];
+  int nlost = 0;
+  for (int i = 0; i < g->k; ++i) {
+    if (g->delivered & (1ull << i))
+      continue;
+    if (nlost == kMaxFecParity)
+      return 0;
+    lost[nlost++] = i;
+  }
+  if (!nlost || nlost > g->nparity)
+    return 0;
+
+  int rows[kMaxFecParity];
+  int nrows = 0;
+  unsigned int len = 0;
+  for (int j = 0; j < kMaxFecParity && nrows < nlost; ++j) {
+    if (!g->parity[j].buffer)
+      continue;
+    if (len && g->parity[j].len != len)
+      return 0;
+    len = g->parity[j].len;
+    rows[nrows++] = j;
+  }
+  if (len < 2)
+    return 0;
+
+  // Takes the frames received out of the parity, which leaves the lost
+  // ones times their coefficients.
+  if (scratch_.size() < nlost * len)
+    scratch_.resize(nlost * len);
+  for (int r = 0; r < nrows; ++r) {
+    unsigned char* s = &scratch_[r * len];
+    memcpy(s, g->parity[rows[r]].data, len);
+    for (int i = 0; i < g->k; ++i) {
+      const Symbol& d = g->data[i];
+      if (!d.buffer)
+        continue;
+      if (d.len + 2 > len) {
+        metrics_.errors->Increment();
+        return 0;
+      }
+      uint8_t c = FecCoefficient(rows[r], i);
+      unsigned char prefix[2] = {(unsigned char)(d.len >> 8),
+                                 (unsigned char)d.len};
+      GfMulAdd(s, prefix, c, 2);
+      GfMulAdd(s + 2, d.data, c, d.len);
+    }
+  }
+
+  // Inverts the coefficients of the lost frames, Gauss-Jordan.
+  uint8_t a[kMaxFecParity][kMaxFecParity];
+  uint8_t inv[kMaxFecParity][kMaxFecParity];
+  memset(inv, 0, sizeof(inv));
+  for (int r = 0; r < nlost; ++r) {
+    for (int c = 0; c < nlost; ++c)
+      a[r][c] = FecCoefficient(rows[r], lost[c]);
+    inv[r][r] = 1;
+  }
+  for (int c = 0; c < nlost; ++c) {
+    int p = c;
+    while (p < nlost && !a[p][c])
+      ++p;
+    if (p == nlost)
+      return 0;
+    if (p != c) {
+      for (int k = 0; k < nlost; ++k) {
+        uint8_t t = a[c][k];
+        a[c][k] = a[p][k];
+        a[p][k] = t;
+        t = inv[c][k];
+        inv[c][k] = inv[p][k];
+        inv[p][k] = t;
+      }
+    }
+    uint8_t f = GfInv(a[c][c]);
+    for (int k = 0; k < nlost; ++k) {
+      a[c][k] = GfMul(a[c][k], f);
+      inv[c][k] = GfMul(inv[c][k], f);
+    }
+    for (int r = 0; r < nlost; ++r) {
+      uint8_t e = a[r][c];
+      if (r == c || !e)
+        continue;
+      for (int k = 0; k < nlost; ++k) {
+        a[r][k] ^= GfMul(e, a[c][k]);
+        inv[r][k] ^= GfMul(e, inv[c][k]);
+      }
+    }
+  }
+
+  int n = 0;
+  for (int c = 0; c < nlost; ++c) {
+    Buffer* b = pool_->Get();
+    if (!b || b->capacity() < len) {
+      metrics_.errors->Increment();
+      if (b)
+        b->Unref();
+      continue;
+    }
+    unsigned char* d = b->data();
+    memset(d, 0, len);
+    for (int r = 0; r < nlost; ++r)
+      GfMulAdd(d, &scratch_[r * len], inv[c][r], len);
+    unsigned int flen = (d[0] << 8) | d[1];
+    if (flen + 2 > len) {
+      metrics_.errors->Increment();
+      b->Unref();
+      continue;
+    }
+    b->Pull(2);
+    b->set_len(flen);
+    g->delivered |= 1ull << lost[c];
+    out[n++] = b;
+  }
+  metrics_.recovered->Add(n);
+  return n;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,237 @@
+#ifndef BANGNET_FEC_H_
+#define BANGNET_FEC_H_
+
+#include <stdint.h>
+
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+// Forward error correction of frames sent to a peer over a lossy underlay.
+// Frames are grouped k at a time and every group is followed by m parity
+// packets, so the receiver rebuilds up to m lost frames of the group as
+// soon as enough packets arrived, instead of the tunnelled flows waiting an
+// end to end round trip for retransmissions.
+//
+// The code is a systematic Reed-Solomon code over GF(2^8) with a Cauchy
+// parity matrix, normalized so its first row is all ones: with m = 1 the
+// parity is a plain XOR of the frames.
+
+// Max frames and parity packets of a group.
+const int kMaxFecData = 64;
+const int kMaxFecParity = 16;
+
+// Multiplication in GF(2^8), polynomial 0x11d.
+uint8_t GfMul(uint8_t a, uint8_t b);
+uint8_t GfInv(uint8_t a);
+
+// dst[i] ^= c * src[i] over n bytes, the kernel of encoding and decoding.
+void GfMulAdd(unsigned char* dst, const unsigned char* src, uint8_t c,
+              unsigned int n);
+
+// Implementations of GfMulAdd(). The SIMD ones look up the products of the
+// low and high nibbles of 16 or 32 bytes at once with byte shuffles.
+enum GfKernel {
+  GF_KERNEL_SCALAR,
+  GF_KERNEL_SSSE3,
+  GF_KERNEL_AVX2
+};
+
+// The kernel in use, the fastest the cpu supports unless set.
+GfKernel gf_kernel();
+
+// Returns false if the cpu does not support kernel.
+bool SetGfKernel(GfKernel kernel);
+
+// Coefficient of data frame i in parity packet j.
+uint8_t FecCoefficient(int j, int i);
+
+// Starts every packet of a group, in network byte order. Data packets are
+// the frame behind it, parity packets hold the parity of the group's
+// frames, each prefixed with its 16 bit length and zero padded to the
+// longest.
+struct FecHeader {
+  uint32_t group;
+  // Frame number in the group, or k plus the parity number.
+  uint8_t index;
+  // Frames in the group. Data packets carry the configured size, parity
+  // packets the actual one, which is smaller for groups closed early.
+  uint8_t k;
+  uint8_t m;
+  uint8_t flags;
+} __attribute__((packed));
+
+const unsigned int kFecHeaderLen = sizeof(FecHeader);
+
+enum FecFlags {
+  FEC_PARITY = 1
+};
+
+struct FecOptions {
+  FecOptions()
+      : k(10), m(2), max_k(32), max_m(8), adaptive(true),
+        target_loss(0.001), group_timeout_ns(2000000) {}
+
+  // Group size and parity packets per group, m may be 0 to only number
+  // frames. Starting values when adaptive.
+  int k;
+  int m;
+
+  // Bounds of the adaptive choice. Larger groups cost less parity for the
+  // same protection, but frames lost early in a group wait longer for it.
+  int max_k;
+  int max_m;
+
+  // Whether k and m follow the loss the peer reports.
+  bool adaptive;
+
+  // Frame loss left after recovery the adaptive choice aims below.
+  double target_loss;
+
+  // A group not filled in this time is closed with the frames it has, so
+  // parity does not wait for traffic which may not come.
+  uint64_t group_timeout_ns;
+};
+
+// Picks the group size and parity count with the least overhead m / k
+// which keeps the chance of more than m losses in a group under
+// options.target_loss, for packets lost independently with probability
+// loss.
+void ChooseFecParams(double loss, const FecOptions& options, int* k, int* m);
+
+// Adds FEC to the frames sent to one peer. Parity is accumulated as frames
+// pass, so frames go out without delay and are not held. Not thread safe.
+class FecEncoder {
+public:
+  // Parity packets are built in buffers of pool, which must hold the
+  // largest frame plus 2 bytes and have headroom for the header.
+  FecEncoder(const string& name, BufferPool* pool, const FecOptions& options);
+  ~FecEncoder();
+
+  int k() const { return k_; }
+  int m() const { return m_; }
+
+  // Prepends the header to a frame in its headroom, it is sent next as is.
+  // Returns the parity packets of the group if the frame completed it, in
+  // out, which must have room for kMaxFecParity packets. Frames without headroom
+  // or too long are dropped and -1 is returned.
+  int Encode(Buffer* frame, uint64_t now_ns, Buffer** out);
+
+  // Closes a group past its timeout, returns its parity packets like
+  // Encode().
+  int Poll(uint64_t now_ns, Buffer** out);
+
+  // Adapts k and m to the loss rate the peer measured, from the next group.
+  void OnPeerLoss(double loss);
+
+private:
+  int CloseGroup(Buffer** out);
+
+  string name_;
+  BufferPool* pool_;
+  FecOptions options_;
+  // Sizes of the open group, and of the next one.
+  int k_;
+  int m_;
+  int next_k_;
+  int next_m_;
+  uint32_t group_;
+  // Frames in the open group, the parity built so far and the length of
+  // its longest symbol.
+  int count_;
+  Buffer* parity_[kMaxFecParity];
+  unsigned int parity_len_;
+  uint64_t deadline_;
+
+  struct Metrics {
+    Counter* frames;
+    Counter* parity;
+    Counter* drops;
+    Gauge* k;
+    Gauge* m;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(FecEncoder);
+};
+
+// Receives the packets of a peer's FecEncoder. Frames are returned as they
+// arrive, and lost ones as soon as enough packets of their group did.
+// Not thread safe.
+class FecDecoder {
+public:
+  // groups bounds the groups waiting for packets at once. Rebuilt frames
+  // are written to buffers of pool.
+  FecDecoder(const string& name, BufferPool* pool, unsigned int groups,
+             uint64_t timeout_ns);
+  ~FecDecoder();
+
+  // Takes a received packet and the caller's reference. Fills out with the
+  // frames it yields, with a reference each, and returns their count: the
+  // frame itself, frames it let rebuild, or none. out must have room for
+  // kMaxFecData frames.
+  //
+  // Frames are kept referenced until their group is done, so they must not
+  // be written to.
+  int Decode(Buffer* packet, uint64_t now_ns, Buffer** out);
+
+  // Drops groups which can no longer complete.
+  void Expire(uint64_t now_ns);
+
+  // Moving average of the fraction of frames lost before recovery, what
+  // the peer's encoder adapts to.
+  double loss() const { return loss_; }
+
+private:
+  struct Symbol {
+    Buffer* buffer;
+    // The frame or parity, without the header.
+    const unsigned char* data;
+    unsigned int len;
+  };
+
+  struct Group {
+    uint32_t id;
+    bool used;
+    // Every frame was delivered, later packets are duplicates.
+    bool done;
+    int k;
+    // Whether k is the actual size, known once parity arrived.
+    bool closed;
+    uint64_t received;
+    uint64_t delivered;
+    int ndata;
+    int nparity;
+    Symbol data[kMaxFecData];
+    Symbol parity[kMaxFecParity];
+    uint64_t deadline;
+  };
+
+  Group* Lookup(uint32_t id, uint64_t now_ns);
+  // Accounts the frames of a group lost for good and drops its packets.
+  void Finish(Group* g);
+  int Recover(Group* g, Buffer** out);
+
+  string name_;
+  BufferPool* pool_;
+  uint64_t timeout_ns_;
+  vector<Group> groups_;
+  vector<unsigned char> scratch_;
+  double loss_;
+
+  struct Metrics {
+    Counter* frames;
+    Counter* recovered;
+    Counter* lost;
+    Counter* errors;
+    Counter* surplus;
+    Gauge* loss;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(FecDecoder);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_FEC_H_
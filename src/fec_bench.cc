@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/fec.h"
+
+namespace bangnet {
+namespace {
+
+// GfMulAdd() over a frame sized region with each kernel.
+BenchResult RunKernelBench(GfKernel kernel, unsigned int size,
+                           uint64_t duration_ms) {
+  static const char* kNames[] = {"scalar", "ssse3", "avx2"};
+  vector<unsigned char> src(size), dst(size);
+  for (unsigned int i = 0; i < size; ++i)
+    src[i] = (unsigned char)(i * 7);
+  GfKernel saved = gf_kernel();
+  SetGfKernel(kernel);
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "gf-muladd/%s/%uB", kNames[kernel], size);
+  result.name = name;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  uint8_t c = 2;
+  while (now < end) {
+    for (int i = 0; i < 1024; ++i) {
+      GfMulAdd(&dst[0], &src[0], c, size);
+      c = c == 255 ? 2 : c + 1;
+    }
+    result.packets += 1024;
+    result.bytes += 1024ull * size;
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  SetGfKernel(saved);
+  return result;
+}
+
+// Sends groups of k frames through an encoder and a decoder, losing each
+// packet with probability loss, or exactly the first lost_per_group frames
+// of each group if loss is 0. Reports the rate of frames offered, the
+// encode and decode cost, and the share of frames and of wire bytes which
+// made it as frames.
+BenchResult RunFecBench(int k, int m, double loss, int lost_per_group,
+                        unsigned int frame_size, uint64_t duration_ms) {
+  BufferPool pool(frame_size + 2, 4 * (k + m) + 8);
+  FecOptions options;
+  options.k = k;
+  options.m = m;
+  options.adaptive = false;
+  FecEncoder encoder("bench-enc", &pool, options);
+  FecDecoder decoder("bench-dec", &pool, 64, 1000000000ull);
+
+  StageClock stages;
+  int encode_stage = stages.AddStage("encode");
+  int decode_stage = stages.AddStage("decode");
+
+  BenchResult result;
+  char name[64];
+  if (loss > 0)
+    snprintf(name, sizeof(name), "fec/%d+%d/loss%.1f%%/%uB", k, m,
+             loss * 100, frame_size);
+  else
+    snprintf(name, sizeof(name), "fec/%d+%d/%dlost/%uB", k, m,
+             lost_per_group, frame_size);
+  result.name = name;
+  uint64_t offered = 0, delivered = 0, wire_bytes = 0;
+  uint32_t rng = 12345;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+
+  while (now < end) {
+    Buffer* packets[kMaxFecData + kMaxFecParity];
+    int npackets = 0;
+    uint64_t c0 = CycleCount();
+    for (int i = 0; i < k; ++i) {
+      Buffer* b = pool.Get();
+      memset(b->data(), i, frame_size);
+      b->set_len(frame_size);
+      if (encoder.Encode(b, 0, packets + npackets + 1) < 0)
+        LOG(FATAL) << "encode failed";
+      // The frame goes out before its group's parity.
+      packets[npackets] = b;
+      npackets += i == k - 1 ? 1 + m : 1;
+    }
+    uint64_t c1 = CycleCount();
+
+    uint64_t decode_cycles = 0;
+    for (int p = 0; p < npackets; ++p) {
+      bool lost;
+      if (loss > 0) {
+        rng = rng * 1103515245u + 12345u;
+        lost = (rng >> 8) < loss * (1 << 24);
+      } else {
+        lost = p < lost_per_group;
+      }
+      wire_bytes += packets[p]->len();
+      if (lost) {
+        packets[p]->Unref();
+        continue;
+      }
+      Buffer* out[kMaxFecData];
+      uint64_t d0 = CycleCount();
+      int n = decoder.Decode(packets[p], 0, out);
+      decode_cycles += CycleCount() - d0;
+      for (int i = 0; i < n; ++i)
+        out[i]->Unref();
+      delivered += n;
+    }
+    decoder.Expire(2000000000ull);
+    stages.Add(encode_stage, c1 - c0);
+    stages.Add(decode_stage, decode_cycles);
+    offered += k;
+    result.packets += k;
+    result.bytes += (uint64_t)k * frame_size;
+    now = MonotonicNs();
+  }
+
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+  result.AddExtra("delivered%", 100.0 * delivered / offered);
+  result.AddExtra("goodput%", 100.0 * delivered * frame_size / wire_bytes);
+  return result;
+}
+
+BENCHMARK(Fec) {
+  GfKernel kernels[] = {GF_KERNEL_SCALAR, GF_KERNEL_SSSE3, GF_KERNEL_AVX2};
+  for (int i = 0; i < 3; ++i) {
+    GfKernel saved = gf_kernel();
+    if (!SetGfKernel(kernels[i]))
+      continue;
+    SetGfKernel(saved);
+    results->push_back(RunKernelBench(kernels[i], 1500, options.duration_ms));
+  }
+
+  for (size_t i = 0; i < options.frame_sizes.size(); ++i) {
+    unsigned int size = options.frame_sizes[i];
+    if (size > 9014)
+      continue;
+    // Encode and decode throughput, without and with recovery.
+    results->push_back(RunFecBench(10, 2, 0, 0, size, options.duration_ms));
+    results->push_back(RunFecBench(10, 2, 0, 2, size, options.duration_ms));
+    // Goodput under random loss with what the adaptive choice picks.
+    double losses[] = {0.01, 0.05};
+    for (int l = 0; l < 2; ++l) {
+      FecOptions fec;
+      int k, m;
+      ChooseFecParams(losses[l], fec, &k, &m);
+      results->push_back(RunFecBench(k, 0, losses[l], 0, size,
+                                     options.duration_ms));
+      results->push_back(RunFecBench(k, m, losses[l], 0, size,
+                                     options.duration_ms));
+    }
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,236 @@
+#include "src/fec.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+TEST(GfTest, Arithmetic) {
+  for (int a = 1; a < 256; ++a) {
+    EXPECT_EQ(1, GfMul(a, GfInv(a)));
+    EXPECT_EQ(a, GfMul(a, 1));
+    EXPECT_EQ(0, GfMul(a, 0));
+  }
+  // x * x^7 wraps around the polynomial.
+  EXPECT_EQ(0x1d, GfMul(0x02, 0x80));
+  for (int i = 0; i < kMaxFecData; ++i)
+    EXPECT_EQ(1, FecCoefficient(0, i));
+}
+
+TEST(GfTest, KernelsAgree) {
+  unsigned char src[1000], ref[1000], dst[1000];
+  for (int i = 0; i < 1000; ++i)
+    src[i] = (unsigned char)(i * 131 + 7);
+  GfKernel saved = gf_kernel();
+  GfKernel kernels[] = {GF_KERNEL_SCALAR, GF_KERNEL_SSSE3, GF_KERNEL_AVX2};
+  for (int c = 2; c < 256; c += 37) {
+    for (int i = 0; i < 1000; ++i)
+      ref[i] = (unsigned char)i ^ GfMul(c, src[i]);
+    for (int k = 0; k < 3; ++k) {
+      if (!SetGfKernel(kernels[k]))
+        continue;
+      for (int i = 0; i < 1000; ++i)
+        dst[i] = (unsigned char)i;
+      // Odd length, so the tail is handled too.
+      GfMulAdd(dst, src, c, 999);
+      EXPECT_EQ(0, memcmp(ref, dst, 999)) << "kernel " << k << " c " << c;
+      EXPECT_EQ((unsigned char)999, dst[999]);
+    }
+  }
+  SetGfKernel(saved);
+}
+
+TEST(FecParamsTest, FollowsLoss) {
+  FecOptions options;
+  int k, m;
+  ChooseFecParams(0, options, &k, &m);
+  EXPECT_EQ(0, m);
+
+  ChooseFecParams(0.01, options, &k, &m);
+  EXPECT_GE(m, 1);
+  double low = (double)m / k;
+  ChooseFecParams(0.1, options, &k, &m);
+  EXPECT_GT((double)m / k, low);
+  EXPECT_LE(k, options.max_k);
+  EXPECT_LE(m, options.max_m);
+}
+
+class FecTest : public ::testing::Test {
+protected:
+  FecTest() : pool_(2048, 256) {}
+
+  // Encodes count frames of distinct lengths and contents, closing the
+  // group early if count is less than k. Returns the packets in send order.
+  vector<Buffer*> Send(FecEncoder* encoder, int count) {
+    vector<Buffer*> packets;
+    Buffer* parity[kMaxFecParity];
+    for (int i = 0; i < count; ++i) {
+      Buffer* b = pool_.Get();
+      unsigned int len = 60 + i * 97;
+      for (unsigned int j = 0; j < len; ++j)
+        b->data()[j] = (unsigned char)(i * 31 + j);
+      b->set_len(len);
+      int n = encoder->Encode(b, 0, parity);
+      EXPECT_GE(n, 0);
+      packets.push_back(b);
+      packets.insert(packets.end(), parity, parity + n);
+    }
+    int n = encoder->Poll(1000000000ull, parity);
+    packets.insert(packets.end(), parity, parity + n);
+    return packets;
+  }
+
+  // Delivers packets but those in lost, returns the frames by index, or an
+  // empty string for frames not returned.
+  vector<string> Receive(FecDecoder* decoder, const vector<Buffer*>& packets,
+                         const vector<int>& lost) {
+    vector<string> frames(kMaxFecData);
+    for (size_t p = 0; p < packets.size(); ++p) {
+      if (std::find(lost.begin(), lost.end(), (int)p) != lost.end()) {
+        packets[p]->Unref();
+        continue;
+      }
+      Buffer* out[kMaxFecData];
+      int n = decoder->Decode(packets[p], 0, out);
+      for (int i = 0; i < n; ++i) {
+        // Frame f starts with f * 31.
+        const unsigned char* d = out[i]->data();
+        int index = 0;
+        while (index < kMaxFecData && (unsigned char)(index * 31) != d[0])
+          ++index;
+        if (index == kMaxFecData) {
+          ADD_FAILURE() << "unknown frame";
+          index = 0;
+        }
+        frames[index].assign((const char*)d, out[i]->len());
+        out[i]->Unref();
+      }
+    }
+    return frames;
+  }
+
+  static bool Intact(const string& frame, int i) {
+    if (frame.size() != 60 + (unsigned int)i * 97)
+      return false;
+    for (size_t j = 0; j < frame.size(); ++j) {
+      if ((unsigned char)frame[j] != (unsigned char)(i * 31 + j))
+        return false;
+    }
+    return true;
+  }
+
+  // Value of the counter name of the decoder stage.
+  static int64_t Counted(const string& name, const string& stage) {
+    vector<MetricSample> samples = MetricsRegistry::Instance()->Snapshot();
+    for (size_t i = 0; i < samples.size(); ++i) {
+      if (samples[i].name == name &&
+          samples[i].labels == "stage=\"" + stage + "\"")
+        return samples[i].value;
+    }
+    return -1;
+  }
+
+  BufferPool pool_;
+};
+
+TEST_F(FecTest, LosslessStreamHasNoErrors) {
+  FecOptions options;
+  options.k = 4;
+  options.m = 2;
+  FecEncoder encoder("enc", &pool_, options);
+  FecDecoder decoder("lossless", &pool_, 16, 1000000000ull);
+  for (int g = 0; g < 3; ++g) {
+    vector<string> frames = Receive(&decoder, Send(&encoder, 4),
+                                    vector<int>());
+    for (int i = 0; i < 4; ++i)
+      EXPECT_TRUE(Intact(frames[i], i)) << i;
+  }
+  EXPECT_EQ(0, Counted("bangnet_fec_errors_total", "lossless"));
+  // The second parity packet of each group was not needed.
+  EXPECT_EQ(3, Counted("bangnet_fec_surplus_total", "lossless"));
+  EXPECT_EQ(0, Counted("bangnet_fec_lost_total", "lossless"));
+}
+
+TEST_F(FecTest, RecoversUpToMLosses) {
+  FecOptions options;
+  options.k = 8;
+  options.m = 3;
+  // Packets 0-7 are the frames, 8-10 the parity.
+  int patterns[][3] = {{0, -1, -1}, {1, 5, 7}, {2, 8, -1}, {0, 9, 10},
+                       {8, 9, 10}, {3, 4, 10}};
+  for (size_t t = 0; t < sizeof(patterns) / sizeof(patterns[0]); ++t) {
+    FecEncoder encoder("enc", &pool_, options);
+    FecDecoder decoder("dec", &pool_, 16, 1000000000ull);
+    vector<Buffer*> packets = Send(&encoder, 8);
+    ASSERT_EQ(11u, packets.size());
+    vector<int> lost;
+    for (int i = 0; i < 3; ++i) {
+      if (patterns[t][i] >= 0)
+        lost.push_back(patterns[t][i]);
+    }
+    vector<string> frames = Receive(&decoder, packets, lost);
+    for (int i = 0; i < 8; ++i)
+      EXPECT_TRUE(Intact(frames[i], i)) << "pattern " << t << " frame " << i;
+  }
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(FecTest, LosesMoreThanM) {
+  FecOptions options;
+  options.k = 4;
+  options.m = 1;
+  FecEncoder encoder("enc", &pool_, options);
+  FecDecoder decoder("dec", &pool_, 16, 1000000000ull);
+  vector<int> lost;
+  lost.push_back(0);
+  lost.push_back(2);
+  vector<string> frames = Receive(&decoder, Send(&encoder, 4), lost);
+  EXPECT_TRUE(frames[0].empty());
+  EXPECT_TRUE(Intact(frames[1], 1));
+  EXPECT_TRUE(frames[2].empty());
+  EXPECT_TRUE(Intact(frames[3], 3));
+
+  decoder.Expire(2000000000ull);
+  EXPECT_GT(decoder.loss(), 0);
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(FecTest, ClosesPartialGroups) {
+  FecOptions options;
+  options.k = 10;
+  options.m = 2;
+  FecEncoder encoder("enc", &pool_, options);
+  FecDecoder decoder("dec", &pool_, 16, 1000000000ull);
+  // 3 frames, then 2 parity packets from the timeout.
+  vector<Buffer*> packets = Send(&encoder, 3);
+  ASSERT_EQ(5u, packets.size());
+  vector<int> lost;
+  lost.push_back(1);
+  lost.push_back(2);
+  vector<string> frames = Receive(&decoder, packets, lost);
+  for (int i = 0; i < 3; ++i)
+    EXPECT_TRUE(Intact(frames[i], i)) << i;
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(FecTest, AdaptsToPeerLoss) {
+  FecOptions options;
+  FecEncoder encoder("enc", &pool_, options);
+  encoder.OnPeerLoss(0.05);
+  // Taken from the next group on.
+  vector<Buffer*> packets = Send(&encoder, 1);
+  for (size_t i = 0; i < packets.size(); ++i)
+    packets[i]->Unref();
+  int k, m;
+  ChooseFecParams(0.05, options, &k, &m);
+  EXPECT_EQ(k, encoder.k());
+  EXPECT_EQ(m, encoder.m());
+  EXPECT_EQ(256u, pool_.available());
+}
+
+}  // namespace
+}  // namespace bangnet
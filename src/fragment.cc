@@ -0,0 +1,218 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "src/fragment.h"
+
+namespace bangnet {
+
+Fragmenter::Fragmenter(unsigned int mtu) : mtu_(mtu), next_id_(1) {}
+
+int Fragmenter::Split(const unsigned char* frame, unsigned int len,
+                      Fragment* out, int max) {
+  if (len == 0 || len > kMaxFrameLen || mtu_ <= kFragmentHeaderLen + 8)
+    return 0;
+
+  // Fragments but the last carry a multiple of 8 bytes.
+  unsigned int per = (mtu_ - kFragmentHeaderLen) & ~7u;
+  int count = (int)((len + per - 1) / per);
+  if (len <= mtu_ - kFragmentHeaderLen)
+    count = 1;
+  if (count > max || count > kMaxFragments)
+    return 0;
+
+  uint32_t id = next_id_++;
+  unsigned int offset = 0;
+  for (int i = 0; i < count; ++i) {
+    unsigned int n = i == count - 1 ? len - offset : per;
+    FragmentHeader h;
+    h.id = htonl(id);
+    h.offset8 = htons((uint16_t)(offset / 8));
+    h.index = (uint8_t)i;
+    h.count = (uint8_t)count;
+    h.total_len = htonl(len);
+    memcpy(out[i].header, &h, sizeof(h));
+    out[i].data = frame + offset;
+    out[i].len = n;
+    offset += n;
+  }
+  return count;
+}
+
+Reassembler::Reassembler(const string& name, BufferPool* pool,
+                         unsigned int slots, uint64_t timeout_ns)
+    : name_(name), pool_(pool), timeout_ns_(timeout_ns), pending_(0) {
+  nsets_ = (slots + kWays - 1) / kWays;
+  if (nsets_ == 0)
+    nsets_ = 1;
+  Slot empty;
+  memset(&empty, 0, sizeof(empty));
+  slots_.assign(nsets_ * kWays, empty);
+
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.frames = r->NewCounter("bangnet_reassembly_frames_total",
+      "Frames returned by the reassembler.", labels);
+  metrics_.fragments = r->NewCounter("bangnet_reassembly_fragments_total",
+      "Fragments of split frames received.", labels);
+  metrics_.timeouts = r->NewCounter("bangnet_reassembly_timeouts_total",
+      "Frames dropped because fragments did not arrive in time.", labels);
+  metrics_.evictions = r->NewCounter("bangnet_reassembly_evictions_total",
+      "Frames dropped to make room in a full table set.", labels);
+  metrics_.errors = r->NewCounter("bangnet_reassembly_errors_total",
+      "Malformed, duplicate or unbufferable fragments.", labels);
+}
+
+Reassembler::~Reassembler() {
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    if (slots_[i].count)
+      Release(&slots_[i]);
+  }
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+void Reassembler::Release(Slot* s) {
+  if (s->frame)
+    s->frame->Unref();
+  memset(s, 0, sizeof(*s));
+  --pending_;
+}
+
+Reassembler::Slot* Reassembler::Lookup(uint32_t peer, uint32_t id,
+                                       uint64_t now_ns) {
+  uint32_t h = (peer * 0x9e3779b1u) ^ (id * 0x85ebca6bu);
+  h ^= h >> 15;
+  Slot* set = &slots_[(h % nsets_) * kWays];
+
+  Slot* free_slot = 0;
+  Slot* oldest = 0;
+  for (unsigned int i = 0; i < kWays; ++i) {
+    Slot* s = &set[i];
+    if (s->count && s->deadline <= now_ns) {
+      metrics_.timeouts->Increment();
+      Release(s);
+    }
+    if (!s->count) {
+      if (!free_slot)
+        free_slot = s;
+      continue;
+    }
+    if (s->peer == peer && s->id == id)
+      return s;
+    if (!oldest || s->deadline < oldest->deadline)
+      oldest = s;
+  }
+
+  if (!free_slot) {
+    metrics_.evictions->Increment();
+    Release(oldest);
+    free_slot = oldest;
+  }
+  free_slot->peer = peer;
+  free_slot->id = id;
+  free_slot->deadline = now_ns + timeout_ns_;
+  ++pending_;
+  return free_slot;
+}
+
+Buffer* Reassembler::Add(uint32_t peer, Buffer* fragment, uint64_t now_ns) {
+  if (fragment->len() < kFragmentHeaderLen) {
+    metrics_.errors->Increment();
+    fragment->Unref();
+    return 0;
+  }
+
+  FragmentHeader h;
+  memcpy(&h, fragment->data(), sizeof(h));
+  uint32_t id = ntohl(h.id);
+  unsigned int offset = ntohs(h.offset8) * 8;
+  unsigned int total_len = ntohl(h.total_len);
+  unsigned int n = fragment->len() - kFragmentHeaderLen;
+  if (h.count == 0 || h.count > kMaxFragments || h.index >= h.count ||
+      total_len > kMaxFrameLen || offset + n > total_len) {
+    metrics_.errors->Increment();
+    fragment->Unref();
+    return 0;
+  }
+
+  // Whole frames skip the table.
+  if (h.count == 1) {
+    fragment->Pull(kFragmentHeaderLen);
+    metrics_.frames->Increment();
+    return fragment;
+  }
+
+  // Fragments but the last carry per bytes each, the last one the rest, so
+  // each fragment implies per and its own offset and length.
+  bool last = h.index == h.count - 1;
+  unsigned int per = last ? offset / (h.count - 1) : n;
+  if (per == 0 || per % 8 || offset != h.index * per ||
+      (last ? offset + n != total_len || n > per : n != per) ||
+      (h.count - 1) * per >= total_len || total_len > h.count * per) {
+    metrics_.errors->Increment();
+    fragment->Unref();
+    return 0;
+  }
+
+  metrics_.fragments->Increment();
+  Slot* s = Lookup(peer, id, now_ns);
+  uint64_t bit = 1ull << h.index;
+  if (!s->count) {
+    s->count = h.count;
+    s->total_len = total_len;
+    s->per_fragment = per;
+  } else if (s->count != h.count || s->total_len != total_len ||
+             s->per_fragment != per) {
+    // Fragments which overlap or leave holes, the frame can not be trusted.
+    metrics_.errors->Increment();
+    fragment->Unref();
+    Release(s);
+    return 0;
+  } else if (s->received & bit) {
+    metrics_.errors->Increment();
+    fragment->Unref();
+    return 0;
+  }
+
+  if (!s->frame && h.index == 0 &&
+      fragment->capacity() >= kFragmentHeaderLen + total_len) {
+    // Build the frame in the first fragment's own buffer.
+    fragment->Pull(kFragmentHeaderLen);
+    s->frame = fragment;
+  } else {
+    if (!s->frame) {
+      s->frame = pool_->Get();
+      if (!s->frame || s->frame->capacity() < total_len) {
+        metrics_.errors->Increment();
+        fragment->Unref();
+        Release(s);
+        return 0;
+      }
+    }
+    memcpy(s->frame->data() + offset,
+           fragment->data() + kFragmentHeaderLen, n);
+    fragment->Unref();
+  }
+
+  s->received |= bit;
+  if (++s->nreceived < s->count)
+    return 0;
+
+  Buffer* frame = s->frame;
+  frame->set_len(total_len);
+  s->frame = 0;
+  Release(s);
+  metrics_.frames->Increment();
+  return frame;
+}
+
+void Reassembler::Expire(uint64_t now_ns) {
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    Slot* s = &slots_[i];
+    if (s->count && s->deadline <= now_ns) {
+      metrics_.timeouts->Increment();
+      Release(s);
+    }
+  }
+}
+
+}  // namespace bangnet
@@ -0,0 +1,128 @@
+#ifndef BANGNET_FRAGMENT_H_
+#define BANGNET_FRAGMENT_H_
+
+#include <stdint.h>
+
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/frame_device.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+// Every overlay frame sent over the underlay starts with this header, in
+// network byte order. Frames which fit the underlay are sent whole, as the
+// only fragment of themselves.
+struct FragmentHeader {
+  // Frame id, unique per sender for a while.
+  uint32_t id;
+  // Offset of this fragment's data in the frame, in units of 8 bytes.
+  uint16_t offset8;
+  uint8_t index;
+  uint8_t count;
+  // Length of the whole frame, up to kMaxFrameLen.
+  uint32_t total_len;
+} __attribute__((packed));
+
+const unsigned int kFragmentHeaderLen = sizeof(FragmentHeader);
+
+// Max fragments a frame is split into, bounds the reassembly bitmap.
+const int kMaxFragments = 64;
+
+// A fragment ready to send as a two element iovec: its header, then a
+// slice of the original frame, which is never copied.
+struct Fragment {
+  unsigned char header[kFragmentHeaderLen];
+  const unsigned char* data;
+  unsigned int len;
+};
+
+// Splits overlay frames so each fragment fits one underlay datagram.
+class Fragmenter {
+public:
+  // mtu is the largest underlay payload, fragment header included.
+  explicit Fragmenter(unsigned int mtu);
+
+  unsigned int mtu() const { return mtu_; }
+  void set_mtu(unsigned int mtu) { mtu_ = mtu; }
+
+  // Fills out with the fragments of a frame, returns their count, or 0 if
+  // the frame needs more than max or kMaxFragments fragments.
+  int Split(const unsigned char* frame, unsigned int len, Fragment* out,
+            int max);
+
+private:
+  unsigned int mtu_;
+  uint32_t next_id_;
+};
+
+// Puts fragments back together. The table of frames being reassembled is
+// preallocated, set associative and bounded: when a set is full the oldest
+// frame in it is evicted, and frames not completed within the timeout are
+// dropped.
+class Reassembler {
+public:
+  // slots is rounded up to a multiple of the set size. Frames are built in
+  // buffers from pool, which must hold the largest overlay frame.
+  Reassembler(const string& name, BufferPool* pool, unsigned int slots,
+              uint64_t timeout_ns);
+  ~Reassembler();
+
+  // Takes a received fragment from peer, starting with its header, and the
+  // caller's reference to it. Returns the whole frame once complete, with a
+  // reference for the caller, or null. Fragments must lay out the frame the
+  // way Fragmenter does, the frame is dropped on one which overlaps the
+  // others or leaves a hole.
+  //
+  // Unfragmented frames are returned in the same buffer with the header
+  // stripped. A first fragment whose buffer can hold the whole frame
+  // becomes the frame buffer, so only the other fragments are copied.
+  Buffer* Add(uint32_t peer, Buffer* fragment, uint64_t now_ns);
+
+  // Drops frames which were not completed in time.
+  void Expire(uint64_t now_ns);
+
+  // Frames being reassembled.
+  unsigned int pending() const { return pending_; }
+
+private:
+  // Ways of each set of the table.
+  static const unsigned int kWays = 4;
+
+  struct Slot {
+    uint32_t peer;
+    uint32_t id;
+    Buffer* frame;
+    uint64_t received;
+    uint64_t deadline;
+    uint32_t total_len;
+    // Data bytes of each fragment but the last.
+    uint32_t per_fragment;
+    uint8_t count;
+    uint8_t nreceived;
+  };
+
+  void Release(Slot* s);
+  Slot* Lookup(uint32_t peer, uint32_t id, uint64_t now_ns);
+
+  string name_;
+  BufferPool* pool_;
+  uint64_t timeout_ns_;
+  unsigned int nsets_;
+  vector<Slot> slots_;
+  unsigned int pending_;
+
+  struct Metrics {
+    Counter* frames;
+    Counter* fragments;
+    Counter* timeouts;
+    Counter* evictions;
+    Counter* errors;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Reassembler);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_FRAGMENT_H_
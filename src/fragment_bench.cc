@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/fragment.h"
+
+namespace bangnet {
+namespace {
+
+// Splits frames for an underlay of mtu bytes and reassembles them, copying
+// each fragment into a pool buffer the way a receive does. With an mtu above
+// the frame size they take the same path unsplit, which is the baseline.
+BenchResult RunFragmentBench(unsigned int frame_size, unsigned int mtu,
+                             uint64_t duration_ms) {
+  BufferPool pool(kFragmentHeaderLen + kMaxFrameLen, 256);
+  Fragmenter fragmenter(mtu);
+  Reassembler reassembler("bench", &pool, 256, 1000000000ull);
+  vector<unsigned char> frame(frame_size);
+  for (size_t i = 0; i < frame.size(); ++i)
+    frame[i] = (unsigned char)i;
+
+  StageClock stages;
+  int split_stage = stages.AddStage("split");
+  int recv_stage = stages.AddStage("recv-copy");
+  int reassemble_stage = stages.AddStage("reassemble");
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "fragment/%uB%s", frame_size,
+           mtu >= kFragmentHeaderLen + frame_size ? "/whole" : "");
+  result.name = name;
+  uint64_t fragments = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+
+  while (now < end) {
+    for (int k = 0; k < 256; ++k) {
+      uint64_t c0 = CycleCount();
+      Fragment frags[kMaxFragments];
+      int n = fragmenter.Split(&frame[0], frame_size, frags, kMaxFragments);
+      uint64_t c1 = CycleCount();
+
+      Buffer* bufs[kMaxFragments];
+      for (int i = 0; i < n; ++i) {
+        bufs[i] = pool.Get();
+        memcpy(bufs[i]->data(), frags[i].header, kFragmentHeaderLen);
+        memcpy(bufs[i]->data() + kFragmentHeaderLen, frags[i].data,
+               frags[i].len);
+        bufs[i]->set_len(kFragmentHeaderLen + frags[i].len);
+      }
+      uint64_t c2 = CycleCount();
+
+      Buffer* out = 0;
+      for (int i = 0; i < n; ++i)
+        out = reassembler.Add(1, bufs[i], c2);
+      uint64_t c3 = CycleCount();
+      CHECK(out != 0);
+      out->Unref();
+
+      stages.Add(split_stage, c1 - c0);
+      stages.Add(recv_stage, c2 - c1);
+      stages.Add(reassemble_stage, c3 - c2);
+      fragments += n;
+      result.packets++;
+      result.bytes += frame_size;
+    }
+    now = MonotonicNs();
+  }
+
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+  result.AddExtra("fragments/frame", (double)fragments / result.packets);
+  return result;
+}
+
+// Each size over a 1500 byte underlay, and those split over it also whole
+// for comparison.
+BENCHMARK(Fragmentation) {
+  static const unsigned int kSizes[] = {1400, 1514, 2814, 9014, kMaxFrameLen};
+  const unsigned int kMtu = 1500;
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+    unsigned int size = kSizes[i];
+    BenchResult r = RunFragmentBench(size, kMtu, options.duration_ms);
+    if (size + kFragmentHeaderLen > kMtu) {
+      BenchResult whole = RunFragmentBench(
+          size, size + kFragmentHeaderLen, options.duration_ms);
+      if (whole.Gbps() > 0)
+        r.AddExtra("gbps-vs-unfragmented", r.Gbps() / whole.Gbps());
+      results->push_back(whole);
+    }
+    results->push_back(r);
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,139 @@
+#include "src/fragment.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+class FragmentTest : public ::testing::Test {
+protected:
+  FragmentTest()
+      : pool_(9100, 64), fragmenter_(1500),
+        reassembler_("test", &pool_, 16, 1000) {
+    frame_.resize(4000);
+    for (size_t i = 0; i < frame_.size(); ++i)
+      frame_[i] = (unsigned char)(i * 7);
+  }
+
+  // Copies a fragment into a pool buffer, like a receive would.
+  Buffer* Receive(const Fragment& f) {
+    Buffer* b = pool_.Get();
+    memcpy(b->data(), f.header, kFragmentHeaderLen);
+    memcpy(b->data() + kFragmentHeaderLen, f.data, f.len);
+    b->set_len(kFragmentHeaderLen + f.len);
+    return b;
+  }
+
+  BufferPool pool_;
+  Fragmenter fragmenter_;
+  Reassembler reassembler_;
+  vector<unsigned char> frame_;
+};
+
+TEST_F(FragmentTest, SplitsToMtu) {
+  Fragment frags[kMaxFragments];
+  int n = fragmenter_.Split(&frame_[0], frame_.size(), frags, kMaxFragments);
+  ASSERT_EQ(3, n);
+  unsigned int total = 0;
+  for (int i = 0; i < n; ++i) {
+    EXPECT_LE(kFragmentHeaderLen + frags[i].len, 1500u);
+    EXPECT_EQ(&frame_[total], frags[i].data);
+    total += frags[i].len;
+  }
+  EXPECT_EQ(frame_.size(), total);
+  EXPECT_EQ(0, fragmenter_.Split(&frame_[0], frame_.size(), frags, 2));
+}
+
+TEST_F(FragmentTest, ReassemblesOutOfOrder) {
+  Fragment frags[kMaxFragments];
+  int n = fragmenter_.Split(&frame_[0], frame_.size(), frags, kMaxFragments);
+  ASSERT_EQ(3, n);
+
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[2]), 0) == 0);
+  // Duplicates are dropped.
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[2]), 0) == 0);
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[0]), 0) == 0);
+  EXPECT_EQ(1u, reassembler_.pending());
+  Buffer* b = reassembler_.Add(1, Receive(frags[1]), 0);
+  ASSERT_TRUE(b != 0);
+  ASSERT_EQ(frame_.size(), b->len());
+  EXPECT_EQ(0, memcmp(b->data(), &frame_[0], frame_.size()));
+  b->Unref();
+  EXPECT_EQ(0u, reassembler_.pending());
+  EXPECT_EQ(pool_.count(), pool_.available());
+}
+
+TEST_F(FragmentTest, WholeFrameIsZeroCopy) {
+  Fragment frags[kMaxFragments];
+  ASSERT_EQ(1, fragmenter_.Split(&frame_[0], 1000, frags, kMaxFragments));
+  Buffer* in = Receive(frags[0]);
+  unsigned char* payload = in->data() + kFragmentHeaderLen;
+  Buffer* out = reassembler_.Add(1, in, 0);
+  ASSERT_EQ(in, out);
+  EXPECT_EQ(payload, out->data());
+  EXPECT_EQ(1000u, out->len());
+  out->Unref();
+}
+
+TEST_F(FragmentTest, DropsOverlappingFragments) {
+  Fragment frags[kMaxFragments];
+  ASSERT_EQ(3, fragmenter_.Split(&frame_[0], frame_.size(), frags,
+                                 kMaxFragments));
+  FragmentHeader h;
+  memcpy(&h, frags[1].header, sizeof(h));
+  unsigned int per = frags[0].len;
+
+  // A middle fragment starting 8 bytes early, so it overlaps the first.
+  Fragment early = frags[1];
+  h.offset8 = htons((uint16_t)(per / 8 - 1));
+  memcpy(early.header, &h, sizeof(h));
+  early.data -= 8;
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[0]), 0) == 0);
+  EXPECT_TRUE(reassembler_.Add(1, Receive(early), 0) == 0);
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[2]), 0) == 0);
+  EXPECT_EQ(1u, reassembler_.pending());
+
+  // One laid out with shorter fragments overlaps the first and leaves a
+  // hole before the last, the frame is dropped.
+  Fragment shorter = frags[1];
+  h.offset8 = htons((uint16_t)(per / 8 - 1));
+  memcpy(shorter.header, &h, sizeof(h));
+  shorter.data = &frame_[per - 8];
+  shorter.len = per - 8;
+  EXPECT_TRUE(reassembler_.Add(1, Receive(shorter), 0) == 0);
+  EXPECT_EQ(0u, reassembler_.pending());
+  EXPECT_EQ(pool_.count(), pool_.available());
+}
+
+TEST_F(FragmentTest, TimesOut) {
+  Fragment frags[kMaxFragments];
+  ASSERT_EQ(3, fragmenter_.Split(&frame_[0], frame_.size(), frags,
+                                 kMaxFragments));
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[0]), 0) == 0);
+  reassembler_.Expire(500);
+  EXPECT_EQ(1u, reassembler_.pending());
+  reassembler_.Expire(1000);
+  EXPECT_EQ(0u, reassembler_.pending());
+
+  // The rest of the frame starts over and never completes.
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[1]), 2000) == 0);
+  EXPECT_TRUE(reassembler_.Add(1, Receive(frags[2]), 2000) == 0);
+  reassembler_.Expire(5000);
+  EXPECT_EQ(pool_.count(), pool_.available());
+}
+
+TEST_F(FragmentTest, TableIsBounded) {
+  Fragment frags[kMaxFragments];
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(3, fragmenter_.Split(&frame_[0], frame_.size(), frags,
+                                   kMaxFragments));
+    EXPECT_TRUE(reassembler_.Add(i, Receive(frags[0]), 0) == 0);
+  }
+  EXPECT_EQ(16u, reassembler_.pending());
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,62 @@
+#include "src/frame_burst.h"
+
+#include "src/multipath.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+
+void FrameBurst::Parse(int first) {
+  for (int i = first; i < count; ++i) {
+    // The headers of later frames are likely not in the cache yet.
+    if (i + 2 < count)
+      __builtin_prefetch(buffers[i + 2]->data());
+    const unsigned char* f = buffers[i]->data();
+    unsigned int len = buffers[i]->len();
+    EthernetTags tags;
+    if (!ParseEthernet(f, len, &tags)) {
+      dst[i] = src[i] = 0;
+      ethertype[i] = 0;
+      l3_offset[i] = 0;
+      flow_hash[i] = 0;
+      verdict[i] = VERDICT_DROP;
+      continue;
+    }
+    dst[i] = LoadMac(f);
+    src[i] = LoadMac(f + 6);
+    ethertype[i] = tags.ethertype;
+    l3_offset[i] = (uint16_t)tags.payload_offset;
+    flow_hash[i] = FlowHash(f, len);
+    verdict[i] = VERDICT_PASS;
+  }
+}
+
+int FrameBurst::Compact() {
+  int n = 0;
+  for (int i = 0; i < count; ++i) {
+    if (verdict[i] != VERDICT_PASS) {
+      if (verdict[i] == VERDICT_DROP)
+        buffers[i]->Unref();
+      continue;
+    }
+    if (n != i) {
+      buffers[n] = buffers[i];
+      dst[n] = dst[i];
+      src[n] = src[i];
+      ethertype[n] = ethertype[i];
+      l3_offset[n] = l3_offset[i];
+      flow_hash[n] = flow_hash[i];
+      verdict[n] = VERDICT_PASS;
+    }
+    ++n;
+  }
+  count = n;
+  return n;
+}
+
+void FrameBurst::Release() {
+  for (int i = 0; i < count; ++i)
+    buffers[i]->Unref();
+  count = 0;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,79 @@
+#ifndef BANGNET_FRAME_BURST_H_
+#define BANGNET_FRAME_BURST_H_
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "src/buffer_pool.h"
+#include "src/common.h"
+
+namespace bangnet {
+
+// What a stage decided about a frame of a burst.
+enum FrameVerdict {
+  // Goes on to the next stage.
+  VERDICT_PASS = 0,
+  // Freed when the burst is compacted.
+  VERDICT_DROP,
+  // A stage kept its reference, like to queue the frame elsewhere.
+  VERDICT_TAKEN
+};
+
+// A burst of frames and their metadata, laid out as one array per field so
+// a stage runs one tight loop over the field it needs for all frames, like
+// the mac table over dst, instead of taking each frame through every stage
+// in turn. Frames are pool buffers, the burst holds a reference to each.
+struct FrameBurst {
+  static const int kMaxFrames = 64;
+
+  FrameBurst() : count(0) {}
+
+  int count;
+  Buffer* buffers[kMaxFrames];
+  // Mac addresses in the low 48 bits, the first byte most significant.
+  uint64_t dst[kMaxFrames];
+  uint64_t src[kMaxFrames];
+  // Of the payload after any vlan tags, 0 for frames too short to parse.
+  uint16_t ethertype[kMaxFrames];
+  uint16_t l3_offset[kMaxFrames];
+  // FlowHash() of the frame.
+  uint32_t flow_hash[kMaxFrames];
+  // A FrameVerdict, VERDICT_PASS when parsed.
+  uint8_t verdict[kMaxFrames];
+
+  bool full() const { return count == kMaxFrames; }
+
+  // Appends b, taking the caller's reference, to pass. The rest of its
+  // metadata is filled by Parse(). Returns false if the burst is full.
+  bool Add(Buffer* b) {
+    if (count == kMaxFrames)
+      return false;
+    verdict[count] = VERDICT_PASS;
+    buffers[count++] = b;
+    return true;
+  }
+
+  // Fills the metadata of the frames from first on. Frames that are not
+  // ethernet frames are marked VERDICT_DROP.
+  void Parse(int first = 0);
+
+  // Frees the dropped frames, forgets the taken ones and moves the rest to
+  // the front in order. Returns the frames left.
+  int Compact();
+
+  // Frees every frame.
+  void Release();
+};
+
+// Loads the mac address at p in the form of FrameBurst. Reads 8 bytes, so
+// the 2 after the address must be readable.
+inline uint64_t LoadMac(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return be64toh(v) >> 16;
+}
+
+}  // namespace bangnet
+
+#endif  // BANGNET_FRAME_BURST_H_
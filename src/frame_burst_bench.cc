@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/frame_burst.h"
+#include "src/multipath.h"
+#include "src/switch.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+namespace {
+
+// Parses, hashes and looks up the destination of frames to many hosts,
+// one frame at a time through every step or a burst at a time through
+// each step.
+BenchResult RunBurstBench(bool burst, unsigned int hosts,
+                          uint64_t duration_ms) {
+  MacTable table(hosts, ~0ull);
+  BufferPool pool(256, FrameBurst::kMaxFrames * 16);
+  unsigned char mac[6] = {0x02, 0, 0, 0, 0, 0};
+  for (unsigned int i = 0; i < hosts; ++i) {
+    memcpy(mac + 2, &i, 4);
+    table.Learn(mac, i & 63, 1);
+  }
+
+  // Udp frames to random hosts.
+  vector<Buffer*> frames;
+  uint32_t x = 1;
+  while (Buffer* b = pool.Get()) {
+    unsigned char* f = b->data();
+    memset(f, 0, 64);
+    x = x * 1103515245u + 12345u;
+    unsigned int k = (x >> 4) % hosts;
+    f[0] = 0x02;
+    memcpy(f + 2, &k, 4);
+    f[6] = 0x02;
+    f[12] = 0x08;
+    f[14] = 0x45;
+    f[17] = 50;
+    f[23] = 17;
+    memcpy(f + 26, &x, 4);
+    b->set_len(64);
+    frames.push_back(b);
+  }
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "%s/%uk", burst ? "burst" : "per-frame",
+           hosts / 1024);
+  result.name = name;
+  FrameBurst fb;
+  int ports[FrameBurst::kMaxFrames];
+  int64_t sum = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    for (size_t i = 0; i < frames.size(); i += FrameBurst::kMaxFrames) {
+      if (burst) {
+        fb.count = FrameBurst::kMaxFrames;
+        memcpy(fb.buffers, &frames[i], sizeof(fb.buffers));
+        fb.Parse();
+        table.LookupBurst(fb.dst, fb.count, 2, ports);
+        for (int j = 0; j < fb.count; ++j)
+          sum += ports[j] + fb.flow_hash[j];
+      } else {
+        for (int j = 0; j < FrameBurst::kMaxFrames; ++j) {
+          Buffer* b = frames[i + j];
+          EthernetTags tags;
+          if (!ParseEthernet(b->data(), b->len(), &tags))
+            continue;
+          uint32_t hash = FlowHash(b->data(), b->len());
+          sum += table.Lookup(b->data(), 2) + hash;
+        }
+      }
+    }
+    result.packets += frames.size();
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  if (sum == 0)
+    LOG(INFO) << "unexpected sum";
+  for (size_t i = 0; i < frames.size(); ++i)
+    frames[i]->Unref();
+  return result;
+}
+
+BENCHMARK(FrameBurst) {
+  unsigned int hosts[] = {1024, 1024 * 1024};
+  for (int h = 0; h < 2; ++h) {
+    results->push_back(RunBurstBench(false, hosts[h], options.duration_ms));
+    results->push_back(RunBurstBench(true, hosts[h], options.duration_ms));
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,107 @@
+#include "src/frame_burst.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "src/multipath.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+namespace {
+
+class FrameBurstTest : public ::testing::Test {
+protected:
+  FrameBurstTest() : pool_(256, 128) {}
+
+  // Adds an ipv4 frame from mac 0x0a..id to 0x0c..id, tagged if vlan is
+  // not 0.
+  Buffer* Add(unsigned char id, uint16_t vlan) {
+    Buffer* b = pool_.Get();
+    unsigned char* f = b->data();
+    memset(f, 0, 60);
+    memset(f, 0x0c, 6);
+    f[5] = id;
+    memset(f + 6, 0x0a, 6);
+    f[11] = id;
+    f[12] = 0x08;
+    f[14] = 0x45;
+    f[16] = 0;
+    f[17] = 46;
+    f[29] = id;
+    b->set_len(60);
+    if (vlan)
+      PushVlanTag(b, kEtherTypeVlan, vlan);
+    EXPECT_TRUE(burst_.Add(b));
+    return b;
+  }
+
+  BufferPool pool_;
+  FrameBurst burst_;
+};
+
+TEST_F(FrameBurstTest, ParsesMetadata) {
+  Add(1, 0);
+  Buffer* tagged = Add(2, 100);
+  Buffer* runt = Add(3, 0);
+  runt->set_len(12);
+  burst_.Parse();
+
+  EXPECT_EQ(0x0c0c0c0c0c01ull, burst_.dst[0]);
+  EXPECT_EQ(0x0a0a0a0a0a01ull, burst_.src[0]);
+  EXPECT_EQ(0x0800, burst_.ethertype[0]);
+  EXPECT_EQ(14, burst_.l3_offset[0]);
+  EXPECT_EQ(FlowHash(burst_.buffers[0]->data(), 60), burst_.flow_hash[0]);
+  EXPECT_EQ(VERDICT_PASS, burst_.verdict[0]);
+
+  EXPECT_EQ(0x0c0c0c0c0c02ull, burst_.dst[1]);
+  EXPECT_EQ(0x0800, burst_.ethertype[1]);
+  EXPECT_EQ(18, burst_.l3_offset[1]);
+  EXPECT_EQ(FlowHash(tagged->data(), tagged->len()), burst_.flow_hash[1]);
+  EXPECT_NE(burst_.flow_hash[0], burst_.flow_hash[1]);
+
+  EXPECT_EQ(0, burst_.ethertype[2]);
+  EXPECT_EQ(VERDICT_DROP, burst_.verdict[2]);
+  burst_.Release();
+  EXPECT_EQ(128u, pool_.available());
+}
+
+TEST_F(FrameBurstTest, CompactsByVerdict) {
+  for (int i = 0; i < FrameBurst::kMaxFrames; ++i)
+    Add((unsigned char)i, 0);
+  EXPECT_TRUE(burst_.full());
+  Buffer* extra = pool_.Get();
+  EXPECT_FALSE(burst_.Add(extra));
+  extra->Unref();
+  burst_.Parse();
+
+  // Every third frame is dropped and every fifth taken by a stage.
+  vector<Buffer*> taken;
+  for (int i = 0; i < burst_.count; ++i) {
+    if (i % 3 == 0) {
+      burst_.verdict[i] = VERDICT_DROP;
+    } else if (i % 5 == 0) {
+      burst_.verdict[i] = VERDICT_TAKEN;
+      taken.push_back(burst_.buffers[i]);
+    }
+  }
+  int left = burst_.Compact();
+  EXPECT_EQ(left, burst_.count);
+  EXPECT_EQ(64 - 22 - (int)taken.size(), left);
+  for (int i = 0, j = 0; i < 64; ++i) {
+    if (i % 3 == 0 || i % 5 == 0)
+      continue;
+    EXPECT_EQ(0x0c0c0c0c0c00ull | i, burst_.dst[j]);
+    EXPECT_EQ(i, burst_.buffers[j]->data()[5]);
+    EXPECT_EQ(VERDICT_PASS, burst_.verdict[j]);
+    ++j;
+  }
+
+  burst_.Release();
+  for (size_t i = 0; i < taken.size(); ++i)
+    taken[i]->Unref();
+  EXPECT_EQ(128u, pool_.available());
+}
+
+}  // namespace
+}  // namespace bangnet
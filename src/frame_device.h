@@ -0,0 +1,93 @@
+#ifndef BANGNET_FRAME_DEVICE_H_
+#define BANGNET_FRAME_DEVICE_H_
+
+#include <poll.h>
+
+#include "src/common.h"
+
+namespace bangnet {
+
+// Largest mtu a device may have, the 64KB of an ipv4 packet.
+const unsigned int kMaxMtu = 65535;
+
+// Largest frame any device carries, ethernet header included.
+const unsigned int kMaxFrameLen = kMaxMtu + 14;
+
+// A frame buffer handed to or filled by a FrameDevice.
+struct FrameSlot {
+  unsigned char* data;
+  // Bytes of the frame.
+  unsigned int len;
+  // Bytes data can hold, used when reading.
+  unsigned int cap;
+};
+
+// A device whole frames are read from and written to. The tap device is
+// one, others let the datapath run without /dev/net/tun, like in tests and
+// benchmarks.
+class FrameDevice {
+public:
+  virtual ~FrameDevice() {}
+
+  // Returns device's name.
+  virtual string device_name() const = 0;
+
+  // Largest payload a frame may carry, without the link header.
+  virtual unsigned int mtu() const = 0;
+
+  // Changes the mtu at runtime. Returns false if the device can not, or
+  // refused the new mtu.
+  virtual bool SetMtu(unsigned int /*mtu*/) { return false; }
+
+  // Length of the link header in front of each frame's payload.
+  virtual unsigned int header_len() const { return 14; }
+
+  // A descriptor which polls readable when frames are waiting, or -1.
+  virtual int fd() const = 0;
+
+  virtual bool IsOpen() const = 0;
+
+  virtual void close() = 0;
+
+  // Writes a complete frame, returns false if it was dropped.
+  virtual bool WriteFrame(const void* frame, unsigned int len) = 0;
+
+  // Reads a complete frame into buf, blocking until one arrives. Returns
+  // the frame length, or 0 on error.
+  virtual unsigned int ReadFrame(void* buf, unsigned int cap) = 0;
+
+  // Reads up to n frames, blocking until at least one arrives, and sets
+  // their len. Returns the number of frames read. Backends override these
+  // to read or write a burst with a single call.
+  virtual int ReadBurst(FrameSlot* frames, int n) {
+    if (n <= 0)
+      return 0;
+    frames[0].len = ReadFrame(frames[0].data, frames[0].cap);
+    return frames[0].len > 0 ? 1 : 0;
+  }
+
+  // Reads up to n frames like ReadBurst() but without blocking, returns 0
+  // if none is waiting. Busy polling spins on it, so backends override it
+  // with a single non-blocking call.
+  virtual int TryReadBurst(FrameSlot* frames, int n) {
+    struct pollfd pfd;
+    pfd.fd = fd();
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (pfd.fd < 0 || poll(&pfd, 1, 0) <= 0)
+      return 0;
+    return ReadBurst(frames, n);
+  }
+
+  // Writes n frames, returns the number written.
+  virtual int WriteBurst(const FrameSlot* frames, int n) {
+    int i = 0;
+    while (i < n && WriteFrame(frames[i].data, frames[i].len))
+      ++i;
+    return i;
+  }
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_FRAME_DEVICE_H_
@@ -0,0 +1,142 @@
+#include "src/frame_view.h"
+
+namespace bangnet {
+
+namespace {
+
+const uint16_t kEtherTypeIpv4 = 0x0800;
+const uint16_t kEtherTypeIpv6 = 0x86dd;
+
+// Ipv6 extension headers skipped to find the transport header.
+const int kMaxExtensionHeaders = 4;
+
+inline unsigned int Load16(const unsigned char* p) {
+  return (p[0] << 8) | p[1];
+}
+
+}  // namespace
+
+bool FrameView::Parse(unsigned char* frame, unsigned int len) {
+  frame_ = frame;
+  len_ = len;
+  layers_ = 0;
+  proto_ = 0;
+  l3_ = l4_ = payload_ = 0;
+  end_ = 0;
+  if (!ParseEthernet(frame, len, &tags_)) {
+    tags_.count = 0;
+    tags_.ethertype = 0;
+    tags_.payload_offset = 0;
+    return false;
+  }
+  layers_ = FRAME_ETHERNET | (tags_.count ? FRAME_VLAN : 0);
+  l3_ = l4_ = payload_ = (uint16_t)tags_.payload_offset;
+  end_ = len;
+  if (tags_.ethertype == kEtherTypeIpv4)
+    ParseIpv4();
+  else if (tags_.ethertype == kEtherTypeIpv6)
+    ParseIpv6();
+  return true;
+}
+
+void FrameView::ParseIpv4() {
+  const unsigned char* ip = frame_ + l3_;
+  if (len_ < l3_ + 20u || (ip[0] >> 4) != 4)
+    return;
+  unsigned int ihl = (ip[0] & 0xf) * 4;
+  unsigned int total = Load16(ip + 2);
+  if (ihl < 20 || total < ihl || len_ < l3_ + total)
+    return;
+  layers_ |= FRAME_IPV4;
+  proto_ = ip[9];
+  end_ = l3_ + total;
+  l4_ = payload_ = (uint16_t)(l3_ + ihl);
+  // Flags MF and the offset, only the first fragment has a transport
+  // header.
+  unsigned int frag = Load16(ip + 6) & 0x3fff;
+  if (frag) {
+    layers_ |= FRAME_FRAGMENT;
+    if (frag & 0x1fff)
+      return;
+  }
+  ParseTransport(l3_ + ihl);
+}
+
+void FrameView::ParseIpv6() {
+  const unsigned char* ip = frame_ + l3_;
+  if (len_ < l3_ + 40u || (ip[0] >> 4) != 6)
+    return;
+  unsigned int total = 40 + Load16(ip + 4);
+  if (len_ < l3_ + total)
+    return;
+  layers_ |= FRAME_IPV6;
+  end_ = l3_ + total;
+  unsigned int off = l3_ + 40;
+  proto_ = ip[6];
+  l4_ = payload_ = (uint16_t)off;
+  for (int i = 0; i < kMaxExtensionHeaders; ++i) {
+    if (proto_ == IPPROTO_HOPOPTS || proto_ == IPPROTO_ROUTING ||
+        proto_ == IPPROTO_DSTOPTS) {
+      if (end_ < off + 8 || end_ < off + (frame_[off + 1] + 1) * 8)
+        return;
+      proto_ = frame_[off];
+      off += (frame_[off + 1] + 1) * 8;
+    } else if (proto_ == IPPROTO_FRAGMENT) {
+      if (end_ < off + 8)
+        return;
+      layers_ |= FRAME_FRAGMENT;
+      proto_ = frame_[off];
+      bool first = (Load16(frame_ + off + 2) & 0xfff8) == 0;
+      off += 8;
+      if (!first) {
+        l4_ = payload_ = (uint16_t)off;
+        return;
+      }
+    } else {
+      break;
+    }
+    l4_ = payload_ = (uint16_t)off;
+  }
+  ParseTransport(off);
+}
+
+void FrameView::ParseTransport(unsigned int off) {
+  unsigned int hlen;
+  FrameLayer layer;
+  if (proto_ == IPPROTO_TCP) {
+    if (end_ < off + 20)
+      return;
+    hlen = (frame_[off + 12] >> 4) * 4;
+    if (hlen < 20)
+      return;
+    layer = FRAME_TCP;
+  } else if (proto_ == IPPROTO_UDP) {
+    hlen = 8;
+    layer = FRAME_UDP;
+  } else if ((proto_ == IPPROTO_ICMP && Has(FRAME_IPV4)) ||
+             (proto_ == IPPROTO_ICMPV6 && Has(FRAME_IPV6))) {
+    hlen = 8;
+    layer = FRAME_ICMP;
+  } else {
+    return;
+  }
+  if (end_ < off + hlen)
+    return;
+  layers_ |= layer;
+  l4_ = (uint16_t)off;
+  payload_ = (uint16_t)(off + hlen);
+}
+
+int ParseBurst(const FrameSlot* frames, int n, FrameView* views) {
+  int parsed = 0;
+  for (int i = 0; i < n; ++i) {
+    // The next frame's headers are likely not in the cache yet.
+    if (i + 1 < n)
+      __builtin_prefetch(frames[i + 1].data);
+    if (views[i].Parse(frames[i].data, frames[i].len))
+      ++parsed;
+  }
+  return parsed;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,106 @@
+#ifndef BANGNET_FRAME_VIEW_H_
+#define BANGNET_FRAME_VIEW_H_
+
+#include <stdint.h>
+
+#include <netinet/icmp6.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/ip_icmp.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+
+#include "src/frame_device.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+
+// Headers found in a frame, the bits of FrameView::layers().
+enum FrameLayer {
+  FRAME_ETHERNET = 1 << 0,
+  FRAME_VLAN = 1 << 1,
+  FRAME_IPV4 = 1 << 2,
+  FRAME_IPV6 = 1 << 3,
+  FRAME_TCP = 1 << 4,
+  FRAME_UDP = 1 << 5,
+  FRAME_ICMP = 1 << 6,
+  // A fragment of an ip packet. Only the first one has a transport header.
+  FRAME_FRAGMENT = 1 << 7
+};
+
+// The headers of an ethernet frame, parsed in place. The view holds offsets
+// into the frame and owns none of it, so it is valid while the frame is.
+// Parse() checks the bounds of every header once, the accessors then only
+// add an offset: a header is there if its layer is, and lies within the
+// frame. Malformed or truncated headers end the parse, the layers above
+// them are missing.
+class FrameView {
+public:
+  FrameView() : frame_(NULL), len_(0), end_(0), layers_(0), proto_(0),
+                l3_(0), l4_(0), payload_(0) {}
+
+  FrameView(unsigned char* frame, unsigned int len) { Parse(frame, len); }
+
+  // Parses frame. Returns false if it is not even an ethernet frame, with
+  // layers() 0.
+  bool Parse(unsigned char* frame, unsigned int len);
+
+  unsigned char* data() const { return frame_; }
+  unsigned int len() const { return len_; }
+
+  unsigned int layers() const { return layers_; }
+  bool Has(FrameLayer layer) const { return (layers_ & layer) != 0; }
+
+  // Link layer.
+  unsigned char* dst() const { return frame_; }
+  unsigned char* src() const { return frame_ + 6; }
+  const EthernetTags& tags() const { return tags_; }
+  uint16_t vlan() const { return tags_.vlan(); }
+  uint16_t ethertype() const { return tags_.ethertype; }
+
+  // Network layer, at l3_offset(), right after the tags.
+  unsigned int l3_offset() const { return l3_; }
+  struct iphdr* ipv4() const { return (struct iphdr*)(frame_ + l3_); }
+  struct ip6_hdr* ipv6() const { return (struct ip6_hdr*)(frame_ + l3_); }
+  // Protocol of the transport header, after ipv6 extension headers.
+  uint8_t ip_proto() const { return proto_; }
+  // End of the ip packet, before any ethernet padding.
+  unsigned int l3_end() const { return end_; }
+
+  // Transport layer, at l4_offset(). Icmpv6 shares the type, code and
+  // checksum of icmp.
+  unsigned int l4_offset() const { return l4_; }
+  struct tcphdr* tcp() const { return (struct tcphdr*)(frame_ + l4_); }
+  struct udphdr* udp() const { return (struct udphdr*)(frame_ + l4_); }
+  struct icmphdr* icmp() const { return (struct icmphdr*)(frame_ + l4_); }
+
+  // What follows the innermost header parsed, up to the end of the ip
+  // packet.
+  unsigned int payload_offset() const { return payload_; }
+  unsigned char* payload() const { return frame_ + payload_; }
+  unsigned int payload_len() const { return end_ - payload_; }
+
+private:
+  void ParseIpv4();
+  void ParseIpv6();
+  void ParseTransport(unsigned int off);
+
+  unsigned char* frame_;
+  unsigned int len_;
+  unsigned int end_;
+  uint16_t layers_;
+  uint8_t proto_;
+  // Offsets of the headers, all within the first few hundred bytes.
+  uint16_t l3_;
+  uint16_t l4_;
+  uint16_t payload_;
+  EthernetTags tags_;
+};
+
+// Parses a burst of frames into views, one per frame. Returns the number of
+// ethernet frames, those that are not have no layers.
+int ParseBurst(const FrameSlot* frames, int n, FrameView* views);
+
+}  // namespace bangnet
+
+#endif  // BANGNET_FRAME_VIEW_H_
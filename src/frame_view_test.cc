@@ -0,0 +1,157 @@
+#include "src/frame_view.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+// Builds frames from mac 0x0a to 0x0c, the ip header at offset 14.
+class FrameViewTest : public ::testing::Test {
+protected:
+  FrameViewTest() {
+    memset(frame_, 0, sizeof(frame_));
+    memset(frame_, 0x0c, 6);
+    memset(frame_ + 6, 0x0a, 6);
+  }
+
+  // An ipv4 packet of proto with len bytes after the 20 byte header.
+  unsigned int Ipv4(uint8_t proto, unsigned int len) {
+    frame_[12] = 0x08;
+    frame_[13] = 0x00;
+    unsigned char* ip = frame_ + 14;
+    ip[0] = 0x45;
+    ip[2] = (unsigned char)((20 + len) >> 8);
+    ip[3] = (unsigned char)(20 + len);
+    ip[8] = 64;
+    ip[9] = proto;
+    return 14 + 20 + len;
+  }
+
+  // An ipv6 packet whose first header is next, len bytes of payload.
+  unsigned int Ipv6(uint8_t next, unsigned int len) {
+    frame_[12] = 0x86;
+    frame_[13] = 0xdd;
+    unsigned char* ip = frame_ + 14;
+    ip[0] = 0x60;
+    ip[4] = (unsigned char)(len >> 8);
+    ip[5] = (unsigned char)len;
+    ip[6] = next;
+    ip[7] = 64;
+    return 14 + 40 + len;
+  }
+
+  unsigned char frame_[256];
+};
+
+TEST_F(FrameViewTest, ParsesTcpOverIpv4) {
+  unsigned int len = Ipv4(IPPROTO_TCP, 20 + 10);
+  frame_[34 + 12] = 0x50;
+  FrameView view(frame_, len);
+  EXPECT_EQ(FRAME_ETHERNET | FRAME_IPV4 | FRAME_TCP, (int)view.layers());
+  EXPECT_EQ(0x0c, view.dst()[0]);
+  EXPECT_EQ(0x0a, view.src()[5]);
+  EXPECT_EQ(0x0800, view.ethertype());
+  EXPECT_EQ(14u, view.l3_offset());
+  EXPECT_EQ(4u, view.ipv4()->version);
+  EXPECT_EQ(IPPROTO_TCP, view.ip_proto());
+  EXPECT_EQ(34u, view.l4_offset());
+  EXPECT_EQ(5u, view.tcp()->doff);
+  EXPECT_EQ(54u, view.payload_offset());
+  EXPECT_EQ(10u, view.payload_len());
+}
+
+TEST_F(FrameViewTest, SkipsTagsAndPadding) {
+  // A short udp packet padded to the minimum frame, behind a tag.
+  Ipv4(IPPROTO_UDP, 8 + 2);
+  unsigned char buf[4 + 256];
+  memcpy(buf + 4, frame_, sizeof(frame_));
+  unsigned char* f = PushVlanTag(buf + 4, kEtherTypeVlan, 7);
+  FrameView view(f, 64);
+  EXPECT_TRUE(view.Has(FRAME_VLAN));
+  EXPECT_TRUE(view.Has(FRAME_UDP));
+  EXPECT_EQ(7, view.vlan());
+  EXPECT_EQ(18u, view.l3_offset());
+  EXPECT_EQ(18u + 20 + 8, view.payload_offset());
+  EXPECT_EQ(2u, view.payload_len());
+  EXPECT_EQ(18u + 30, view.l3_end());
+}
+
+TEST_F(FrameViewTest, ParsesIcmp) {
+  FrameView view(frame_, Ipv4(IPPROTO_ICMP, 8));
+  EXPECT_TRUE(view.Has(FRAME_ICMP));
+  frame_[34] = ICMP_ECHO;
+  EXPECT_EQ(ICMP_ECHO, view.icmp()->type);
+
+  // Icmp in ipv6 is icmpv6 only.
+  EXPECT_FALSE(FrameView(frame_, Ipv6(IPPROTO_ICMP, 8)).Has(FRAME_ICMP));
+  EXPECT_TRUE(FrameView(frame_, Ipv6(IPPROTO_ICMPV6, 8)).Has(FRAME_ICMP));
+}
+
+TEST_F(FrameViewTest, SkipsIpv6ExtensionHeaders) {
+  // Hop by hop options of 16 bytes, then a fragment header, then udp.
+  unsigned int len = Ipv6(IPPROTO_HOPOPTS, 16 + 8 + 8);
+  unsigned char* ext = frame_ + 54;
+  ext[0] = IPPROTO_FRAGMENT;
+  ext[1] = 1;
+  ext[16] = IPPROTO_UDP;
+  FrameView view(frame_, len);
+  EXPECT_EQ(FRAME_ETHERNET | FRAME_IPV6 | FRAME_FRAGMENT | FRAME_UDP,
+            (int)view.layers());
+  EXPECT_EQ(IPPROTO_UDP, view.ip_proto());
+  EXPECT_EQ(54u + 24, view.l4_offset());
+  EXPECT_EQ(0u, view.payload_len());
+
+  // Later fragments have no udp header.
+  ext[18] = 0x01;
+  view.Parse(frame_, len);
+  EXPECT_TRUE(view.Has(FRAME_FRAGMENT));
+  EXPECT_FALSE(view.Has(FRAME_UDP));
+  EXPECT_EQ(54u + 24, view.payload_offset());
+}
+
+TEST_F(FrameViewTest, StopsAtTruncatedHeaders) {
+  // A later ipv4 fragment.
+  unsigned int len = Ipv4(IPPROTO_TCP, 20);
+  frame_[34 + 12] = 0x50;
+  frame_[14 + 7] = 0x10;
+  FrameView view(frame_, len);
+  EXPECT_TRUE(view.Has(FRAME_FRAGMENT));
+  EXPECT_FALSE(view.Has(FRAME_TCP));
+  frame_[14 + 7] = 0;
+
+  // Tcp options past the end of the packet.
+  frame_[34 + 12] = 0x60;
+  view.Parse(frame_, len);
+  EXPECT_EQ(FRAME_ETHERNET | FRAME_IPV4, (int)view.layers());
+  EXPECT_EQ(34u, view.payload_offset());
+
+  // Ip packets longer than the frame.
+  view.Parse(frame_, len - 1);
+  EXPECT_EQ(FRAME_ETHERNET, (int)view.layers());
+  EXPECT_EQ(14u, view.payload_offset());
+  EXPECT_EQ(len - 1 - 14, view.payload_len());
+
+  EXPECT_FALSE(view.Parse(frame_, 13));
+  EXPECT_EQ(0, (int)view.layers());
+}
+
+TEST_F(FrameViewTest, ParsesBursts) {
+  unsigned int len = Ipv4(IPPROTO_UDP, 8);
+  FrameSlot frames[3];
+  frames[0].data = frame_;
+  frames[0].len = len;
+  frames[1].data = frame_;
+  frames[1].len = 10;
+  frames[2].data = frame_;
+  frames[2].len = 60;
+  FrameView views[3];
+  EXPECT_EQ(2, ParseBurst(frames, 3, views));
+  EXPECT_TRUE(views[0].Has(FRAME_UDP));
+  EXPECT_EQ(0, (int)views[1].layers());
+  EXPECT_TRUE(views[2].Has(FRAME_UDP));
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,452 @@
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "src/capture.h"
+#include "src/clock.h"
+#include "src/compress.h"
+#include "src/graph.h"
+#include "src/gro.h"
+#include "src/trace.h"
+
+namespace bangnet {
+
+namespace {
+
+// Reads the frames waiting on a device into pool buffers.
+class DeviceInputNode : public GraphNode {
+public:
+  DeviceInputNode(const string& name, FrameDevice* device, BufferPool* pool)
+      : GraphNode(name), device_(device), pool_(pool) {}
+
+  int fd() const { return device_->fd(); }
+
+  void Process(FrameBurst* burst) {
+    Buffer* buffers[FrameBurst::kMaxFrames];
+    FrameSlot slots[FrameBurst::kMaxFrames];
+    int n = pool_->GetBurst(buffers, FrameBurst::kMaxFrames - burst->count);
+    for (int i = 0; i < n; ++i) {
+      slots[i].data = buffers[i]->data();
+      slots[i].cap = buffers[i]->capacity();
+    }
+    int got = device_->TryReadBurst(slots, n);
+    for (int i = 0; i < n; ++i) {
+      if (i < got) {
+        buffers[i]->set_len(slots[i].len);
+        burst->Add(buffers[i]);
+      } else {
+        buffers[i]->Unref();
+      }
+    }
+  }
+
+private:
+  FrameDevice* device_;
+  BufferPool* pool_;
+};
+
+// Writes every frame to a device, and frees them. With a pool, tcp super
+// frames larger than the device mtu are segmented into its buffers first.
+// A traced burst is finished at stage once written.
+class DeviceOutputNode : public GraphNode {
+public:
+  DeviceOutputNode(const string& name, FrameDevice* device, BufferPool* pool,
+                   TraceStage stage)
+      : GraphNode(name), device_(device), pool_(pool), stage_(stage) {}
+
+  void Process(FrameBurst* burst) {
+    if (pool_) {
+      ProcessSegmenting(burst);
+      TraceEnd(stage_);
+      return;
+    }
+    FrameSlot slots[FrameBurst::kMaxFrames];
+    for (int i = 0; i < burst->count; ++i) {
+      slots[i].data = burst->buffers[i]->data();
+      slots[i].len = burst->buffers[i]->len();
+      slots[i].cap = slots[i].len;
+    }
+    device_->WriteBurst(slots, burst->count);
+    burst->Release();
+    TraceEnd(stage_);
+  }
+
+private:
+  // Frames are written in bursts of up to kMaxFrames, a super frame's
+  // segments in bursts of their own.
+  void ProcessSegmenting(FrameBurst* burst) {
+    Buffer* out[FrameBurst::kMaxFrames];
+    int n = 0;
+    unsigned int max_len = device_->mtu() + device_->header_len();
+    for (int i = 0; i < burst->count; ++i) {
+      Buffer* b = burst->buffers[i];
+      if (b->len() > max_len) {
+        Write(out, n);
+        n = SegmentTcp(b, device_->mtu(), pool_, out,
+                       FrameBurst::kMaxFrames);
+        if (n) {
+          b->Unref();
+          Write(out, n);
+          n = 0;
+          continue;
+        }
+      }
+      out[n++] = b;
+    }
+    Write(out, n);
+    burst->count = 0;
+  }
+
+  // Writes and frees frames.
+  void Write(Buffer** frames, int n) {
+    FrameSlot slots[FrameBurst::kMaxFrames];
+    for (int i = 0; i < n; ++i) {
+      slots[i].data = frames[i]->data();
+      slots[i].len = frames[i]->len();
+      slots[i].cap = slots[i].len;
+    }
+    device_->WriteBurst(slots, n);
+    for (int i = 0; i < n; ++i)
+      frames[i]->Unref();
+  }
+
+  FrameDevice* device_;
+  BufferPool* pool_;
+  TraceStage stage_;
+};
+
+class ParseNode : public GraphNode {
+public:
+  explicit ParseNode(const string& name) : GraphNode(name) {}
+
+  void Process(FrameBurst* burst) { burst->Parse(); }
+};
+
+// Drops frames of the ethertypes not allowed, after parse.
+class AclNode : public GraphNode {
+public:
+  AclNode(const string& name, const vector<uint16_t>& allowed)
+      : GraphNode(name), allowed_(allowed) {}
+
+  void Process(FrameBurst* burst) {
+    for (int i = 0; i < burst->count; ++i) {
+      bool ok = false;
+      for (size_t j = 0; j < allowed_.size(); ++j)
+        ok |= burst->ethertype[i] == allowed_[j];
+      if (!ok)
+        burst->verdict[i] = VERDICT_DROP;
+    }
+  }
+
+private:
+  vector<uint16_t> allowed_;
+};
+
+// Coalesces the tcp segments of a burst into super frames.
+class GroNode : public GraphNode {
+public:
+  GroNode(const string& name, unsigned int mtu)
+      : GraphNode(name), coalescer_(name, mtu) {}
+
+  void Process(FrameBurst* burst) {
+    burst->count = coalescer_.Coalesce(burst->buffers, burst->count);
+  }
+
+private:
+  TcpCoalescer coalescer_;
+};
+
+class CaptureNode : public GraphNode {
+public:
+  CaptureNode(const string& name, CapturePoint point)
+      : GraphNode(name), point_(point) {}
+
+  void Process(FrameBurst* burst) {
+    for (int i = 0; i < burst->count; ++i)
+      CaptureFrame(point_, burst->buffers[i]->data(),
+                   burst->buffers[i]->len());
+  }
+
+private:
+  CapturePoint point_;
+};
+
+// Only the buffers of the burst are valid after it, the frames changed.
+class CompressNode : public GraphNode {
+public:
+  CompressNode(const string& name, Compressor* compressor)
+      : GraphNode(name), compressor_(compressor) {}
+
+  void Process(FrameBurst* burst) {
+    burst->count = compressor_->CompressBurst(burst->buffers, burst->count);
+  }
+
+private:
+  Compressor* compressor_;
+};
+
+class DecompressNode : public GraphNode {
+public:
+  DecompressNode(const string& name, Compressor* compressor)
+      : GraphNode(name), compressor_(compressor) {}
+
+  void Process(FrameBurst* burst) {
+    for (int i = 0; i < burst->count; ++i) {
+      Buffer* b = compressor_->Decompress(burst->buffers[i]);
+      if (b)
+        burst->buffers[i] = b;
+      else
+        burst->verdict[i] = VERDICT_TAKEN;
+    }
+  }
+
+private:
+  Compressor* compressor_;
+};
+
+bool ParseEtherTypes(const string& args, vector<uint16_t>* types) {
+  stringstream ss(args);
+  string type;
+  while (getline(ss, type, ',')) {
+    char* end;
+    unsigned long v = strtoul(type.c_str(), &end, 16);
+    if (type.empty() || *end || v > 0xffff)
+      return false;
+    types->push_back((uint16_t)v);
+  }
+  return !types->empty();
+}
+
+}  // namespace
+
+GraphNode* NewGraphNode(const string& name, const string& args,
+                        GraphContext* context) {
+  string type = name.substr(0, name.find('#'));
+  if (type == "tap-input" || type == "udp-input") {
+    FrameDevice* device = type == "tap-input" ? context->tap : context->udp;
+    if (!device || !context->pool)
+      return NULL;
+    return new DeviceInputNode(name, device, context->pool);
+  }
+  if (type == "tap-output" || type == "udp-output") {
+    FrameDevice* device = type == "tap-output" ? context->tap : context->udp;
+    if (!device || (args != "" && (args != "gso" || !context->pool)))
+      return NULL;
+    return new DeviceOutputNode(
+        name, device, args == "gso" ? context->pool : NULL,
+        type == "tap-output" ? TRACE_TAP_PUT : TRACE_UDP_SEND);
+  }
+  if (type == "parse")
+    return new ParseNode(name);
+  if (type == "acl") {
+    vector<uint16_t> allowed;
+    if (!ParseEtherTypes(args.empty() ? "0800,86dd,0806" : args, &allowed))
+      return NULL;
+    return new AclNode(name, allowed);
+  }
+  if (type == "gro") {
+    unsigned long mtu = context->tap ? context->tap->mtu() : kMaxMtu;
+    if (!args.empty()) {
+      char* end;
+      mtu = strtoul(args.c_str(), &end, 10);
+      if (*end || mtu < 576 || mtu > kMaxMtu)
+        return NULL;
+    }
+    return new GroNode(name, (unsigned int)mtu);
+  }
+  if (type == "capture") {
+    for (int p = 0; p < CAPTURE_POINT_COUNT; ++p) {
+      if (args == CapturePointName((CapturePoint)p) ||
+          (args.empty() && p == CAPTURE_PRE_ENCRYPT))
+        return new CaptureNode(name, (CapturePoint)p);
+    }
+    return NULL;
+  }
+  if (type == "compress" && context->compressor)
+    return new CompressNode(name, context->compressor);
+  if (type == "decompress" && context->compressor)
+    return new DecompressNode(name, context->compressor);
+  return NULL;
+}
+
+ProcessGraph::ProcessGraph(const string& name) : name_(name) {}
+
+ProcessGraph::~ProcessGraph() {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    r->RemoveLabeled("graph=\"" + name_ + "\",node=\"" +
+                     nodes_[i].node->name() + "\"");
+    delete nodes_[i].node;
+  }
+}
+
+bool ProcessGraph::AddNode(GraphNode* node) {
+  if (Find(node->name()) >= 0) {
+    LOG(ERROR) << "Graph " << name_ << " already has a node "
+               << node->name();
+    delete node;
+    return false;
+  }
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "graph=\"" + name_ + "\",node=\"" + node->name() + "\"";
+  Node n;
+  n.node = node;
+  n.next = -1;
+  n.bursts = n.frames = n.cycles = 0;
+  n.bursts_total = r->NewCounter("bangnet_graph_node_bursts_total",
+      "Bursts a node of the processing graph worked on.", labels);
+  n.frames_total = r->NewCounter("bangnet_graph_node_frames_total",
+      "Frames a node of the processing graph worked on.", labels);
+  n.cycles_total = r->NewCounter("bangnet_graph_node_cycles_total",
+      "Cycles spent in a node of the processing graph.", labels);
+  if (node->fd() >= 0)
+    inputs_.push_back((int)nodes_.size());
+  nodes_.push_back(n);
+  return true;
+}
+
+int ProcessGraph::Find(const string& name) const {
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    if (nodes_[i].node->name() == name)
+      return (int)i;
+  }
+  return -1;
+}
+
+bool ProcessGraph::Connect(const string& from, const string& to) {
+  int f = Find(from), t = Find(to);
+  // Frames must reach an output, not come back around.
+  bool loop = f == t;
+  for (int i = t; i >= 0 && !loop; i = nodes_[i].next)
+    loop = nodes_[i].next == f;
+  if (f < 0 || t < 0 || loop || nodes_[t].node->fd() >= 0 ||
+      (nodes_[f].next >= 0 && nodes_[f].next != t)) {
+    LOG(ERROR) << "Unable to connect " << from << " to " << to
+               << " in graph " << name_;
+    return false;
+  }
+  nodes_[f].next = t;
+  return true;
+}
+
+bool ProcessGraph::Build(const string& spec, GraphContext* context) {
+  stringstream chains(spec);
+  string chain;
+  while (getline(chains, chain, ';')) {
+    stringstream tokens(chain);
+    string token, prev;
+    while (tokens >> token) {
+      size_t colon = token.find(':');
+      string name = token.substr(0, colon);
+      string args = colon == string::npos ? "" : token.substr(colon + 1);
+      if (Find(name) < 0) {
+        GraphNode* node = NewGraphNode(name, args, context);
+        if (!node) {
+          LOG(ERROR) << "Unable to create node " << token << " of graph "
+                     << name_;
+          return false;
+        }
+        if (!AddNode(node))
+          return false;
+      }
+      if (!prev.empty() && !Connect(prev, name))
+        return false;
+      prev = name;
+    }
+  }
+  if (inputs_.empty()) {
+    LOG(ERROR) << "Graph " << name_ << " has no input node";
+    return false;
+  }
+  return true;
+}
+
+void ProcessGraph::Run(const string& node, FrameBurst* burst) {
+  int i = Find(node);
+  if (i < 0) {
+    burst->Release();
+    return;
+  }
+  Run(i, burst);
+}
+
+void ProcessGraph::Run(int i, FrameBurst* burst) {
+  while (i >= 0) {
+    Node& n = nodes_[i];
+    bool input = n.node->fd() >= 0;
+    if (!input && !burst->count)
+      break;
+    int frames = burst->count;
+    uint64_t c0 = CycleCount();
+    n.node->Process(burst);
+    uint64_t cycles = CycleCount() - c0;
+    // Inputs count what they read, the others what they were given.
+    if (input)
+      frames = burst->count;
+    n.cycles += cycles;
+    n.cycles_total->Add(cycles);
+    if (frames) {
+      ++n.bursts;
+      n.frames += frames;
+      n.bursts_total->Increment();
+      n.frames_total->Add(frames);
+    }
+    burst->Compact();
+    i = n.next;
+  }
+  // What the last node left.
+  burst->Release();
+  TraceDrop();
+}
+
+int ProcessGraph::Poll(int timeout_ms) {
+  int n = (int)inputs_.size();
+  vector<struct pollfd> pfds(n);
+  for (int i = 0; i < n; ++i) {
+    pfds[i].fd = nodes_[inputs_[i]].node->fd();
+    pfds[i].events = POLLIN;
+    pfds[i].revents = 0;
+  }
+  if (poll(&pfds[0], n, timeout_ms) <= 0)
+    return 0;
+  int frames = 0;
+  for (int i = 0; i < n; ++i) {
+    if (!(pfds[i].revents & POLLIN))
+      continue;
+    uint64_t read = nodes_[inputs_[i]].frames;
+    FrameBurst burst;
+    Run(inputs_[i], &burst);
+    frames += (int)(nodes_[inputs_[i]].frames - read);
+  }
+  return frames;
+}
+
+ProcessGraph::NodeStats ProcessGraph::stats(int node) const {
+  const Node& n = nodes_[node];
+  NodeStats s;
+  s.name = n.node->name();
+  s.bursts = n.bursts;
+  s.frames = n.frames;
+  s.cycles = n.cycles;
+  return s;
+}
+
+string ProcessGraph::Describe() const {
+  string out;
+  for (int i = 0; i < size(); ++i) {
+    NodeStats s = stats(i);
+    const Node& n = nodes_[i];
+    char line[256];
+    snprintf(line, sizeof(line),
+             "%-12s -> %-12s frames %12llu  vector %5.1f  "
+             "cycles/frame %8.1f\n",
+             s.name.c_str(),
+             n.next >= 0 ? nodes_[n.next].node->name().c_str() : "-",
+             (unsigned long long)s.frames, s.vector_size(),
+             s.cycles_per_frame());
+    out += line;
+  }
+  return out;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,152 @@
+#ifndef BANGNET_GRAPH_H_
+#define BANGNET_GRAPH_H_
+
+#include <stdint.h>
+
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/frame_burst.h"
+#include "src/frame_device.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+class Compressor;
+
+// A stage of a ProcessGraph, which works on a burst of frames at a time.
+// Nodes with a descriptor are inputs: they fill an empty burst when it
+// polls readable. The others mark the frames of the burst they are given
+// with verdicts, and the frames left passing go on to the next node. A
+// node without a next node is an output, it must free or keep every frame.
+class GraphNode {
+public:
+  explicit GraphNode(const string& name) : name_(name) {}
+  virtual ~GraphNode() {}
+
+  const string& name() const { return name_; }
+
+  // Polls readable when an input node has frames, -1 for other nodes.
+  virtual int fd() const { return -1; }
+
+  virtual void Process(FrameBurst* burst) = 0;
+
+private:
+  string name_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(GraphNode);
+};
+
+// What the nodes of a graph built from a spec work on, not owned.
+struct GraphContext {
+  GraphContext() : pool(NULL), tap(NULL), udp(NULL), compressor(NULL) {}
+
+  // Buffers input nodes read frames into, which must hold the largest.
+  BufferPool* pool;
+  FrameDevice* tap;
+  // The underlay to the peer.
+  FrameDevice* udp;
+  Compressor* compressor;
+};
+
+// Creates the node named name, like "acl", given the arguments after the
+// colon in "acl:0800,86dd". Its type is the name up to a '#', so "acl#rx"
+// is another acl node. Returns null if there is no such type or the
+// arguments or context do not suit it. The node types are:
+//
+//   tap-input  udp-input     reads frames of the device
+//   tap-output udp-output    writes frames to the device
+//   tap-output:gso ..        segments tcp super frames larger than the
+//                            device mtu first, into the context's pool
+//   gro[:MTU]                coalesces tcp segments into super frames of
+//                            up to MTU, by default the tap's
+//   parse                    fills the burst metadata
+//   acl[:T,T..]              drops frames of ethertypes not listed, hex,
+//                            by default ipv4, ipv6 and arp
+//   capture[:POINT]          records frames to the running capture, at
+//                            pre-encrypt by default
+//   compress  decompress     with the context's compressor
+GraphNode* NewGraphNode(const string& name, const string& args,
+                        GraphContext* context);
+
+// Frames moving through named nodes a burst at a time, each node running
+// over the whole burst before the next one, so its code and data stay in
+// the caches. Every node counts the cycles it spends, the frames it sees
+// and how many bursts they came in, which points at the bottleneck under
+// load. Not thread safe, a graph runs on one thread.
+class ProcessGraph {
+public:
+  // name labels the metrics.
+  explicit ProcessGraph(const string& name);
+  ~ProcessGraph();
+
+  // Adds a node, owned by the graph. Returns false if the name is taken.
+  bool AddNode(GraphNode* node);
+
+  // Sends the frames node from passes on to node to.
+  bool Connect(const string& from, const string& to);
+
+  // Adds the nodes of spec, chains of node names separated by ';' whose
+  // frames go from left to right, like
+  //
+  //   tap-input parse acl udp-output; udp-input parse#rx tap-output
+  //
+  // Stages are added or removed by changing the spec. A name given twice
+  // is one node, which must have the same next node in both chains, so a
+  // type in more than one chain takes a '#' and an instance name.
+  bool Build(const string& spec, GraphContext* context);
+
+  // Waits up to timeout_ms for an input node to poll readable, and runs a
+  // burst of every ready one through the graph. Returns frames read.
+  int Poll(int timeout_ms);
+
+  // Runs burst through node and the nodes after it.
+  void Run(const string& node, FrameBurst* burst);
+
+  struct NodeStats {
+    string name;
+    uint64_t bursts;
+    uint64_t frames;
+    uint64_t cycles;
+
+    double cycles_per_frame() const {
+      return frames ? (double)cycles / frames : 0;
+    }
+    double vector_size() const {
+      return bursts ? (double)frames / bursts : 0;
+    }
+  };
+
+  // Nodes in the order added.
+  int size() const { return (int)nodes_.size(); }
+  NodeStats stats(int node) const;
+
+  // A line of stats per node, like for a status page.
+  string Describe() const;
+
+private:
+  struct Node {
+    GraphNode* node;
+    // Index of the next node, or -1.
+    int next;
+    uint64_t bursts;
+    uint64_t frames;
+    uint64_t cycles;
+    Counter* bursts_total;
+    Counter* frames_total;
+    Counter* cycles_total;
+  };
+
+  int Find(const string& name) const;
+  void Run(int node, FrameBurst* burst);
+
+  string name_;
+  vector<Node> nodes_;
+  // Indexes of the input nodes.
+  vector<int> inputs_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(ProcessGraph);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_GRAPH_H_
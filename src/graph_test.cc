@@ -0,0 +1,159 @@
+#include "src/graph.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "src/compress.h"
+#include "src/loopback_device.h"
+
+namespace bangnet {
+namespace {
+
+// A graph between two loopback links standing in for the tap and the
+// underlay, the test on the far end of both.
+class GraphTest : public ::testing::Test {
+protected:
+  GraphTest() : pool_(2048, 256), graph_("test") {
+    LoopbackDevice::CreatePair(1500, &tap_, &host_);
+    LoopbackDevice::CreatePair(1600, &udp_, &peer_);
+    context_.pool = &pool_;
+    context_.tap = tap_;
+    context_.udp = udp_;
+  }
+
+  ~GraphTest() {
+    delete tap_;
+    delete host_;
+    delete udp_;
+    delete peer_;
+  }
+
+  // Writes a frame of ethertype from the host, its bytes after the header
+  // all fill.
+  void Send(uint16_t type, unsigned int len, unsigned char fill) {
+    unsigned char f[1514];
+    memset(f, fill, len);
+    memset(f, 0x0c, 6);
+    memset(f + 6, 0x0a, 6);
+    f[12] = (unsigned char)(type >> 8);
+    f[13] = (unsigned char)type;
+    ASSERT_TRUE(host_->WriteFrame(f, len));
+  }
+
+  // Reads a frame waiting on dev, returns its length or 0.
+  unsigned int Receive(LoopbackDevice* dev, unsigned char* buf) {
+    FrameSlot slot;
+    slot.data = buf;
+    slot.cap = 2048;
+    return dev->TryReadBurst(&slot, 1) ? slot.len : 0;
+  }
+
+  BufferPool pool_;
+  LoopbackDevice* tap_;
+  LoopbackDevice* host_;
+  LoopbackDevice* udp_;
+  LoopbackDevice* peer_;
+  GraphContext context_;
+  ProcessGraph graph_;
+};
+
+TEST_F(GraphTest, RunsBurstsThroughNodes) {
+  ASSERT_TRUE(graph_.Build("tap-input parse acl:0800 udp-output",
+                           &context_));
+  ASSERT_EQ(4, graph_.size());
+  for (int i = 0; i < 10; ++i)
+    Send(i % 2 ? 0x0806 : 0x0800, 100, (unsigned char)i);
+  EXPECT_EQ(10, graph_.Poll(1000));
+
+  // Only ipv4 passes the acl.
+  unsigned char buf[2048];
+  for (int i = 0; i < 10; i += 2) {
+    ASSERT_EQ(100u, Receive(peer_, buf));
+    EXPECT_EQ(0x08, buf[12]);
+    EXPECT_EQ(i, buf[20]);
+  }
+  EXPECT_EQ(0u, Receive(peer_, buf));
+  EXPECT_EQ(256u, pool_.available());
+
+  // One burst of all frames, thinned by the acl.
+  ProcessGraph::NodeStats input = graph_.stats(0);
+  EXPECT_EQ("tap-input", input.name);
+  EXPECT_EQ(10u, input.frames);
+  EXPECT_EQ(10.0, input.vector_size());
+  EXPECT_EQ(10u, graph_.stats(2).frames);
+  ProcessGraph::NodeStats output = graph_.stats(3);
+  EXPECT_EQ(5u, output.frames);
+  EXPECT_EQ(1u, output.bursts);
+  EXPECT_GT(output.cycles_per_frame(), 0);
+  EXPECT_NE(string::npos,
+            graph_.Describe().find("acl          -> udp-output"));
+}
+
+TEST_F(GraphTest, InsertsStagesFromSpec) {
+  // Frames compressed towards the underlay come back restored.
+  Compressor compressor("graph-test", &pool_, CompressionOptions());
+  context_.compressor = &compressor;
+  ASSERT_TRUE(graph_.Build("tap-input capture compress udp-output; "
+                           "udp-input decompress tap-output", &context_));
+  EXPECT_EQ(7, graph_.size());
+  Send(0x0800, 1000, 0);
+  EXPECT_EQ(1, graph_.Poll(1000));
+  unsigned char buf[2048];
+  unsigned int len = Receive(peer_, buf);
+  ASSERT_GT(len, 0u);
+  EXPECT_LT(len, 1000u);
+
+  ASSERT_TRUE(peer_->WriteFrame(buf, len));
+  EXPECT_EQ(1, graph_.Poll(1000));
+  ASSERT_EQ(1000u, Receive(host_, buf));
+  EXPECT_EQ(0x0a, buf[6]);
+  EXPECT_EQ(0, buf[999]);
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(GraphTest, RejectsBadSpecs) {
+  EXPECT_FALSE(graph_.Build("tap-input encrypt udp-output", &context_));
+  EXPECT_FALSE(ProcessGraph("a").Build("tap-input acl:xyz", &context_));
+  EXPECT_FALSE(ProcessGraph("b").Build("parse acl", &context_));
+  EXPECT_FALSE(ProcessGraph("c").Build("tap-input compress", &context_));
+  // Frames go one way from a node, into no input and not around in a loop.
+  EXPECT_FALSE(ProcessGraph("d").Build(
+      "tap-input parse tap-output; udp-input parse udp-output", &context_));
+  EXPECT_FALSE(ProcessGraph("e").Build("tap-input parse udp-input",
+                                       &context_));
+  EXPECT_FALSE(ProcessGraph("f").Build("tap-input parse acl parse",
+                                       &context_));
+  EXPECT_TRUE(ProcessGraph("g").Build(
+      "tap-input parse udp-output; udp-input parse", &context_));
+  EXPECT_FALSE(ProcessGraph("h").Build("tap-input udp-output:tso",
+                                       &context_));
+  EXPECT_FALSE(ProcessGraph("i").Build("tap-input gro:100 tap-output",
+                                       &context_));
+  EXPECT_TRUE(ProcessGraph("j").Build(
+      "tap-input udp-output:gso; udp-input gro:9000 tap-output", &context_));
+  EXPECT_FALSE(ProcessGraph("k").Build("tap-input foo#rx", &context_));
+}
+
+TEST_F(GraphTest, NamesInstancesOfATypeApart) {
+  ASSERT_TRUE(graph_.Build("tap-input parse acl udp-output; "
+                           "udp-input parse#rx acl#rx:0800 tap-output",
+                           &context_));
+  EXPECT_EQ(8, graph_.size());
+  Send(0x0806, 100, 1);
+  EXPECT_EQ(1, graph_.Poll(1000));
+  unsigned char buf[2048];
+  unsigned int len = Receive(peer_, buf);
+  ASSERT_EQ(100u, len);
+
+  // Arp passes the acl towards the underlay, not the one from it.
+  ASSERT_TRUE(peer_->WriteFrame(buf, len));
+  EXPECT_EQ(1, graph_.Poll(1000));
+  EXPECT_EQ(0u, Receive(host_, buf));
+  EXPECT_EQ(1u, graph_.stats(5).frames);
+  EXPECT_EQ("acl#rx", graph_.stats(6).name);
+  EXPECT_EQ(256u, pool_.available());
+}
+
+}  // namespace
+}  // namespace bangnet
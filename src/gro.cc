@@ -0,0 +1,268 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "src/checksum.h"
+#include "src/frame_burst.h"
+#include "src/frame_view.h"
+#include "src/gro.h"
+
+namespace bangnet {
+
+namespace {
+
+// Tcp flags, in the 14th byte of the header.
+const uint8_t kTcpFin = 0x01;
+const uint8_t kTcpPsh = 0x08;
+const uint8_t kTcpAck = 0x10;
+const uint8_t kTcpCwr = 0x80;
+
+// Room in super frame buffers for the link header and tags.
+const unsigned int kLinkRoom = 64;
+
+uint8_t TcpFlags(const FrameView& v) {
+  return v.data()[v.l4_offset() + 13];
+}
+
+// Tcp over ipv4 without options or fragments, or over ipv6 without
+// extension headers, the segments the offloads rewrite.
+bool PlainTcp(const FrameView& v) {
+  if (!v.Has(FRAME_TCP) || v.Has(FRAME_FRAGMENT))
+    return false;
+  if (v.Has(FRAME_IPV4))
+    return v.ipv4()->ihl == 5;
+  return v.l4_offset() == v.l3_offset() + sizeof(struct ip6_hdr);
+}
+
+// Pseudo header sum of the tcp segment in frame, whose headers are laid
+// out like those of v.
+uint32_t PseudoHeaderSum(const unsigned char* frame, const FrameView& v,
+                         unsigned int tcp_len) {
+  const unsigned char* ip = frame + v.l3_offset();
+  if (v.Has(FRAME_IPV4))
+    return PseudoHeaderSum4(ip + 12, ip + 16, IPPROTO_TCP, tcp_len);
+  return PseudoHeaderSum6(ip + 8, ip + 24, IPPROTO_TCP, tcp_len);
+}
+
+// Sets the lengths and checksums of the headers of the tcp segment in
+// frame, laid out like v, with payload_len bytes of payload summing to
+// payload_sum.
+void FinishHeaders(unsigned char* frame, const FrameView& v,
+                   unsigned int payload_len, uint32_t payload_sum) {
+  unsigned int hlen = v.payload_offset() - v.l4_offset();
+  unsigned int tcp_len = hlen + payload_len;
+  if (v.Has(FRAME_IPV4)) {
+    struct iphdr* ip = (struct iphdr*)(frame + v.l3_offset());
+    ip->tot_len = htons((uint16_t)(20 + tcp_len));
+    ip->check = 0;
+    ip->check = InetChecksum(ip, 20);
+  } else {
+    struct ip6_hdr* ip = (struct ip6_hdr*)(frame + v.l3_offset());
+    ip->ip6_plen = htons((uint16_t)tcp_len);
+  }
+  struct tcphdr* tcp = (struct tcphdr*)(frame + v.l4_offset());
+  tcp->check = 0;
+  uint32_t sum = ChecksumPartial(tcp, hlen,
+                                 PseudoHeaderSum(frame, v, tcp_len));
+  tcp->check = ChecksumFold(sum + payload_sum);
+}
+
+// Sum of the payload of a segment, from its checksum: the sums of the
+// pseudo header, the header with the checksum and the payload add up to
+// zero. A corrupted payload gives a sum it does not have, so the checksum
+// of a super frame made of it fails as well.
+uint32_t PayloadSum(const FrameView& v) {
+  unsigned int hlen = v.payload_offset() - v.l4_offset();
+  uint32_t sum = ChecksumFold(
+      PseudoHeaderSum(v.data(), v, hlen + v.payload_len()));
+  return sum + ChecksumFold(ChecksumPartial(v.tcp(), hlen, 0));
+}
+
+// Whether two segments are of the same stream, over the same link header.
+bool SameFlow(const FrameView& a, const FrameView& b) {
+  if (a.l3_offset() != b.l3_offset() || a.l4_offset() != b.l4_offset() ||
+      a.ethertype() != b.ethertype() ||
+      memcmp(a.data(), b.data(), a.l3_offset()) != 0 ||
+      memcmp(a.tcp(), b.tcp(), 4) != 0)
+    return false;
+  if (a.Has(FRAME_IPV4))
+    return memcmp(&a.ipv4()->saddr, &b.ipv4()->saddr, 8) == 0;
+  return memcmp(&a.ipv6()->ip6_src, &b.ipv6()->ip6_src, 32) == 0;
+}
+
+}  // namespace
+
+int SegmentTcp(const Buffer* frame, unsigned int mtu, BufferPool* pool,
+               Buffer** out, int max) {
+  FrameView v((unsigned char*)frame->data(), frame->len());
+  if (!PlainTcp(v) || v.l3_end() - v.l3_offset() <= mtu)
+    return 0;
+  unsigned int hdr_end = v.payload_offset();
+  if (mtu <= hdr_end - v.l3_offset())
+    return 0;
+  unsigned int mss = mtu - (hdr_end - v.l3_offset());
+  unsigned int len = v.payload_len();
+  int n = (int)((len + mss - 1) / mss);
+  if (n > max || pool->buffer_size() < hdr_end + mss)
+    return 0;
+  int got = pool->GetBurst(out, n);
+  if (got < n) {
+    for (int i = 0; i < got; ++i)
+      out[i]->Unref();
+    return 0;
+  }
+
+  uint32_t seq = ntohl(v.tcp()->seq);
+  uint8_t flags = TcpFlags(v);
+  uint16_t id = v.Has(FRAME_IPV4) ? ntohs(v.ipv4()->id) : 0;
+  for (int i = 0; i < n; ++i) {
+    unsigned int off = i * mss;
+    unsigned int seg = len - off < mss ? len - off : mss;
+    unsigned char* d = out[i]->data();
+    memcpy(d, frame->data(), hdr_end);
+    memcpy(d + hdr_end, v.payload() + off, seg);
+    out[i]->set_len(hdr_end + seg);
+
+    ((struct tcphdr*)(d + v.l4_offset()))->seq = htonl(seq + off);
+    // Fin and psh end the data, cwr answers a congestion signal once.
+    uint8_t f = flags;
+    if (i < n - 1)
+      f &= ~(kTcpFin | kTcpPsh);
+    if (i > 0)
+      f &= ~kTcpCwr;
+    d[v.l4_offset() + 13] = f;
+    if (v.Has(FRAME_IPV4))
+      ((struct iphdr*)(d + v.l3_offset()))->id = htons((uint16_t)(id + i));
+    FinishHeaders(d, v, seg, ChecksumPartial(d + hdr_end, seg, 0));
+  }
+  return n;
+}
+
+TcpCoalescer::TcpCoalescer(const string& name, unsigned int mtu)
+    : name_(name), mtu_(mtu),
+      pool_(mtu + kLinkRoom, 2 * FrameBurst::kMaxFrames, 0) {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.segments = r->NewCounter("bangnet_gro_segments_total",
+      "Tcp segments coalesced into super frames.", labels);
+  metrics_.frames = r->NewCounter("bangnet_gro_frames_total",
+      "Super frames made of tcp segments.", labels);
+}
+
+TcpCoalescer::~TcpCoalescer() {
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+int TcpCoalescer::Coalesce(Buffer** frames, int n) {
+  Flow flows[kMaxFlows];
+  int nflows = 0, out = 0;
+  for (int i = 0; i < n; ++i) {
+    Buffer* b = frames[i];
+    FrameView v(b->data(), b->len());
+    Flow* flow = NULL;
+    if (v.Has(FRAME_TCP)) {
+      for (int j = 0; j < nflows && !flow; ++j) {
+        FrameView first(flows[j].first->data(), flows[j].first->len());
+        if (SameFlow(first, v))
+          flow = &flows[j];
+      }
+    }
+    bool data = PlainTcp(v) && v.payload_len() > 0 &&
+                (TcpFlags(v) & ~kTcpPsh) == kTcpAck;
+    if (flow && data && Merge(flow, v)) {
+      b->Unref();
+      if (flow->psh) {
+        Finish(flow, frames);
+        *flow = flows[--nflows];
+      }
+      continue;
+    }
+    // Anything else of the stream goes after what was coalesced so far.
+    if (flow) {
+      Finish(flow, frames);
+      *flow = flows[--nflows];
+    }
+    if (data && !(TcpFlags(v) & kTcpPsh) && nflows < kMaxFlows &&
+        v.l3_offset() <= kLinkRoom) {
+      Flow& f = flows[nflows++];
+      f.index = out;
+      f.first = b;
+      f.l3 = v.l3_offset();
+      f.l4 = v.l4_offset();
+      f.hdr_end = v.payload_offset();
+      f.next_seq = ntohl(v.tcp()->seq) + v.payload_len();
+      f.super = NULL;
+      f.payload_len = v.payload_len();
+      f.payload_sum = 0;
+      f.psh = false;
+    }
+    frames[out++] = b;
+  }
+  for (int j = 0; j < nflows; ++j)
+    Finish(&flows[j], frames);
+  return out;
+}
+
+bool TcpCoalescer::Merge(Flow* flow, const FrameView& v) {
+  FrameView first(flow->first->data(), flow->first->len());
+  struct tcphdr* t = first.tcp();
+  struct tcphdr* u = v.tcp();
+  if (ntohl(u->seq) != flow->next_seq || u->ack_seq != t->ack_seq ||
+      v.payload_offset() != flow->hdr_end ||
+      memcmp(t + 1, u + 1, flow->hdr_end - flow->l4 - 20) != 0 ||
+      flow->hdr_end - flow->l3 + flow->payload_len + v.payload_len() > mtu_)
+    return false;
+  // Packets whose ip headers differ in more than ids and lengths are not
+  // of one stream the way the receiver should see it.
+  if (first.Has(FRAME_IPV4)) {
+    struct iphdr* a = first.ipv4();
+    struct iphdr* c = v.ipv4();
+    if (a->tos != c->tos || a->ttl != c->ttl || a->frag_off != c->frag_off)
+      return false;
+  } else {
+    struct ip6_hdr* a = first.ipv6();
+    struct ip6_hdr* c = v.ipv6();
+    if (a->ip6_flow != c->ip6_flow || a->ip6_hlim != c->ip6_hlim)
+      return false;
+  }
+
+  if (!flow->super) {
+    Buffer* s = pool_.Get();
+    if (!s)
+      return false;
+    memcpy(s->data(), first.data(), flow->hdr_end + flow->payload_len);
+    flow->super = s;
+    flow->payload_sum = PayloadSum(first);
+    metrics_.segments->Increment();
+  }
+  unsigned char* d = flow->super->data();
+  memcpy(d + flow->hdr_end + flow->payload_len, v.payload(),
+         v.payload_len());
+  uint32_t sum = ~ChecksumFold(PayloadSum(v)) & 0xffff;
+  // A payload at an odd offset pairs its bytes the other way round.
+  if (flow->payload_len & 1)
+    sum = ((sum & 0xff) << 8) | (sum >> 8);
+  flow->payload_sum += sum;
+  flow->payload_len += v.payload_len();
+  flow->next_seq += v.payload_len();
+  // The latest window is the one the receiver goes by.
+  ((struct tcphdr*)(d + flow->l4))->window = u->window;
+  flow->psh = (TcpFlags(v) & kTcpPsh) != 0;
+  metrics_.segments->Increment();
+  return true;
+}
+
+void TcpCoalescer::Finish(Flow* flow, Buffer** frames) {
+  if (!flow->super)
+    return;
+  unsigned char* d = flow->super->data();
+  if (flow->psh)
+    d[flow->l4 + 13] |= kTcpPsh;
+  flow->super->set_len(flow->hdr_end + flow->payload_len);
+  FrameView first(flow->first->data(), flow->first->len());
+  FinishHeaders(d, first, flow->payload_len, flow->payload_sum);
+  flow->first->Unref();
+  frames[flow->index] = flow->super;
+  metrics_.frames->Increment();
+}
+
+}  // namespace bangnet
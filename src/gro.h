@@ -0,0 +1,89 @@
+#ifndef BANGNET_GRO_H_
+#define BANGNET_GRO_H_
+
+#include <stdint.h>
+
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/frame_view.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+// Software segmentation and receive offloads for tcp carried over the
+// tunnel. Without them every segment of a bulk stream pays for the whole
+// datapath. With a tap of a large mtu the kernel hands over tcp super
+// frames of up to 64KB, which go through the per frame stages once and are
+// split into segments that fit the underlay only at the output. On the far
+// end the segments of a stream arriving in a burst are coalesced back into
+// one frame before they are written to the tap.
+
+// Splits the tcp segment in frame, over ipv4 or ipv6, into segments whose
+// ip packets are at most mtu bytes. They are copied into buffers of pool
+// with their lengths, sequence numbers, ipv4 ids, flags and checksums set,
+// and appended to out. Returns how many, or 0 if the packet fits mtu, is
+// not tcp, has ip options or extension headers, needs more than max
+// segments or the pool ran dry. frame is left as is.
+int SegmentTcp(const Buffer* frame, unsigned int mtu, BufferPool* pool,
+               Buffer** out, int max);
+
+// Coalesces consecutive in order segments of tcp streams, like the kernel's
+// gro. Segments merge while they carry data with only ack and psh set, the
+// same ack and options, and the next sequence number; a psh ends the super
+// frame. Its checksum is derived from those of the segments, so the data is
+// only copied and a corrupted segment still fails the checksum of the
+// whole. Not thread safe.
+class TcpCoalescer {
+public:
+  // Super frames are ip packets of up to mtu bytes, in buffers of a pool
+  // of the coalescer's own. name labels the metrics.
+  TcpCoalescer(const string& name, unsigned int mtu);
+  ~TcpCoalescer();
+
+  unsigned int mtu() const { return mtu_; }
+
+  // Coalesces a burst of frames, taking the references of the segments
+  // merged. The frames of a stream keep their order, those of other
+  // streams and protocols pass as they are. Returns the frames left,
+  // packed at the front.
+  int Coalesce(Buffer** frames, int n);
+
+private:
+  // Streams tracked at a time in a burst, the others pass as they are.
+  static const int kMaxFlows = 8;
+
+  // A stream with a super frame open, at frames[index].
+  struct Flow {
+    int index;
+    // The first segment, and its headers.
+    Buffer* first;
+    unsigned int l3;
+    unsigned int l4;
+    unsigned int hdr_end;
+    uint32_t next_seq;
+    // Null until a second segment merges into the first.
+    Buffer* super;
+    unsigned int payload_len;
+    // Running sum of the payload, from the checksums of the segments.
+    uint32_t payload_sum;
+    bool psh;
+  };
+
+  bool Merge(Flow* flow, const FrameView& v);
+  void Finish(Flow* flow, Buffer** frames);
+
+  string name_;
+  unsigned int mtu_;
+  BufferPool pool_;
+
+  struct {
+    Counter* segments;
+    Counter* frames;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(TcpCoalescer);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_GRO_H_
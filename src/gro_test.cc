@@ -0,0 +1,234 @@
+#include "src/gro.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <gtest/gtest.h>
+
+#include "src/checksum.h"
+
+namespace bangnet {
+namespace {
+
+const uint8_t kAck = 0x10;
+const uint8_t kPsh = 0x08;
+const uint8_t kFin = 0x01;
+
+class GroTest : public ::testing::Test {
+protected:
+  GroTest() : pool_(kMaxFrameLen, 128) {}
+
+  // Returns a tcp segment of len bytes of payload, the byte at stream
+  // offset seq being seq * 7, of flow port over ipv4 or ipv6, with valid
+  // checksums.
+  Buffer* Segment(bool v6, uint16_t port, uint32_t seq, unsigned int len,
+                  uint8_t flags) {
+    Buffer* b = pool_.Get();
+    unsigned char* f = b->data();
+    memset(f, 0, 100);
+    memset(f, 0x0c, 6);
+    memset(f + 6, 0x0a, 6);
+    unsigned int l4;
+    if (v6) {
+      f[12] = 0x86;
+      f[13] = 0xdd;
+      f[14] = 0x60;
+      f[18] = (unsigned char)((len + 32) >> 8);
+      f[19] = (unsigned char)(len + 32);
+      f[20] = IPPROTO_TCP;
+      f[21] = 64;
+      f[22 + 15] = 1;
+      f[38 + 15] = 2;
+      l4 = 54;
+    } else {
+      f[12] = 0x08;
+      f[14] = 0x45;
+      f[16] = (unsigned char)((len + 52) >> 8);
+      f[17] = (unsigned char)(len + 52);
+      f[18] = 0x12;
+      f[20] = 0x40;
+      f[22] = 64;
+      f[23] = IPPROTO_TCP;
+      f[26] = 10;
+      f[29] = 1;
+      f[30] = 10;
+      f[33] = 2;
+      uint16_t c = InetChecksum(f + 14, 20);
+      memcpy(f + 24, &c, 2);
+      l4 = 34;
+    }
+    f[l4] = 0x30;
+    f[l4 + 1] = 0x39;
+    f[l4 + 2] = (unsigned char)(port >> 8);
+    f[l4 + 3] = (unsigned char)port;
+    uint32_t s = htonl(seq);
+    memcpy(f + l4 + 4, &s, 4);
+    f[l4 + 8] = 0x77;
+    // Header with the timestamp option, 32 bytes.
+    f[l4 + 12] = 0x80;
+    f[l4 + 13] = flags;
+    f[l4 + 14] = 0x10;
+    f[l4 + 20] = 1;
+    f[l4 + 21] = 1;
+    f[l4 + 22] = 8;
+    f[l4 + 23] = 10;
+    f[l4 + 27] = 5;
+    for (unsigned int i = 0; i < len; ++i)
+      f[l4 + 32 + i] = (unsigned char)((seq + i) * 7);
+    b->set_len(l4 + 32 + len);
+    uint16_t c = ChecksumFold(TcpSum(b));
+    memcpy(f + l4 + 16, &c, 2);
+    return b;
+  }
+
+  // Sum of the tcp segment in b and its pseudo header, 0xffff folded if
+  // the checksum is right.
+  static uint32_t TcpSum(const Buffer* b) {
+    FrameView v((unsigned char*)b->data(), b->len());
+    unsigned int len = v.l3_end() - v.l4_offset();
+    uint32_t sum = v.Has(FRAME_IPV4)
+        ? PseudoHeaderSum4(&v.ipv4()->saddr, &v.ipv4()->daddr,
+                           IPPROTO_TCP, len)
+        : PseudoHeaderSum6(&v.ipv6()->ip6_src, &v.ipv6()->ip6_dst,
+                           IPPROTO_TCP, len);
+    return ChecksumPartial(v.tcp(), len, sum);
+  }
+
+  static bool ChecksumsOk(const Buffer* b) {
+    FrameView v((unsigned char*)b->data(), b->len());
+    if (v.Has(FRAME_IPV4) && InetChecksum(v.ipv4(), 20) != 0)
+      return false;
+    return v.Has(FRAME_TCP) && ChecksumFold(TcpSum(b)) == 0;
+  }
+
+  static uint32_t Seq(const Buffer* b) {
+    FrameView v((unsigned char*)b->data(), b->len());
+    return ntohl(v.tcp()->seq);
+  }
+
+  static uint8_t Flags(const Buffer* b) {
+    FrameView v((unsigned char*)b->data(), b->len());
+    return b->data()[v.l4_offset() + 13];
+  }
+
+  void SegmentsAndCoalesces(bool v6) {
+    Buffer* super = Segment(v6, 80, 1000, 20001, kAck | kPsh);
+    ASSERT_TRUE(ChecksumsOk(super));
+    Buffer* segs[32];
+    int n = SegmentTcp(super, 1500, &pool_, segs, 32);
+    unsigned int mss = v6 ? 1428 : 1448;
+    ASSERT_EQ(v6 ? 15 : 14, n);
+    for (int i = 0; i < n; ++i) {
+      FrameView v(segs[i]->data(), segs[i]->len());
+      EXPECT_EQ(i < n - 1 ? mss : 20001 - (n - 1) * mss,
+                v.payload_len()) << i;
+      EXPECT_LE(v.l3_end() - v.l3_offset(), 1500u);
+      EXPECT_EQ(1000 + i * mss, Seq(segs[i]));
+      EXPECT_EQ(i < n - 1 ? kAck : kAck | kPsh, Flags(segs[i]));
+      EXPECT_TRUE(ChecksumsOk(segs[i])) << i;
+      if (!v6) {
+        EXPECT_EQ(0x1200 + i, ntohs(v.ipv4()->id));
+      }
+      EXPECT_EQ((unsigned char)((1000 + i * mss) * 7), v.payload()[0]);
+    }
+    EXPECT_EQ(0, SegmentTcp(segs[0], 1500, &pool_, segs + n, 32));
+
+    TcpCoalescer gro("gro-test", kMaxMtu);
+    EXPECT_EQ(1, gro.Coalesce(segs, n));
+    EXPECT_EQ(super->len(), segs[0]->len());
+    EXPECT_EQ(0, memcmp(super->data(), segs[0]->data(), super->len()));
+    EXPECT_TRUE(ChecksumsOk(segs[0]));
+    segs[0]->Unref();
+    super->Unref();
+    EXPECT_EQ(128u, pool_.available());
+  }
+
+  BufferPool pool_;
+};
+
+TEST_F(GroTest, SegmentsAndCoalescesIpv4) { SegmentsAndCoalesces(false); }
+
+TEST_F(GroTest, SegmentsAndCoalescesIpv6) { SegmentsAndCoalesces(true); }
+
+TEST_F(GroTest, CoalescesOddSizedSegments) {
+  Buffer* frames[3] = {Segment(false, 80, 0, 101, kAck),
+                       Segment(false, 80, 101, 33, kAck),
+                       Segment(false, 80, 134, 1000, kAck)};
+  TcpCoalescer gro("gro-test", 1500);
+  ASSERT_EQ(1, gro.Coalesce(frames, 3));
+  EXPECT_TRUE(ChecksumsOk(frames[0]));
+  Buffer* whole = Segment(false, 80, 0, 1134, kAck);
+  EXPECT_EQ(0, memcmp(whole->data(), frames[0]->data(), whole->len()));
+  whole->Unref();
+  frames[0]->Unref();
+}
+
+TEST_F(GroTest, KeepsOrderOfStreams) {
+  Buffer* arp = pool_.Get();
+  memset(arp->data(), 0, 60);
+  arp->data()[12] = 0x08;
+  arp->data()[13] = 0x06;
+  arp->set_len(60);
+  // Stream 80 has a gap before its last segment and 81 ends with a fin.
+  Buffer* frames[8] = {
+    Segment(false, 80, 0, 1000, kAck),
+    arp,
+    Segment(false, 81, 0, 1000, kAck),
+    Segment(false, 80, 1000, 1000, kAck),
+    Segment(false, 81, 1000, 1000, kAck),
+    Segment(false, 81, 2000, 0, kAck | kFin),
+    Segment(false, 80, 3000, 1000, kAck),
+    Segment(false, 80, 4000, 1000, kAck),
+  };
+  Buffer* fin = frames[5];
+  TcpCoalescer gro("gro-test", 65535);
+  ASSERT_EQ(5, gro.Coalesce(frames, 8));
+  EXPECT_EQ(0u, Seq(frames[0]));
+  EXPECT_EQ(66u + 2000, frames[0]->len());
+  EXPECT_EQ(arp, frames[1]);
+  EXPECT_EQ(66u + 2000, frames[2]->len());
+  EXPECT_EQ(fin, frames[3]);
+  EXPECT_EQ(3000u, Seq(frames[4]));
+  EXPECT_EQ(66u + 2000, frames[4]->len());
+  for (int i = 0; i < 5; ++i) {
+    if (i != 1) {
+      EXPECT_TRUE(ChecksumsOk(frames[i])) << i;
+    }
+    frames[i]->Unref();
+  }
+  EXPECT_EQ(128u, pool_.available());
+}
+
+TEST_F(GroTest, StopsAtPushAndMtu) {
+  Buffer* frames[5] = {
+    Segment(false, 80, 0, 1000, kAck),
+    Segment(false, 80, 1000, 1000, kAck | kPsh),
+    Segment(false, 80, 2000, 1000, kAck),
+    Segment(false, 80, 3000, 1000, kAck),
+    Segment(false, 80, 4000, 1000, kAck),
+  };
+  // Two segments and their headers fit.
+  TcpCoalescer gro("gro-test", 2100);
+  ASSERT_EQ(3, gro.Coalesce(frames, 5));
+  EXPECT_EQ(kAck | kPsh, Flags(frames[0]));
+  EXPECT_EQ(2000u, Seq(frames[1]));
+  EXPECT_EQ(4000u, Seq(frames[2]));
+  EXPECT_EQ(66u + 2000, frames[0]->len());
+  EXPECT_EQ(66u + 2000, frames[1]->len());
+  EXPECT_EQ(66u + 1000, frames[2]->len());
+  for (int i = 0; i < 3; ++i)
+    frames[i]->Unref();
+}
+
+TEST_F(GroTest, KeepsCorruptionDetectable) {
+  Buffer* frames[2] = {Segment(true, 80, 0, 1000, kAck),
+                       Segment(true, 80, 1000, 1000, kAck)};
+  frames[1]->data()[frames[1]->len() - 10] ^= 0x40;
+  TcpCoalescer gro("gro-test", 9000);
+  ASSERT_EQ(1, gro.Coalesce(frames, 2));
+  EXPECT_FALSE(ChecksumsOk(frames[0]));
+  frames[0]->Unref();
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,95 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "src/checksum.h"
+#include "src/icmp.h"
+
+namespace bangnet {
+
+namespace {
+
+// Errors must not exceed the minimum mtu of the protocol.
+const unsigned int kMaxError4 = 576;
+const unsigned int kMaxError6 = 1280;
+
+unsigned int TooBig4(const unsigned char* ip, unsigned int len,
+                     unsigned int mtu, unsigned char* out) {
+  unsigned int ihl = (ip[0] & 0xf) * 4;
+  if (len <= mtu || len < 20 || ihl < 20 || len < ihl)
+    return 0;
+  // Only when DF is set, and never in reply to an ICMP error.
+  if (!(ip[6] & 0x40))
+    return 0;
+  if (ip[9] == 1 && len >= ihl + 1 && ip[ihl] != 0 && ip[ihl] != 8)
+    return 0;
+
+  unsigned int quote = len;
+  if (20 + 8 + quote > kMaxError4)
+    quote = kMaxError4 - 20 - 8;
+  unsigned int total = 20 + 8 + quote;
+
+  memset(out, 0, 28);
+  out[0] = 0x45;
+  *(uint16_t*)(out + 2) = htons((uint16_t)total);
+  out[8] = 64;
+  out[9] = 1;
+  memcpy(out + 12, ip + 16, 4);
+  memcpy(out + 16, ip + 12, 4);
+  *(uint16_t*)(out + 10) = InetChecksum(out, 20);
+
+  unsigned char* icmp = out + 20;
+  icmp[0] = 3;  // Destination unreachable
+  icmp[1] = 4;  // Fragmentation needed
+  *(uint16_t*)(icmp + 6) = htons((uint16_t)mtu);
+  memcpy(icmp + 8, ip, quote);
+  *(uint16_t*)(icmp + 2) = InetChecksum(icmp, 8 + quote);
+  return total;
+}
+
+unsigned int TooBig6(const unsigned char* ip, unsigned int len,
+                     unsigned int mtu, unsigned char* out) {
+  if (len <= mtu || len < 40)
+    return 0;
+  // Not in reply to ICMPv6 errors, types below 128.
+  if (ip[6] == 58 && len >= 41 && ip[40] < 128)
+    return 0;
+
+  unsigned int quote = len;
+  if (40 + 8 + quote > kMaxError6)
+    quote = kMaxError6 - 40 - 8;
+  unsigned int payload = 8 + quote;
+
+  memset(out, 0, 48);
+  out[0] = 0x60;
+  *(uint16_t*)(out + 4) = htons((uint16_t)payload);
+  out[6] = 58;
+  out[7] = 64;
+  memcpy(out + 8, ip + 24, 16);
+  memcpy(out + 24, ip + 8, 16);
+
+  unsigned char* icmp = out + 40;
+  icmp[0] = 2;  // Packet too big
+  icmp[1] = 0;
+  *(uint32_t*)(icmp + 4) = htonl(mtu);
+  memcpy(icmp + 8, ip, quote);
+  uint32_t sum = PseudoHeaderSum6(out + 8, out + 24, 58, payload);
+  *(uint16_t*)(icmp + 2) = ChecksumFold(ChecksumPartial(icmp, payload, sum));
+  return 40 + payload;
+}
+
+}  // namespace
+
+unsigned int BuildIcmpTooBig(const unsigned char* frame, unsigned int len,
+                             unsigned int mtu, unsigned char* out) {
+  if (len < 14)
+    return 0;
+  uint16_t type = (uint16_t)(frame[12] << 8 | frame[13]);
+  if (type == 0x0800)
+    return TooBig4(frame + 14, len - 14, mtu, out);
+  if (type == 0x86dd)
+    return TooBig6(frame + 14, len - 14, mtu < kMaxError6 ? kMaxError6 : mtu,
+                   out);
+  return 0;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,21 @@
+#ifndef BANGNET_ICMP_H_
+#define BANGNET_ICMP_H_
+
+#include "src/common.h"
+
+namespace bangnet {
+
+// Builds the ICMP error telling the sender of an ethernet frame that its
+// packet does not fit a link of `mtu` bytes: "fragmentation needed" for
+// ipv4 packets with DF set, "packet too big" for ipv6.
+//
+// out receives the ip packet of the error, addressed back to the sender,
+// and must hold 1280 bytes. Returns its length, or 0 if no error is due:
+// the packet fits, it is ipv4 without DF, or it is an ICMP error itself.
+// Ipv6 links have an mtu of at least 1280, smaller ones are raised to it.
+unsigned int BuildIcmpTooBig(const unsigned char* frame, unsigned int len,
+                             unsigned int mtu, unsigned char* out);
+
+}  // namespace bangnet
+
+#endif  // BANGNET_ICMP_H_
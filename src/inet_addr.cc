@@ -38,10 +38,10 @@ namespace bangnet {
   string InetAddress::ToIpString() const {
     char buf[128];
     if(family() == AF_INET) {
-      if (inet_ntop(AF_INET, raw_ip_addr(), buf, sizeof(128)))
+      if (inet_ntop(AF_INET, raw_ip_addr(), buf, sizeof(buf)))
         return string(buf);
     } else {
-      if (inet_ntop(AF_INET6, raw_ip_addr(), buf, sizeof(128)))
+      if (inet_ntop(AF_INET6, raw_ip_addr(), buf, sizeof(buf)))
         return string(buf);
     }
     return string();
@@ -62,16 +62,27 @@ namespace bangnet {
   }
 
   bool InetAddress::operator==(const InetAddress &a) const {
-    if (family() == AF_INET) {
-      if (a.family() == AF_INET)
-        return ((int*)raw_ip_addr() == (int*)a.raw_ip_addr()) && 
-          (port() == a.port());
+    if (family() != a.family())
       return false;
-    } else if (family() == AF_INET6) {
-      // if (a.family() == AF_INET6)
-      //   return (*raw_ip_addr() == *a.raw_ip_addr()) && (port() == a.port());
+    if (family() == AF_INET)
+      return memcmp(raw_ip_addr(), a.raw_ip_addr(), 4) == 0 &&
+        port() == a.port();
+    if (family() == AF_INET6)
+      return memcmp(raw_ip_addr(), a.raw_ip_addr(), 16) == 0 &&
+        port() == a.port();
+    // Null addresses are all equal.
+    return true;
+  }
+
+  bool InetAddress::operator<(const InetAddress &a) const {
+    if (family() != a.family())
+      return family() < a.family();
+    if (!*this)
       return false;
-    }
+    int c = memcmp(raw_ip_addr(), a.raw_ip_addr(), IsV4() ? 4 : 16);
+    if (c)
+      return c < 0;
+    return port() < a.port();
   }
 
 }  // namespace bangnet
@@ -26,6 +26,11 @@ public:
     memcpy(&sa_, &ip.sa_, sizeof(sa_));
   }
 
+  InetAddress& operator=(const InetAddress& ip) {
+    memcpy(&sa_, &ip.sa_, sizeof(sa_));
+    return *this;
+  }
+
   // InetAddress(const struct sockaddr *sa) {
   //   SetInetAddr(sa);
   // }
@@ -122,7 +127,10 @@ public:
     return 0;
   }
 
+  // Compare family, address and port, so addresses can key maps and sets.
   bool operator==(const InetAddress &a) const;
+  bool operator!=(const InetAddress &a) const { return !(*this == a); }
+  bool operator<(const InetAddress &a) const;
 
   // Returns true if this address is a internet style address.
   // Caller should call it like this `if (ip)`.
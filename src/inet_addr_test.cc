@@ -0,0 +1,41 @@
+#include "src/inet_addr.h"
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+TEST(InetAddressTest, Compares) {
+  InetAddress a("10.0.0.1", 4789), b("10.0.0.1", 4789);
+  EXPECT_TRUE(a == b);
+  EXPECT_FALSE(a != b);
+  EXPECT_FALSE(a < b);
+  EXPECT_TRUE(a != InetAddress("10.0.0.1", 4790));
+  EXPECT_TRUE(a != InetAddress("10.0.0.2", 4789));
+  EXPECT_TRUE(a < InetAddress("10.0.0.2", 1));
+  EXPECT_TRUE(a < InetAddress("10.0.0.1", 4790));
+
+  InetAddress c("fd00::1", 4789), d("fd00::1", 4789);
+  EXPECT_TRUE(c == d);
+  EXPECT_TRUE(c != InetAddress("fd00::2", 4789));
+  EXPECT_TRUE(c < InetAddress("fd00::2", 4789));
+  // Ipv4 orders before ipv6.
+  EXPECT_TRUE(a != c);
+  EXPECT_TRUE(a < c);
+  EXPECT_FALSE(c < a);
+
+  EXPECT_TRUE(InetAddress() == InetAddress());
+  EXPECT_TRUE(InetAddress() != a);
+}
+
+TEST(InetAddressTest, KeysSets) {
+  set<InetAddress> s;
+  s.insert(InetAddress("10.0.0.1", 1));
+  s.insert(InetAddress("10.0.0.1", 1));
+  s.insert(InetAddress("10.0.0.1", 2));
+  s.insert(InetAddress("fd00::1", 1));
+  EXPECT_EQ(3u, s.size());
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "src/loopback_device.h"
+
+namespace bangnet {
+
+void LoopbackDevice::CreatePair(unsigned int mtu, LoopbackDevice** a,
+                                LoopbackDevice** b) {
+  static int next_id = 0;
+  int fds[2];
+  CHECK_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds))
+      << "Unable to create loopback socketpair";
+
+  // Room for a few thousand frames in flight, like a device queue.
+  int bufsize = 4 << 20;
+  for (int i = 0; i < 2; ++i) {
+    setsockopt(fds[i], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+    setsockopt(fds[i], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+  }
+
+  char name[32];
+  int id = next_id++;
+  snprintf(name, sizeof(name), "lo%da", id);
+  *a = new LoopbackDevice(fds[0], mtu, name);
+  snprintf(name, sizeof(name), "lo%db", id);
+  *b = new LoopbackDevice(fds[1], mtu, name);
+}
+
+LoopbackDevice::LoopbackDevice(int fd, unsigned int mtu, const string& name)
+    : fd_(fd), mtu_(mtu), name_(name), tx_drops_(0) {}
+
+LoopbackDevice::~LoopbackDevice() {
+  this->close();
+}
+
+void LoopbackDevice::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool LoopbackDevice::WriteFrame(const void* frame, unsigned int len) {
+  if (fd_ < 0)
+    return false;
+  if (len > mtu_ + header_len()) {
+    ++tx_drops_;
+    return false;
+  }
+  return send(fd_, frame, len, 0) == (ssize_t)len;
+}
+
+unsigned int LoopbackDevice::ReadFrame(void* buf, unsigned int cap) {
+  while (fd_ >= 0) {
+    ssize_t n = recv(fd_, buf, cap, 0);
+    if (n > 0)
+      return (unsigned int)n;
+    if (n == 0 || errno != EINTR)
+      return 0;
+  }
+  return 0;
+}
+
+int LoopbackDevice::ReadBurst(FrameSlot* frames, int n) {
+  // Block for the first frame only.
+  return RecvBurst(frames, n, MSG_WAITFORONE);
+}
+
+int LoopbackDevice::TryReadBurst(FrameSlot* frames, int n) {
+  return RecvBurst(frames, n, MSG_DONTWAIT);
+}
+
+int LoopbackDevice::RecvBurst(FrameSlot* frames, int n, int flags) {
+  if (fd_ < 0 || n <= 0)
+    return 0;
+  if (n > kMaxBurst)
+    n = kMaxBurst;
+
+  struct mmsghdr msgs[kMaxBurst];
+  struct iovec iovs[kMaxBurst];
+  memset(msgs, 0, sizeof(msgs[0]) * n);
+  for (int i = 0; i < n; ++i) {
+    iovs[i].iov_base = frames[i].data;
+    iovs[i].iov_len = frames[i].cap;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int got;
+  do {
+    got = recvmmsg(fd_, msgs, n, flags, NULL);
+  } while (got < 0 && errno == EINTR);
+  if (got <= 0)
+    return 0;
+  for (int i = 0; i < got; ++i)
+    frames[i].len = msgs[i].msg_len;
+  return got;
+}
+
+int LoopbackDevice::WriteBurst(const FrameSlot* frames, int n) {
+  if (fd_ < 0 || n <= 0)
+    return 0;
+  if (n > kMaxBurst)
+    n = kMaxBurst;
+
+  struct mmsghdr msgs[kMaxBurst];
+  struct iovec iovs[kMaxBurst];
+  memset(msgs, 0, sizeof(msgs[0]) * n);
+  int m = 0;
+  for (int i = 0; i < n; ++i) {
+    // Oversized frames are dropped, like by WriteFrame().
+    if (frames[i].len > mtu_ + header_len()) {
+      ++tx_drops_;
+      continue;
+    }
+    iovs[m].iov_base = frames[i].data;
+    iovs[m].iov_len = frames[i].len;
+    msgs[m].msg_hdr.msg_iov = &iovs[m];
+    msgs[m].msg_hdr.msg_iovlen = 1;
+    ++m;
+  }
+  if (m == 0)
+    return 0;
+
+  int sent;
+  do {
+    sent = sendmmsg(fd_, msgs, m, 0);
+  } while (sent < 0 && errno == EINTR);
+  return sent < 0 ? 0 : sent;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,57 @@
+#ifndef BANGNET_LOOPBACK_DEVICE_H_
+#define BANGNET_LOOPBACK_DEVICE_H_
+
+#include "src/common.h"
+#include "src/frame_device.h"
+
+namespace bangnet {
+
+// One end of an in-memory link made of a SOCK_SEQPACKET socketpair. Frames
+// written to one end are read from the other, which stands in for a tap
+// device in tests and benchmarks without root or /dev/net/tun.
+class LoopbackDevice : public FrameDevice {
+public:
+  // Creates both ends of a link, owned by the caller.
+  static void CreatePair(unsigned int mtu, LoopbackDevice** a,
+                         LoopbackDevice** b);
+
+  ~LoopbackDevice();
+
+  string device_name() const { return name_; }
+  unsigned int mtu() const { return mtu_; }
+  bool SetMtu(unsigned int mtu) { mtu_ = mtu; return true; }
+  int fd() const { return fd_; }
+  bool IsOpen() const { return fd_ >= 0; }
+  void close();
+
+  bool WriteFrame(const void* frame, unsigned int len);
+  unsigned int ReadFrame(void* buf, unsigned int cap);
+
+  // Bursts take a single recvmmsg/sendmmsg call.
+  int ReadBurst(FrameSlot* frames, int n);
+  int TryReadBurst(FrameSlot* frames, int n);
+  int WriteBurst(const FrameSlot* frames, int n);
+
+  // Frames dropped for being larger than the mtu allows.
+  uint64_t tx_drops() const { return tx_drops_; }
+
+private:
+  LoopbackDevice(int fd, unsigned int mtu, const string& name);
+
+  // recvmmsg() with flags, returns the frames read or 0.
+  int RecvBurst(FrameSlot* frames, int n, int flags);
+
+  // Largest burst handled by one call.
+  static const int kMaxBurst = 64;
+
+  int fd_;
+  unsigned int mtu_;
+  string name_;
+  uint64_t tx_drops_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(LoopbackDevice);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_LOOPBACK_DEVICE_H_
@@ -0,0 +1,82 @@
+#include "src/loopback_device.h"
+
+#include <gtest/gtest.h>
+
+#include "src/pktgen.h"
+
+namespace bangnet {
+namespace {
+
+TEST(LoopbackDeviceTest, FrameRoundTrip) {
+  LoopbackDevice* a;
+  LoopbackDevice* b;
+  LoopbackDevice::CreatePair(1500, &a, &b);
+
+  const char frame[] = "0123456789abcdef";
+  EXPECT_TRUE(a->WriteFrame(frame, sizeof(frame)));
+  char buf[2048];
+  EXPECT_EQ(sizeof(frame), b->ReadFrame(buf, sizeof(buf)));
+  EXPECT_STREQ(frame, buf);
+
+  // Oversized frames are dropped.
+  vector<char> big(1500 + 15);
+  EXPECT_FALSE(a->WriteFrame(&big[0], big.size()));
+  EXPECT_EQ(1u, a->tx_drops());
+
+  // Also in a burst, the frames around them still go out.
+  FrameSlot frames[3];
+  for (int i = 0; i < 3; ++i) {
+    frames[i].data = (unsigned char*)&big[0];
+    frames[i].len = big.size();
+  }
+  frames[1].data = (unsigned char*)frame;
+  frames[1].len = sizeof(frame);
+  EXPECT_EQ(1, a->WriteBurst(frames, 3));
+  EXPECT_EQ(3u, a->tx_drops());
+  EXPECT_EQ(sizeof(frame), b->ReadFrame(buf, sizeof(buf)));
+  delete a;
+  delete b;
+}
+
+TEST(LoopbackDeviceTest, BurstWithGeneratedFrames) {
+  LoopbackDevice* a;
+  LoopbackDevice* b;
+  LoopbackDevice::CreatePair(1500, &a, &b);
+
+  PktgenOptions options;
+  options.frame_size = 128;
+  options.flows = 4;
+  PacketGenerator gen(options);
+
+  const int n = 16;
+  vector<unsigned char> mem(n * 256);
+  FrameSlot frames[n];
+  for (int i = 0; i < n; ++i) {
+    frames[i].data = &mem[i * 256];
+    frames[i].cap = 256;
+  }
+  gen.Fill(frames, n, 42);
+  EXPECT_EQ(n, a->WriteBurst(frames, n));
+
+  for (int i = 0; i < n; ++i)
+    memset(frames[i].data, 0, 256);
+  int got = 0;
+  while (got < n) {
+    int r = b->ReadBurst(frames + got, n - got);
+    ASSERT_GT(r, 0);
+    got += r;
+  }
+  for (int i = 0; i < n; ++i) {
+    uint64_t seq, stamp;
+    ASSERT_TRUE(PacketGenerator::Parse(frames[i].data, frames[i].len, &seq,
+                                       &stamp));
+    EXPECT_EQ(128u, frames[i].len);
+    EXPECT_EQ((uint64_t)i, seq);
+    EXPECT_EQ(42u, stamp);
+  }
+  delete a;
+  delete b;
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -5,8 +5,21 @@
 namespace bangnet {
 namespace {
 
-class MACTest : public ::testing::Test {
-  
+TEST(MACTest, FromString) {
+  MacAddress mac;
+  EXPECT_TRUE(mac.FromString("02:00:5e:10:00:01"));
+  EXPECT_EQ(0x02, mac.data(0));
+  EXPECT_EQ(0x01, mac.data(5));
+  EXPECT_EQ("02:00:5e:10:00:01", mac.ToString());
+  EXPECT_FALSE(mac.FromString("12:34:56:78"));
 }
+
+TEST(MACTest, Broadcast) {
+  MacAddress mac(0xff);
+  EXPECT_TRUE(mac.IsBroadcast());
+  mac.SetZero();
+  EXPECT_FALSE(mac.IsBroadcast());
 }
-}  // namespace bangnet
\ No newline at end of file
+
+}  // namespace
+}  // namespace bangnet
@@ -1,15 +1,99 @@
+// Bridges a tap device to a peer over udp through a processing graph.
+// Flags:
+//
+//   --peer=IP            host of the peer, required
+//   --mac=XX:XX:..       mac address of the tap
+//   --port=N             udp port of both ends, 4789 by default
+//   --graph=SPEC         the nodes frames go through, see ProcessGraph
+//   --stats_s=N          logs the stats of every node each N seconds
+
+#include <stdlib.h>
+#include <string.h>
+
 #include <iostream>
 
+#include "src/clock.h"
 #include "src/common.h"
+#include "src/compress.h"
+#include "src/graph.h"
 #include "src/tap.h"
 #include "src/mac.h"
+#include "src/udp_device.h"
 
 using namespace bangnet;
 
+namespace {
+
+const char kDefaultGraph[] =
+    "tap-input parse acl udp-output; udp-input tap-output";
+
+bool FlagValue(const char* arg, const char* name, const char** value) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+    return false;
+  *value = arg + len + 1;
+  return true;
+}
+
+}  // namespace
+
 int main(int argc, char** argv) {
+  string peer, mac_string = "02:62:67:00:00:01", spec = kDefaultGraph;
+  unsigned int port = 4789, stats_s = 0;
+  for (int i = 1; i < argc; ++i) {
+    const char* v;
+    if (FlagValue(argv[i], "--peer", &v)) {
+      peer = v;
+    } else if (FlagValue(argv[i], "--mac", &v)) {
+      mac_string = v;
+    } else if (FlagValue(argv[i], "--port", &v)) {
+      port = (unsigned int)strtoul(v, NULL, 10);
+    } else if (FlagValue(argv[i], "--graph", &v)) {
+      spec = v;
+    } else if (FlagValue(argv[i], "--stats_s", &v)) {
+      stats_s = (unsigned int)strtoul(v, NULL, 10);
+    } else {
+      fprintf(stderr, "Unknown flag %s\n", argv[i]);
+      return 1;
+    }
+  }
+  InetAddress peer_addr(peer, port);
+  if (!peer_addr) {
+    fprintf(stderr, "--peer=IP is required\n");
+    return 1;
+  }
+
   MacAddress mac;
-  mac.FromString("12:34:56:78");
+  if (!mac.FromString(mac_string.c_str())) {
+    fprintf(stderr, "Invalid mac %s\n", mac_string.c_str());
+    return 1;
+  }
   Tap tap(mac);
+  // Room for the headers stages like compress add to frames.
+  UdpDevice udp(InetAddress(peer_addr.IsV4() ? "0.0.0.0" : "::", port),
+                peer_addr, tap.mtu() + 64);
+  if (!tap.IsOpen() || !udp.IsOpen())
+    return 1;
+
+  BufferPool pool(tap.max_frame_len(), 4096);
+  Compressor compressor(peer, &pool, CompressionOptions());
+  GraphContext context;
+  context.pool = &pool;
+  context.tap = &tap;
+  context.udp = &udp;
+  context.compressor = &compressor;
+  ProcessGraph graph("main");
+  if (!graph.Build(spec, &context))
+    return 1;
 
+  CycleClock::Calibrate(50 * 1000 * 1000);
+  uint64_t next_stats = MonotonicNs() + stats_s * 1000000000ull;
+  for (;;) {
+    graph.Poll(100);
+    if (stats_s && MonotonicNs() >= next_stats) {
+      LOG(INFO) << "Graph stats:\n" << graph.Describe();
+      next_stats += stats_s * 1000000000ull;
+    }
+  }
   return 0;
-}
\ No newline at end of file
+}
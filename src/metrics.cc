@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "src/metrics.h"
+
+namespace bangnet {
+
+namespace metrics_internal {
+
+int AssignThreadSlot() {
+  static std::atomic<int> next_slot(0);
+  int slot = next_slot.fetch_add(1, std::memory_order_relaxed);
+  return slot < kMaxMetricThreads - 1 ? slot : kMaxMetricThreads - 1;
+}
+
+}  // namespace metrics_internal
+
+uint64_t Counter::Value() const {
+  uint64_t sum = 0;
+  for (int i = 0; i < kMaxMetricThreads; ++i)
+    sum += cells_[i].value.load(std::memory_order_relaxed);
+  return sum;
+}
+
+uint64_t HistogramSnapshot::Percentile(double q) const {
+  if (count == 0)
+    return 0;
+  if (q < 0)
+    q = 0;
+  if (q > 1)
+    q = 1;
+
+  uint64_t rank = (uint64_t)(q * count + 0.5);
+  if (rank == 0)
+    rank = 1;
+  uint64_t seen = 0;
+  for (size_t b = 0; b < buckets.size(); ++b) {
+    seen += buckets[b];
+    if (seen >= rank)
+      return Histogram::BucketUpper((int)b);
+  }
+  return Histogram::BucketUpper((int)buckets.size() - 1);
+}
+
+void HistogramSnapshot::Merge(const HistogramSnapshot& other) {
+  if (buckets.size() < other.buckets.size())
+    buckets.resize(other.buckets.size(), 0);
+  for (size_t b = 0; b < other.buckets.size(); ++b)
+    buckets[b] += other.buckets[b];
+  count += other.count;
+  sum += other.sum;
+}
+
+Histogram::Histogram() {
+  for (int i = 0; i < kMaxMetricThreads; ++i)
+    slots_[i].store(0, std::memory_order_relaxed);
+}
+
+Histogram::~Histogram() {
+  for (int i = 0; i < kMaxMetricThreads; ++i)
+    delete slots_[i].load(std::memory_order_relaxed);
+}
+
+Histogram::Slot* Histogram::NewSlot(int slot) {
+  // Value-initialized, so all buckets start at zero.
+  Slot* s = new Slot();
+  Slot* expected = 0;
+  if (!slots_[slot].compare_exchange_strong(expected, s,
+                                            std::memory_order_acq_rel)) {
+    // Another thread sharing the last slot was first.
+    delete s;
+    return expected;
+  }
+  return s;
+}
+
+uint64_t Histogram::BucketUpper(int b) {
+  if (b < kSubBuckets)
+    return (uint64_t)b;
+  int e = b / kSubBuckets + kSubBits - 1;
+  uint64_t m = (uint64_t)(b % kSubBuckets);
+  uint64_t width = 1ull << (e - kSubBits);
+  return ((kSubBuckets + m) << (e - kSubBits)) + width - 1;
+}
+
+HistogramSnapshot Histogram::Snapshot() const {
+  HistogramSnapshot snap;
+  snap.buckets.assign(kBuckets, 0);
+  for (int i = 0; i < kMaxMetricThreads; ++i) {
+    const Slot* s = slots_[i].load(std::memory_order_acquire);
+    if (!s)
+      continue;
+    for (int b = 0; b < kBuckets; ++b)
+      snap.buckets[b] += s->buckets[b].load(std::memory_order_relaxed);
+    snap.count += s->count.load(std::memory_order_relaxed);
+    snap.sum += s->sum.load(std::memory_order_relaxed);
+  }
+  return snap;
+}
+
+MetricsRegistry* MetricsRegistry::Instance() {
+  static MetricsRegistry* registry = new MetricsRegistry();
+  return registry;
+}
+
+MetricsRegistry::MetricsRegistry() : listen_fd_(-1), stop_(false) {}
+
+void MetricsRegistry::Add(const string& name, const string& help,
+                          const string& labels, MetricType type,
+                          void* metric) {
+  Entry e;
+  e.name = name;
+  e.help = help;
+  e.labels = labels;
+  e.type = type;
+  e.metric = metric;
+  std::lock_guard<std::mutex> lock(mu_);
+  entries_.push_back(e);
+}
+
+Counter* MetricsRegistry::NewCounter(const string& name, const string& help,
+                                     const string& labels) {
+  Counter* c = new Counter();
+  Add(name, help, labels, METRIC_COUNTER, c);
+  return c;
+}
+
+Gauge* MetricsRegistry::NewGauge(const string& name, const string& help,
+                                 const string& labels) {
+  Gauge* g = new Gauge();
+  Add(name, help, labels, METRIC_GAUGE, g);
+  return g;
+}
+
+Histogram* MetricsRegistry::NewHistogram(const string& name,
+                                         const string& help,
+                                         const string& labels) {
+  Histogram* h = new Histogram();
+  Add(name, help, labels, METRIC_HISTOGRAM, h);
+  return h;
+}
+
+void MetricsRegistry::RemoveLabeled(const string& labels) {
+  std::lock_guard<std::mutex> lock(mu_);
+  vector<Entry> kept;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry& e = entries_[i];
+    if (e.labels != labels) {
+      kept.push_back(e);
+      continue;
+    }
+    switch (e.type) {
+      case METRIC_COUNTER:
+        delete (Counter*)e.metric;
+        break;
+      case METRIC_GAUGE:
+        delete (Gauge*)e.metric;
+        break;
+      case METRIC_HISTOGRAM:
+        delete (Histogram*)e.metric;
+        break;
+    }
+  }
+  entries_.swap(kept);
+}
+
+vector<MetricSample> MetricsRegistry::Snapshot() {
+  std::lock_guard<std::mutex> lock(mu_);
+  vector<MetricSample> samples(entries_.size());
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    const Entry& e = entries_[i];
+    MetricSample& s = samples[i];
+    s.name = e.name;
+    s.help = e.help;
+    s.labels = e.labels;
+    s.type = e.type;
+    s.value = 0;
+    switch (e.type) {
+      case METRIC_COUNTER:
+        s.value = (int64_t)((Counter*)e.metric)->Value();
+        break;
+      case METRIC_GAUGE:
+        s.value = ((Gauge*)e.metric)->Value();
+        break;
+      case METRIC_HISTOGRAM:
+        s.histogram = ((Histogram*)e.metric)->Snapshot();
+        break;
+    }
+  }
+  return samples;
+}
+
+string MetricsRegistry::ExportPrometheus() {
+  vector<MetricSample> samples = Snapshot();
+
+  // Group samples of one family together, keeping the creation order.
+  vector<string> names;
+  map<string, vector<const MetricSample*> > families;
+  for (size_t i = 0; i < samples.size(); ++i) {
+    if (!families.count(samples[i].name))
+      names.push_back(samples[i].name);
+    families[samples[i].name].push_back(&samples[i]);
+  }
+
+  static const double kQuantiles[] = {0.5, 0.9, 0.99, 0.999};
+  ostringstream out;
+  for (size_t i = 0; i < names.size(); ++i) {
+    const vector<const MetricSample*>& family = families[names[i]];
+    const MetricSample& first = *family[0];
+    const char* type = first.type == METRIC_COUNTER ? "counter" :
+        (first.type == METRIC_GAUGE ? "gauge" : "summary");
+    out << "# HELP " << first.name << " " << first.help << "\n";
+    out << "# TYPE " << first.name << " " << type << "\n";
+
+    for (size_t j = 0; j < family.size(); ++j) {
+      const MetricSample& s = *family[j];
+      if (s.type != METRIC_HISTOGRAM) {
+        out << s.name;
+        if (!s.labels.empty())
+          out << "{" << s.labels << "}";
+        out << " " << s.value << "\n";
+        continue;
+      }
+      string sep = s.labels.empty() ? "" : ",";
+      for (size_t q = 0; q < sizeof(kQuantiles) / sizeof(kQuantiles[0]);
+           ++q) {
+        out << s.name << "{" << s.labels << sep << "quantile=\""
+            << kQuantiles[q] << "\"} " << s.histogram.Percentile(kQuantiles[q])
+            << "\n";
+      }
+      string labels = s.labels.empty() ? "" : "{" + s.labels + "}";
+      out << s.name << "_sum" << labels << " " << s.histogram.sum << "\n";
+      out << s.name << "_count" << labels << " " << s.histogram.count << "\n";
+    }
+  }
+  return out.str();
+}
+
+bool MetricsRegistry::Serve(const string& socket_path) {
+  if (listen_fd_ >= 0)
+    return false;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(addr.sun_path))
+    return false;
+  strcpy(addr.sun_path, socket_path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+  unlink(socket_path.c_str());
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(fd, 8) < 0) {
+    LOG(ERROR) << "Unable to listen on " << socket_path << ": "
+               << strerror(errno);
+    ::close(fd);
+    return false;
+  }
+
+  listen_fd_ = fd;
+  socket_path_ = socket_path;
+  stop_ = false;
+  server_ = std::thread(&MetricsRegistry::ServeLoop, this);
+  LOG(INFO) << "Metrics served on " << socket_path;
+  return true;
+}
+
+void MetricsRegistry::StopServing() {
+  if (listen_fd_ < 0)
+    return;
+  stop_ = true;
+  server_.join();
+  ::close(listen_fd_);
+  listen_fd_ = -1;
+  unlink(socket_path_.c_str());
+}
+
+void MetricsRegistry::ServeLoop() {
+  while (!stop_.load()) {
+    struct pollfd pfd;
+    pfd.fd = listen_fd_;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 200) <= 0)
+      continue;
+
+    int conn = accept(listen_fd_, NULL, NULL);
+    if (conn < 0)
+      continue;
+
+    // Whatever was asked, the answer is the metrics page.
+    char req[1024];
+    struct pollfd cfd;
+    cfd.fd = conn;
+    cfd.events = POLLIN;
+    if (poll(&cfd, 1, 100) > 0 && recv(conn, req, sizeof(req), 0) < 0) {
+      ::close(conn);
+      continue;
+    }
+
+    string body = ExportPrometheus();
+    char header[160];
+    snprintf(header, sizeof(header),
+             "HTTP/1.0 200 OK\r\n"
+             "Content-Type: text/plain; version=0.0.4\r\n"
+             "Content-Length: %zu\r\n\r\n", body.size());
+    string resp = string(header) + body;
+    size_t off = 0;
+    while (off < resp.size()) {
+      ssize_t n = send(conn, resp.data() + off, resp.size() - off,
+                       MSG_NOSIGNAL);
+      if (n <= 0)
+        break;
+      off += (size_t)n;
+    }
+    ::close(conn);
+  }
+}
+
+}  // namespace bangnet
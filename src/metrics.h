@@ -0,0 +1,244 @@
+#ifndef BANGNET_METRICS_H_
+#define BANGNET_METRICS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "src/clock.h"
+#include "src/common.h"
+
+namespace bangnet {
+
+// Max number of threads with their own metric slot, threads beyond this
+// share the last slot and pay for an atomic add.
+const int kMaxMetricThreads = 32;
+
+namespace metrics_internal {
+
+int AssignThreadSlot();
+
+// Returns the metric slot of the calling thread.
+inline int ThreadSlot() {
+  static thread_local int slot = -1;
+  if (BN_UNLIKELY(slot < 0))
+    slot = AssignThreadSlot();
+  return slot;
+}
+
+// Adds to a slot value. A slot is only written by its own thread, so a
+// plain load and store is enough, except for the shared last slot.
+inline void SlotAdd(int slot, std::atomic<uint64_t>* v, uint64_t n) {
+  if (BN_LIKELY(slot != kMaxMetricThreads - 1))
+    v->store(v->load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+  else
+    v->fetch_add(n, std::memory_order_relaxed);
+}
+
+}  // namespace metrics_internal
+
+// A monotonically increasing counter, each thread adds to its own cache
+// line and readers sum all of them.
+class Counter {
+public:
+  Counter() {
+    for (int i = 0; i < kMaxMetricThreads; ++i)
+      cells_[i].value.store(0, std::memory_order_relaxed);
+  }
+
+  inline void Add(uint64_t n) {
+    int slot = metrics_internal::ThreadSlot();
+    metrics_internal::SlotAdd(slot, &cells_[slot].value, n);
+  }
+
+  inline void Increment() { Add(1); }
+
+  uint64_t Value() const;
+
+private:
+  struct Cell {
+    std::atomic<uint64_t> value;
+    char pad[64 - sizeof(std::atomic<uint64_t>)];
+  };
+  Cell cells_[kMaxMetricThreads];
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Counter);
+};
+
+// A value which can go up and down, like the mtu of a device.
+class Gauge {
+public:
+  Gauge() : value_(0) {}
+
+  void Set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+  void Add(int64_t v) { value_.fetch_add(v, std::memory_order_relaxed); }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<int64_t> value_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Gauge);
+};
+
+// An aggregated copy of a histogram.
+struct HistogramSnapshot {
+  HistogramSnapshot() : count(0), sum(0) {}
+
+  vector<uint64_t> buckets;
+  uint64_t count;
+  uint64_t sum;
+
+  // Returns the value at quantile q in [0, 1], within the bucket precision.
+  uint64_t Percentile(double q) const;
+
+  double Mean() const { return count ? (double)sum / count : 0; }
+
+  void Merge(const HistogramSnapshot& other);
+};
+
+// A log-linear histogram in the spirit of HdrHistogram: every power of two
+// is split in kSubBuckets linear buckets, so values are kept with a relative
+// error of 1/kSubBuckets. Each thread records into its own buckets.
+class Histogram {
+public:
+  static const int kSubBits = 3;
+  static const int kSubBuckets = 1 << kSubBits;
+  // Values above 2^kMaxExp land in the last bucket.
+  static const int kMaxExp = 40;
+  static const int kBuckets = (kMaxExp - kSubBits + 1) * kSubBuckets;
+
+  Histogram();
+  ~Histogram();
+
+  inline void Record(uint64_t v) {
+    int slot = metrics_internal::ThreadSlot();
+    Slot* s = slots_[slot].load(std::memory_order_acquire);
+    if (BN_UNLIKELY(s == 0))
+      s = NewSlot(slot);
+    metrics_internal::SlotAdd(slot, &s->buckets[BucketOf(v)], 1);
+    metrics_internal::SlotAdd(slot, &s->count, 1);
+    metrics_internal::SlotAdd(slot, &s->sum, v);
+  }
+
+  HistogramSnapshot Snapshot() const;
+
+  static inline int BucketOf(uint64_t v) {
+    if (v < (uint64_t)kSubBuckets)
+      return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e >= kMaxExp)
+      return kBuckets - 1;
+    return (e - kSubBits + 1) * kSubBuckets +
+           (int)((v >> (e - kSubBits)) & (kSubBuckets - 1));
+  }
+
+  // Returns the highest value that lands in bucket b.
+  static uint64_t BucketUpper(int b);
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> buckets[kBuckets];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+  };
+
+  Slot* NewSlot(int slot);
+
+  std::atomic<Slot*> slots_[kMaxMetricThreads];
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Histogram);
+};
+
+// Records the nanoseconds spent in a scope.
+class ScopedLatency {
+public:
+  explicit ScopedLatency(Histogram* h) : h_(h), start_(MonotonicNs()) {}
+  ~ScopedLatency() { h_->Record(MonotonicNs() - start_); }
+
+private:
+  Histogram* h_;
+  uint64_t start_;
+};
+
+enum MetricType {
+  METRIC_COUNTER = 0,
+  METRIC_GAUGE,
+  METRIC_HISTOGRAM
+};
+
+// A point in time value of one metric.
+struct MetricSample {
+  string name;
+  string help;
+  // Prometheus style labels, like `device="bg0"`, may be empty.
+  string labels;
+  MetricType type;
+  // Counter and gauge value.
+  int64_t value;
+  HistogramSnapshot histogram;
+};
+
+// Owns all metrics of the process. Metrics are created once, usually when
+// a device or stage is set up, and updated without any lock after that.
+class MetricsRegistry {
+public:
+  // Returns the process wide registry.
+  static MetricsRegistry* Instance();
+
+  // Returns a new metric, owned by the registry.
+  Counter* NewCounter(const string& name, const string& help,
+                      const string& labels);
+  Gauge* NewGauge(const string& name, const string& help,
+                  const string& labels);
+  Histogram* NewHistogram(const string& name, const string& help,
+                          const string& labels);
+
+  // Deletes all metrics with exactly these labels, used when the object
+  // they describe goes away.
+  void RemoveLabeled(const string& labels);
+
+  // Aggregates all thread slots of all metrics.
+  vector<MetricSample> Snapshot();
+
+  // Returns all metrics in the prometheus text exposition format,
+  // histograms are exposed as summaries.
+  string ExportPrometheus();
+
+  // Serves ExportPrometheus() over http on a local unix socket, so it can
+  // be scraped with `curl --unix-socket <path> http://localhost/metrics`.
+  bool Serve(const string& socket_path);
+
+  void StopServing();
+
+private:
+  struct Entry {
+    string name;
+    string help;
+    string labels;
+    MetricType type;
+    void* metric;
+  };
+
+  MetricsRegistry();
+
+  void Add(const string& name, const string& help, const string& labels,
+           MetricType type, void* metric);
+  void ServeLoop();
+
+  std::mutex mu_;
+  vector<Entry> entries_;
+
+  int listen_fd_;
+  string socket_path_;
+  std::thread server_;
+  std::atomic<bool> stop_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(MetricsRegistry);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_METRICS_H_
@@ -0,0 +1,103 @@
+#include "src/metrics.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+TEST(CounterTest, SumsAllThreads) {
+  Counter c;
+  vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.push_back(std::thread([&c]() {
+      for (int j = 0; j < 10000; ++j)
+        c.Increment();
+    }));
+  }
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+  c.Add(5);
+  EXPECT_EQ(40005u, c.Value());
+}
+
+TEST(HistogramTest, Buckets) {
+  for (uint64_t v = 0; v < 100000; v = v * 3 + 1) {
+    int b = Histogram::BucketOf(v);
+    EXPECT_LE(v, Histogram::BucketUpper(b));
+    if (b > 0) {
+      EXPECT_GT(v, Histogram::BucketUpper(b - 1));
+    }
+  }
+  EXPECT_EQ(Histogram::kBuckets - 1, Histogram::BucketOf(~0ull));
+}
+
+TEST(HistogramTest, Percentiles) {
+  Histogram h;
+  for (uint64_t v = 1; v <= 1000; ++v)
+    h.Record(v);
+  HistogramSnapshot s = h.Snapshot();
+  EXPECT_EQ(1000u, s.count);
+  EXPECT_EQ(500500u, s.sum);
+
+  // Within the relative error of the buckets.
+  EXPECT_NEAR(500, (double)s.Percentile(0.5), 500 / 8.0);
+  EXPECT_NEAR(990, (double)s.Percentile(0.99), 990 / 8.0);
+  EXPECT_EQ(0u, HistogramSnapshot().Percentile(0.5));
+}
+
+TEST(MetricsRegistryTest, ExportPrometheus) {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  Counter* c = r->NewCounter("test_frames_total", "Frames.", "dev=\"t0\"");
+  Gauge* g = r->NewGauge("test_mtu", "Mtu.", "dev=\"t0\"");
+  Histogram* h = r->NewHistogram("test_latency_ns", "Latency.", "dev=\"t0\"");
+  c->Add(3);
+  g->Set(1500);
+  h->Record(100);
+
+  string text = r->ExportPrometheus();
+  EXPECT_NE(string::npos, text.find("# TYPE test_frames_total counter\n"));
+  EXPECT_NE(string::npos, text.find("test_frames_total{dev=\"t0\"} 3\n"));
+  EXPECT_NE(string::npos, text.find("test_mtu{dev=\"t0\"} 1500\n"));
+  EXPECT_NE(string::npos,
+            text.find("test_latency_ns{dev=\"t0\",quantile=\"0.5\"} 103\n"));
+  EXPECT_NE(string::npos, text.find("test_latency_ns_count{dev=\"t0\"} 1\n"));
+
+  r->RemoveLabeled("dev=\"t0\"");
+  EXPECT_EQ(string::npos, r->ExportPrometheus().find("test_frames_total"));
+}
+
+TEST(MetricsRegistryTest, ServeOverUnixSocket) {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  r->NewCounter("test_served_total", "Served.", "dev=\"t1\"")->Add(7);
+  string path = "/tmp/bangnet_metrics_test.sock";
+  ASSERT_TRUE(r->Serve(path));
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path.c_str());
+  ASSERT_EQ(0, connect(fd, (struct sockaddr*)&addr, sizeof(addr)));
+  const char req[] = "GET /metrics HTTP/1.0\r\n\r\n";
+  ASSERT_GT(send(fd, req, sizeof(req) - 1, 0), 0);
+
+  string resp;
+  char buf[4096];
+  ssize_t n;
+  while ((n = recv(fd, buf, sizeof(buf), 0)) > 0)
+    resp.append(buf, n);
+  close(fd);
+  r->StopServing();
+  r->RemoveLabeled("dev=\"t1\"");
+
+  EXPECT_EQ(0u, resp.find("HTTP/1.0 200 OK"));
+  EXPECT_NE(string::npos, resp.find("test_served_total{dev=\"t1\"} 7\n"));
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,404 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "src/multipath.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+
+namespace {
+
+// Rtt smoothing as in TCP, and the weight of each probe in the loss.
+const int kRttShift = 3;
+const double kLossAlpha = 1.0 / 16;
+
+inline uint32_t Read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+inline uint32_t Mix(uint32_t h, uint32_t v) {
+  v *= 0xcc9e2d51u;
+  v = (v << 15) | (v >> 17);
+  h ^= v * 0x1b873593u;
+  h = (h << 13) | (h >> 19);
+  return h * 5 + 0xe6546b64u;
+}
+
+inline uint32_t Finish(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  return h ^ (h >> 16);
+}
+
+inline bool HasPorts(uint8_t proto) {
+  return proto == 6 || proto == 17 || proto == 132;
+}
+
+uint64_t Htonll(uint64_t v) {
+  return ((uint64_t)htonl((uint32_t)v) << 32) | htonl((uint32_t)(v >> 32));
+}
+
+}  // namespace
+
+unsigned int WritePathProbe(int path, uint32_t seq, uint64_t now_ns,
+                            unsigned char* buf) {
+  PathMessage m;
+  m.type = PATH_PROBE;
+  m.path = (uint8_t)path;
+  m.reserved = 0;
+  m.seq = htonl(seq);
+  m.timestamp = Htonll(now_ns);
+  memcpy(buf, &m, sizeof(m));
+  return sizeof(m);
+}
+
+bool ParsePathMessage(const unsigned char* data, unsigned int len,
+                      PathMessage* msg) {
+  if (len != kPathMessageLen)
+    return false;
+  memcpy(msg, data, sizeof(*msg));
+  msg->seq = ntohl(msg->seq);
+  msg->timestamp = Htonll(msg->timestamp);
+  return (msg->type == PATH_PROBE || msg->type == PATH_PROBE_ACK) &&
+         msg->path < kMaxPaths;
+}
+
+unsigned int WritePathAck(const PathMessage& probe, unsigned char* buf) {
+  unsigned int len = WritePathProbe(probe.path, probe.seq, probe.timestamp,
+                                    buf);
+  buf[0] = PATH_PROBE_ACK;
+  return len;
+}
+
+uint32_t FlowHash(const unsigned char* frame, unsigned int len) {
+  uint32_t h = 0x9747b28cu;
+  EthernetTags tags;
+  if (!ParseEthernet(frame, len, &tags)) {
+    if (len >= 12) {
+      h = Mix(h, Read32(frame));
+      h = Mix(h, Read32(frame + 4));
+      h = Mix(h, Read32(frame + 8));
+    }
+    h = Finish(h);
+    return h ? h : 1;
+  }
+
+  const unsigned char* p = frame + tags.payload_offset;
+  unsigned int rem = len - tags.payload_offset;
+  if (tags.ethertype == 0x0800 && rem >= 20) {
+    unsigned int ihl = (p[0] & 0xf) * 4;
+    uint16_t frag;
+    memcpy(&frag, p + 6, 2);
+    h = Mix(h, Read32(p + 12));
+    h = Mix(h, Read32(p + 16));
+    h = Mix(h, p[9]);
+    // Fragments of a datagram go the same way, whether they carry the
+    // ports or not.
+    if (!(ntohs(frag) & 0x3fff) && HasPorts(p[9]) && rem >= ihl + 4)
+      h = Mix(h, Read32(p + ihl));
+  } else if (tags.ethertype == 0x86dd && rem >= 40) {
+    for (int i = 0; i < 32; i += 4)
+      h = Mix(h, Read32(p + 8 + i));
+    h = Mix(h, p[6]);
+    if (HasPorts(p[6]) && rem >= 44)
+      h = Mix(h, Read32(p + 40));
+  } else {
+    h = Mix(h, Read32(frame));
+    h = Mix(h, Read32(frame + 4));
+    h = Mix(h, Read32(frame + 8));
+    h = Mix(h, tags.ethertype);
+  }
+  h = Finish(h);
+  return h ? h : 1;
+}
+
+MultipathRouter::MultipathRouter(const string& name,
+                                 const MultipathOptions& options)
+    : name_(name), options_(options) {
+  CHECK(options_.flow_slots &&
+        !(options_.flow_slots & (options_.flow_slots - 1)))
+      << "flow_slots must be a power of 2";
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.probes = r->NewCounter("bangnet_multipath_probes_total",
+      "Path probes sent to peers.", labels);
+  metrics_.probes_lost = r->NewCounter("bangnet_multipath_probes_lost_total",
+      "Path probes which were not acked in time.", labels);
+  metrics_.path_changes = r->NewCounter(
+      "bangnet_multipath_path_changes_total",
+      "Paths which went up or down.", labels);
+  metrics_.failovers = r->NewCounter("bangnet_multipath_failovers_total",
+      "Flows moved off a path which went down.", labels);
+  metrics_.paths_up = r->NewGauge("bangnet_multipath_paths_up",
+      "Paths up across peers.", labels);
+}
+
+MultipathRouter::~MultipathRouter() {
+  for (map<uint32_t, Peer*>::iterator it = peers_.begin();
+       it != peers_.end(); ++it) {
+    RemovePathMetrics(it->second);
+    delete it->second;
+  }
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+void MultipathRouter::RemovePathMetrics(Peer* p) {
+  for (size_t i = 0; i < p->metrics.size(); ++i)
+    MetricsRegistry::Instance()->RemoveLabeled(p->metrics[i].labels);
+  for (size_t i = 0; i < p->paths.size(); ++i) {
+    if (p->paths[i].up)
+      metrics_.paths_up->Add(-1);
+  }
+}
+
+int MultipathRouter::AddPath(uint32_t peer, const InetAddress& local,
+                             const InetAddress& remote, unsigned int weight,
+                             uint64_t now_ns) {
+  Peer* p;
+  map<uint32_t, Peer*>::iterator it = peers_.find(peer);
+  if (it == peers_.end()) {
+    p = new Peer;
+    p->ncandidates = 0;
+    p->candidate_mask = 0;
+    p->flowlet_gap_ns = options_.flowlet_gap_ns;
+    Flow free_flow = {0, -1, 0};
+    p->flows.assign(options_.flow_slots, free_flow);
+    peers_[peer] = p;
+  } else {
+    p = it->second;
+  }
+  if (p->paths.size() >= (size_t)kMaxPaths)
+    return -1;
+  for (size_t i = 0; i < p->paths.size(); ++i) {
+    if (p->paths[i].local == local && p->paths[i].remote == remote)
+      return -1;
+  }
+
+  PathState s;
+  s.local = local;
+  s.remote = remote;
+  s.weight = weight ? weight : 1;
+  s.up = false;
+  s.srtt_ns = 0;
+  s.rttvar_ns = 0;
+  s.loss = 0;
+  s.missed = 0;
+  s.seq = 0;
+  s.acked = false;
+  s.next_probe_ns = now_ns;
+  p->paths.push_back(s);
+
+  int index = (int)p->paths.size() - 1;
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  ostringstream labels;
+  labels << "stage=\"" << name_ << "\",peer=\"" << peer << "\",path=\""
+         << index << "\"";
+  PathMetrics m;
+  m.labels = labels.str();
+  m.up = r->NewGauge("bangnet_multipath_path_up",
+      "Whether a path is up.", m.labels);
+  m.rtt_us = r->NewGauge("bangnet_multipath_path_rtt_us",
+      "Smoothed rtt of a path.", m.labels);
+  m.loss_ppm = r->NewGauge("bangnet_multipath_path_loss_ppm",
+      "Moving average of the probes a path lost, per million.", m.labels);
+  p->metrics.push_back(m);
+  UpdateCandidates(p);
+  return index;
+}
+
+void MultipathRouter::RemovePeer(uint32_t peer) {
+  map<uint32_t, Peer*>::iterator it = peers_.find(peer);
+  if (it == peers_.end())
+    return;
+  RemovePathMetrics(it->second);
+  delete it->second;
+  peers_.erase(it);
+}
+
+void MultipathRouter::UpdateCandidates(Peer* p) {
+  // The paths allowed to carry flows: up and not too lossy, else up, else
+  // all of them, as sending blind beats not sending.
+  int eligible[kMaxPaths];
+  int n = 0;
+  for (int pass = 0; pass < 3 && !n; ++pass) {
+    for (size_t i = 0; i < p->paths.size(); ++i) {
+      const PathState& s = p->paths[i];
+      if (pass == 2 || (s.up && (pass == 1 || s.loss <= options_.max_loss)))
+        eligible[n++] = (int)i;
+    }
+  }
+
+  uint64_t best = 0;
+  for (int i = 0; i < n; ++i) {
+    uint64_t rtt = p->paths[eligible[i]].srtt_ns;
+    if (rtt && (!best || rtt < best))
+      best = rtt;
+  }
+  uint64_t limit = (uint64_t)(best * options_.rtt_slack) +
+                   options_.rtt_margin_ns;
+  uint64_t min_rtt = 0, max_rtt = 0;
+  p->ncandidates = 0;
+  p->candidate_mask = 0;
+  for (int i = 0; i < n; ++i) {
+    uint64_t rtt = p->paths[eligible[i]].srtt_ns;
+    if (best && rtt > limit)
+      continue;
+    p->candidates[p->ncandidates++] = eligible[i];
+    p->candidate_mask |= 1 << eligible[i];
+    if (!min_rtt || rtt < min_rtt)
+      min_rtt = rtt;
+    if (rtt > max_rtt)
+      max_rtt = rtt;
+  }
+  // A flow moving to a faster path must not overtake its own frames still
+  // in flight on the slower one.
+  p->flowlet_gap_ns = options_.flowlet_gap_ns;
+  if (max_rtt - min_rtt > p->flowlet_gap_ns)
+    p->flowlet_gap_ns = max_rtt - min_rtt;
+}
+
+void MultipathRouter::UpdateMetrics(const Peer& p, int index) {
+  const PathState& s = p.paths[index];
+  const PathMetrics& m = p.metrics[index];
+  m.up->Set(s.up);
+  m.rtt_us->Set(s.srtt_ns / 1000);
+  m.loss_ppm->Set((int64_t)(s.loss * 1000000));
+}
+
+int MultipathRouter::Poll(uint64_t now_ns, PathProbeRequest* out, int max) {
+  int n = 0;
+  for (map<uint32_t, Peer*>::iterator it = peers_.begin();
+       it != peers_.end() && n < max; ++it) {
+    Peer* p = it->second;
+    bool changed = false;
+    for (size_t i = 0; i < p->paths.size() && n < max; ++i) {
+      PathState& s = p->paths[i];
+      if (now_ns < s.next_probe_ns)
+        continue;
+      if (s.seq && !s.acked) {
+        metrics_.probes_lost->Increment();
+        s.loss += (1 - s.loss) * kLossAlpha;
+        if (++s.missed >= options_.down_after && s.up) {
+          LOG(WARNING) << name_ << ": path " << i << " to peer " << it->first
+                       << " at " << s.remote.ToString() << "/"
+                       << s.remote.port() << " is down";
+          s.up = false;
+          metrics_.path_changes->Increment();
+          metrics_.paths_up->Add(-1);
+        }
+        changed = true;
+      } else if (s.seq) {
+        s.loss -= s.loss * kLossAlpha;
+      }
+      s.acked = false;
+      s.next_probe_ns = now_ns + options_.probe_interval_ns;
+      out[n].peer = it->first;
+      out[n].path = (int)i;
+      out[n].seq = ++s.seq;
+      ++n;
+      UpdateMetrics(*p, (int)i);
+    }
+    if (changed)
+      UpdateCandidates(p);
+  }
+  metrics_.probes->Add(n);
+  return n;
+}
+
+void MultipathRouter::OnProbeAck(uint32_t peer, const PathMessage& ack,
+                                 uint64_t now_ns) {
+  map<uint32_t, Peer*>::iterator it = peers_.find(peer);
+  if (it == peers_.end() || ack.path >= it->second->paths.size())
+    return;
+  Peer* p = it->second;
+  PathState& s = p->paths[ack.path];
+  if (!ack.seq || ack.seq > s.seq || ack.timestamp > now_ns)
+    return;
+
+  uint64_t rtt = now_ns - ack.timestamp;
+  if (!s.srtt_ns) {
+    s.srtt_ns = rtt ? rtt : 1;
+    s.rttvar_ns = rtt / 2;
+  } else {
+    uint64_t delta = rtt > s.srtt_ns ? rtt - s.srtt_ns : s.srtt_ns - rtt;
+    s.rttvar_ns = s.rttvar_ns - (s.rttvar_ns >> 2) + (delta >> 2);
+    s.srtt_ns = s.srtt_ns - (s.srtt_ns >> kRttShift) + (rtt >> kRttShift);
+  }
+  if (ack.seq == s.seq)
+    s.acked = true;
+  s.missed = 0;
+  if (!s.up) {
+    LOG(INFO) << name_ << ": path " << (int)ack.path << " to peer " << peer
+              << " at " << s.remote.ToString() << "/" << s.remote.port()
+              << " is up";
+    s.up = true;
+    metrics_.path_changes->Increment();
+    metrics_.paths_up->Add(1);
+  }
+  UpdateCandidates(p);
+  UpdateMetrics(*p, ack.path);
+}
+
+int MultipathRouter::Rendezvous(const Peer& p, uint32_t flow) const {
+  // Weighted rendezvous hashing: the path with the highest
+  // weight / -ln(u) wins, u uniform in (0, 1) from the flow and the path.
+  int best = p.candidates[0];
+  double best_score = -1;
+  for (int i = 0; i < p.ncandidates; ++i) {
+    int index = p.candidates[i];
+    uint32_t h = Finish(Mix(flow, 0x9e3779b9u * (index + 1)));
+    double u = (h + 0.5) / 4294967296.0;
+    double score = p.paths[index].weight / -std::log(u);
+    if (score > best_score) {
+      best_score = score;
+      best = index;
+    }
+  }
+  return best;
+}
+
+int MultipathRouter::Select(uint32_t peer, uint32_t flow, uint64_t now_ns) {
+  map<uint32_t, Peer*>::iterator it = peers_.find(peer);
+  if (BN_UNLIKELY(it == peers_.end() || !it->second->ncandidates))
+    return -1;
+  Peer* p = it->second;
+  Flow& f = p->flows[flow & (options_.flow_slots - 1)];
+  if (f.path >= 0 && f.hash == flow) {
+    bool usable = p->paths[f.path].up || (p->candidate_mask & (1 << f.path));
+    bool busy = now_ns - f.last_ns < p->flowlet_gap_ns;
+    if (BN_LIKELY(usable && busy)) {
+      f.last_ns = now_ns;
+      return f.path;
+    }
+    if (busy)
+      metrics_.failovers->Increment();
+  }
+  f.hash = flow;
+  f.path = Rendezvous(*p, flow);
+  f.last_ns = now_ns;
+  return f.path;
+}
+
+const PathState* MultipathRouter::path(uint32_t peer, int index) const {
+  map<uint32_t, Peer*>::const_iterator it = peers_.find(peer);
+  if (it == peers_.end() || index < 0 ||
+      (size_t)index >= it->second->paths.size())
+    return NULL;
+  return &it->second->paths[index];
+}
+
+int MultipathRouter::paths_up(uint32_t peer) const {
+  map<uint32_t, Peer*>::const_iterator it = peers_.find(peer);
+  if (it == peers_.end())
+    return 0;
+  int n = 0;
+  for (size_t i = 0; i < it->second->paths.size(); ++i)
+    n += it->second->paths[i].up;
+  return n;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,201 @@
+#ifndef BANGNET_MULTIPATH_H_
+#define BANGNET_MULTIPATH_H_
+
+#include <stdint.h>
+
+#include "src/common.h"
+#include "src/control.h"
+#include "src/inet_addr.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+// Spreads the traffic to a peer over several underlay paths, one for each
+// pair of local and remote endpoints it can be reached by, like an ipv4
+// and an ipv6 address or one address per uplink.
+//
+// Every path is probed continuously for its rtt and loss. Each flow is
+// hashed onto one of the best paths with weighted rendezvous hashing, so
+// flows spread over the links in proportion to their capacity, and only
+// the flows of a path move when it comes or goes. A flow stays on its
+// path while it is busy and is only hashed again after an idle gap longer
+// than the rtt difference between paths, so its frames are not reordered,
+// or right away when its path goes down.
+
+// Probe and ack messages, in network byte order. The ack echoes the probe,
+// so the prober takes the rtt from its own timestamp.
+struct PathMessage {
+  uint8_t type;
+  // Index of the path at the prober.
+  uint8_t path;
+  uint16_t reserved;
+  uint32_t seq;
+  // Send time at the prober, in ns.
+  uint64_t timestamp;
+} __attribute__((packed));
+
+const unsigned int kPathMessageLen = sizeof(PathMessage);
+
+// Max paths to a peer.
+const int kMaxPaths = 8;
+
+struct MultipathOptions {
+  MultipathOptions()
+      : probe_interval_ns(100000000), down_after(3), max_loss(0.1),
+        rtt_slack(1.5), rtt_margin_ns(2000000), flowlet_gap_ns(50000000),
+        flow_slots(4096) {}
+
+  // Every path is probed at this interval.
+  uint64_t probe_interval_ns;
+
+  // Probes lost in a row before a path is down. With the defaults a dead
+  // path stops carrying flows within 400ms.
+  unsigned int down_after;
+
+  // Paths losing more probes than this only carry flows if no path is
+  // better.
+  double max_loss;
+
+  // Paths with a smoothed rtt within rtt_slack times the best one, plus
+  // rtt_margin_ns, share the flows. Slower paths are kept as backups.
+  double rtt_slack;
+  uint64_t rtt_margin_ns;
+
+  // Least idle time before a flow may move to another path. Raised to the
+  // rtt spread of the paths in use.
+  uint64_t flowlet_gap_ns;
+
+  // Flows remembered per peer, a power of 2. Flows sharing a slot are
+  // hashed again, which only moves them if the paths changed meanwhile.
+  unsigned int flow_slots;
+};
+
+struct PathState {
+  // Local address to send from, null for any, and the peer's endpoint.
+  InetAddress local;
+  InetAddress remote;
+  // Relative capacity, the share of flows the path gets.
+  unsigned int weight;
+
+  // Acked since the last time it went down.
+  bool up;
+  // Smoothed rtt and its variation, 0 before the first ack.
+  uint64_t srtt_ns;
+  uint64_t rttvar_ns;
+  // Moving average of the fraction of probes lost.
+  double loss;
+  // Probes lost in a row.
+  unsigned int missed;
+
+  // The last probe sent and whether it was acked.
+  uint32_t seq;
+  bool acked;
+  uint64_t next_probe_ns;
+};
+
+// A probe to send to a peer over one of its paths, with WritePathProbe().
+struct PathProbeRequest {
+  uint32_t peer;
+  int path;
+  uint32_t seq;
+};
+
+// Writes a probe into buf, returns its length.
+unsigned int WritePathProbe(int path, uint32_t seq, uint64_t now_ns,
+                            unsigned char* buf);
+
+// Parses a received message into msg, with fields in host order. Returns
+// false if it is not a well formed probe or ack, like one of another type
+// or length.
+bool ParsePathMessage(const unsigned char* data, unsigned int len,
+                      PathMessage* msg);
+
+// Writes the ack of a parsed probe into buf, returns its length. It goes
+// back over the path the probe came in on.
+unsigned int WritePathAck(const PathMessage& probe, unsigned char* buf);
+
+// Hashes the addresses, protocol and ports of the ipv4 or ipv6 packet in
+// an ethernet frame, or the mac addresses of other frames. Never 0.
+uint32_t FlowHash(const unsigned char* frame, unsigned int len);
+
+// Keeps the paths to every peer and picks one for each frame. Not thread
+// safe, it is driven by the thread sending to the underlay.
+class MultipathRouter {
+public:
+  // name labels the metrics.
+  MultipathRouter(const string& name, const MultipathOptions& options);
+  ~MultipathRouter();
+
+  // Adds a path to peer, returns its index, or -1 if the peer has
+  // kMaxPaths paths or one to the same endpoints. A path only carries
+  // flows once acked, unless no path of the peer is up.
+  int AddPath(uint32_t peer, const InetAddress& local,
+              const InetAddress& remote, unsigned int weight,
+              uint64_t now_ns);
+  void RemovePeer(uint32_t peer);
+
+  // Fills out with the probes due, returns their count. Also counts
+  // probes not acked by then as lost and takes paths down.
+  int Poll(uint64_t now_ns, PathProbeRequest* out, int max);
+
+  // Handles a probe ack from a peer.
+  void OnProbeAck(uint32_t peer, const PathMessage& ack, uint64_t now_ns);
+
+  // Returns the index of the path to send a frame of flow to peer over,
+  // or -1 for unknown peers.
+  int Select(uint32_t peer, uint32_t flow, uint64_t now_ns);
+
+  // Returns a path of peer, NULL if there is none.
+  const PathState* path(uint32_t peer, int index) const;
+
+  int paths_up(uint32_t peer) const;
+
+private:
+  struct Flow {
+    uint32_t hash;
+    // -1 for free slots.
+    int path;
+    uint64_t last_ns;
+  };
+
+  struct PathMetrics {
+    string labels;
+    Gauge* up;
+    Gauge* rtt_us;
+    Gauge* loss_ppm;
+  };
+
+  struct Peer {
+    vector<PathState> paths;
+    vector<PathMetrics> metrics;
+    // Paths sharing the flows.
+    int candidates[kMaxPaths];
+    int ncandidates;
+    unsigned int candidate_mask;
+    uint64_t flowlet_gap_ns;
+    vector<Flow> flows;
+  };
+
+  void UpdateCandidates(Peer* p);
+  void UpdateMetrics(const Peer& p, int index);
+  int Rendezvous(const Peer& p, uint32_t flow) const;
+  void RemovePathMetrics(Peer* p);
+
+  string name_;
+  MultipathOptions options_;
+  map<uint32_t, Peer*> peers_;
+
+  struct Metrics {
+    Counter* probes;
+    Counter* probes_lost;
+    Counter* path_changes;
+    Counter* failovers;
+    Gauge* paths_up;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(MultipathRouter);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_MULTIPATH_H_
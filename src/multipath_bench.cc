@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/multipath.h"
+#include "src/pktgen.h"
+
+namespace bangnet {
+namespace {
+
+// Hashes generated frames and picks their path over npaths equally good
+// links. Reports the cost per frame and how close the busiest link comes
+// to its share, which bounds the aggregate throughput at npaths times that
+// share of one link.
+BenchResult RunSelectBench(int npaths, unsigned int flows,
+                           unsigned int frame_size, uint64_t duration_ms) {
+  MultipathOptions options;
+  MultipathRouter router("bench", options);
+  for (int i = 0; i < npaths; ++i) {
+    ostringstream ip;
+    ip << "192.0.2." << i + 1;
+    router.AddPath(1, InetAddress(), InetAddress(ip.str(), 4789), 1, 0);
+  }
+  // Every path acked with the same rtt.
+  PathProbeRequest probes[kMaxPaths];
+  int n = router.Poll(0, probes, kMaxPaths);
+  for (int i = 0; i < n; ++i) {
+    unsigned char buf[kPathMessageLen];
+    PathMessage ack;
+    WritePathProbe(probes[i].path, probes[i].seq, 0, buf);
+    ParsePathMessage(buf, kPathMessageLen, &ack);
+    router.OnProbeAck(1, ack, 1000000);
+  }
+
+  PktgenOptions gen_options;
+  gen_options.frame_size = frame_size;
+  gen_options.flows = flows;
+  PacketGenerator gen(gen_options);
+  const int kBurst = 256;
+  vector<unsigned char> data(kBurst * frame_size);
+  FrameSlot frames[kBurst];
+  for (int i = 0; i < kBurst; ++i) {
+    frames[i].data = &data[i * frame_size];
+    frames[i].cap = frame_size;
+  }
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "multipath/%dpaths/%uflows/%uB", npaths,
+           flows, frame_size);
+  result.name = name;
+  uint64_t per_path[kMaxPaths] = {0};
+  uint64_t cycles = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    gen.Fill(frames, kBurst, 0);
+    uint64_t c0 = CycleCount();
+    for (int i = 0; i < kBurst; ++i) {
+      int p = router.Select(1, FlowHash(frames[i].data, frames[i].len), now);
+      per_path[p] += frames[i].len;
+      result.bytes += frames[i].len;
+    }
+    cycles += CycleCount() - c0;
+    result.packets += kBurst;
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+
+  uint64_t busiest = 0;
+  for (int i = 0; i < npaths; ++i) {
+    if (per_path[i] > busiest)
+      busiest = per_path[i];
+  }
+  result.AddExtra("cycles/frame", (double)cycles / result.packets);
+  // 100% when the links fill evenly.
+  result.AddExtra("aggregate%",
+                  100.0 * result.bytes / (busiest * (double)npaths));
+  return result;
+}
+
+BENCHMARK(Multipath) {
+  int paths[] = {1, 2, 4};
+  for (int i = 0; i < 3; ++i) {
+    results->push_back(RunSelectBench(paths[i], options.flows, 64,
+                                      options.duration_ms));
+  }
+  results->push_back(RunSelectBench(4, 16, 64, options.duration_ms));
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,219 @@
+#include "src/multipath.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+const uint64_t kMs = 1000000ull;
+
+// Builds an ethernet frame carrying udp from 10.0.0.1:sport to
+// 10.0.0.2:dport.
+vector<unsigned char> UdpFrame(uint16_t sport, uint16_t dport) {
+  vector<unsigned char> f(14 + 28, 0);
+  memcpy(&f[0], "\x02\x00\x00\x00\x00\x02\x02\x00\x00\x00\x00\x01\x08\x00",
+         14);
+  unsigned char* ip = &f[14];
+  ip[0] = 0x45;
+  ip[8] = 64;
+  ip[9] = 17;
+  memcpy(ip + 12, "\x0a\x00\x00\x01\x0a\x00\x00\x02", 8);
+  *(uint16_t*)(ip + 20) = htons(sport);
+  *(uint16_t*)(ip + 22) = htons(dport);
+  return f;
+}
+
+class MultipathTest : public ::testing::Test {
+protected:
+  MultipathTest() : now_(0) {
+    rtt_[0] = rtt_[1] = rtt_[2] = 10 * kMs;
+    dead_[0] = dead_[1] = dead_[2] = false;
+  }
+
+  // Adds n paths to peer 1 over distinct uplinks.
+  void AddPaths(MultipathRouter* router, int n, const unsigned int* weights) {
+    for (int i = 0; i < n; ++i) {
+      ostringstream ip;
+      ip << "192.0.2." << i + 1;
+      EXPECT_EQ(i, router->AddPath(1, InetAddress(), InetAddress(ip.str(),
+                                   4789), weights ? weights[i] : 1, now_));
+    }
+  }
+
+  // Runs the probes for duration, acking those over paths not dead after
+  // their rtt.
+  void Run(MultipathRouter* router, uint64_t duration) {
+    uint64_t end = now_ + duration;
+    for (; now_ < end; now_ += kMs) {
+      PathProbeRequest probes[8];
+      int n = router->Poll(now_, probes, 8);
+      for (int i = 0; i < n; ++i) {
+        if (dead_[probes[i].path])
+          continue;
+        unsigned char buf[64];
+        unsigned int len = WritePathProbe(probes[i].path, probes[i].seq,
+                                          now_, buf);
+        PathMessage probe;
+        ASSERT_TRUE(ParsePathMessage(buf, len, &probe));
+        len = WritePathAck(probe, buf);
+        PathMessage ack;
+        ASSERT_TRUE(ParsePathMessage(buf, len, &ack));
+        ASSERT_EQ(PATH_PROBE_ACK, ack.type);
+        inflight_.push_back(make_pair(now_ + rtt_[probes[i].path], ack));
+      }
+      for (size_t i = 0; i < inflight_.size();) {
+        if (inflight_[i].first <= now_) {
+          router->OnProbeAck(1, inflight_[i].second, now_);
+          inflight_.erase(inflight_.begin() + i);
+        } else {
+          ++i;
+        }
+      }
+    }
+  }
+
+  uint64_t now_;
+  uint64_t rtt_[3];
+  bool dead_[3];
+  vector<pair<uint64_t, PathMessage> > inflight_;
+};
+
+TEST(FlowHashTest, FollowsTheFiveTuple) {
+  vector<unsigned char> a = UdpFrame(1000, 53), b = UdpFrame(1000, 53);
+  vector<unsigned char> c = UdpFrame(1001, 53);
+  EXPECT_EQ(FlowHash(&a[0], a.size()), FlowHash(&b[0], b.size()));
+  EXPECT_NE(FlowHash(&a[0], a.size()), FlowHash(&c[0], c.size()));
+
+  // Later fragments lack the ports, so fragments ignore them.
+  a[14 + 6] = 0x20;
+  c[14 + 6] = 0x20;
+  EXPECT_EQ(FlowHash(&a[0], a.size()), FlowHash(&c[0], c.size()));
+  EXPECT_NE(0u, FlowHash(&a[0], 3));
+}
+
+TEST(PathMessageTest, ProbeAndAck) {
+  unsigned char buf[64];
+  unsigned int len = WritePathProbe(3, 7, 1234, buf);
+  ASSERT_EQ(kPathMessageLen, len);
+  PathMessage m;
+  ASSERT_TRUE(ParsePathMessage(buf, len, &m));
+  EXPECT_EQ(PATH_PROBE, m.type);
+  EXPECT_EQ(3, m.path);
+  EXPECT_EQ(7u, m.seq);
+  EXPECT_EQ(1234u, m.timestamp);
+
+  len = WritePathAck(m, buf);
+  ASSERT_TRUE(ParsePathMessage(buf, len, &m));
+  EXPECT_EQ(PATH_PROBE_ACK, m.type);
+
+  // Messages of another length or type, like path mtu probes sharing the
+  // channel, are not taken for path messages.
+  EXPECT_FALSE(ParsePathMessage(buf, len - 1, &m));
+  EXPECT_FALSE(ParsePathMessage(buf, len + 1, &m));
+  buf[0] = PMTU_PROBE_ACK;
+  EXPECT_FALSE(ParsePathMessage(buf, len, &m));
+}
+
+TEST_F(MultipathTest, ProbesPaths) {
+  MultipathOptions options;
+  MultipathRouter router("mp", options);
+  AddPaths(&router, 2, NULL);
+  rtt_[1] = 30 * kMs;
+  EXPECT_EQ(-1, router.AddPath(1, InetAddress(),
+                               InetAddress("192.0.2.1", 4789), 1, now_));
+  EXPECT_EQ(0, router.paths_up(1));
+  Run(&router, 1000 * kMs);
+  EXPECT_EQ(2, router.paths_up(1));
+  const PathState* s = router.path(1, 1);
+  ASSERT_TRUE(s != NULL);
+  EXPECT_NEAR(30.0, s->srtt_ns / 1e6, 1.0);
+  EXPECT_EQ(0, s->loss);
+  EXPECT_TRUE(router.path(1, 2) == NULL);
+  EXPECT_EQ(-1, router.Select(2, 1, now_));
+}
+
+TEST_F(MultipathTest, SpreadsFlowsByWeight) {
+  MultipathOptions options;
+  MultipathRouter router("mp", options);
+  unsigned int weights[] = {3, 1};
+  AddPaths(&router, 2, weights);
+  Run(&router, 500 * kMs);
+  int count[2] = {0, 0};
+  for (uint32_t flow = 1; flow <= 4000; ++flow) {
+    int p = router.Select(1, flow * 2654435761u, now_);
+    ASSERT_GE(p, 0);
+    ++count[p];
+  }
+  EXPECT_NEAR(3000, count[0], 150);
+  EXPECT_NEAR(1000, count[1], 150);
+}
+
+TEST_F(MultipathTest, KeepsSlowPathsAsBackup) {
+  MultipathOptions options;
+  MultipathRouter router("mp", options);
+  AddPaths(&router, 2, NULL);
+  rtt_[1] = 100 * kMs;
+  Run(&router, 1000 * kMs);
+  for (uint32_t flow = 1; flow <= 100; ++flow)
+    EXPECT_EQ(0, router.Select(1, flow, now_));
+}
+
+TEST_F(MultipathTest, FailsOverWithinASecond) {
+  MultipathOptions options;
+  MultipathRouter router("mp", options);
+  AddPaths(&router, 3, NULL);
+  Run(&router, 500 * kMs);
+  // Flows busy on every path.
+  int before[64];
+  for (uint32_t flow = 0; flow < 64; ++flow)
+    before[flow] = router.Select(1, flow + 1, now_);
+
+  dead_[0] = true;
+  uint64_t start = now_;
+  while (router.paths_up(1) == 3 && now_ - start < 2000 * kMs) {
+    Run(&router, 10 * kMs);
+    for (uint32_t flow = 0; flow < 64; ++flow)
+      router.Select(1, flow + 1, now_);
+  }
+  EXPECT_LT(now_ - start, 500 * kMs);
+  EXPECT_FALSE(router.path(1, 0)->up);
+
+  for (uint32_t flow = 0; flow < 64; ++flow) {
+    int p = router.Select(1, flow + 1, now_);
+    EXPECT_NE(0, p);
+    // Only the flows of the dead path moved.
+    if (before[flow] != 0) {
+      EXPECT_EQ(before[flow], p);
+    }
+  }
+
+  // Back once acked again.
+  dead_[0] = false;
+  Run(&router, 200 * kMs);
+  EXPECT_EQ(3, router.paths_up(1));
+}
+
+TEST_F(MultipathTest, MovesFlowsOnlyWhenIdle) {
+  MultipathOptions options;
+  MultipathRouter router("mp", options);
+  AddPaths(&router, 2, NULL);
+  Run(&router, 500 * kMs);
+  // A flow on path 0, which then turns slow.
+  uint32_t flow = 1;
+  while (router.Select(1, flow, now_) != 0)
+    ++flow;
+  rtt_[0] = 80 * kMs;
+  for (int i = 0; i < 300; ++i) {
+    Run(&router, 5 * kMs);
+    EXPECT_EQ(0, router.Select(1, flow, now_));
+  }
+  // Idle for longer than the rtt spread, then it moves.
+  Run(&router, 200 * kMs);
+  EXPECT_EQ(1, router.Select(1, flow, now_));
+}
+
+}  // namespace
+}  // namespace bangnet
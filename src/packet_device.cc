@@ -0,0 +1,464 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include "src/packet_device.h"
+#include "src/utils.h"
+
+namespace bangnet {
+
+namespace {
+
+// Where a written frame starts in its transmit slot, right after the
+// header, unless the socket was told otherwise.
+const unsigned int kTxDataOffset = TPACKET_ALIGN(sizeof(struct tpacket3_hdr));
+
+inline struct tpacket_block_desc* BlockAt(unsigned char* ring,
+                                          unsigned int size, unsigned int i) {
+  return (struct tpacket_block_desc*)(ring + (size_t)i * size);
+}
+
+inline bool IsPowerOf2(unsigned int n) {
+  return n && !(n & (n - 1));
+}
+
+// Keeps the kernel from sending router solicitations and the like out of
+// a test interface.
+void DisableIpv6(const string& ifname) {
+  string path = "/proc/sys/net/ipv6/conf/" + ifname + "/disable_ipv6";
+  FILE* f = fopen(path.c_str(), "w");
+  if (f) {
+    fputs("1", f);
+    fclose(f);
+  }
+}
+
+}  // namespace
+
+std::atomic<int> PacketDevice::next_member_(0);
+
+PacketDevice::PacketDevice(const string& ifname,
+                           const PacketDeviceOptions& options)
+    : ifname_(ifname), mtu_(0), fd_(-1), ring_(NULL), ring_len_(0),
+      block_size_(options.block_size), rx_blocks_(options.rx_blocks),
+      tx_frame_size_(options.tx_frame_size), tx_frames_(options.tx_frames),
+      tx_ring_(NULL), block_(0), left_(0), next_frame_(NULL), released_(0),
+      finished_(0), tx_next_(0), rx_drops_(0) {
+  labels_ = "device=\"" + ifname_ + "\"";
+  if (options.fanout_group) {
+    char member[32];
+    snprintf(member, sizeof(member), ",member=\"%d\"", next_member_++);
+    labels_ += member;
+  }
+  RegisterMetrics();
+  if (!Setup(ifname, options)) {
+    this->close();
+    return;
+  }
+  LOG(INFO) << "Device " << device_name() << " attached, "
+            << rx_blocks_ << " blocks of " << block_size_ << " bytes";
+}
+
+bool PacketDevice::CreateVethPair(const string& a, const string& b) {
+  if (!utils::RunIp("link", "add", a.c_str(), "type", "veth", "peer",
+                    "name", b.c_str())) {
+    LOG(ERROR) << "Unable to create veth pair " << a << " " << b;
+    return false;
+  }
+  DisableIpv6(a);
+  DisableIpv6(b);
+  if (!utils::RunIp("link", "set", a.c_str(), "up") ||
+      !utils::RunIp("link", "set", b.c_str(), "up")) {
+    LOG(ERROR) << "Unable to bring up veth pair " << a << " " << b;
+    DeleteVethPair(a);
+    return false;
+  }
+  return true;
+}
+
+void PacketDevice::DeleteVethPair(const string& a) {
+  utils::RunIp("link", "del", a.c_str());
+}
+
+PacketDevice::~PacketDevice() {
+  this->close();
+  MetricsRegistry::Instance()->RemoveLabeled(labels_);
+}
+
+void PacketDevice::RegisterMetrics() {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  const string& labels = labels_;
+  metrics_.rx_frames = r->NewCounter("bangnet_packet_rx_frames_total",
+      "Frames read from the receive ring.", labels);
+  metrics_.rx_bytes = r->NewCounter("bangnet_packet_rx_bytes_total",
+      "Bytes read from the receive ring.", labels);
+  metrics_.rx_blocks = r->NewCounter("bangnet_packet_rx_blocks_total",
+      "Blocks of frames handed back to the kernel.", labels);
+  metrics_.rx_drops = r->NewCounter("bangnet_packet_rx_drops_total",
+      "Frames the kernel dropped on a full receive ring.", labels);
+  metrics_.tx_frames = r->NewCounter("bangnet_packet_tx_frames_total",
+      "Frames queued in the transmit ring.", labels);
+  metrics_.tx_bytes = r->NewCounter("bangnet_packet_tx_bytes_total",
+      "Bytes queued in the transmit ring.", labels);
+  metrics_.tx_drops = r->NewCounter("bangnet_packet_tx_drops_total",
+      "Frames dropped on a full transmit ring or for their size.", labels);
+  metrics_.tx_errors = r->NewCounter("bangnet_packet_tx_errors_total",
+      "Failed sends of the transmit ring.", labels);
+}
+
+bool PacketDevice::Setup(const string& ifname,
+                         const PacketDeviceOptions& options) {
+  long page = sysconf(_SC_PAGESIZE);
+  if (!IsPowerOf2(block_size_) || block_size_ < page || !rx_blocks_ ||
+      !IsPowerOf2(tx_frame_size_) || tx_frame_size_ <= kTxDataOffset ||
+      !tx_frames_) {
+    LOG(ERROR) << "Invalid ring sizes for " << ifname;
+    return false;
+  }
+
+  unsigned int ifindex = if_nametoindex(ifname.c_str());
+  if (!ifindex) {
+    LOG(ERROR) << "No interface " << ifname;
+    return false;
+  }
+
+  // No protocol until bound, so frames of other interfaces do not land in
+  // the ring meanwhile.
+  fd_ = socket(AF_PACKET, SOCK_RAW, 0);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Unable to open packet socket: " << strerror(errno);
+    return false;
+  }
+
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname.c_str(), IFNAMSIZ - 1);
+  if (ioctl(fd_, SIOCGIFMTU, &ifr) < 0) {
+    LOG(ERROR) << "Unable to get mtu of " << ifname;
+    return false;
+  }
+  mtu_ = ifr.ifr_mtu;
+
+  int version = TPACKET_V3;
+  if (setsockopt(fd_, SOL_PACKET, PACKET_VERSION, &version,
+                 sizeof(version)) < 0) {
+    LOG(ERROR) << "No TPACKET_V3 support: " << strerror(errno);
+    return false;
+  }
+
+  // Malformed frames are skipped instead of stopping the transmit ring.
+  int one = 1;
+  setsockopt(fd_, SOL_PACKET, PACKET_LOSS, &one, sizeof(one));
+  if (options.qdisc_bypass)
+    setsockopt(fd_, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+  // Like a tap, the device does not read back what was sent through it.
+  if (setsockopt(fd_, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one,
+                 sizeof(one)) < 0) {
+    LOG(WARNING) << "Device " << ifname << " reads its own frames back";
+  }
+
+  struct tpacket_req3 rx;
+  memset(&rx, 0, sizeof(rx));
+  rx.tp_block_size = block_size_;
+  rx.tp_block_nr = rx_blocks_;
+  // Frame slots are only a hint to the kernel for V3 rings.
+  rx.tp_frame_size = TPACKET_ALIGNMENT << 7;
+  rx.tp_frame_nr = (block_size_ / rx.tp_frame_size) * rx_blocks_;
+  rx.tp_retire_blk_tov = options.block_timeout_ms;
+  if (setsockopt(fd_, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx)) < 0) {
+    LOG(ERROR) << "Unable to set up receive ring: " << strerror(errno);
+    return false;
+  }
+
+  // Transmit slots are laid out in blocks of at least a page.
+  struct tpacket_req3 tx;
+  memset(&tx, 0, sizeof(tx));
+  tx.tp_block_size = tx_frame_size_ > page ? tx_frame_size_ : page;
+  tx.tp_frame_size = tx_frame_size_;
+  unsigned int per_block = tx.tp_block_size / tx_frame_size_;
+  tx.tp_block_nr = (tx_frames_ + per_block - 1) / per_block;
+  tx.tp_frame_nr = tx.tp_block_nr * per_block;
+  tx_frames_ = tx.tp_frame_nr;
+  if (setsockopt(fd_, SOL_PACKET, PACKET_TX_RING, &tx, sizeof(tx)) < 0) {
+    LOG(ERROR) << "Unable to set up transmit ring: " << strerror(errno);
+    return false;
+  }
+
+  // Both rings in one mapping, the transmit one after the receive one.
+  size_t rx_len = (size_t)block_size_ * rx_blocks_;
+  ring_len_ = rx_len + (size_t)tx.tp_block_size * tx.tp_block_nr;
+  void* ring = mmap(NULL, ring_len_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd_, 0);
+  if (ring == MAP_FAILED) {
+    // Locking fails beyond RLIMIT_MEMLOCK, the rings work without it.
+    ring = mmap(NULL, ring_len_, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, fd_, 0);
+  }
+  if (ring == MAP_FAILED) {
+    LOG(ERROR) << "Unable to map rings: " << strerror(errno);
+    ring_len_ = 0;
+    return false;
+  }
+  ring_ = (unsigned char*)ring;
+  tx_ring_ = ring_ + rx_len;
+
+  struct sockaddr_ll addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_protocol = htons(ETH_P_ALL);
+  addr.sll_ifindex = ifindex;
+  if (bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    LOG(ERROR) << "Unable to bind to " << ifname << ": " << strerror(errno);
+    return false;
+  }
+
+  // Frames to any mac, like a switch port.
+  struct packet_mreq mreq;
+  memset(&mreq, 0, sizeof(mreq));
+  mreq.mr_ifindex = ifindex;
+  mreq.mr_type = PACKET_MR_PROMISC;
+  if (setsockopt(fd_, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+                 sizeof(mreq)) < 0) {
+    LOG(WARNING) << "Unable to make " << ifname << " promiscuous";
+  }
+
+  if (options.fanout_group) {
+    int fanout = options.fanout_group | (options.fanout_mode << 16);
+    if (setsockopt(fd_, SOL_PACKET, PACKET_FANOUT, &fanout,
+                   sizeof(fanout)) < 0) {
+      LOG(ERROR) << "Unable to join fanout group " << options.fanout_group
+                 << " of " << ifname << ": " << strerror(errno);
+      return false;
+    }
+  }
+  return true;
+}
+
+void PacketDevice::close() {
+  if (ring_) {
+    munmap(ring_, ring_len_);
+    ring_ = NULL;
+    tx_ring_ = NULL;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool PacketDevice::BlockReady() {
+  if (!ring_ || finished_ == rx_blocks_)
+    return false;
+  struct tpacket_block_desc* b = BlockAt(ring_, block_size_, block_);
+  if (!next_frame_) {
+    if (!(__atomic_load_n(&b->hdr.bh1.block_status, __ATOMIC_ACQUIRE) &
+          TP_STATUS_USER)) {
+      return false;
+    }
+    left_ = b->hdr.bh1.num_pkts;
+    next_frame_ = (unsigned char*)b + b->hdr.bh1.offset_to_first_pkt;
+  }
+  return true;
+}
+
+bool PacketDevice::WaitBlock(int timeout_ms) {
+  while (!BlockReady()) {
+    if (fd_ < 0 || finished_ == rx_blocks_)
+      return false;
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int r = poll(&pfd, 1, timeout_ms);
+    if (r == 0 || (r < 0 && errno != EINTR))
+      return false;
+  }
+  return true;
+}
+
+int PacketDevice::PeekBurst(FrameSlot* frames, int n) {
+  if (n <= 0 || !BlockReady())
+    return 0;
+
+  int got = 0;
+  uint64_t bytes = 0;
+  while (got < n && left_) {
+    struct tpacket3_hdr* h = (struct tpacket3_hdr*)next_frame_;
+    frames[got].data = next_frame_ + h->tp_mac;
+    frames[got].len = h->tp_snaplen;
+    frames[got].cap = h->tp_snaplen;
+    bytes += h->tp_snaplen;
+    ++got;
+    next_frame_ += h->tp_next_offset;
+    --left_;
+  }
+  if (!left_) {
+    // The whole block was handed out, move on to the next.
+    next_frame_ = NULL;
+    ++finished_;
+    block_ = (block_ + 1) % rx_blocks_;
+  }
+  metrics_.rx_frames->Add(got);
+  metrics_.rx_bytes->Add(bytes);
+  return got;
+}
+
+void PacketDevice::Release() {
+  if (!ring_)
+    return;
+  for (; finished_; --finished_) {
+    struct tpacket_block_desc* b = BlockAt(ring_, block_size_, released_);
+    __atomic_store_n(&b->hdr.bh1.block_status, TP_STATUS_KERNEL,
+                     __ATOMIC_RELEASE);
+    released_ = (released_ + 1) % rx_blocks_;
+    metrics_.rx_blocks->Increment();
+  }
+}
+
+int PacketDevice::CopyBurst(FrameSlot* frames, int n) {
+  FrameSlot peeked[64];
+  int got = 0;
+  while (got < n) {
+    int want = n - got < 64 ? n - got : 64;
+    int m = PeekBurst(peeked, want);
+    if (!m)
+      break;
+    for (int i = 0; i < m; ++i, ++got) {
+      unsigned int len = peeked[i].len;
+      // Frames larger than the slot are truncated, like a short read.
+      if (len > frames[got].cap)
+        len = frames[got].cap;
+      memcpy(frames[got].data, peeked[i].data, len);
+      frames[got].len = len;
+    }
+  }
+  Release();
+  return got;
+}
+
+unsigned int PacketDevice::ReadFrame(void* buf, unsigned int cap) {
+  FrameSlot frame;
+  frame.data = (unsigned char*)buf;
+  frame.cap = cap;
+  frame.len = 0;
+  while (fd_ >= 0) {
+    if (CopyBurst(&frame, 1))
+      return frame.len;
+    if (!WaitBlock(-1))
+      return 0;
+  }
+  return 0;
+}
+
+int PacketDevice::ReadBurst(FrameSlot* frames, int n) {
+  if (n <= 0 || !WaitBlock(-1))
+    return 0;
+  return CopyBurst(frames, n);
+}
+
+int PacketDevice::TryReadBurst(FrameSlot* frames, int n) {
+  return n > 0 ? CopyBurst(frames, n) : 0;
+}
+
+bool PacketDevice::Oversized(unsigned int len) const {
+  return len > tx_frame_size_ - kTxDataOffset || len > mtu_ + header_len();
+}
+
+bool PacketDevice::Queue(const void* frame, unsigned int len) {
+  unsigned char* slot = tx_ring_ + (size_t)tx_next_ * tx_frame_size_;
+  struct tpacket3_hdr* h = (struct tpacket3_hdr*)slot;
+  if (__atomic_load_n(&h->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE)
+    return false;
+  memcpy(slot + kTxDataOffset, frame, len);
+  h->tp_len = len;
+  h->tp_snaplen = len;
+  h->tp_next_offset = 0;
+  __atomic_store_n(&h->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+  tx_next_ = (tx_next_ + 1) % tx_frames_;
+  metrics_.tx_frames->Increment();
+  metrics_.tx_bytes->Add(len);
+  return true;
+}
+
+bool PacketDevice::Flush() {
+  // Hands the queued slots to the kernel without waiting for them to go
+  // out, they turn available again once sent.
+  while (send(fd_, NULL, 0, MSG_DONTWAIT) < 0) {
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == ENOBUFS)
+      return true;
+    metrics_.tx_errors->Increment();
+    return false;
+  }
+  return true;
+}
+
+bool PacketDevice::WriteFrame(const void* frame, unsigned int len) {
+  if (!tx_ring_)
+    return false;
+  if (Oversized(len)) {
+    metrics_.tx_drops->Increment();
+    return false;
+  }
+  bool queued = Queue(frame, len);
+  if (!queued) {
+    // The ring is full of frames not sent yet, push them and try again.
+    Flush();
+    queued = Queue(frame, len);
+    if (!queued)
+      metrics_.tx_drops->Increment();
+  }
+  return Flush() && queued;
+}
+
+int PacketDevice::WriteBurst(const FrameSlot* frames, int n) {
+  if (!tx_ring_ || n <= 0)
+    return 0;
+  int queued = 0;
+  for (int i = 0; i < n; ++i) {
+    if (Oversized(frames[i].len)) {
+      metrics_.tx_drops->Increment();
+      continue;
+    }
+    if (Queue(frames[i].data, frames[i].len)) {
+      ++queued;
+      continue;
+    }
+    // The ring is full of frames not sent yet, push them and try again.
+    Flush();
+    if (Queue(frames[i].data, frames[i].len)) {
+      ++queued;
+    } else {
+      // Still full, the rest of the burst is dropped.
+      metrics_.tx_drops->Add(n - i);
+      break;
+    }
+  }
+  Flush();
+  return queued;
+}
+
+uint64_t PacketDevice::rx_drops() {
+  struct tpacket_stats_v3 stats;
+  socklen_t len = sizeof(stats);
+  // The kernel resets its counts on every read.
+  if (fd_ >= 0 &&
+      getsockopt(fd_, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == 0) {
+    rx_drops_ += stats.tp_drops;
+    metrics_.rx_drops->Add(stats.tp_drops);
+  }
+  return rx_drops_;
+}
+
+}  // namespace bangnet
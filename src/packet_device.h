@@ -0,0 +1,144 @@
+#ifndef BANGNET_PACKET_DEVICE_H_
+#define BANGNET_PACKET_DEVICE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "src/common.h"
+#include "src/frame_device.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+struct PacketDeviceOptions {
+  PacketDeviceOptions()
+      : block_size(1 << 20), rx_blocks(16), block_timeout_ms(1),
+        tx_frame_size(1 << 11), tx_frames(1024), fanout_group(0),
+        fanout_mode(0), qdisc_bypass(true) {}
+
+  // The receive ring is rx_blocks blocks of block_size bytes, a power of 2
+  // multiple of the page size. The kernel fills a block with as many
+  // frames as fit and hands it over whole, or once it was open for
+  // block_timeout_ms.
+  unsigned int block_size;
+  unsigned int rx_blocks;
+  unsigned int block_timeout_ms;
+
+  // The transmit ring is tx_frames slots of tx_frame_size bytes, which
+  // bounds the frames written, their header included.
+  unsigned int tx_frame_size;
+  unsigned int tx_frames;
+
+  // Devices of one process opened with the same group on the same
+  // interface share its frames, each frame goes to one of them chosen by
+  // fanout_mode, PACKET_FANOUT_HASH to keep flows on one worker or
+  // PACKET_FANOUT_CPU to keep frames on the cpu they arrived on. 0 for no
+  // fanout.
+  uint16_t fanout_group;
+  uint16_t fanout_mode;
+
+  // Writes skip the qdisc of the interface, like a driver's own queue.
+  bool qdisc_bypass;
+};
+
+// A frame device on an existing interface, like a veth or a bridge port,
+// through an AF_PACKET socket with TPACKET_V3 rings shared with the
+// kernel. Frames are received in blocks, so a burst takes no system call
+// while a block is filled, and can be read in place with PeekBurst().
+// Written frames are queued in the transmit ring and sent with one call
+// per burst. Frames the device sends are not received back.
+class PacketDevice : public FrameDevice {
+public:
+  // Attaches to the interface ifname, check IsOpen() for errors.
+  PacketDevice(const string& ifname, const PacketDeviceOptions& options);
+  ~PacketDevice();
+
+  // Creates the veth pair a and b and brings it up without ipv6, so only
+  // frames written to one end arrive at the other. Needs root.
+  static bool CreateVethPair(const string& a, const string& b);
+
+  // Removes the veth pair of end a.
+  static void DeleteVethPair(const string& a);
+
+  string device_name() const { return ifname_; }
+  unsigned int mtu() const { return mtu_; }
+  int fd() const { return fd_; }
+  bool IsOpen() const { return fd_ >= 0; }
+  void close();
+
+  bool WriteFrame(const void* frame, unsigned int len);
+  unsigned int ReadFrame(void* buf, unsigned int cap);
+  int ReadBurst(FrameSlot* frames, int n);
+  int TryReadBurst(FrameSlot* frames, int n);
+  int WriteBurst(const FrameSlot* frames, int n);
+
+  // Points up to n frames at the receive ring without copying, from one
+  // block, and returns their count, 0 if no block is ready. The frames
+  // stay valid until Release().
+  int PeekBurst(FrameSlot* frames, int n);
+
+  // Hands the blocks of the frames peeked back to the kernel.
+  void Release();
+
+  // Frames the kernel dropped because the receive ring was full.
+  uint64_t rx_drops();
+
+private:
+  bool Setup(const string& ifname, const PacketDeviceOptions& options);
+  void RegisterMetrics();
+  // Returns true if the kernel handed over the block being read.
+  bool BlockReady();
+  // Waits up to timeout_ms for a block, returns false if none came.
+  bool WaitBlock(int timeout_ms);
+  int CopyBurst(FrameSlot* frames, int n);
+  // Returns true if a frame of len bytes fits no transmit slot or the mtu.
+  bool Oversized(unsigned int len) const;
+  // Queues a frame that is not oversized in the transmit ring, false if
+  // the ring is full.
+  bool Queue(const void* frame, unsigned int len);
+  bool Flush();
+
+  string ifname_;
+  // Metric labels, fanout members of one interface each have their own.
+  string labels_;
+  unsigned int mtu_;
+  int fd_;
+
+  unsigned char* ring_;
+  size_t ring_len_;
+  unsigned int block_size_;
+  unsigned int rx_blocks_;
+  unsigned int tx_frame_size_;
+  unsigned int tx_frames_;
+  unsigned char* tx_ring_;
+
+  // Block being read, the frames of it left and the next of them.
+  unsigned int block_;
+  unsigned int left_;
+  unsigned char* next_frame_;
+  // Blocks read to the end but not handed back, from released_ on.
+  unsigned int released_;
+  unsigned int finished_;
+  unsigned int tx_next_;
+  uint64_t rx_drops_;
+
+  struct Metrics {
+    Counter* rx_frames;
+    Counter* rx_bytes;
+    Counter* rx_blocks;
+    Counter* rx_drops;
+    Counter* tx_frames;
+    Counter* tx_bytes;
+    Counter* tx_drops;
+    Counter* tx_errors;
+  } metrics_;
+
+  static std::atomic<int> next_member_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(PacketDevice);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_PACKET_DEVICE_H_
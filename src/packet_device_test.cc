@@ -0,0 +1,218 @@
+#include "src/packet_device.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+
+#include <linux/if_packet.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+// Frames of the local experimental ethertype, told apart by their byte 14.
+void MakeFrame(unsigned char* frame, unsigned int len, unsigned char id) {
+  memset(frame, 0, len);
+  memset(frame, 0xff, 6);
+  frame[6] = 0x02;
+  frame[11] = id;
+  frame[12] = 0x88;
+  frame[13] = 0xb5;
+  frame[14] = id;
+}
+
+// A veth pair, created for each test when running as root.
+class PacketDeviceTest : public ::testing::Test {
+protected:
+  PacketDeviceTest() : ok_(false) {
+    char name[IFNAMSIZ];
+    snprintf(name, sizeof(name), "bnp%da", (int)getpid());
+    a_ = name;
+    snprintf(name, sizeof(name), "bnp%db", (int)getpid());
+    b_ = name;
+    options_.block_size = 1 << 16;
+    options_.rx_blocks = 4;
+    options_.tx_frames = 64;
+  }
+
+  void SetUp() {
+    ok_ = geteuid() == 0 && PacketDevice::CreateVethPair(a_, b_);
+  }
+
+  void TearDown() {
+    if (ok_)
+      PacketDevice::DeleteVethPair(a_);
+  }
+
+  // Value of a counter of device a_, -1 if missing.
+  int64_t Counted(const string& name) {
+    vector<MetricSample> samples = MetricsRegistry::Instance()->Snapshot();
+    for (size_t i = 0; i < samples.size(); ++i) {
+      if (samples[i].name == name &&
+          samples[i].labels == "device=\"" + a_ + "\"")
+        return samples[i].value;
+    }
+    return -1;
+  }
+
+  // Reads frames from dev until it has n of ours, ignoring others.
+  int ReadOurs(PacketDevice* dev, unsigned char* ids, int n) {
+    int got = 0;
+    unsigned char mem[8][2048];
+    FrameSlot frames[8];
+    for (int i = 0; i < 8; ++i) {
+      frames[i].data = mem[i];
+      frames[i].cap = sizeof(mem[i]);
+    }
+    while (got < n) {
+      struct pollfd pfd;
+      pfd.fd = dev->fd();
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, 1000) <= 0)
+        break;
+      int m = dev->TryReadBurst(frames, 8);
+      for (int i = 0; i < m && got < n; ++i) {
+        if (frames[i].len >= 15 && frames[i].data[12] == 0x88 &&
+            frames[i].data[13] == 0xb5) {
+          ids[got++] = frames[i].data[14];
+        }
+      }
+    }
+    return got;
+  }
+
+  bool ok_;
+  string a_;
+  string b_;
+  PacketDeviceOptions options_;
+};
+
+TEST_F(PacketDeviceTest, FailsOnMissingInterface) {
+  PacketDevice dev("bnp-missing", options_);
+  EXPECT_FALSE(dev.IsOpen());
+  unsigned char frame[64];
+  MakeFrame(frame, sizeof(frame), 1);
+  EXPECT_FALSE(dev.WriteFrame(frame, sizeof(frame)));
+}
+
+TEST_F(PacketDeviceTest, RoundTripsFrames) {
+  if (!ok_) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  PacketDevice a(a_, options_);
+  PacketDevice b(b_, options_);
+  ASSERT_TRUE(a.IsOpen());
+  ASSERT_TRUE(b.IsOpen());
+  EXPECT_EQ(1500u, a.mtu());
+
+  unsigned char mem[4][100];
+  FrameSlot frames[4];
+  for (int i = 0; i < 4; ++i) {
+    MakeFrame(mem[i], sizeof(mem[i]), (unsigned char)(i + 1));
+    frames[i].data = mem[i];
+    frames[i].len = 60 + i;
+  }
+  EXPECT_EQ(4, a.WriteBurst(frames, 4));
+  // As large as the mtu allows.
+  unsigned char full[1514];
+  MakeFrame(full, sizeof(full), 5);
+  EXPECT_TRUE(a.WriteFrame(full, sizeof(full)));
+
+  unsigned char ids[5];
+  ASSERT_EQ(5, ReadOurs(&b, ids, 5));
+  for (int i = 0; i < 4; ++i)
+    EXPECT_EQ(i + 1, ids[i]);
+  EXPECT_EQ(5, ids[4]);
+
+  // Too large for the mtu.
+  unsigned char big[1600];
+  MakeFrame(big, sizeof(big), 9);
+  EXPECT_FALSE(a.WriteFrame(big, sizeof(big)));
+  EXPECT_EQ(0u, b.rx_drops());
+}
+
+TEST_F(PacketDeviceTest, CountsEachDropOnce) {
+  if (!ok_) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  PacketDevice a(a_, options_);
+  ASSERT_TRUE(a.IsOpen());
+
+  unsigned char big[1600];
+  MakeFrame(big, sizeof(big), 1);
+  EXPECT_FALSE(a.WriteFrame(big, sizeof(big)));
+  EXPECT_EQ(1, Counted("bangnet_packet_tx_drops_total"));
+
+  // Oversized frames in a burst are skipped, the others still go out.
+  unsigned char small[64];
+  MakeFrame(small, sizeof(small), 2);
+  FrameSlot frames[3] = {{big, sizeof(big), 0},
+                         {small, sizeof(small), 0},
+                         {big, sizeof(big), 0}};
+  EXPECT_EQ(1, a.WriteBurst(frames, 3));
+  EXPECT_EQ(3, Counted("bangnet_packet_tx_drops_total"));
+  EXPECT_EQ(1, Counted("bangnet_packet_tx_frames_total"));
+}
+
+TEST_F(PacketDeviceTest, PeeksInPlace) {
+  if (!ok_) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  PacketDevice a(a_, options_);
+  PacketDevice b(b_, options_);
+  ASSERT_TRUE(a.IsOpen() && b.IsOpen());
+
+  unsigned char frame[64];
+  for (int i = 0; i < 3; ++i) {
+    MakeFrame(frame, sizeof(frame), (unsigned char)(i + 1));
+    ASSERT_TRUE(a.WriteFrame(frame, sizeof(frame)));
+  }
+
+  FrameSlot frames[8];
+  int ours = 0;
+  for (int tries = 0; ours < 3 && tries < 100; ++tries) {
+    struct pollfd pfd;
+    pfd.fd = b.fd();
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 100);
+    int n = b.PeekBurst(frames, 8);
+    for (int i = 0; i < n; ++i) {
+      if (frames[i].len == sizeof(frame) && frames[i].data[12] == 0x88) {
+        EXPECT_EQ(++ours, frames[i].data[14]);
+      }
+    }
+    b.Release();
+  }
+  EXPECT_EQ(3, ours);
+}
+
+TEST_F(PacketDeviceTest, FansOutFrames) {
+  if (!ok_) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  // Round robin, so both members get frames of a single flow.
+  options_.fanout_group = (uint16_t)getpid();
+  options_.fanout_mode = PACKET_FANOUT_LB;
+  PacketDevice a(a_, PacketDeviceOptions());
+  PacketDevice b1(b_, options_);
+  PacketDevice b2(b_, options_);
+  ASSERT_TRUE(a.IsOpen() && b1.IsOpen() && b2.IsOpen());
+
+  unsigned char frame[64];
+  for (int i = 0; i < 8; ++i) {
+    MakeFrame(frame, sizeof(frame), (unsigned char)i);
+    ASSERT_TRUE(a.WriteFrame(frame, sizeof(frame)));
+  }
+  unsigned char ids[8];
+  EXPECT_EQ(4, ReadOurs(&b1, ids, 4));
+  EXPECT_EQ(4, ReadOurs(&b2, ids, 4));
+}
+
+}  // namespace
+}  // namespace bangnet
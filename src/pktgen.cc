@@ -0,0 +1,255 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "src/checksum.h"
+#include "src/clock.h"
+#include "src/pktgen.h"
+
+namespace bangnet {
+
+namespace {
+
+const uint32_t kStampMagic = 0x62616e67;  // "bang"
+
+// Offset of the stamp, right after the udp header.
+const unsigned int kStampOffset = 14 + 20 + 8;
+
+struct Stamp {
+  uint32_t magic;
+  uint64_t seq;
+  uint64_t stamp;
+} __attribute__((packed));
+
+int TryRead(FrameDevice* rx, FrameSlot* frames, int n) {
+  return rx->TryReadBurst(frames, n);
+}
+
+}  // namespace
+
+PacketGenerator::PacketGenerator(const PktgenOptions& options)
+    : options_(options), next_seq_(0), next_flow_(0) {
+  if (options_.frame_size < kMinFrameSize)
+    options_.frame_size = kMinFrameSize;
+  CHECK_LE(options_.frame_size, kMaxFrameSize) << "Invalid frame size";
+  if (options_.flows == 0)
+    options_.flows = 1;
+
+  unsigned int size = options_.frame_size;
+  template_.assign(size, 0);
+  unsigned char* f = &template_[0];
+
+  const unsigned char dst[6] = {0x02, 0x62, 0x67, 0, 0, 0x02};
+  const unsigned char src[6] = {0x02, 0x62, 0x67, 0, 0, 0x01};
+  memcpy(f, dst, 6);
+  memcpy(f + 6, src, 6);
+  f[12] = 0x08;
+  f[13] = 0x00;
+
+  unsigned char* ip = f + 14;
+  uint16_t ip_len = (uint16_t)(size - 14);
+  ip[0] = 0x45;
+  *(uint16_t*)(ip + 2) = htons(ip_len);
+  ip[8] = 64;
+  ip[9] = 17;
+  const unsigned char sip[4] = {10, 98, 0, 1};
+  const unsigned char dip[4] = {10, 98, 0, 2};
+  memcpy(ip + 12, sip, 4);
+  memcpy(ip + 16, dip, 4);
+  *(uint16_t*)(ip + 10) = InetChecksum(ip, 20);
+
+  unsigned char* udp = ip + 20;
+  *(uint16_t*)(udp + 2) = htons(9);
+  *(uint16_t*)(udp + 4) = htons((uint16_t)(ip_len - 20));
+  for (unsigned int i = kStampOffset + sizeof(Stamp); i < size; ++i)
+    f[i] = (unsigned char)i;
+}
+
+void PacketGenerator::Fill(FrameSlot* frames, int n, uint64_t stamp) {
+  unsigned int size = options_.frame_size;
+  for (int i = 0; i < n; ++i) {
+    unsigned char* f = frames[i].data;
+    memcpy(f, &template_[0], size);
+    frames[i].len = size;
+
+    // Flows differ by udp source port, the checksum is left zero.
+    *(uint16_t*)(f + 14 + 20) = htons((uint16_t)(1024 + next_flow_));
+    if (++next_flow_ == options_.flows)
+      next_flow_ = 0;
+
+    Stamp s;
+    s.magic = kStampMagic;
+    s.seq = next_seq_++;
+    s.stamp = stamp;
+    memcpy(f + kStampOffset, &s, sizeof(s));
+  }
+}
+
+bool PacketGenerator::Parse(const unsigned char* frame, unsigned int len,
+                            uint64_t* seq, uint64_t* stamp) {
+  if (len < kStampOffset + sizeof(Stamp))
+    return false;
+  Stamp s;
+  memcpy(&s, frame + kStampOffset, sizeof(s));
+  if (s.magic != kStampMagic)
+    return false;
+  *seq = s.seq;
+  *stamp = s.stamp;
+  return true;
+}
+
+BenchResult RunFrameBench(const string& name, FrameDevice* tx,
+                          FrameDevice* rx, const PktgenOptions& options,
+                          uint64_t duration_ms) {
+  PacketGenerator gen(options);
+  unsigned int burst = options.burst ? options.burst : 1;
+  unsigned int size = gen.options().frame_size;
+  unsigned int cap = size + 64;
+
+  vector<unsigned char> tx_mem(burst * size), rx_mem(burst * cap);
+  vector<FrameSlot> tx_frames(burst), rx_frames(burst);
+  for (unsigned int i = 0; i < burst; ++i) {
+    tx_frames[i].data = &tx_mem[i * size];
+    tx_frames[i].cap = size;
+    rx_frames[i].data = &rx_mem[i * cap];
+    rx_frames[i].cap = cap;
+  }
+
+  StageClock stages;
+  int gen_stage = stages.AddStage("gen");
+  int tx_stage = stages.AddStage("tx");
+  int rx_stage = stages.AddStage("rx");
+  Histogram latency;
+
+  BenchResult result;
+  result.name = name;
+  uint64_t lost = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+
+  while (now < end) {
+    uint64_t c0 = CycleCount();
+    gen.Fill(&tx_frames[0], burst, c0);
+    uint64_t c1 = CycleCount();
+    int sent = tx->WriteBurst(&tx_frames[0], burst);
+    uint64_t c2 = CycleCount();
+    stages.Add(gen_stage, c1 - c0);
+    stages.Add(tx_stage, c2 - c1);
+
+    int received = 0;
+    while (received < sent) {
+      struct pollfd pfd;
+      pfd.fd = rx->fd();
+      pfd.events = POLLIN;
+      if (pfd.fd >= 0 && poll(&pfd, 1, 100) <= 0)
+        break;
+
+      uint64_t c3 = CycleCount();
+      int got = rx->ReadBurst(&rx_frames[0], sent - received);
+      uint64_t c4 = CycleCount();
+      stages.Add(rx_stage, c4 - c3);
+      if (got <= 0)
+        break;
+
+      for (int i = 0; i < got; ++i) {
+        uint64_t seq, stamp;
+        if (PacketGenerator::Parse(rx_frames[i].data, rx_frames[i].len,
+                                   &seq, &stamp)) {
+          latency.Record((uint64_t)((c4 - stamp) *
+                                    CycleClock::ns_per_cycle()));
+        }
+        result.bytes += rx_frames[i].len;
+      }
+      received += got;
+      result.packets += got;
+    }
+    lost += burst - received;
+    now = MonotonicNs();
+  }
+
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+  result.latency = latency.Snapshot();
+  if (lost)
+    result.AddExtra("lost", (double)lost);
+  return result;
+}
+
+BenchResult RunStreamBench(const string& name, FrameDevice* tx,
+                           FrameDevice* rx, StreamReader reader,
+                           const PktgenOptions& options,
+                           uint64_t duration_ms) {
+  PacketGenerator gen(options);
+  unsigned int burst = options.burst ? options.burst : 1;
+  unsigned int size = gen.options().frame_size;
+  unsigned int cap = size + 64;
+  if (!reader)
+    reader = TryRead;
+
+  vector<unsigned char> tx_mem(burst * size), rx_mem(burst * cap);
+  vector<FrameSlot> tx_frames(burst), rx_frames(burst);
+  for (unsigned int i = 0; i < burst; ++i) {
+    tx_frames[i].data = &tx_mem[i * size];
+    tx_frames[i].cap = size;
+    rx_frames[i].data = &rx_mem[i * cap];
+    rx_frames[i].cap = cap;
+  }
+
+  StageClock stages;
+  int gen_stage = stages.AddStage("gen");
+  int tx_stage = stages.AddStage("tx");
+  int rx_stage = stages.AddStage("rx");
+  Histogram latency;
+
+  // Frames left over from an earlier run, which devices batching frames
+  // may hand over only after a timeout.
+  usleep(10000);
+  while (rx->TryReadBurst(&rx_frames[0], burst) > 0) {}
+
+  BenchResult result;
+  result.name = name;
+  uint64_t sent = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    uint64_t c0 = CycleCount();
+    gen.Fill(&tx_frames[0], burst, c0);
+    uint64_t c1 = CycleCount();
+    sent += tx->WriteBurst(&tx_frames[0], burst);
+    uint64_t c2 = CycleCount();
+    stages.Add(gen_stage, c1 - c0);
+    stages.Add(tx_stage, c2 - c1);
+
+    int got;
+    do {
+      uint64_t c3 = CycleCount();
+      got = reader(rx, &rx_frames[0], burst);
+      for (int i = 0; i < got; ++i) {
+        uint64_t seq, stamp;
+        if (!PacketGenerator::Parse(rx_frames[i].data, rx_frames[i].len,
+                                    &seq, &stamp)) {
+          continue;
+        }
+        latency.Record((uint64_t)((c3 - stamp) *
+                                  CycleClock::ns_per_cycle()));
+        result.packets++;
+        result.bytes += rx_frames[i].len;
+      }
+      stages.Add(rx_stage, CycleCount() - c3);
+    } while (got > 0);
+    now = MonotonicNs();
+  }
+
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+  result.latency = latency.Snapshot();
+  if (sent > result.packets)
+    result.AddExtra("lost", (double)(sent - result.packets));
+  return result;
+}
+
+}  // namespace bangnet
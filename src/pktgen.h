@@ -0,0 +1,79 @@
+#ifndef BANGNET_PKTGEN_H_
+#define BANGNET_PKTGEN_H_
+
+#include <stdint.h>
+
+#include "src/bench.h"
+#include "src/common.h"
+#include "src/frame_device.h"
+
+namespace bangnet {
+
+struct PktgenOptions {
+  PktgenOptions() : frame_size(64), flows(1), burst(32) {}
+
+  // Whole frame size, ethernet header included.
+  unsigned int frame_size;
+
+  // Frames are spread round robin over this many udp flows.
+  unsigned int flows;
+
+  // Frames per burst.
+  unsigned int burst;
+};
+
+// Generates ethernet/ipv4/udp frames in the style of the kernel pktgen.
+// Every frame carries a sequence number and the cycle count it was sent at,
+// so the receiving side can measure latency and loss.
+class PacketGenerator {
+public:
+  // Smallest frame that holds the headers and the stamp.
+  static const unsigned int kMinFrameSize = 64;
+
+  // Largest frame, whose ip length still fits 16 bits.
+  static const unsigned int kMaxFrameSize = 65535 + 14;
+
+  explicit PacketGenerator(const PktgenOptions& options);
+
+  const PktgenOptions& options() const { return options_; }
+
+  // Fills n frames, data of each must hold options().frame_size bytes.
+  void Fill(FrameSlot* frames, int n, uint64_t stamp);
+
+  // Reads the stamp of a generated frame, returns false if it is not one.
+  static bool Parse(const unsigned char* frame, unsigned int len,
+                    uint64_t* seq, uint64_t* stamp);
+
+private:
+  PktgenOptions options_;
+  vector<unsigned char> template_;
+  uint64_t next_seq_;
+  unsigned int next_flow_;
+};
+
+// Pushes generated bursts through tx and reads them back from rx for
+// duration_ms, one burst in flight at a time. Reports rate, the ns per
+// packet of the generate, tx and rx stages, and the tx to rx latency.
+BenchResult RunFrameBench(const string& name, FrameDevice* tx,
+                          FrameDevice* rx, const PktgenOptions& options,
+                          uint64_t duration_ms);
+
+// Reads up to n frames from rx without blocking, like TryReadBurst(). The
+// frames need to stay valid until the next call only, so readers can hand
+// out frames in place and release them on the next call.
+typedef int (*StreamReader)(FrameDevice* rx, FrameSlot* frames, int n);
+
+// Streams generated bursts into tx for duration_ms while draining what
+// arrived at rx without blocking, the way a worker loop alternates between
+// its devices. Unlike RunFrameBench(), which waits for each burst, this
+// lets devices which hand over frames in batches fill them. Frames are
+// read with reader, or TryReadBurst() if it is null. Frames still in
+// flight at the end count as lost.
+BenchResult RunStreamBench(const string& name, FrameDevice* tx,
+                           FrameDevice* rx, StreamReader reader,
+                           const PktgenOptions& options,
+                           uint64_t duration_ms);
+
+}  // namespace bangnet
+
+#endif  // BANGNET_PKTGEN_H_
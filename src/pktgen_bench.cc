@@ -0,0 +1,61 @@
+#include <stdio.h>
+
+#include "src/clock.h"
+#include "src/loopback_device.h"
+#include "src/pktgen.h"
+
+namespace bangnet {
+namespace {
+
+BENCHMARK(LoopbackFrames) {
+  for (size_t i = 0; i < options.frame_sizes.size(); ++i) {
+    PktgenOptions pktgen;
+    pktgen.frame_size = options.frame_sizes[i];
+    pktgen.flows = options.flows;
+    pktgen.burst = options.burst;
+
+    LoopbackDevice* a;
+    LoopbackDevice* b;
+    LoopbackDevice::CreatePair(pktgen.frame_size, &a, &b);
+    char name[64];
+    snprintf(name, sizeof(name), "loopback/%uB/burst%u", pktgen.frame_size,
+             pktgen.burst);
+    results->push_back(RunFrameBench(name, a, b, pktgen,
+                                     options.duration_ms));
+    delete a;
+    delete b;
+  }
+}
+
+// Throughput per core of the standard, jumbo and 64KB mtus. Frames take the
+// same per packet costs whatever their size, so the larger the mtu, the more
+// bytes a core moves.
+BENCHMARK(JumboMtu) {
+  static const unsigned int kMtus[] = {1500, 9000, kMaxMtu};
+  for (size_t i = 0; i < sizeof(kMtus) / sizeof(kMtus[0]); ++i) {
+    PktgenOptions pktgen;
+    pktgen.frame_size = kMtus[i] + 14;
+    pktgen.flows = options.flows;
+    // Keep a burst within the socket buffers.
+    pktgen.burst = options.burst;
+    while (pktgen.burst > 1 && pktgen.burst * pktgen.frame_size > (1 << 20))
+      pktgen.burst /= 2;
+
+    LoopbackDevice* a;
+    LoopbackDevice* b;
+    LoopbackDevice::CreatePair(kMtus[i], &a, &b);
+    char name[64];
+    snprintf(name, sizeof(name), "mtu%u/burst%u", kMtus[i], pktgen.burst);
+    uint64_t cpu = ThreadCpuNs();
+    BenchResult r = RunFrameBench(name, a, b, pktgen, options.duration_ms);
+    cpu = ThreadCpuNs() - cpu;
+    if (cpu > 0)
+      r.AddExtra("gbps/core", r.bytes * 8 / (double)cpu);
+    results->push_back(r);
+    delete a;
+    delete b;
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
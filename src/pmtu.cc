@@ -0,0 +1,305 @@
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "src/checksum.h"
+#include "src/icmp.h"
+#include "src/pmtu.h"
+
+namespace bangnet {
+
+namespace {
+
+// The search stops once the bounds are this close.
+const unsigned int kSearchPrecision = 8;
+
+const uint8_t kTcpSyn = 0x02;
+const uint8_t kTcpOptionEnd = 0;
+const uint8_t kTcpOptionNop = 1;
+const uint8_t kTcpOptionMss = 2;
+
+}  // namespace
+
+PathMtuProber::PathMtuProber(const PmtuOptions& options, uint64_t now_ns)
+    : options_(options), low_(options.base_mtu), high_(0), searching_(true),
+      probe_size_(0), probe_seq_(0), probe_losses_(0), deadline_(now_ns),
+      next_seq_(1), probes_lost_(0) {
+  Restart(now_ns);
+}
+
+void PathMtuProber::Restart(uint64_t now_ns) {
+  high_ = options_.max_mtu + 1;
+  searching_ = true;
+  probe_size_ = 0;
+  probe_losses_ = 0;
+  deadline_ = now_ns;
+}
+
+void PathMtuProber::Finish(uint64_t now_ns) {
+  searching_ = false;
+  probe_size_ = 0;
+  deadline_ = now_ns + options_.reprobe_interval_ns;
+}
+
+unsigned int PathMtuProber::NextProbe(uint64_t now_ns, uint32_t* seq) {
+  if (now_ns < deadline_)
+    return 0;
+  if (!searching_)
+    Restart(now_ns);
+
+  if (probe_size_) {
+    // Timed out, the same size is retried until max_probes were lost.
+    ++probes_lost_;
+    if (++probe_losses_ >= options_.max_probes) {
+      high_ = probe_size_;
+      probe_losses_ = 0;
+    }
+  }
+
+  if (high_ <= low_ + kSearchPrecision) {
+    Finish(now_ns);
+    return 0;
+  }
+  if (!probe_size_ || probe_losses_ == 0)
+    probe_size_ = low_ + (high_ - low_) / 2;
+  probe_seq_ = next_seq_++;
+  deadline_ = now_ns + options_.probe_timeout_ns;
+  *seq = probe_seq_;
+  return probe_size_;
+}
+
+bool PathMtuProber::OnProbeAck(uint32_t seq, unsigned int size,
+                               uint64_t now_ns) {
+  // Only the probe in flight counts, stale or forged acks are ignored.
+  if (!probe_size_ || seq != probe_seq_ || size != probe_size_)
+    return false;
+  probe_size_ = 0;
+  probe_losses_ = 0;
+  // Send the next probe right away.
+  deadline_ = now_ns;
+  if (size <= low_ || size >= high_)
+    return false;
+  low_ = size;
+  return true;
+}
+
+bool PathMtuProber::OnPacketTooBig(unsigned int mtu, uint64_t /*now_ns*/) {
+  if (mtu < options_.base_mtu)
+    mtu = options_.base_mtu;
+  if (mtu + 1 < high_)
+    high_ = mtu + 1;
+  if (mtu >= low_)
+    return false;
+  low_ = mtu;
+  return true;
+}
+
+unsigned int WritePmtuProbe(uint32_t seq, unsigned int size,
+                            const PmtuOptions& options, unsigned char* buf) {
+  unsigned int len = size - options.underlay_overhead;
+  PmtuMessage m;
+  m.type = PMTU_PROBE;
+  m.reserved = 0;
+  m.size = htons((uint16_t)size);
+  m.seq = htonl(seq);
+  memcpy(buf, &m, sizeof(m));
+  memset(buf + sizeof(m), 0, len - sizeof(m));
+  return len;
+}
+
+bool ParsePmtuMessage(const unsigned char* data, unsigned int len,
+                      const PmtuOptions& options, PmtuMessage* msg) {
+  if (len < kPmtuMessageLen)
+    return false;
+  memcpy(msg, data, sizeof(*msg));
+  msg->size = ntohs(msg->size);
+  msg->seq = ntohl(msg->seq);
+  if (msg->type == PMTU_PROBE)
+    return msg->size == len + options.underlay_overhead;
+  return msg->type == PMTU_PROBE_ACK && len == kPmtuMessageLen;
+}
+
+unsigned int WritePmtuAck(const PmtuMessage& probe, unsigned char* buf) {
+  PmtuMessage m;
+  m.type = PMTU_PROBE_ACK;
+  m.reserved = 0;
+  m.size = htons(probe.size);
+  m.seq = htonl(probe.seq);
+  memcpy(buf, &m, sizeof(m));
+  return sizeof(m);
+}
+
+PathMtuManager::PathMtuManager(const string& name, FrameDevice* device,
+                               Mode mode, const PmtuOptions& options)
+    : name_(name), device_(device), mode_(mode), options_(options),
+      min_overlay_mtu_(0) {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "stage=\"" + name_ + "\"";
+  metrics_.probes = r->NewCounter("bangnet_pmtu_probes_total",
+      "Path mtu probes sent to peers.", labels);
+  metrics_.probes_lost = r->NewCounter("bangnet_pmtu_probes_lost_total",
+      "Path mtu probes which were not acked in time.", labels);
+  metrics_.icmp_sent = r->NewCounter("bangnet_pmtu_icmp_sent_total",
+      "ICMP too big errors written back to the device.", labels);
+  metrics_.min_overlay_mtu = r->NewGauge("bangnet_pmtu_min_overlay_mtu",
+      "Smallest overlay mtu across peers.", labels);
+}
+
+PathMtuManager::~PathMtuManager() {
+  for (map<uint32_t, PathMtuProber*>::iterator it = peers_.begin();
+       it != peers_.end(); ++it)
+    delete it->second;
+  MetricsRegistry::Instance()->RemoveLabeled("stage=\"" + name_ + "\"");
+}
+
+unsigned int PathMtuManager::OverlayMtu(unsigned int path_mtu) const {
+  unsigned int overhead = options_.underlay_overhead +
+                          options_.encap_overhead + 14;
+  return path_mtu > overhead ? path_mtu - overhead : 0;
+}
+
+void PathMtuManager::AddPeer(uint32_t peer, uint64_t now_ns) {
+  if (peers_.count(peer))
+    return;
+  peers_[peer] = new PathMtuProber(options_, now_ns);
+  Update();
+}
+
+void PathMtuManager::RemovePeer(uint32_t peer) {
+  map<uint32_t, PathMtuProber*>::iterator it = peers_.find(peer);
+  if (it == peers_.end())
+    return;
+  delete it->second;
+  peers_.erase(it);
+  Update();
+}
+
+int PathMtuManager::Poll(uint64_t now_ns, PmtuProbeRequest* out, int max) {
+  int n = 0;
+  for (map<uint32_t, PathMtuProber*>::iterator it = peers_.begin();
+       it != peers_.end() && n < max; ++it) {
+    PathMtuProber* p = it->second;
+    uint64_t lost = p->probes_lost();
+    uint32_t seq;
+    unsigned int size = p->NextProbe(now_ns, &seq);
+    metrics_.probes_lost->Add(p->probes_lost() - lost);
+    if (!size)
+      continue;
+    out[n].peer = it->first;
+    out[n].seq = seq;
+    out[n].size = size;
+    ++n;
+  }
+  metrics_.probes->Add(n);
+  return n;
+}
+
+void PathMtuManager::OnProbeAck(uint32_t peer, const PmtuMessage& ack,
+                                uint64_t now_ns) {
+  map<uint32_t, PathMtuProber*>::iterator it = peers_.find(peer);
+  if (it != peers_.end() && it->second->OnProbeAck(ack.seq, ack.size, now_ns))
+    Update();
+}
+
+void PathMtuManager::OnPacketTooBig(uint32_t peer, unsigned int mtu,
+                                    uint64_t now_ns) {
+  map<uint32_t, PathMtuProber*>::iterator it = peers_.find(peer);
+  if (it != peers_.end() && it->second->OnPacketTooBig(mtu, now_ns))
+    Update();
+}
+
+unsigned int PathMtuManager::overlay_mtu(uint32_t peer) const {
+  map<uint32_t, PathMtuProber*>::const_iterator it = peers_.find(peer);
+  if (it == peers_.end())
+    return 0;
+  return OverlayMtu(it->second->path_mtu());
+}
+
+void PathMtuManager::Update() {
+  unsigned int mtu = 0;
+  for (map<uint32_t, PathMtuProber*>::iterator it = peers_.begin();
+       it != peers_.end(); ++it) {
+    unsigned int m = OverlayMtu(it->second->path_mtu());
+    if (!mtu || m < mtu)
+      mtu = m;
+  }
+  if (!mtu || mtu == min_overlay_mtu_)
+    return;
+
+  LOG(INFO) << name_ << ": overlay mtu " << min_overlay_mtu_ << " -> " << mtu;
+  min_overlay_mtu_ = mtu;
+  metrics_.min_overlay_mtu->Set(mtu);
+  if (mode_ == PMTU_ADJUST_DEVICE && !device_->SetMtu(mtu))
+    LOG(WARNING) << name_ << ": unable to set mtu of "
+                 << device_->device_name();
+}
+
+bool PathMtuManager::CheckFrame(uint32_t peer, const unsigned char* frame,
+                                unsigned int len) {
+  if (mode_ != PMTU_SEND_ICMP)
+    return true;
+  unsigned int mtu = overlay_mtu(peer);
+  if (!mtu || len <= mtu + 14)
+    return true;
+
+  unsigned int n = BuildIcmpTooBig(frame, len, mtu, icmp_buff_ + 14);
+  if (!n)
+    return true;
+  // Back to the sender, as if from the destination.
+  memcpy(icmp_buff_, frame + 6, 6);
+  memcpy(icmp_buff_ + 6, frame, 6);
+  memcpy(icmp_buff_ + 12, frame + 12, 2);
+  if (device_->WriteFrame(icmp_buff_, n + 14))
+    metrics_.icmp_sent->Increment();
+  return false;
+}
+
+bool ClampTcpMss(const FrameView& view, unsigned int mtu) {
+  if (!view.Has(FRAME_TCP) || view.Has(FRAME_FRAGMENT))
+    return false;
+  unsigned char* tcp = view.data() + view.l4_offset();
+  if (!(tcp[13] & kTcpSyn))
+    return false;
+  // The mss leaves out the ip and tcp headers, options excluded, RFC 6691.
+  unsigned int headers = (view.Has(FRAME_IPV4) ? 20 : 40) + 20;
+  if (mtu <= headers)
+    return false;
+  unsigned int max_mss = mtu - headers;
+
+  unsigned int hlen = view.payload_offset() - view.l4_offset();
+  unsigned int i = 20;
+  while (i < hlen) {
+    uint8_t kind = tcp[i];
+    if (kind == kTcpOptionEnd)
+      break;
+    if (kind == kTcpOptionNop) {
+      ++i;
+      continue;
+    }
+    if (i + 1 >= hlen || tcp[i + 1] < 2 || i + tcp[i + 1] > hlen)
+      break;
+    if (kind == kTcpOptionMss && tcp[i + 1] == 4) {
+      unsigned char* p = tcp + i + 2;
+      if ((unsigned int)(p[0] << 8 | p[1]) <= max_mss)
+        return false;
+      uint16_t old_value, new_value, check;
+      memcpy(&old_value, p, 2);
+      p[0] = (unsigned char)(max_mss >> 8);
+      p[1] = (unsigned char)max_mss;
+      memcpy(&new_value, p, 2);
+      // A field at an odd offset straddles two words of the sum, which
+      // then change by its bytes swapped.
+      if (i & 1) {
+        old_value = (uint16_t)(old_value << 8 | old_value >> 8);
+        new_value = (uint16_t)(new_value << 8 | new_value >> 8);
+      }
+      memcpy(&check, tcp + 16, 2);
+      check = ChecksumUpdate16(check, old_value, new_value);
+      memcpy(tcp + 16, &check, 2);
+      return true;
+    }
+    i += tcp[i + 1];
+  }
+  return false;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,203 @@
+#ifndef BANGNET_PMTU_H_
+#define BANGNET_PMTU_H_
+
+#include <stdint.h>
+
+#include "src/common.h"
+#include "src/control.h"
+#include "src/frame_device.h"
+#include "src/frame_view.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+// Path mtu discovery over the underlay, in the manner of packetization
+// layer PMTUD (RFC 4821): peers echo padded probes, so the largest probe
+// which made it across is the path mtu, whether or not routers on the way
+// send ICMP errors.
+
+// Starts probe and ack messages, in network byte order. Probes are padded
+// with zeros to the datagram size they test, acks are just the header.
+struct PmtuMessage {
+  uint8_t type;
+  uint8_t reserved;
+  // Path mtu the probe tests, ip and udp headers included.
+  uint16_t size;
+  uint32_t seq;
+} __attribute__((packed));
+
+const unsigned int kPmtuMessageLen = sizeof(PmtuMessage);
+
+struct PmtuOptions {
+  PmtuOptions()
+      : base_mtu(1280), max_mtu(9000), underlay_overhead(28),
+        encap_overhead(12), probe_timeout_ns(1000000000ull),
+        max_probes(3), reprobe_interval_ns(600000000000ull) {}
+
+  // Path mtu assumed to always work, where the search starts.
+  unsigned int base_mtu;
+
+  // Largest path mtu probed for.
+  unsigned int max_mtu;
+
+  // Underlay ip and udp headers, 28 for ipv4, 48 for ipv6.
+  unsigned int underlay_overhead;
+
+  // Bytes the overlay adds to each frame, the fragment header.
+  unsigned int encap_overhead;
+
+  // A probe not acked within this time is lost.
+  uint64_t probe_timeout_ns;
+
+  // Lost probes of a size before the size is considered too big.
+  unsigned int max_probes;
+
+  // The path mtu may grow, so a finished search starts over after this.
+  uint64_t reprobe_interval_ns;
+};
+
+// A probe to send to a peer.
+struct PmtuProbeRequest {
+  uint32_t peer;
+  uint32_t seq;
+  unsigned int size;
+};
+
+// Searches the path mtu to one peer. The search is binary, between the
+// largest size acked and the smallest size lost.
+class PathMtuProber {
+public:
+  PathMtuProber(const PmtuOptions& options, uint64_t now_ns);
+
+  // Path mtu confirmed so far.
+  unsigned int path_mtu() const { return low_; }
+
+  bool searching() const { return searching_; }
+
+  // Returns the size of the probe to send now and sets seq, or 0 if none is
+  // due. Also counts the probe in flight as lost once it timed out.
+  unsigned int NextProbe(uint64_t now_ns, uint32_t* seq);
+
+  // Handles an ack, returns true if the path mtu changed. Acks of any but
+  // the probe in flight, by seq and size, are ignored.
+  bool OnProbeAck(uint32_t seq, unsigned int size, uint64_t now_ns);
+
+  // Handles an ICMP error from the underlay reporting a smaller mtu on the
+  // way, returns true if the path mtu changed.
+  bool OnPacketTooBig(unsigned int mtu, uint64_t now_ns);
+
+  // Probes lost since the prober was created.
+  uint64_t probes_lost() const { return probes_lost_; }
+
+private:
+  void Restart(uint64_t now_ns);
+  void Finish(uint64_t now_ns);
+
+  PmtuOptions options_;
+  // Largest size known to pass and smallest size known not to, plus one.
+  unsigned int low_;
+  unsigned int high_;
+  bool searching_;
+  // Size and seq of the probe in flight, if any.
+  unsigned int probe_size_;
+  uint32_t probe_seq_;
+  unsigned int probe_losses_;
+  uint64_t deadline_;
+  uint32_t next_seq_;
+  uint64_t probes_lost_;
+};
+
+// Writes a probe, padded to its size less the underlay headers, into buf.
+// Returns the datagram length.
+unsigned int WritePmtuProbe(uint32_t seq, unsigned int size,
+                            const PmtuOptions& options, unsigned char* buf);
+
+// Parses a received message into msg, with fields in host order. Returns
+// false if it is not a well formed probe or ack, like a truncated probe or
+// a message of another type.
+bool ParsePmtuMessage(const unsigned char* data, unsigned int len,
+                      const PmtuOptions& options, PmtuMessage* msg);
+
+// Writes the ack of a parsed probe into buf, returns its length.
+unsigned int WritePmtuAck(const PmtuMessage& probe, unsigned char* buf);
+
+// Lowers the mss option of a tcp syn or syn-ack in view, in place, so the
+// segments of the connection fit ip packets of mtu bytes: both ends then
+// send segments which cross the overlay whole, without fragmentation or
+// black holes where ICMP errors are filtered. The tcp checksum is fixed up
+// incrementally. Returns true if the mss was lowered.
+bool ClampTcpMss(const FrameView& view, unsigned int mtu);
+
+// Keeps the path mtu of every peer and applies the smallest overlay mtu to
+// the local device, in one of two ways:
+//
+//  PMTU_ADJUST_DEVICE changes the device mtu, so the local stack sizes its
+//  packets to fit every peer.
+//
+//  PMTU_SEND_ICMP keeps the device mtu and answers frames too large for
+//  their peer with an ICMP error written back to the device, so the stack
+//  lowers its route mtu to that destination only.
+//
+// Either way frames fit the underlay without overlay fragmentation, except
+// for ipv4 frames without DF, which the overlay has to fragment. Not thread
+// safe, it is driven by the thread reading the device.
+class PathMtuManager {
+public:
+  enum Mode {
+    PMTU_ADJUST_DEVICE,
+    PMTU_SEND_ICMP
+  };
+
+  // device is not owned. name labels the metrics.
+  PathMtuManager(const string& name, FrameDevice* device, Mode mode,
+                 const PmtuOptions& options);
+  ~PathMtuManager();
+
+  void AddPeer(uint32_t peer, uint64_t now_ns);
+  void RemovePeer(uint32_t peer);
+
+  // Fills out with the probes due, returns their count.
+  int Poll(uint64_t now_ns, PmtuProbeRequest* out, int max);
+
+  // Handles a probe ack or an underlay ICMP error from a peer.
+  void OnProbeAck(uint32_t peer, const PmtuMessage& ack, uint64_t now_ns);
+  void OnPacketTooBig(uint32_t peer, unsigned int mtu, uint64_t now_ns);
+
+  // Mtu of frame payloads which reach peer whole, without the ethernet
+  // header. 0 for unknown peers.
+  unsigned int overlay_mtu(uint32_t peer) const;
+
+  // Smallest overlay mtu across peers.
+  unsigned int min_overlay_mtu() const { return min_overlay_mtu_; }
+
+  // Checks a frame read from the device before it is sent to peer. Returns
+  // false if it is too large and was answered with an ICMP error, in
+  // PMTU_SEND_ICMP mode.
+  bool CheckFrame(uint32_t peer, const unsigned char* frame,
+                  unsigned int len);
+
+private:
+  unsigned int OverlayMtu(unsigned int path_mtu) const;
+  void Update();
+
+  string name_;
+  FrameDevice* device_;
+  Mode mode_;
+  PmtuOptions options_;
+  map<uint32_t, PathMtuProber*> peers_;
+  unsigned int min_overlay_mtu_;
+  unsigned char icmp_buff_[14 + 1280];
+
+  struct Metrics {
+    Counter* probes;
+    Counter* probes_lost;
+    Counter* icmp_sent;
+    Gauge* min_overlay_mtu;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(PathMtuManager);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_PMTU_H_
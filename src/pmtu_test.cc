@@ -0,0 +1,336 @@
+#include "src/pmtu.h"
+
+#include <string.h>
+#include <arpa/inet.h>
+
+#include <gtest/gtest.h>
+
+#include "src/checksum.h"
+#include "src/icmp.h"
+#include "src/loopback_device.h"
+
+namespace bangnet {
+namespace {
+
+const uint64_t kSecond = 1000000000ull;
+
+// Runs a prober against a path dropping datagrams larger than path_mtu,
+// returns the path mtu found.
+unsigned int Converge(PathMtuProber* p, unsigned int path_mtu,
+                      uint64_t* now) {
+  for (int i = 0; i < 200 && (i == 0 || p->searching()); ++i) {
+    uint32_t seq;
+    unsigned int size = p->NextProbe(*now, &seq);
+    if (size && size <= path_mtu)
+      p->OnProbeAck(seq, size, *now);
+    *now += kSecond;
+  }
+  return p->path_mtu();
+}
+
+// Builds an ethernet frame of len bytes carrying ipv4 to 10.0.0.2.
+vector<unsigned char> Ipv4Frame(unsigned int len, bool df) {
+  vector<unsigned char> f(len, 0xab);
+  memcpy(&f[0], "\x02\x00\x00\x00\x00\x02\x02\x00\x00\x00\x00\x01\x08\x00",
+         14);
+  unsigned char* ip = &f[14];
+  memset(ip, 0, 20);
+  ip[0] = 0x45;
+  *(uint16_t*)(ip + 2) = htons((uint16_t)(len - 14));
+  ip[6] = df ? 0x40 : 0;
+  ip[8] = 64;
+  ip[9] = 17;
+  memcpy(ip + 12, "\x0a\x00\x00\x01\x0a\x00\x00\x02", 8);
+  *(uint16_t*)(ip + 10) = InetChecksum(ip, 20);
+  return f;
+}
+
+TEST(PathMtuProberTest, FindsPathMtu) {
+  PmtuOptions options;
+  uint64_t now = 0;
+  PathMtuProber p(options, now);
+  EXPECT_EQ(1280u, p.path_mtu());
+  unsigned int mtu = Converge(&p, 1500, &now);
+  EXPECT_FALSE(p.searching());
+  EXPECT_LE(mtu, 1500u);
+  EXPECT_GE(mtu, 1500u - 8);
+  EXPECT_GT(p.probes_lost(), 0u);
+}
+
+TEST(PathMtuProberTest, RetriesLostProbes) {
+  PmtuOptions options;
+  uint64_t now = 0;
+  PathMtuProber p(options, now);
+  uint32_t seq;
+  unsigned int size = p.NextProbe(now, &seq);
+  ASSERT_GT(size, 1280u);
+  // Nothing is due until the probe times out.
+  EXPECT_EQ(0u, p.NextProbe(now + 1, &seq));
+  for (unsigned int i = 1; i < options.max_probes; ++i) {
+    now += options.probe_timeout_ns;
+    EXPECT_EQ(size, p.NextProbe(now, &seq));
+  }
+  now += options.probe_timeout_ns;
+  EXPECT_GT(size, p.NextProbe(now, &seq));
+  EXPECT_EQ(1280u, p.path_mtu());
+}
+
+TEST(PathMtuProberTest, IgnoresStaleAcks) {
+  PmtuOptions options;
+  uint64_t now = 0;
+  PathMtuProber p(options, now);
+  uint32_t seq;
+  unsigned int size = p.NextProbe(now, &seq);
+  ASSERT_GT(size, 1280u);
+
+  // A size or seq the prober did not send, or an earlier probe.
+  EXPECT_FALSE(p.OnProbeAck(seq, size + 8, now));
+  EXPECT_FALSE(p.OnProbeAck(seq + 1, size, now));
+  EXPECT_FALSE(p.OnProbeAck(seq - 1, size - 8, now));
+  EXPECT_EQ(1280u, p.path_mtu());
+
+  EXPECT_TRUE(p.OnProbeAck(seq, size, now));
+  EXPECT_EQ(size, p.path_mtu());
+  // Acked once only.
+  EXPECT_FALSE(p.OnProbeAck(seq, size, now));
+}
+
+TEST(PathMtuProberTest, PacketTooBigAndReprobe) {
+  PmtuOptions options;
+  uint64_t now = 0;
+  PathMtuProber p(options, now);
+  Converge(&p, 9000, &now);
+  EXPECT_GE(p.path_mtu(), 9000u - 8);
+
+  EXPECT_TRUE(p.OnPacketTooBig(1400, now));
+  EXPECT_EQ(1400u, p.path_mtu());
+  EXPECT_FALSE(p.OnPacketTooBig(1500, now));
+  // Never below the base mtu.
+  EXPECT_TRUE(p.OnPacketTooBig(576, now));
+  EXPECT_EQ(1280u, p.path_mtu());
+
+  // The path grows back, which a later search notices.
+  uint32_t seq;
+  EXPECT_EQ(0u, p.NextProbe(now, &seq));
+  now += options.reprobe_interval_ns;
+  EXPECT_GE(Converge(&p, 1500, &now), 1500u - 8);
+}
+
+TEST(PmtuMessageTest, ProbeAndAck) {
+  PmtuOptions options;
+  unsigned char buf[9000];
+  unsigned int len = WritePmtuProbe(7, 1400, options, buf);
+  EXPECT_EQ(1400u - 28, len);
+
+  PmtuMessage m;
+  ASSERT_TRUE(ParsePmtuMessage(buf, len, options, &m));
+  EXPECT_EQ(PMTU_PROBE, m.type);
+  EXPECT_EQ(1400, m.size);
+  EXPECT_EQ(7u, m.seq);
+  // Truncated probes did not make it across.
+  EXPECT_FALSE(ParsePmtuMessage(buf, len - 1, options, &m));
+
+  len = WritePmtuAck(m, buf);
+  ASSERT_TRUE(ParsePmtuMessage(buf, len, options, &m));
+  EXPECT_EQ(PMTU_PROBE_ACK, m.type);
+  EXPECT_EQ(1400, m.size);
+  EXPECT_EQ(7u, m.seq);
+  // Acks are the header alone, and other messages on the channel, like
+  // path probes, are not taken for acks.
+  EXPECT_FALSE(ParsePmtuMessage(buf, len + 1, options, &m));
+  buf[0] = PATH_PROBE_ACK;
+  EXPECT_FALSE(ParsePmtuMessage(buf, len, options, &m));
+}
+
+TEST(IcmpTest, FragmentationNeeded) {
+  vector<unsigned char> f = Ipv4Frame(1514, true);
+  unsigned char out[1280];
+  unsigned int n = BuildIcmpTooBig(&f[0], f.size(), 1400, out);
+  ASSERT_EQ(576u, n);
+  EXPECT_EQ(0, InetChecksum(out, 20));
+  EXPECT_EQ(0, InetChecksum(out + 20, n - 20));
+  EXPECT_EQ(0, memcmp(out + 12, &f[14 + 16], 4));
+  EXPECT_EQ(0, memcmp(out + 16, &f[14 + 12], 4));
+  EXPECT_EQ(3, out[20]);
+  EXPECT_EQ(4, out[21]);
+  EXPECT_EQ(1400, ntohs(*(uint16_t*)(out + 26)));
+
+  // Fits, or may be fragmented.
+  EXPECT_EQ(0u, BuildIcmpTooBig(&f[0], f.size(), 1500, out));
+  f = Ipv4Frame(1514, false);
+  EXPECT_EQ(0u, BuildIcmpTooBig(&f[0], f.size(), 1400, out));
+}
+
+TEST(IcmpTest, PacketTooBig) {
+  vector<unsigned char> f(14 + 1500, 0);
+  f[12] = 0x86;
+  f[13] = 0xdd;
+  unsigned char* ip = &f[14];
+  ip[0] = 0x60;
+  *(uint16_t*)(ip + 4) = htons(1460);
+  ip[6] = 17;
+  ip[23] = 1;
+  ip[39] = 2;
+  unsigned char out[1280];
+  unsigned int n = BuildIcmpTooBig(&f[0], f.size(), 1400, out);
+  ASSERT_EQ(1280u, n);
+  EXPECT_EQ(2, out[40]);
+  EXPECT_EQ(1400u, ntohl(*(uint32_t*)(out + 44)));
+  uint32_t sum = PseudoHeaderSum6(out + 8, out + 24, 58, n - 40);
+  EXPECT_EQ(0, ChecksumFold(ChecksumPartial(out + 40, n - 40, sum)));
+}
+
+TEST(PathMtuManagerTest, AdjustsDevice) {
+  LoopbackDevice* a;
+  LoopbackDevice* b;
+  LoopbackDevice::CreatePair(9000, &a, &b);
+  PmtuOptions options;
+  PathMtuManager m("pmtu-test", a, PathMtuManager::PMTU_ADJUST_DEVICE,
+                   options);
+  uint64_t now = 0;
+  m.AddPeer(1, now);
+  m.AddPeer(2, now);
+  EXPECT_EQ(1280u - 28 - 12 - 14, a->mtu());
+
+  // Peer 1 reaches 9000, peer 2 only 1500.
+  PmtuProbeRequest probes[4];
+  for (int i = 0; i < 200; ++i) {
+    int n = m.Poll(now, probes, 4);
+    for (int j = 0; j < n; ++j) {
+      unsigned int limit = probes[j].peer == 1 ? 9000 : 1500;
+      if (probes[j].size > limit)
+        continue;
+      PmtuMessage ack;
+      ack.type = PMTU_PROBE_ACK;
+      ack.size = probes[j].size;
+      ack.seq = probes[j].seq;
+      m.OnProbeAck(probes[j].peer, ack, now);
+    }
+    now += kSecond;
+  }
+  EXPECT_GE(m.overlay_mtu(1), 9000u - 8 - 54);
+  EXPECT_GE(m.overlay_mtu(2), 1500u - 8 - 54);
+  EXPECT_EQ(m.overlay_mtu(2), a->mtu());
+
+  m.RemovePeer(2);
+  EXPECT_EQ(m.overlay_mtu(1), a->mtu());
+  delete a;
+  delete b;
+}
+
+TEST(PathMtuManagerTest, SendsIcmp) {
+  LoopbackDevice* a;
+  LoopbackDevice* b;
+  LoopbackDevice::CreatePair(9000, &a, &b);
+  PmtuOptions options;
+  PathMtuManager m("pmtu-test", a, PathMtuManager::PMTU_SEND_ICMP, options);
+  m.AddPeer(1, 0);
+  EXPECT_EQ(9000u, a->mtu());
+
+  vector<unsigned char> f = Ipv4Frame(1000, true);
+  EXPECT_TRUE(m.CheckFrame(1, &f[0], f.size()));
+  f = Ipv4Frame(2000, true);
+  EXPECT_FALSE(m.CheckFrame(1, &f[0], f.size()));
+
+  unsigned char buf[2048];
+  unsigned int n = b->ReadFrame(buf, sizeof(buf));
+  ASSERT_EQ(14u + 576, n);
+  EXPECT_EQ(0, memcmp(buf, &f[6], 6));
+  EXPECT_EQ(0, memcmp(buf + 6, &f[0], 6));
+  EXPECT_EQ(m.overlay_mtu(1), ntohs(*(uint16_t*)(buf + 14 + 26)));
+  delete a;
+  delete b;
+}
+
+// Builds a tcp syn with the given options, and valid checksums, over ipv4
+// or ipv6.
+vector<unsigned char> SynFrame(bool v6, const unsigned char* options,
+                               unsigned int options_len, uint8_t flags) {
+  unsigned int l3 = v6 ? 40 : 20;
+  unsigned int tcp_len = 20 + options_len;
+  vector<unsigned char> f(14 + l3 + tcp_len, 0);
+  memcpy(&f[0], "\x02\x00\x00\x00\x00\x02\x02\x00\x00\x00\x00\x01", 12);
+  unsigned char* ip = &f[14];
+  if (v6) {
+    f[12] = 0x86;
+    f[13] = 0xdd;
+    ip[0] = 0x60;
+    *(uint16_t*)(ip + 4) = htons((uint16_t)tcp_len);
+    ip[6] = IPPROTO_TCP;
+    ip[7] = 64;
+    ip[23] = 1;
+    ip[39] = 2;
+  } else {
+    f[12] = 0x08;
+    ip[0] = 0x45;
+    *(uint16_t*)(ip + 2) = htons((uint16_t)(20 + tcp_len));
+    ip[8] = 64;
+    ip[9] = IPPROTO_TCP;
+    memcpy(ip + 12, "\x0a\x00\x00\x01\x0a\x00\x00\x02", 8);
+    *(uint16_t*)(ip + 10) = InetChecksum(ip, 20);
+  }
+  unsigned char* tcp = ip + l3;
+  memcpy(tcp, "\xc0\x01\x01\xbb\x12\x34\x56\x78", 8);
+  tcp[12] = (unsigned char)(tcp_len / 4 << 4);
+  tcp[13] = flags;
+  tcp[14] = 0xfa;
+  memcpy(tcp + 20, options, options_len);
+  uint32_t sum = v6 ? PseudoHeaderSum6(ip + 8, ip + 24, IPPROTO_TCP, tcp_len)
+                    : PseudoHeaderSum4(ip + 12, ip + 16, IPPROTO_TCP,
+                                       tcp_len);
+  *(uint16_t*)(tcp + 16) = ChecksumFold(ChecksumPartial(tcp, tcp_len, sum));
+  return f;
+}
+
+bool TcpChecksumOk(const FrameView& v) {
+  unsigned int len = v.l3_end() - v.l4_offset();
+  uint32_t sum = v.Has(FRAME_IPV4)
+      ? PseudoHeaderSum4(&v.ipv4()->saddr, &v.ipv4()->daddr, IPPROTO_TCP,
+                         len)
+      : PseudoHeaderSum6(&v.ipv6()->ip6_src, &v.ipv6()->ip6_dst,
+                         IPPROTO_TCP, len);
+  return ChecksumFold(ChecksumPartial(v.tcp(), len, sum)) == 0;
+}
+
+unsigned int Mss(const FrameView& v, unsigned int at) {
+  const unsigned char* p = v.data() + v.l4_offset() + at;
+  return p[0] << 8 | p[1];
+}
+
+TEST(ClampTcpMssTest, LowersMssOfSyns) {
+  // Mss 1460 and window scale.
+  const unsigned char options[] = {2, 4, 0x05, 0xb4, 1, 3, 3, 7};
+  vector<unsigned char> f = SynFrame(false, options, 8, 0x02);
+  FrameView v(&f[0], f.size());
+  EXPECT_FALSE(ClampTcpMss(v, 1500));
+  EXPECT_TRUE(ClampTcpMss(v, 1226));
+  EXPECT_EQ(1186u, Mss(v, 22));
+  EXPECT_TRUE(TcpChecksumOk(v));
+  EXPECT_FALSE(ClampTcpMss(v, 1226));
+
+  // Not a syn.
+  f = SynFrame(false, options, 8, 0x10);
+  v.Parse(&f[0], f.size());
+  EXPECT_FALSE(ClampTcpMss(v, 1226));
+  EXPECT_EQ(1460u, Mss(v, 22));
+}
+
+TEST(ClampTcpMssTest, FixesChecksumAtOddOffsets) {
+  // A syn-ack, its mss after a nop, at an odd offset.
+  const unsigned char options[] = {1, 2, 4, 0x23, 0x28, 1, 1, 0};
+  vector<unsigned char> f = SynFrame(true, options, 8, 0x12);
+  FrameView v(&f[0], f.size());
+  ASSERT_TRUE(TcpChecksumOk(v));
+  EXPECT_TRUE(ClampTcpMss(v, 1280));
+  EXPECT_EQ(1220u, Mss(v, 23));
+  EXPECT_TRUE(TcpChecksumOk(v));
+
+  // Options cut short end the search.
+  const unsigned char bad[] = {1, 1, 3, 9, 2, 4, 0x23, 0x28};
+  f = SynFrame(true, bad, 8, 0x02);
+  v.Parse(&f[0], f.size());
+  EXPECT_FALSE(ClampTcpMss(v, 1280));
+}
+
+}  // namespace
+}  // namespace bangnet
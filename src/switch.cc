@@ -0,0 +1,407 @@
+#include <poll.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "src/clock.h"
+#include "src/switch.h"
+
+namespace bangnet {
+
+namespace {
+
+inline bool IsMulticast(const unsigned char* mac) { return mac[0] & 1; }
+
+}  // namespace
+
+MacTable::MacTable(unsigned int entries, uint64_t age_ns, Arena* arena)
+    : age_ns_(age_ns), arena_(NULL) {
+  nsets_ = (entries + kWays - 1) / kWays;
+  if (nsets_ == 0)
+    nsets_ = 1;
+  nentries_ = nsets_ * kWays;
+  if (!arena) {
+    arena_ = new Arena(nentries_ * sizeof(Entry) + 64);
+    arena = arena_;
+  }
+  // Arena memory comes zeroed, every entry free.
+  entries_ = (Entry*)arena->Allocate(nentries_ * sizeof(Entry));
+}
+
+MacTable::~MacTable() {
+  delete arena_;
+}
+
+uint64_t MacTable::Key(const unsigned char* mac) {
+  uint64_t k = 0;
+  for (int i = 0; i < 6; ++i)
+    k = (k << 8) | mac[i];
+  return k | (1ull << 63);
+}
+
+const MacTable::Entry* MacTable::Set(uint64_t key) const {
+  uint64_t h = key * 0x9e3779b97f4a7c15ull;
+  return &entries_[((h >> 32) % nsets_) * kWays];
+}
+
+bool MacTable::Learn(const unsigned char* mac, int port, uint64_t now_ns) {
+  uint64_t key = Key(mac);
+  Entry* set = const_cast<Entry*>(Set(key));
+  Entry* victim = 0;
+  for (unsigned int i = 0; i < kWays; ++i) {
+    Entry* e = &set[i];
+    if (e->key == key) {
+      bool moved = e->port != port || now_ns - e->last_seen >= age_ns_;
+      e->port = port;
+      e->last_seen = now_ns;
+      return moved;
+    }
+    if (!victim || !e->key ||
+        (victim->key && e->last_seen < victim->last_seen))
+      victim = e;
+  }
+  victim->key = key;
+  victim->port = port;
+  victim->last_seen = now_ns;
+  return true;
+}
+
+int MacTable::Lookup(const unsigned char* mac, uint64_t now_ns) const {
+  uint64_t key = Key(mac);
+  const Entry* set = Set(key);
+  for (unsigned int i = 0; i < kWays; ++i) {
+    if (set[i].key == key)
+      return now_ns - set[i].last_seen < age_ns_ ? set[i].port : -1;
+  }
+  return -1;
+}
+
+void MacTable::LookupBurst(const uint64_t* macs, int n, uint64_t now_ns,
+                           int* ports) const {
+  const int kChunk = 64;
+  const Entry* sets[kChunk];
+  for (int base = 0; base < n; base += kChunk) {
+    int m = n - base < kChunk ? n - base : kChunk;
+    for (int i = 0; i < m; ++i) {
+      sets[i] = Set(macs[base + i] | (1ull << 63));
+      // A set spans three cache lines.
+      __builtin_prefetch(sets[i]);
+      __builtin_prefetch((const char*)sets[i] + 64);
+      __builtin_prefetch((const char*)sets[i] + 128);
+    }
+    for (int i = 0; i < m; ++i) {
+      uint64_t key = macs[base + i] | (1ull << 63);
+      int port = -1;
+      for (unsigned int w = 0; w < kWays; ++w) {
+        if (sets[i][w].key == key) {
+          if (now_ns - sets[i][w].last_seen < age_ns_)
+            port = sets[i][w].port;
+          break;
+        }
+      }
+      ports[base + i] = port;
+    }
+  }
+}
+
+void MacTable::Flush(int port) {
+  for (size_t i = 0; i < nentries_; ++i) {
+    if (entries_[i].key && entries_[i].port == port)
+      entries_[i].key = 0;
+  }
+}
+
+unsigned int MacTable::size(uint64_t now_ns) const {
+  unsigned int n = 0;
+  for (size_t i = 0; i < nentries_; ++i) {
+    if (entries_[i].key && now_ns - entries_[i].last_seen < age_ns_)
+      ++n;
+  }
+  return n;
+}
+
+L2Switch::L2Switch(const string& name, BufferPool* pool,
+                   unsigned int mac_entries, uint64_t mac_age_ns)
+    : name_(name), pool_(pool), arena_(0), mac_entries_(mac_entries),
+      mac_age_ns_(mac_age_ns) {
+  memset(macs_, 0, sizeof(macs_));
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "switch=\"" + name_ + "\"";
+  metrics_.frames = r->NewCounter("bangnet_switch_frames_total",
+      "Frames received on switch ports.", labels);
+  metrics_.forwarded = r->NewCounter("bangnet_switch_forwarded_total",
+      "Frames forwarded to the single port of a learned mac.", labels);
+  metrics_.flooded = r->NewCounter("bangnet_switch_flooded_total",
+      "Broadcast, multicast and unknown unicast frames flooded.", labels);
+  metrics_.suppressed = r->NewCounter("bangnet_switch_suppressed_total",
+      "Flooded frames not sent to a port over its flood rate.", labels);
+  metrics_.filtered = r->NewCounter("bangnet_switch_filtered_total",
+      "Frames dropped by vlan membership or sent back to their port.",
+      labels);
+  metrics_.copies = r->NewCounter("bangnet_switch_copies_total",
+      "Frames copied to flood ports taking different tags.", labels);
+  metrics_.drops = r->NewCounter("bangnet_switch_drops_total",
+      "Frames dropped for lack of buffers or failed writes.", labels);
+  metrics_.learned = r->NewCounter("bangnet_switch_learned_total",
+      "Mac addresses learned or moved to another port.", labels);
+}
+
+L2Switch::~L2Switch() {
+  Flush();
+  for (size_t i = 0; i < ports_.size(); ++i)
+    delete ports_[i];
+  for (int i = 0; i < 4096; ++i)
+    delete macs_[i];
+  MetricsRegistry::Instance()->RemoveLabeled("switch=\"" + name_ + "\"");
+}
+
+int L2Switch::AddPort(FrameDevice* device, const SwitchPortOptions& options) {
+  if ((int)ports_.size() >= kMaxPorts)
+    return -1;
+  Port* p = new Port;
+  p->device = device;
+  p->options = options;
+  p->vlans.assign(4096, false);
+  if (options.pvid)
+    p->vlans[options.pvid & 0xfff] = true;
+  if (options.trunk) {
+    for (size_t i = 0; i < options.allowed.size(); ++i)
+      p->vlans[options.allowed[i] & 0xfff] = true;
+  }
+  for (int i = 1; i < 4095; ++i) {
+    if (p->vlans[i] && !macs_[i])
+      macs_[i] = new MacTable(mac_entries_, mac_age_ns_, &arena_);
+  }
+  p->queued = 0;
+  p->tokens = options.flood_pps / 10 + 1;
+  p->refill_ns = MonotonicNs();
+  ports_.push_back(p);
+  LOG(INFO) << name_ << ": port " << ports_.size() - 1 << " is "
+            << device->device_name();
+  return (int)ports_.size() - 1;
+}
+
+int L2Switch::Egress(const Port& p, uint16_t vlan) const {
+  if (!p.vlans[vlan])
+    return -1;
+  return vlan == p.options.pvid ? 0 : p.options.tpid;
+}
+
+bool L2Switch::FloodAllowed(Port* p, uint64_t now_ns) {
+  unsigned int pps = p->options.flood_pps;
+  if (!pps)
+    return true;
+  double max = pps / 10 + 1;
+  p->tokens += (now_ns - p->refill_ns) * 1e-9 * pps;
+  if (p->tokens > max)
+    p->tokens = max;
+  p->refill_ns = now_ns;
+  if (p->tokens < 1)
+    return false;
+  p->tokens -= 1;
+  return true;
+}
+
+void L2Switch::Enqueue(int port, Buffer* frame) {
+  Port* p = ports_[port];
+  if (p->queued == kTxQueue)
+    Flush();
+  p->queue[p->queued++] = frame;
+}
+
+void L2Switch::Flush() {
+  FrameSlot slots[kTxQueue];
+  for (size_t i = 0; i < ports_.size(); ++i) {
+    Port* p = ports_[i];
+    if (!p->queued)
+      continue;
+    for (int j = 0; j < p->queued; ++j) {
+      slots[j].data = p->queue[j]->data();
+      slots[j].len = p->queue[j]->len();
+    }
+    int sent = p->device->WriteBurst(slots, p->queued);
+    if (sent < p->queued)
+      metrics_.drops->Add(p->queued - sent);
+    for (int j = 0; j < p->queued; ++j)
+      p->queue[j]->Unref();
+    p->queued = 0;
+  }
+}
+
+Buffer* L2Switch::Copy(const Buffer* frame, uint16_t tpid, uint16_t vlan) {
+  Buffer* copy = pool_->Get();
+  if (!copy)
+    return 0;
+  unsigned int tag = tpid ? 4 : 0;
+  if (copy->capacity() < frame->len() + tag) {
+    copy->Unref();
+    return 0;
+  }
+  unsigned char* c = copy->data();
+  memcpy(c, frame->data(), 12);
+  if (tpid) {
+    c[12] = (unsigned char)(tpid >> 8);
+    c[13] = (unsigned char)tpid;
+    c[14] = (unsigned char)(vlan >> 8);
+    c[15] = (unsigned char)vlan;
+  }
+  memcpy(c + 12 + tag, frame->data() + 12, frame->len() - 12);
+  copy->set_len(frame->len() + tag);
+  metrics_.copies->Increment();
+  return copy;
+}
+
+void L2Switch::Input(int port, Buffer* frame, uint64_t now_ns) {
+  metrics_.frames->Increment();
+  Port* in = ports_[port];
+  EthernetTags tags;
+  if (!ParseEthernet(frame->data(), frame->len(), &tags)) {
+    metrics_.drops->Increment();
+    frame->Unref();
+    return;
+  }
+
+  // Frames are switched without the port's tag, in their vlan. Untagged and
+  // priority tagged frames belong to the port's vlan, access ports take no
+  // other tags. Tags of other protocols are left in the payload.
+  bool tagged = tags.count && tags.tpid[0] == in->options.tpid;
+  uint16_t vlan = tagged ? tags.vlan() : 0;
+  if (!vlan)
+    vlan = in->options.pvid;
+  else if (!in->options.trunk)
+    vlan = 0;
+  if (!vlan || !in->vlans[vlan]) {
+    metrics_.filtered->Increment();
+    frame->Unref();
+    return;
+  }
+  if (tagged)
+    PopVlanTag(frame);
+
+  MacTable* macs = macs_[vlan];
+  const unsigned char* d = frame->data();
+  if (!IsMulticast(d + 6) && macs->Learn(d + 6, port, now_ns))
+    metrics_.learned->Increment();
+
+  int out = IsMulticast(d) ? -1 : macs->Lookup(d, now_ns);
+  if (out >= 0) {
+    int e = Egress(*ports_[out], vlan);
+    if (out == port || e < 0) {
+      metrics_.filtered->Increment();
+      frame->Unref();
+      return;
+    }
+    if (e && !PushVlanTag(frame, (uint16_t)e, vlan)) {
+      metrics_.drops->Increment();
+      frame->Unref();
+      return;
+    }
+    metrics_.forwarded->Increment();
+    Enqueue(out, frame);
+    return;
+  }
+
+  // Flood within the vlan, grouping the ports by the tag they take. Every
+  // form but the last is a copy, the last is the frame itself, so with
+  // untagged ports last it needs no tag pushed.
+  metrics_.flooded->Increment();
+  int egress[kMaxPorts], forms[kMaxPorts];
+  int ports[kMaxPorts];
+  int nports = 0, nforms = 0;
+  for (size_t i = 0; i < ports_.size(); ++i) {
+    if ((int)i == port)
+      continue;
+    int e = Egress(*ports_[i], vlan);
+    if (e < 0)
+      continue;
+    if (!FloodAllowed(ports_[i], now_ns)) {
+      metrics_.suppressed->Increment();
+      continue;
+    }
+    ports[nports] = (int)i;
+    egress[nports++] = e;
+    int f = 0;
+    while (f < nforms && forms[f] != e)
+      ++f;
+    if (f == nforms)
+      forms[nforms++] = e;
+  }
+  for (int f = 0; f < nforms - 1; ++f) {
+    if (!forms[f]) {
+      forms[f] = forms[nforms - 1];
+      forms[nforms - 1] = 0;
+    }
+  }
+  if (!nforms) {
+    frame->Unref();
+    return;
+  }
+
+  for (int f = 0; f < nforms; ++f) {
+    uint16_t tpid = (uint16_t)forms[f];
+    Buffer* b = 0;
+    if (f < nforms - 1)
+      b = Copy(frame, tpid, vlan);
+    else if (!tpid || PushVlanTag(frame, tpid, vlan))
+      b = frame;
+    // Each queued frame holds a reference, the one passed in included.
+    int refs = 0;
+    for (int i = 0; i < nports; ++i) {
+      if (egress[i] != forms[f])
+        continue;
+      if (!b) {
+        metrics_.drops->Increment();
+        continue;
+      }
+      if (refs++)
+        b->Ref();
+      Enqueue(ports[i], b);
+    }
+    if (f == nforms - 1 && !b)
+      frame->Unref();
+  }
+}
+
+int L2Switch::Poll(int timeout_ms, int burst) {
+  if (burst > kTxQueue)
+    burst = kTxQueue;
+  struct pollfd pfds[kMaxPorts];
+  int nfds = 0;
+  for (size_t i = 0; i < ports_.size(); ++i) {
+    pfds[nfds].fd = ports_[i]->device->fd();
+    pfds[nfds].events = POLLIN;
+    pfds[nfds].revents = 0;
+    ++nfds;
+  }
+  if (poll(pfds, nfds, timeout_ms) <= 0)
+    return 0;
+
+  int total = 0;
+  uint64_t now = MonotonicNs();
+  for (int i = 0; i < nfds; ++i) {
+    if (!(pfds[i].revents & POLLIN))
+      continue;
+    Buffer* bufs[kTxQueue];
+    int n = pool_->GetBurst(bufs, burst);
+    if (!n) {
+      metrics_.drops->Increment();
+      continue;
+    }
+    FrameSlot slots[kTxQueue];
+    for (int j = 0; j < n; ++j) {
+      slots[j].data = bufs[j]->data();
+      slots[j].cap = bufs[j]->capacity();
+    }
+    int got = ports_[i]->device->ReadBurst(slots, n);
+    for (int j = 0; j < got; ++j) {
+      bufs[j]->set_len(slots[j].len);
+      Input(i, bufs[j], now);
+    }
+    for (int j = got < 0 ? 0 : got; j < n; ++j)
+      bufs[j]->Unref();
+    total += got > 0 ? got : 0;
+  }
+  Flush();
+  return total;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,188 @@
+#ifndef BANGNET_SWITCH_H_
+#define BANGNET_SWITCH_H_
+
+#include <stdint.h>
+
+#include "src/arena.h"
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/frame_device.h"
+#include "src/metrics.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+
+// Learned location of mac addresses of one vlan. The table is preallocated
+// and set associative like the reassembly table: when a set is full the
+// least recently seen entry is replaced, and entries not seen within the
+// age are ignored.
+class MacTable {
+public:
+  // The entries are carved out of arena, or out of an arena of the table's
+  // own if it is null.
+  MacTable(unsigned int entries, uint64_t age_ns, Arena* arena = NULL);
+  ~MacTable();
+
+  // Records that mac was seen on port. Returns true if it is new or moved
+  // from another port.
+  bool Learn(const unsigned char* mac, int port, uint64_t now_ns);
+
+  // Returns the port mac was last seen on, or -1.
+  int Lookup(const unsigned char* mac, uint64_t now_ns) const;
+
+  // Same for n macs in the form of FrameBurst, into ports. The sets of a
+  // burst are all fetched before the first is probed, so their cache misses
+  // overlap.
+  void LookupBurst(const uint64_t* macs, int n, uint64_t now_ns,
+                   int* ports) const;
+
+  // Forgets every entry of port, like when it goes away.
+  void Flush(int port);
+
+  // Live entries.
+  unsigned int size(uint64_t now_ns) const;
+
+private:
+  static const unsigned int kWays = 8;
+
+  struct Entry {
+    // Mac in the low 48 bits, zero for a free entry.
+    uint64_t key;
+    uint64_t last_seen;
+    int port;
+  };
+
+  static uint64_t Key(const unsigned char* mac);
+  const Entry* Set(uint64_t key) const;
+
+  uint64_t age_ns_;
+  unsigned int nsets_;
+  // The arena the table owns, if it was not given one.
+  Arena* arena_;
+  Entry* entries_;
+  size_t nentries_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(MacTable);
+};
+
+// How a switch port treats vlans.
+struct SwitchPortOptions {
+  SwitchPortOptions()
+      : pvid(1), trunk(false), tpid(kEtherTypeVlan), flood_pps(0) {}
+
+  // Untagged frames belong to this vlan, and frames of it leave the port
+  // untagged. 0 for a trunk without a native vlan.
+  uint16_t pvid;
+
+  // Trunks carry tagged frames of the allowed vlans, access ports only
+  // untagged frames of pvid.
+  bool trunk;
+
+  // Vlans a trunk carries, besides pvid.
+  vector<uint16_t> allowed;
+
+  // Protocol of the tags the port switches on, tags of others are payload.
+  // kEtherTypeQinQ makes a provider port: the service tag selects the vlan
+  // and customer tags pass through inside it.
+  uint16_t tpid;
+
+  // Broadcast suppression: max frames per second flooded out of this port,
+  // broadcast, multicast and unknown unicast. 0 for no limit.
+  unsigned int flood_pps;
+};
+
+// A user space learning switch between frame devices, like the taps of
+// several tenants on one host, so their traffic does not go through the
+// kernel or the underlay. Every vlan has a mac table of its own, so vlans
+// are isolated and one can not evict the macs of another.
+//
+// Frames are read into refcounted pool buffers and queued to the egress
+// ports by reference, a flood takes one reference per port. Tags are
+// pushed and popped in place, only a flood out of ports taking different
+// forms, tagged and untagged, copies the frame once per extra form.
+class L2Switch {
+public:
+  // Max ports of a switch.
+  static const int kMaxPorts = 64;
+
+  // pool must hold frames of the largest port mtu plus a vlan tag.
+  // mac_entries is the size of the table of each vlan.
+  L2Switch(const string& name, BufferPool* pool, unsigned int mac_entries,
+           uint64_t mac_age_ns);
+  ~L2Switch();
+
+  // Attaches a device, not owned. Returns the port number, or -1.
+  int AddPort(FrameDevice* device, const SwitchPortOptions& options);
+
+  // Switches a frame received on port, taking the caller's reference.
+  // Frames are queued on the egress ports until Flush().
+  void Input(int port, Buffer* frame, uint64_t now_ns);
+
+  // Writes the frames queued on every port.
+  void Flush();
+
+  // Waits up to timeout_ms for frames on any port, switches up to burst
+  // frames of each ready port and flushes. Returns frames received.
+  int Poll(int timeout_ms, int burst);
+
+  // Returns the mac table of vlan, null if no port carries it.
+  const MacTable* mac_table(uint16_t vlan) const {
+    return macs_[vlan & 0xfff];
+  }
+
+private:
+  // Frames queued on a port before a flush.
+  static const int kTxQueue = 64;
+
+  struct Port {
+    FrameDevice* device;
+    SwitchPortOptions options;
+    // Bit per vlan the port carries.
+    vector<bool> vlans;
+    Buffer* queue[kTxQueue];
+    int queued;
+    // Token bucket of flood_pps, in frames.
+    double tokens;
+    uint64_t refill_ns;
+  };
+
+  // Tpid of the tag a frame of vlan leaves port with, 0 if it leaves
+  // untagged, or -1 if the port does not carry vlan.
+  int Egress(const Port& p, uint16_t vlan) const;
+
+  // Takes a flood token of port, false if it is over its limit.
+  bool FloodAllowed(Port* p, uint64_t now_ns);
+
+  void Enqueue(int port, Buffer* frame);
+
+  // Copies an untagged frame, tagging the copy if tpid is not 0.
+  Buffer* Copy(const Buffer* frame, uint16_t tpid, uint16_t vlan);
+
+  string name_;
+  BufferPool* pool_;
+  // Holds the mac tables, which are large and looked up at random.
+  Arena arena_;
+  unsigned int mac_entries_;
+  uint64_t mac_age_ns_;
+  // Mac table of each vlan some port carries.
+  MacTable* macs_[4096];
+  vector<Port*> ports_;
+
+  struct Metrics {
+    Counter* frames;
+    Counter* forwarded;
+    Counter* flooded;
+    Counter* suppressed;
+    Counter* filtered;
+    // Frames copied to flood a vlan in several forms.
+    Counter* copies;
+    Counter* drops;
+    Counter* learned;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(L2Switch);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_SWITCH_H_
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/loopback_device.h"
+#include "src/pktgen.h"
+#include "src/switch.h"
+
+namespace bangnet {
+namespace {
+
+// Sends generated frames from the host of port 0 through a switch of
+// nports loopback ports for duration_ms and reads them on the other hosts.
+// If learn is set the destination is known on port 1, otherwise frames are
+// flooded to every other port.
+BenchResult RunSwitchBench(int nports, bool learn,
+                           const PktgenOptions& options,
+                           uint64_t duration_ms) {
+  BufferPool pool(2048, 1024);
+  L2Switch sw("bench", &pool, 4096, 60000000000ull);
+  vector<LoopbackDevice*> ports(nports), hosts(nports);
+  for (int i = 0; i < nports; ++i) {
+    LoopbackDevice::CreatePair(1500, &ports[i], &hosts[i]);
+    sw.AddPort(ports[i], SwitchPortOptions());
+  }
+
+  PacketGenerator gen(options);
+  unsigned int burst = options.burst ? options.burst : 1;
+  unsigned int size = gen.options().frame_size;
+  vector<unsigned char> tx_mem(burst * size), rx_mem(burst * 2048);
+  vector<FrameSlot> tx(burst), rx(burst);
+  for (unsigned int i = 0; i < burst; ++i) {
+    tx[i].data = &tx_mem[i * size];
+    tx[i].cap = size;
+    rx[i].data = &rx_mem[i * 2048];
+    rx[i].cap = 2048;
+  }
+
+  if (learn) {
+    // A frame from the generator's destination teaches the switch where it
+    // is.
+    gen.Fill(&tx[0], 1, 0);
+    unsigned char f[64];
+    memcpy(f, tx[0].data + 6, 6);
+    memcpy(f + 6, tx[0].data, 6);
+    memcpy(f + 12, tx[0].data + 12, sizeof(f) - 12);
+    hosts[1]->WriteFrame(f, sizeof(f));
+    sw.Poll(100, 1);
+    for (int i = 2; i < nports; ++i)
+      hosts[i]->ReadFrame(rx[0].data, rx[0].cap);
+    hosts[0]->ReadFrame(rx[0].data, rx[0].cap);
+  }
+
+  StageClock stages;
+  int tx_stage = stages.AddStage("tx");
+  int switch_stage = stages.AddStage("switch");
+  int rx_stage = stages.AddStage("rx");
+
+  BenchResult result;
+  char name[64];
+  snprintf(name, sizeof(name), "%s/%dports/%uB", learn ? "unicast" : "flood",
+           nports, size);
+  result.name = name;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    uint64_t c0 = CycleCount();
+    gen.Fill(&tx[0], burst, c0);
+    int sent = hosts[0]->WriteBurst(&tx[0], burst);
+    uint64_t c1 = CycleCount();
+    int switched = 0;
+    while (switched < sent) {
+      int n = sw.Poll(100, burst);
+      if (n <= 0)
+        break;
+      switched += n;
+    }
+    uint64_t c2 = CycleCount();
+    int last = learn ? 2 : nports;
+    for (int p = 1; p < last; ++p) {
+      int got = 0;
+      while (got < switched) {
+        int n = hosts[p]->ReadBurst(&rx[0], switched - got);
+        if (n <= 0)
+          break;
+        got += n;
+      }
+      // Port to port packets, each copy of a flood counts.
+      result.packets += got;
+      result.bytes += (uint64_t)got * size;
+    }
+    uint64_t c3 = CycleCount();
+    stages.Add(tx_stage, c1 - c0);
+    stages.Add(switch_stage, c2 - c1);
+    stages.Add(rx_stage, c3 - c2);
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+
+  for (int i = 0; i < nports; ++i) {
+    delete ports[i];
+    delete hosts[i];
+  }
+  return result;
+}
+
+BENCHMARK(SwitchPorts) {
+  for (size_t i = 0; i < options.frame_sizes.size(); ++i) {
+    PktgenOptions pktgen;
+    pktgen.frame_size = options.frame_sizes[i];
+    pktgen.flows = options.flows;
+    pktgen.burst = options.burst;
+    if (pktgen.frame_size > 1514)
+      continue;
+    results->push_back(RunSwitchBench(2, true, pktgen, options.duration_ms));
+    results->push_back(RunSwitchBench(4, false, pktgen, options.duration_ms));
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,263 @@
+#include "src/switch.h"
+
+#include <poll.h>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "src/clock.h"
+#include "src/frame_burst.h"
+#include "src/loopback_device.h"
+
+namespace bangnet {
+namespace {
+
+// A switch with loopback ports, the other end of each stands for a host.
+class SwitchTest : public ::testing::Test {
+protected:
+  SwitchTest()
+      : pool_(2048, 256), switch_("test", &pool_, 1024, 1000000000ull) {}
+
+  ~SwitchTest() {
+    for (size_t i = 0; i < ports_.size(); ++i) {
+      delete ports_[i];
+      delete hosts_[i];
+    }
+  }
+
+  int AddPort(const SwitchPortOptions& options) {
+    LoopbackDevice* a;
+    LoopbackDevice* b;
+    LoopbackDevice::CreatePair(1500, &a, &b);
+    ports_.push_back(a);
+    hosts_.push_back(b);
+    return switch_.AddPort(a, options);
+  }
+
+  // Sends a frame from the host of port, of vlan if not 0, and runs it
+  // through the switch.
+  void Send(int port, unsigned char dst, unsigned char src, uint16_t vlan,
+            uint16_t tpid = kEtherTypeVlan) {
+    unsigned char f[64];
+    memset(f, 0, sizeof(f));
+    memset(f, dst, 6);
+    memset(f + 6, src, 6);
+    unsigned int n = 12;
+    if (vlan) {
+      f[n++] = tpid >> 8;
+      f[n++] = tpid & 0xff;
+      f[n++] = vlan >> 8;
+      f[n++] = vlan & 0xff;
+    }
+    f[n++] = 0x08;
+    f[n++] = 0x00;
+    ASSERT_TRUE(hosts_[port]->WriteFrame(f, sizeof(f)));
+    EXPECT_EQ(1, switch_.Poll(100, 32));
+  }
+
+  // Returns the outer vlan of the frame the host of port got, 0 if
+  // untagged, or -1 if it got none. Its tags are left in tags_.
+  int Received(int port, unsigned char* src) {
+    struct pollfd pfd;
+    pfd.fd = hosts_[port]->fd();
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) <= 0)
+      return -1;
+    unsigned char f[2048];
+    unsigned int n = hosts_[port]->ReadFrame(f, sizeof(f));
+    if (n < 14)
+      return -1;
+    *src = f[6];
+    if (!ParseEthernet(f, n, &tags_))
+      return -1;
+    return tags_.vlan();
+  }
+
+  BufferPool pool_;
+  L2Switch switch_;
+  vector<LoopbackDevice*> ports_;
+  vector<LoopbackDevice*> hosts_;
+  EthernetTags tags_;
+};
+
+TEST_F(SwitchTest, LearnsAndForwards) {
+  SwitchPortOptions options;
+  for (int i = 0; i < 3; ++i)
+    AddPort(options);
+
+  unsigned char src;
+  // Unknown destination, flooded to the other ports.
+  Send(0, 0x0c, 0x0a, 0);
+  EXPECT_EQ(-1, Received(0, &src));
+  EXPECT_EQ(0, Received(1, &src));
+  EXPECT_EQ(0x0a, src);
+  EXPECT_EQ(0, Received(2, &src));
+
+  // 0x0a was learned on port 0.
+  Send(1, 0x0a, 0x0c, 0);
+  EXPECT_EQ(0, Received(0, &src));
+  EXPECT_EQ(0x0c, src);
+  EXPECT_EQ(-1, Received(2, &src));
+  EXPECT_EQ(2u, switch_.mac_table(1)->size(MonotonicNs()));
+
+  // Every buffer went back to the pool.
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(SwitchTest, IsolatesVlans) {
+  SwitchPortOptions access10, access20, trunk;
+  access10.pvid = 10;
+  access20.pvid = 20;
+  trunk.pvid = 0;
+  trunk.trunk = true;
+  trunk.allowed.push_back(10);
+  trunk.allowed.push_back(20);
+  AddPort(access10);
+  AddPort(access20);
+  AddPort(trunk);
+
+  unsigned char src;
+  // A broadcast of vlan 10 reaches the trunk tagged, not vlan 20.
+  Send(0, 0xff, 0x0a, 0);
+  EXPECT_EQ(-1, Received(1, &src));
+  EXPECT_EQ(10, Received(2, &src));
+
+  // Tagged frames of vlan 20 leave the access port untagged.
+  Send(2, 0xff, 0x0c, 20);
+  EXPECT_EQ(-1, Received(0, &src));
+  EXPECT_EQ(0, Received(1, &src));
+  EXPECT_EQ(0x0c, src);
+
+  // The same mac is learned apart per vlan.
+  Send(2, 0x0a, 0x0e, 20);
+  EXPECT_EQ(-1, Received(0, &src));
+  EXPECT_EQ(0, Received(1, &src));
+  Send(2, 0x0a, 0x0e, 10);
+  EXPECT_EQ(0, Received(0, &src));
+  EXPECT_EQ(-1, Received(1, &src));
+
+  // Access ports drop tagged frames.
+  Send(0, 0xff, 0x0a, 20);
+  EXPECT_EQ(-1, Received(1, &src));
+  EXPECT_EQ(-1, Received(2, &src));
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(SwitchTest, FloodsTaggedAndUntagged) {
+  SwitchPortOptions access, trunk;
+  access.pvid = 5;
+  trunk.pvid = 0;
+  trunk.trunk = true;
+  trunk.allowed.push_back(5);
+  AddPort(access);
+  AddPort(access);
+  AddPort(trunk);
+  AddPort(trunk);
+
+  unsigned char src;
+  Send(0, 0xff, 0x0a, 0);
+  EXPECT_EQ(0, Received(1, &src));
+  EXPECT_EQ(5, Received(2, &src));
+  EXPECT_EQ(5, Received(3, &src));
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(SwitchTest, SeparatesMacTablesPerVlan) {
+  SwitchPortOptions access10, access20;
+  access10.pvid = 10;
+  access20.pvid = 20;
+  AddPort(access10);
+  AddPort(access10);
+  AddPort(access20);
+
+  unsigned char src;
+  Send(0, 0xff, 0x0a, 0);
+  Send(2, 0xff, 0x0a, 0);
+  EXPECT_EQ(0, Received(1, &src));
+  EXPECT_EQ(1u, switch_.mac_table(10)->size(MonotonicNs()));
+  EXPECT_EQ(1u, switch_.mac_table(20)->size(MonotonicNs()));
+  EXPECT_TRUE(switch_.mac_table(30) == 0);
+}
+
+TEST_F(SwitchTest, CarriesCustomerTagsOverQinQ) {
+  SwitchPortOptions customer, provider;
+  // Customer ports take the tags of their hosts as payload too.
+  customer.pvid = 100;
+  customer.tpid = kEtherTypeQinQ;
+  provider.pvid = 0;
+  provider.trunk = true;
+  provider.tpid = kEtherTypeQinQ;
+  provider.allowed.push_back(100);
+  AddPort(customer);
+  AddPort(provider);
+  AddPort(customer);
+
+  unsigned char src;
+  // A customer tagged frame goes out of the provider port with a service
+  // tag in front, and untagged out of the other customer port.
+  Send(0, 0xff, 0x0a, 7);
+  EXPECT_EQ(100, Received(1, &src));
+  ASSERT_EQ(2, tags_.count);
+  EXPECT_EQ(kEtherTypeQinQ, tags_.tpid[0]);
+  EXPECT_EQ(kEtherTypeVlan, tags_.tpid[1]);
+  EXPECT_EQ(7, tags_.tci[1] & 0xfff);
+  EXPECT_EQ(7, Received(2, &src));
+  EXPECT_EQ(1, tags_.count);
+
+  // The service tag is popped on the way back.
+  Send(1, 0x0a, 0x0c, 100, kEtherTypeQinQ);
+  EXPECT_EQ(0, Received(0, &src));
+  EXPECT_EQ(0x0c, src);
+  EXPECT_EQ(-1, Received(2, &src));
+
+  // A provider port takes no bare customer tags as vlans.
+  Send(1, 0xff, 0x0c, 100);
+  EXPECT_EQ(-1, Received(0, &src));
+  EXPECT_EQ(256u, pool_.available());
+}
+
+TEST_F(SwitchTest, SuppressesFloods) {
+  SwitchPortOptions options;
+  AddPort(options);
+  options.flood_pps = 1;
+  AddPort(options);
+
+  unsigned char src;
+  // The bucket holds a single frame.
+  Send(0, 0xff, 0x0a, 0);
+  Send(0, 0xff, 0x0a, 0);
+  EXPECT_EQ(0, Received(1, &src));
+  EXPECT_EQ(-1, Received(1, &src));
+
+  // Known unicast is not limited.
+  Send(1, 0x0c, 0x0c, 0);
+  Send(0, 0x0c, 0x0a, 0);
+  EXPECT_EQ(0, Received(1, &src));
+}
+
+TEST(MacTableTest, LooksUpBursts) {
+  MacTable table(1024, 1000);
+  unsigned char mac[8] = {0x02, 0, 0, 0, 0, 0};
+  uint64_t macs[100];
+  for (int i = 0; i < 100; ++i) {
+    mac[5] = (unsigned char)i;
+    macs[i] = LoadMac(mac);
+    if (i % 3)
+      table.Learn(mac, i, i % 2 ? 10 : 0);
+  }
+  // More than one chunk, stale and unknown macs among them.
+  int ports[100];
+  table.LookupBurst(macs, 100, 500, ports);
+  for (int i = 0; i < 100; ++i) {
+    mac[5] = (unsigned char)i;
+    EXPECT_EQ(table.Lookup(mac, 500), ports[i]);
+  }
+  EXPECT_EQ(-1, ports[0]);
+  EXPECT_EQ(1, ports[1]);
+  table.LookupBurst(macs, 100, 1005, ports);
+  EXPECT_EQ(-1, ports[2]);
+  EXPECT_EQ(1, ports[1]);
+}
+
+}  // namespace
+}  // namespace bangnet
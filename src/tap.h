@@ -2,25 +2,32 @@
 #define BANGNET_TAP_H_
 
 #include <string>
+#include "src/tun_tap.h"
+#include "src/frame_burst.h"
+#include "src/frame_view.h"
 #include "src/mac.h"
-#include "src/inet_addr.h"
+#include "src/pmtu.h"
 #include "src/common.h"
 
 namespace bangnet {
 
-class Tap {
+class Tap : public TunTapDevice {
 public:
-  // Constructs a tap device with a mac address.
-  explicit Tap(const MacAddress &mac); 
-  ~Tap();
+  // Mtu of tap devices created without one.
+  static const unsigned int kDefaultMtu = 2800;
+
+  // Constructs a tap device with a mac address and an mtu of up to kMaxMtu,
+  // larger ones suit links within a host or a datacenter.
+  explicit Tap(const MacAddress &mac, unsigned int mtu = kDefaultMtu);
 
   // Access to the mac address of this device.
   const MacAddress& mac() const { return mac_; }
 
-  // Returns device's name
-  string device_name() {
-    return string(dev_);
-  }
+  // Clamps the mss of tcp syns crossing get() and put() in place, to the
+  // smallest overlay mtu of the peers of pmtu, which is not owned: a frame
+  // here may be for any peer. Callers which know the peer of a frame can
+  // use ClampTcpMss() with its own. Null, the default, turns it off.
+  void set_mss_clamp(const PathMtuManager* pmtu) { pmtu_ = pmtu; }
 
   // Packets sent by an OS to user-space program which attaches itself
   // to the device. Also a user-space program can pass packets into tap 
@@ -30,48 +37,33 @@ public:
   void put(const MacAddress& from, const MacAddress& to, unsigned int type, 
            const void* data, unsigned int len); 
 
-  unsigned int get(MacAddress& from, MacAddress& to, unsigned int type, void* buf);
-
-  bool IsOpen() const;
-
-  void close();
+  // Same, tagged with vlan if it is not 0.
+  void put(const MacAddress& from, const MacAddress& to, uint16_t vlan,
+           unsigned int type, const void* data, unsigned int len);
 
-  bool AddIP(const InetAddress& ip);
+  // Get a frame, stripped of its ethernet header and vlan tags.
+  unsigned int get(MacAddress& from, MacAddress& to, unsigned int& type,
+                   void* buf);
 
-bool remove_ip(const char *dev_, set<InetAddress>& ips_, 
-               const InetAddress& ip);
+  // Get a frame without copying it into a buffer of pool, which must hold
+  // max_frame_len() bytes, parsed into view. Returns the buffer with a
+  // reference for the caller, view is valid until it is dropped.
+  Buffer* get(BufferPool* pool, FrameView* view);
 
-  bool RemoveIP(const InetAddress& ip);
+  // Get frames into buffers of pool, appended to burst and parsed, blocking
+  // for the first one and taking what else is queued until the burst is
+  // full. Returns the frames added.
+  int get(BufferPool* pool, FrameBurst* burst);
 
-  inline set<InetAddress> IPSet() {
-    return ips_;
-  }
-  
 private:
+  void ClampMss(const FrameView& view);
+
   // Mac address of this tap device.
   const MacAddress mac_;
-
-  // Mtu number of this tap device. 
-  const unsigned int mtu_;
-
-  // Device name.
-  char dev_[16];
-  
-  // 
-  unsigned char *put_buff_;
-
-  // 
-  unsigned char *get_buff_;
-
-  // File descriptor associated with this interface.
-  int fd_;
-
-  // Bind ip addresses.
-  set<InetAddress> ips_;
-
-  // BN_DISALLOW_COPY_AND_ASSIGN(Tap);
+  const PathMtuManager* pmtu_;
+  Counter* mss_clamped_;
 };
 
 }  // namespace bangnet
 
-#endif  // BANGNET_TAP_H_
\ No newline at end of file
+#endif  // BANGNET_TAP_H_
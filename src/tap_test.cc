@@ -0,0 +1,79 @@
+#include "src/tap.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <net/if.h>
+
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+const unsigned char kMac[6] = {0x02, 0x62, 0x67, 0, 0, 0x0d};
+
+// Sends an ethernet frame out of the interface named ifname, which a tap
+// then reads from its device.
+bool Inject(const string& ifname, const unsigned char* frame,
+            unsigned int len) {
+  int fd = socket(AF_PACKET, SOCK_RAW, 0);
+  if (fd < 0)
+    return false;
+  struct sockaddr_ll addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sll_family = AF_PACKET;
+  addr.sll_ifindex = if_nametoindex(ifname.c_str());
+  bool ok = sendto(fd, frame, len, 0, (struct sockaddr*)&addr,
+                   sizeof(addr)) == (ssize_t)len;
+  close(fd);
+  return ok;
+}
+
+TEST(TapTest, SetMtuKeepsHeldFrames) {
+  if (geteuid() != 0) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  Tap tap((MacAddress(kMac)), 1500);
+  ASSERT_TRUE(tap.IsOpen());
+  BufferPool pool(tap.max_frame_len(), 4);
+
+  // Local experimental ethertype, the kernel sends nothing like it itself.
+  unsigned char frame[64];
+  memset(frame, 0, sizeof(frame));
+  memcpy(frame, kMac, 6);
+  frame[6] = 0x02;
+  frame[12] = 0x88;
+  frame[13] = 0xb5;
+  frame[14] = 0x5a;
+  ASSERT_TRUE(Inject(tap.device_name(), frame, sizeof(frame)));
+
+  // Skip whatever else the kernel sent out of the new interface.
+  FrameView view;
+  Buffer* b = NULL;
+  for (int i = 0; i < 16 && !b; ++i) {
+    b = tap.get(&pool, &view);
+    if (b && (b->len() != sizeof(frame) || view.ethertype() != 0x88b5)) {
+      b->Unref();
+      b = NULL;
+    }
+  }
+  ASSERT_TRUE(b != NULL);
+  EXPECT_EQ(3u, pool.available());
+
+  // The frame is in the caller's pool, so replacing the device's buffers
+  // leaves it alone.
+  ASSERT_TRUE(tap.SetMtu(9000));
+  EXPECT_EQ(9000u, tap.mtu());
+  EXPECT_EQ(0, memcmp(frame, b->data(), sizeof(frame)));
+  EXPECT_EQ(3u, pool.available());
+  b->Unref();
+  EXPECT_EQ(4u, pool.available());
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,256 @@
+// Trace records are exported in the chrome trace event format:
+// https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU
+//
+// Every stamp after the first becomes a complete ("X") event spanning from
+// the previous stamp, named by the stage reached. The first stamp of each
+// record carries a flow event keyed by the trace id, so the viewer draws an
+// arrow from the sending node to the receiving one when the json files of
+// both are loaded together.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "src/trace.h"
+
+namespace bangnet {
+
+namespace {
+
+// Frames between sampling decisions while tracing is off, so a thread picks
+// up Enable() within this many frames.
+const uint32_t kDisabledRecheck = 1 << 16;
+
+}  // namespace
+
+// Fixed size ring of records, written by a single thread and read by the
+// exporter. Records are guarded by their seq, like a seqlock.
+class TraceRing {
+public:
+  TraceRing(unsigned int index, uint32_t size)
+      : index_(index), head_(0) {
+    size_ = 64;
+    while (size_ < size)
+      size_ <<= 1;
+    records_ = new TraceRecord[size_];
+    for (uint32_t i = 0; i < size_; ++i)
+      records_[i].seq.store(0, std::memory_order_relaxed);
+  }
+
+  ~TraceRing() { delete[] records_; }
+
+  TraceRecord* Next() { return &records_[head_ & (size_ - 1)]; }
+  void Advance() { ++head_; }
+
+  unsigned int index() const { return index_; }
+  uint32_t size() const { return size_; }
+  const TraceRecord& record(uint32_t i) const { return records_[i]; }
+
+private:
+  unsigned int index_;
+  TraceRecord* records_;
+  uint32_t size_;
+  uint64_t head_;
+};
+
+namespace trace_internal {
+
+__thread ThreadState state = {0, 0, 0};
+
+void Sample(TraceStage stage) {
+  Tracer* tracer = Tracer::Instance();
+  if (!tracer->enabled()) {
+    state.countdown = kDisabledRecheck;
+    return;
+  }
+  state.countdown = tracer->options().sample_period - 1;
+  uint64_t id = tracer->next_id_.fetch_add(1, std::memory_order_relaxed);
+  TraceRecord* r = tracer->Begin(id, false);
+  if (r)
+    Stamp(stage);
+}
+
+void Continue(uint64_t id, TraceStage stage) {
+  Tracer* tracer = Tracer::Instance();
+  if (!tracer->enabled())
+    return;
+  TraceRecord* r = tracer->Begin(id, true);
+  if (r)
+    Stamp(stage);
+}
+
+void Stamp(TraceStage stage) {
+  TraceRecord* r = state.current;
+  if (r->nstamps >= kMaxTraceStamps)
+    return;
+  r->stages[r->nstamps] = (uint8_t)stage;
+  r->stamps[r->nstamps] = r->cycles ? CycleCount() : MonotonicNs();
+  ++r->nstamps;
+}
+
+void Commit() {
+  TraceRecord* r = state.current;
+  r->seq.store(r->seq.load(std::memory_order_relaxed) + 1,
+               std::memory_order_release);
+  state.ring->Advance();
+  state.current = 0;
+}
+
+}  // namespace trace_internal
+
+const char* TraceStageName(TraceStage stage) {
+  switch (stage) {
+    case TRACE_TAP_GET:
+      return "tap-get";
+    case TRACE_ENCRYPT:
+      return "encrypt";
+    case TRACE_UDP_SEND:
+      return "udp-send";
+    case TRACE_UDP_RECV:
+      return "udp-recv";
+    case TRACE_DECRYPT:
+      return "decrypt";
+    case TRACE_TAP_PUT:
+      return "tap-put";
+    default:
+      return "unknown";
+  }
+}
+
+Tracer* Tracer::Instance() {
+  static Tracer* tracer = new Tracer();
+  return tracer;
+}
+
+Tracer::Tracer()
+    : enabled_(false), next_id_(1), realtime_offset_(0), ring_count_(0) {
+  memset(rings_, 0, sizeof(rings_));
+}
+
+void Tracer::Enable(const TraceOptions& options) {
+  std::lock_guard<std::mutex> lock(mu_);
+  options_ = options;
+  if (options_.sample_period == 0)
+    options_.sample_period = 1;
+  if (options_.use_cycles)
+    CycleClock::Calibrate(10 * 1000 * 1000);
+  realtime_offset_ = (int64_t)(RealtimeNs() - MonotonicNs());
+  // Ids are unique per node, the node id takes the top 16 bits.
+  next_id_.store(((uint64_t)(options_.node_id & 0xffff) << 48) | 1);
+  enabled_.store(true, std::memory_order_release);
+}
+
+void Tracer::Disable() {
+  enabled_.store(false, std::memory_order_release);
+}
+
+TraceRing* Tracer::ThreadRing() {
+  trace_internal::ThreadState& s = trace_internal::state;
+  if (BN_LIKELY(s.ring != 0))
+    return s.ring;
+
+  std::lock_guard<std::mutex> lock(mu_);
+  unsigned int count = ring_count_.load(std::memory_order_relaxed);
+  if (count >= kMaxRings)
+    return 0;
+  s.ring = new TraceRing(count, options_.ring_records);
+  rings_[count] = s.ring;
+  ring_count_.store(count + 1, std::memory_order_release);
+  return s.ring;
+}
+
+TraceRecord* Tracer::Begin(uint64_t id, bool continued) {
+  trace_internal::ThreadState& s = trace_internal::state;
+  // A frame dropped without TraceEnd() is committed as it is.
+  if (s.current)
+    trace_internal::Commit();
+
+  TraceRing* ring = ThreadRing();
+  if (!ring)
+    return 0;
+
+  TraceRecord* r = ring->Next();
+  r->seq.store(r->seq.load(std::memory_order_relaxed) + 1,
+               std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  r->nstamps = 0;
+  r->continued = continued;
+  r->cycles = options_.use_cycles;
+  r->id = id;
+  s.current = r;
+  return r;
+}
+
+string Tracer::ExportChromeJson() {
+  ostringstream out;
+  out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first_event = true;
+  char buf[512];
+
+  unsigned int count = ring_count_.load(std::memory_order_acquire);
+  for (unsigned int i = 0; i < count; ++i) {
+    const TraceRing* ring = rings_[i];
+    for (uint32_t j = 0; j < ring->size(); ++j) {
+      const TraceRecord& src = ring->record(j);
+      uint32_t seq = src.seq.load(std::memory_order_acquire);
+      if (seq == 0 || (seq & 1))
+        continue;
+
+      // Copy and make sure the writer did not reuse it meanwhile.
+      TraceRecord r;
+      r.nstamps = src.nstamps;
+      r.continued = src.continued;
+      r.cycles = src.cycles;
+      r.id = src.id;
+      memcpy(r.stages, src.stages, sizeof(r.stages));
+      memcpy(r.stamps, src.stamps, sizeof(r.stamps));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (src.seq.load(std::memory_order_relaxed) != seq || r.nstamps == 0)
+        continue;
+
+      // Microseconds since the epoch, as the format wants.
+      double us[kMaxTraceStamps];
+      for (int k = 0; k < r.nstamps && k < kMaxTraceStamps; ++k) {
+        uint64_t mono = r.cycles ? CycleClock::ToMonotonicNs(r.stamps[k]) :
+                                   r.stamps[k];
+        us[k] = (double)((int64_t)mono + realtime_offset_) / 1000.0;
+      }
+
+      snprintf(buf, sizeof(buf),
+               "%s{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"%s\","
+               "\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%u,\"tid\":%u%s}",
+               first_event ? "" : ",", r.continued ? "f" : "s",
+               (unsigned long long)r.id, us[0], options_.node_id,
+               ring->index(), r.continued ? ",\"bp\":\"e\"" : "");
+      out << buf;
+      first_event = false;
+
+      for (int k = 1; k < r.nstamps && k < kMaxTraceStamps; ++k) {
+        snprintf(buf, sizeof(buf),
+                 ",{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\","
+                 "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%u,\"tid\":%u,"
+                 "\"args\":{\"trace_id\":\"0x%llx\",\"from\":\"%s\"}}",
+                 TraceStageName((TraceStage)r.stages[k]), us[k - 1],
+                 us[k] - us[k - 1], options_.node_id, ring->index(),
+                 (unsigned long long)r.id,
+                 TraceStageName((TraceStage)r.stages[k - 1]));
+        out << buf;
+      }
+    }
+  }
+  out << "]}\n";
+  return out.str();
+}
+
+bool Tracer::ExportChromeJson(const string& path) {
+  string json = ExportChromeJson();
+  FILE* fp = fopen(path.c_str(), "w");
+  if (!fp) {
+    LOG(ERROR) << "Unable to open " << path;
+    return false;
+  }
+  bool ok = fwrite(json.data(), 1, json.size(), fp) == json.size();
+  fclose(fp);
+  return ok;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,180 @@
+#ifndef BANGNET_TRACE_H_
+#define BANGNET_TRACE_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+
+#include "src/clock.h"
+#include "src/common.h"
+
+namespace bangnet {
+
+// Stages of the frame pipeline a trace is stamped at, in the order a frame
+// passes them from the sending tap to the receiving one.
+enum TraceStage {
+  TRACE_TAP_GET = 0,
+  TRACE_ENCRYPT,
+  TRACE_UDP_SEND,
+  TRACE_UDP_RECV,
+  TRACE_DECRYPT,
+  TRACE_TAP_PUT,
+  TRACE_STAGE_COUNT
+};
+
+// Returns a printable name of a stage, like "tap-get".
+const char* TraceStageName(TraceStage stage);
+
+// Max number of stamps a single trace record holds.
+const int kMaxTraceStamps = 14;
+
+// The stamps a sampled frame collected on one node.
+struct TraceRecord {
+  // Odd while the record is being written.
+  std::atomic<uint32_t> seq;
+  uint16_t nstamps;
+  // True if the trace was started on another node.
+  uint8_t continued;
+  // True if stamps are CycleCount() values instead of MonotonicNs().
+  uint8_t cycles;
+  // Same on every node the frame passes, carried in the encapsulation.
+  uint64_t id;
+  uint8_t stages[kMaxTraceStamps];
+  uint64_t stamps[kMaxTraceStamps];
+};
+
+struct TraceOptions {
+  TraceOptions()
+      : sample_period(1000), use_cycles(true), ring_records(4096),
+        node_id(0) {}
+
+  // One in this many frames is traced.
+  uint32_t sample_period;
+
+  // Stamps with the cpu time stamp counter instead of CLOCK_MONOTONIC.
+  bool use_cycles;
+
+  // Number of records each thread keeps, the oldest are overwritten.
+  uint32_t ring_records;
+
+  // Identifies this node in trace ids and exported traces.
+  uint32_t node_id;
+};
+
+class TraceRing;
+
+namespace trace_internal {
+
+// Trace state of a pipeline thread. Frames are processed run to completion,
+// so a thread has at most one frame being traced.
+struct ThreadState {
+  // Frames left until the next sampling decision.
+  uint32_t countdown;
+  TraceRecord* current;
+  TraceRing* ring;
+};
+
+// Plain __thread so the hot path reads it directly, without the init
+// check of a C++11 thread_local.
+extern __thread ThreadState state;
+
+void Sample(TraceStage stage);
+void Continue(uint64_t id, TraceStage stage);
+void Stamp(TraceStage stage);
+void Commit();
+
+}  // namespace trace_internal
+
+// Collects per-frame stamps in per-thread rings and exports them in the
+// chrome trace event format, which chrome://tracing and perfetto load.
+class Tracer {
+public:
+  // Returns the process wide tracer.
+  static Tracer* Instance();
+
+  void Enable(const TraceOptions& options);
+  void Disable();
+
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+  const TraceOptions& options() const { return options_; }
+
+  // Returns all committed records as chrome trace json.
+  string ExportChromeJson();
+
+  // Writes ExportChromeJson() to a file.
+  bool ExportChromeJson(const string& path);
+
+private:
+  friend void trace_internal::Sample(TraceStage stage);
+  friend void trace_internal::Continue(uint64_t id, TraceStage stage);
+
+  Tracer();
+
+  TraceRing* ThreadRing();
+  TraceRecord* Begin(uint64_t id, bool continued);
+
+  // Max number of threads that can trace frames.
+  static const unsigned int kMaxRings = 128;
+
+  std::mutex mu_;
+  std::atomic<bool> enabled_;
+  TraceOptions options_;
+  std::atomic<uint64_t> next_id_;
+
+  // Realtime minus monotonic time when tracing was enabled, so traces of
+  // different nodes line up.
+  int64_t realtime_offset_;
+
+  TraceRing* rings_[kMaxRings];
+  std::atomic<unsigned int> ring_count_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(Tracer);
+};
+
+// Decides whether the frame entering the pipeline is traced, and stamps it
+// if so. Costs one predictable branch for frames which are not sampled.
+inline void TraceBegin(TraceStage stage) {
+  if (BN_UNLIKELY(trace_internal::state.countdown-- == 0))
+    trace_internal::Sample(stage);
+}
+
+// Continues a trace started on another node, id is zero if the frame was
+// not sampled there.
+inline void TraceContinue(uint64_t id, TraceStage stage) {
+  if (BN_UNLIKELY(id != 0))
+    trace_internal::Continue(id, stage);
+}
+
+// Stamps the frame being traced by this thread, if any.
+inline void TraceStamp(TraceStage stage) {
+  if (BN_UNLIKELY(trace_internal::state.current != 0))
+    trace_internal::Stamp(stage);
+}
+
+// Stamps and finishes the frame being traced by this thread, if any.
+inline void TraceEnd(TraceStage stage) {
+  if (BN_UNLIKELY(trace_internal::state.current != 0)) {
+    trace_internal::Stamp(stage);
+    trace_internal::Commit();
+  }
+}
+
+// Finishes the frame being traced by this thread, if any, without a stamp,
+// like when it was dropped.
+inline void TraceDrop() {
+  if (BN_UNLIKELY(trace_internal::state.current != 0))
+    trace_internal::Commit();
+}
+
+// Returns the id of the frame being traced, to be carried to the next node,
+// or zero.
+inline uint64_t TraceId() {
+  TraceRecord* r = trace_internal::state.current;
+  return BN_UNLIKELY(r != 0) ? r->id : 0;
+}
+
+}  // namespace bangnet
+
+#endif  // BANGNET_TRACE_H_
@@ -0,0 +1,57 @@
+#include "src/trace.h"
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+TEST(TraceTest, DisabledTracesNothing) {
+  for (int i = 0; i < 1000; ++i) {
+    TraceBegin(TRACE_TAP_GET);
+    EXPECT_EQ(0u, TraceId());
+    TraceEnd(TRACE_TAP_PUT);
+  }
+}
+
+TEST(TraceTest, SamplesAndExports) {
+  TraceOptions options;
+  options.sample_period = 10;
+  options.node_id = 7;
+  Tracer::Instance()->Enable(options);
+
+  // Finish the sampling countdown left over from the disabled state.
+  int i = 0;
+  for (; i <= (1 << 16) && TraceId() == 0; ++i)
+    TraceBegin(TRACE_TAP_GET);
+  ASSERT_NE(0u, TraceId());
+  EXPECT_EQ(7u, TraceId() >> 48);
+  TraceEnd(TRACE_TAP_PUT);
+
+  int sampled = 0;
+  for (i = 0; i < 1000; ++i) {
+    TraceBegin(TRACE_TAP_GET);
+    if (TraceId() != 0)
+      ++sampled;
+    TraceStamp(TRACE_ENCRYPT);
+    TraceEnd(TRACE_TAP_PUT);
+  }
+  EXPECT_EQ(100, sampled);
+
+  TraceContinue(0, TRACE_UDP_RECV);
+  EXPECT_EQ(0u, TraceId());
+  TraceContinue(0x1234, TRACE_UDP_RECV);
+  EXPECT_EQ(0x1234u, TraceId());
+  TraceEnd(TRACE_TAP_PUT);
+  Tracer::Instance()->Disable();
+
+  string json = Tracer::Instance()->ExportChromeJson();
+  EXPECT_EQ(0u, json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+  EXPECT_NE(string::npos, json.find("\"name\":\"encrypt\""));
+  EXPECT_NE(string::npos, json.find("\"from\":\"encrypt\""));
+  EXPECT_NE(string::npos, json.find("\"id\":\"0x1234\""));
+  EXPECT_NE(string::npos, json.find("\"bp\":\"e\""));
+  EXPECT_NE(string::npos, json.find("\"pid\":7"));
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,20 @@
+#include <linux/if_tun.h>
+
+#include "src/tun.h"
+
+namespace bangnet {
+
+Tun::Tun(unsigned int mtu)
+    : TunTapDevice(IFF_TUN, "bt", (const unsigned char*)0, mtu) {}
+
+InetAddress Tun::Destination(const void* packet, unsigned int len) {
+  const unsigned char* p = (const unsigned char*)packet;
+  InetAddress dst;
+  if (len >= 20 && (p[0] >> 4) == 4)
+    dst.SetInetAddr(p + 16, 4, 0);
+  else if (len >= 40 && (p[0] >> 4) == 6)
+    dst.SetInetAddr(p + 24, 16, 0);
+  return dst;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,29 @@
+#ifndef BANGNET_TUN_H_
+#define BANGNET_TUN_H_
+
+#include "src/common.h"
+#include "src/inet_addr.h"
+#include "src/tun_tap.h"
+
+namespace bangnet {
+
+// A layer 3 device carrying bare ip packets, for routed deployments. Unlike
+// a tap there is no ethernet header to build or strip and no ARP, packets
+// are routed on their destination address alone. Frames read and written
+// are ip packets, header_len() is 0. They are not captured, capture points,
+// filters and the pcapng interfaces all carry ethernet frames.
+class Tun : public TunTapDevice {
+public:
+  // Mtu of tun devices created without one.
+  static const unsigned int kDefaultMtu = 2800;
+
+  explicit Tun(unsigned int mtu = kDefaultMtu);
+
+  // Returns the destination address of an ip packet, with port 0, or a null
+  // address if it is not ipv4 or ipv6.
+  static InetAddress Destination(const void* packet, unsigned int len);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_TUN_H_
@@ -0,0 +1,424 @@
+// TUN/TAP provides packet reception and transmission for user space programs. 
+// It can be seen as a simple Point-to-Point or Ethernet device, which,
+// instead of receiving packets from physical media, receives them from 
+// user space program and instead of sending packets via physical media 
+// writes them to the user space program. 
+
+// In order to use the driver a program has to open /dev/net/tun and issue a
+// corresponding ioctl() to register a network device with the kernel. A network
+// device will appear as tunXX or tapXX, depending on the options chosen. When
+// the program closes the file descriptor, the network device and all
+// corresponding routes will disappear.
+
+// Depending on the type of device chosen the userspace program has to 
+// read/write IP packets (with tun) or ethernet frames (with tap). 
+// Which one is being used depends on the flags given with the ioctl().
+
+// More details can be found on this link:
+// https://github.com/torvalds/linux/blob/master/Documentation/networking/tuntap.txt
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <net/if_arp.h>
+#include <arpa/inet.h>
+
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <linux/if_addr.h>
+#include <linux/if_ether.h>
+
+#include "tun_tap.h"
+#include "common.h"
+#include "capture.h"
+#include "trace.h"
+#include "utils.h"
+
+#define SYSCTL_COMMAND "/sbin/sysctl"
+
+namespace bangnet {
+
+TunTapDevice::TunTapDevice(int flags, const char* prefix,
+                           const unsigned char* hwaddr, unsigned int mtu)
+    : mtu_(mtu),
+      header_len_((flags & IFF_TAP) ? 14 : 0),
+      pool_((BufferPool*)0),
+      fd_(0) {
+  CHECK(mtu_ >= 68 && mtu_ <= kMaxMtu) << "Invalid mtu " << mtu_;
+
+  fd_ = open("/dev/net/tun", O_RDWR);
+  CHECK_GT(fd_, 0) << "Could not open TUN/TAP device";
+
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+
+  // Get a device name for this inteface.
+  int devno = 0;
+  struct stat sbuf;
+  char procpath[128];
+  do {
+    sprintf(ifr.ifr_name, "%s%d", prefix, devno++);
+    sprintf(procpath, "/proc/sys/net/ipv4/conf/%s", ifr.ifr_name);
+  } while (stat(procpath, &sbuf) == 0);
+
+  ifr.ifr_flags = flags | IFF_NO_PI;
+  if (ioctl(fd_, TUNSETIFF, (void*)&ifr) < 0) {
+    ::close(fd_);
+    LOG(FATAL) << "Unable to configure TUN/TAP device";
+  }
+
+  // Now, we have a name for this interface.
+  strcpy(dev_, ifr.ifr_name); 
+  
+  // Dont know what this does, Leave it now.
+  ioctl(fd_, TUNSETPERSIST, 0);
+
+  // Open an any sockset
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock <= 0) {
+    ::close(fd_);
+    LOG(FATAL) << "Unable to open socket";
+  }
+
+  // Set MacAddress address, tun devices have none.
+  if (hwaddr) {
+    ifr.ifr_ifru.ifru_hwaddr.sa_family = ARPHRD_ETHER;
+    memcpy(ifr.ifr_ifru.ifru_hwaddr.sa_data, hwaddr, 6);
+    if (ioctl(sock,SIOCSIFHWADDR, (void *)&ifr) < 0) {
+      ::close(fd_);
+      ::close(sock);
+      LOG(FATAL) << "Unable to configure interface";
+    }
+  }
+
+  // Set MTU.
+  ifr.ifr_ifru.ifru_mtu = (int)mtu_;
+  if (ioctl(sock, SIOCSIFMTU, (void *)&ifr) < 0) {
+    ::close(fd_);
+    ::close(sock);
+    LOG(FATAL) << "Unable to configure interface";
+  }
+
+  // Reads block in poll(), so a burst can be read without blocking once
+  // the first frame arrived.
+  if (fcntl(fd_, F_SETFL, fcntl(fd_,F_GETFL) | O_NONBLOCK) == -1) {
+    ::close(fd_);
+    LOG(FATAL) << "Unable to configure interface";
+  }
+
+  // Bring interface up.
+  if (ioctl(sock, SIOCGIFFLAGS, (void *)&ifr) < 0) {
+    ::close(fd_);
+    ::close(sock);
+    LOG(FATAL) << "Unable to get interface flags";
+  }
+  ifr.ifr_flags |= IFF_UP;
+  if (ioctl(sock, SIOCSIFFLAGS, (void*)&ifr) < 0) {
+    ::close(fd_);
+    ::close(sock);
+    LOG(FATAL) << "Unable to set interface flags";
+  }
+
+  ::close(sock);
+  pool_ = new BufferPool(max_frame_len(), kPoolBuffers, 0);
+
+  RegisterMetrics();
+  LOG(INFO) << "Device " << device_name() << " created";
+}
+
+TunTapDevice::~TunTapDevice() {
+  this->close();
+  delete pool_;
+  MetricsRegistry::Instance()->RemoveLabeled(
+      "device=\"" + device_name() + "\"");
+}
+
+bool TunTapDevice::SetMtu(unsigned int mtu) {
+  if (mtu == mtu_)
+    return true;
+  if (mtu < 68 || mtu > kMaxMtu)
+    return false;
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    LOG(ERROR) << "Unable to open socket";
+    return false;
+  }
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  snprintf(ifr.ifr_name, IFNAMSIZ, "%s", dev_);
+  ifr.ifr_ifru.ifru_mtu = (int)mtu;
+  int r = ioctl(sock, SIOCSIFMTU, (void*)&ifr);
+  ::close(sock);
+  if (r < 0) {
+    LOG(ERROR) << "Unable to set mtu of " << device_name() << " to " << mtu;
+    return false;
+  }
+
+  LOG(INFO) << "Device " << device_name() << " mtu " << mtu_ << " -> " << mtu;
+  mtu_ = mtu;
+  // The buffers of put() and get() only need to grow.
+  if (max_frame_len() > pool_->buffer_size()) {
+    delete pool_;
+    pool_ = new BufferPool(max_frame_len(), kPoolBuffers, 0);
+  }
+  metrics_.mtu->Set(mtu_);
+  return true;
+}
+
+void TunTapDevice::RegisterMetrics() {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "device=\"" + device_name() + "\"";
+  // Families are named after the kind of device, bangnet_tap_* or
+  // bangnet_tun_*.
+  string prefix = header_len_ ? "bangnet_tap_" : "bangnet_tun_";
+  metrics_.rx_frames = r->NewCounter(prefix + "rx_frames_total",
+      "Frames read from the device.", labels);
+  metrics_.rx_bytes = r->NewCounter(prefix + "rx_bytes_total",
+      "Bytes read from the device.", labels);
+  metrics_.rx_errors = r->NewCounter(prefix + "rx_errors_total",
+      "Failed or truncated reads from the device.", labels);
+  metrics_.tx_frames = r->NewCounter(prefix + "tx_frames_total",
+      "Frames written to the device.", labels);
+  metrics_.tx_bytes = r->NewCounter(prefix + "tx_bytes_total",
+      "Bytes written to the device.", labels);
+  metrics_.tx_drops = r->NewCounter(prefix + "tx_drops_total",
+      "Frames dropped before the device, like oversized ones.", labels);
+  metrics_.tx_errors = r->NewCounter(prefix + "tx_errors_total",
+      "Failed writes to the device.", labels);
+  metrics_.addr_changes = r->NewCounter(prefix + "addr_changes_total",
+      "Addresses added to or removed from the device.", labels);
+  metrics_.addr_errors = r->NewCounter(prefix + "addr_errors_total",
+      "Failed address changes of the device.", labels);
+  metrics_.mtu = r->NewGauge(prefix + "mtu",
+      "Current mtu of the device.", labels);
+  metrics_.mtu->Set(mtu_);
+  metrics_.tx_latency = r->NewHistogram(prefix + "tx_latency_ns",
+      "Nanoseconds spent writing a frame to the device.", labels);
+  metrics_.addr_latency = r->NewHistogram(prefix + "addr_latency_ns",
+      "Nanoseconds spent adding or removing an address.", labels);
+}
+
+bool TunTapDevice::WriteFrame(const void* frame, unsigned int len) {
+  if (fd_ <= 0 || len > max_frame_len()) {
+    metrics_.tx_drops->Increment();
+    return false;
+  }
+  TraceEnd(TRACE_TAP_PUT);
+  // Only ethernet frames are captured, tun packets are left out.
+  if (header_len_)
+    CaptureFrame(CAPTURE_TAP_PUT, frame, len);
+
+  ScopedLatency latency(metrics_.tx_latency);
+  if (::write(fd_, frame, len) < 0) {
+    metrics_.tx_errors->Increment();
+    return false;
+  }
+  metrics_.tx_frames->Increment();
+  metrics_.tx_bytes->Add(len);
+  return true;
+}
+
+int TunTapDevice::read_nonblock(void* buf, unsigned int cap) {
+  int n = ::read(fd_, buf, cap);
+  if (n < 0 && errno != EAGAIN && errno != EINTR)
+    metrics_.rx_errors->Increment();
+  if (n <= 0)
+    return n;
+  if (n <= (int)header_len_) {
+    // Runt frame, skip it.
+    metrics_.rx_errors->Increment();
+    return 0;
+  }
+  metrics_.rx_frames->Increment();
+  metrics_.rx_bytes->Add(n);
+  if (header_len_)
+    CaptureFrame(CAPTURE_TAP_GET, buf, n);
+  return n;
+}
+
+unsigned int TunTapDevice::ReadFrame(void* buf, unsigned int cap) {
+  unsigned int n = read_blocking(buf, cap);
+  if (n)
+    TraceBegin(TRACE_TAP_GET);
+  return n;
+}
+
+unsigned int TunTapDevice::read_blocking(void* buf, unsigned int cap) {
+  while (fd_ > 0) {
+    int n = read_nonblock(buf, cap);
+    if (n > 0)
+      return n;
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+      return 0;
+
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      return 0;
+  }
+  return 0;
+}
+
+int TunTapDevice::ReadBurst(FrameSlot* frames, int n) {
+  if (n <= 0)
+    return 0;
+  frames[0].len = read_blocking(frames[0].data, frames[0].cap);
+  if (frames[0].len == 0)
+    return 0;
+
+  // Take what else is already queued.
+  int i = 1;
+  for (; i < n; ++i) {
+    int len = read_nonblock(frames[i].data, frames[i].cap);
+    if (len <= 0)
+      break;
+    frames[i].len = len;
+  }
+  TraceBegin(TRACE_TAP_GET);
+  return i;
+}
+
+int TunTapDevice::TryReadBurst(FrameSlot* frames, int n) {
+  int i = 0;
+  for (; i < n; ++i) {
+    int len = read_nonblock(frames[i].data, frames[i].cap);
+    if (len <= 0)
+      break;
+    frames[i].len = len;
+  }
+  if (i)
+    TraceBegin(TRACE_TAP_GET);
+  return i;
+}
+
+Buffer* TunTapDevice::ReadBuffer(BufferPool* pool) {
+  Buffer* b = pool->Get();
+  if (!b) {
+    metrics_.rx_errors->Increment();
+    return (Buffer*)0;
+  }
+  if (b->capacity() < max_frame_len()) {
+    LOG(ERROR) << "Buffers of " << b->capacity() << " bytes can not hold "
+               << "frames of " << device_name();
+    b->Unref();
+    return (Buffer*)0;
+  }
+  unsigned int n = ReadFrame(b->data(), b->capacity());
+  if (n == 0) {
+    b->Unref();
+    return (Buffer*)0;
+  }
+  b->set_len(n);
+  return b;
+}
+
+int TunTapDevice::ReadBuffers(BufferPool* pool, Buffer** buffers, int n) {
+  int got = pool->GetBurst(buffers, n);
+  if (got == 0) {
+    metrics_.rx_errors->Increment();
+    return 0;
+  }
+  if (buffers[0]->capacity() < max_frame_len()) {
+    LOG(ERROR) << "Buffers of " << buffers[0]->capacity() << " bytes can "
+               << "not hold frames of " << device_name();
+    for (int j = 0; j < got; ++j)
+      buffers[j]->Unref();
+    return 0;
+  }
+
+  // Block for the first frame only, and sample the burst as a whole.
+  int i = 0;
+  unsigned int len = read_blocking(buffers[0]->data(),
+                                   buffers[0]->capacity());
+  if (len) {
+    buffers[0]->set_len(len);
+    for (i = 1; i < got; ++i) {
+      int m = read_nonblock(buffers[i]->data(), buffers[i]->capacity());
+      if (m <= 0)
+        break;
+      buffers[i]->set_len(m);
+    }
+    TraceBegin(TRACE_TAP_GET);
+  }
+  // Back to the pool with the ones not read into.
+  for (int j = i; j < got; ++j)
+    buffers[j]->Unref();
+  return i;
+}
+
+bool TunTapDevice::WriteBuffer(Buffer* b) {
+  bool ok = WriteFrame(b->data(), b->len());
+  b->Unref();
+  return ok;
+}
+
+bool TunTapDevice::IsOpen() const {
+  return fd_ > 0;
+}
+
+void TunTapDevice::close() {
+  if (fd_ > 0) {
+    int f = fd_;
+    fd_ = 0;
+    ::close(f);
+  }
+}
+
+bool TunTapDevice::remove_ip(const char *dev_, set<InetAddress>& ips_, 
+               const InetAddress& ip) {
+  ScopedLatency latency(metrics_.addr_latency);
+  if (utils::RunIp("addr", "del", ip.ToIpString().c_str(), "dev", dev_)) {
+    ips_.erase(ip);
+    metrics_.addr_changes->Increment();
+    return true;
+  }
+  metrics_.addr_errors->Increment();
+  return false;
+}
+
+bool TunTapDevice::AddIP(const InetAddress& ip) {
+  // If it's not a internet address.
+  if (!ip)
+    return false;
+
+  if (ips_.count(ip))
+    return true;
+  
+  for (auto it = ips_.begin(); it != ips_.end(); ++it) {
+    // If we already has this address, remove first.
+    if (*it == ip) {
+      remove_ip(dev_, ips_, *it);
+      break;
+    }
+  }
+
+  ScopedLatency latency(metrics_.addr_latency);
+  if (utils::RunIp("addr", "add", ip.ToString().c_str(), "dev", dev_)) {
+    ips_.insert(ip);
+    metrics_.addr_changes->Increment();
+    return true;
+  }
+  metrics_.addr_errors->Increment();
+  return false;
+}
+
+bool TunTapDevice::RemoveIP(const InetAddress& ip) {
+  if (ips_.count(ip))
+    return remove_ip(dev_, ips_, ip);
+  return false;
+}
+
+}  // namespace bangnet
\ No newline at end of file
@@ -0,0 +1,146 @@
+#ifndef BANGNET_TUN_TAP_H_
+#define BANGNET_TUN_TAP_H_
+
+#include <string>
+#include "src/buffer_pool.h"
+#include "src/frame_device.h"
+#include "src/inet_addr.h"
+#include "src/common.h"
+#include "src/metrics.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+
+// A kernel TUN/TAP device. Tap and Tun share the device setup, address
+// management, buffers and batch reads here, and differ in what a frame is:
+// an ethernet frame for taps, a bare ip packet for tuns.
+class TunTapDevice : public FrameDevice {
+public:
+  ~TunTapDevice();
+
+  // Returns device's name
+  string device_name() const {
+    return string(dev_);
+  }
+
+  unsigned int mtu() const { return mtu_; }
+
+  unsigned int header_len() const { return header_len_; }
+
+  // Largest frame read or written, link header and vlan tags included.
+  unsigned int max_frame_len() const {
+    return mtu_ + header_len_ + (header_len_ ? 4 * kMaxVlanTags : 0);
+  }
+
+  int fd() const { return fd_; }
+
+  // Changes the mtu of the interface, like when the path mtu to the peers
+  // changed. Frames larger than the new mtu are dropped from then on. Must
+  // not run concurrently with put() or get().
+  bool SetMtu(unsigned int mtu);
+
+  // Writes a whole frame.
+  bool WriteFrame(const void* frame, unsigned int len);
+
+  // Reads a whole frame, blocking until one arrives.
+  unsigned int ReadFrame(void* buf, unsigned int cap);
+
+  // Reads the frames already queued after the first one without blocking.
+  // Bursts are sampled for tracing as a whole, a traced burst is stamped
+  // once when read and once when its first frame is written.
+  int ReadBurst(FrameSlot* frames, int n);
+
+  // Reads the frames already queued, without blocking for the first one.
+  int TryReadBurst(FrameSlot* frames, int n);
+
+  // Reads a frame straight into a buffer of pool, which must hold
+  // max_frame_len() bytes. Returns the buffer with a reference for the caller,
+  // or null.
+  Buffer* ReadBuffer(BufferPool* pool);
+
+  // Reads a burst of up to n frames into buffers of pool, like ReadBurst():
+  // blocks for the first frame and takes the ones queued after it. Returns
+  // their count, each with a reference for the caller.
+  int ReadBuffers(BufferPool* pool, Buffer** buffers, int n);
+
+  // Writes the frame in b and drops the caller's reference to it.
+  bool WriteBuffer(Buffer* b);
+
+  bool IsOpen() const;
+
+  void close();
+
+  bool AddIP(const InetAddress& ip);
+
+bool remove_ip(const char *dev_, set<InetAddress>& ips_, 
+               const InetAddress& ip);
+
+  bool RemoveIP(const InetAddress& ip);
+
+  inline set<InetAddress> IPSet() {
+    return ips_;
+  }
+
+protected:
+  // Creates a device named prefix and the first free number. flags is
+  // IFF_TAP or IFF_TUN, hwaddr the mac address of taps or null.
+  TunTapDevice(int flags, const char* prefix, const unsigned char* hwaddr,
+               unsigned int mtu);
+
+  // Mtu number of this device. 
+  unsigned int mtu_;
+
+  // Link header in front of each packet, 14 for taps, 0 for tuns.
+  const unsigned int header_len_;
+
+  // Device name.
+  char dev_[16];
+
+  // Buffers in pool_, enough for callers holding a burst of frames.
+  static const unsigned int kPoolBuffers = 64;
+
+  // Buffers put() and get() build and read frames in, sized for mtu_.
+  // SetMtu() replaces it, so they never leave the device.
+  BufferPool* pool_;
+
+  // File descriptor associated with this interface.
+  int fd_;
+
+  // Bind ip addresses.
+  set<InetAddress> ips_;
+
+  // Metrics of this device, owned by the metrics registry and labeled
+  // with the device name.
+  struct Metrics {
+    Counter* rx_frames;
+    Counter* rx_bytes;
+    Counter* rx_errors;
+    Counter* tx_frames;
+    Counter* tx_bytes;
+    Counter* tx_drops;
+    Counter* tx_errors;
+    Counter* addr_changes;
+    Counter* addr_errors;
+    Gauge* mtu;
+    // Nanoseconds spent writing a frame to the device.
+    Histogram* tx_latency;
+    // Nanoseconds spent adding or removing an address.
+    Histogram* addr_latency;
+  } metrics_;
+
+private:
+  void RegisterMetrics();
+
+  // Reads one frame without blocking. Returns 0 if none is ready, or -1
+  // and sets errno on error.
+  int read_nonblock(void* buf, unsigned int cap);
+
+  // Reads one frame, blocking until one arrives. Returns 0 on error.
+  unsigned int read_blocking(void* buf, unsigned int cap);
+
+  BN_DISALLOW_COPY_AND_ASSIGN(TunTapDevice);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_TUN_TAP_H_
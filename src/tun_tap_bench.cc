@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/pktgen.h"
+#include "src/tap.h"
+#include "src/tun.h"
+
+namespace bangnet {
+namespace {
+
+// Writes generated traffic into a device for duration_ms. The kernel takes
+// each packet through its receive path and drops it at routing, so this
+// measures the per packet cost of the device, and for a tap, of ethernet.
+// Tun devices are written the same frames without the ethernet header.
+BenchResult RunWriteBench(const string& name, TunTapDevice* dev,
+                          const PktgenOptions& options,
+                          uint64_t duration_ms) {
+  PacketGenerator gen(options);
+  unsigned int burst = options.burst ? options.burst : 1;
+  unsigned int size = gen.options().frame_size;
+  unsigned int skip = 14 - dev->header_len();
+  vector<unsigned char> mem(burst * size);
+  vector<FrameSlot> frames(burst), packets(burst);
+  for (unsigned int i = 0; i < burst; ++i) {
+    frames[i].data = &mem[i * size];
+    frames[i].cap = size;
+  }
+
+  StageClock stages;
+  int gen_stage = stages.AddStage("gen");
+  int tx_stage = stages.AddStage("tx");
+
+  BenchResult result;
+  result.name = name;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+  while (now < end) {
+    uint64_t c0 = CycleCount();
+    gen.Fill(&frames[0], burst, c0);
+    for (unsigned int i = 0; i < burst; ++i) {
+      packets[i].data = frames[i].data + skip;
+      packets[i].len = frames[i].len - skip;
+    }
+    uint64_t c1 = CycleCount();
+    int sent = dev->WriteBurst(&packets[0], burst);
+    uint64_t c2 = CycleCount();
+    stages.Add(gen_stage, c1 - c0);
+    stages.Add(tx_stage, c2 - c1);
+    result.packets += sent;
+    for (int i = 0; i < sent; ++i)
+      result.bytes += packets[i].len;
+    now = MonotonicNs();
+  }
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+  return result;
+}
+
+// Packet rates of a tap and a tun device, needs root.
+BENCHMARK(TapVsTun) {
+  if (geteuid() != 0 || access("/dev/net/tun", R_OK | W_OK) != 0) {
+    printf("  skipped, needs root and /dev/net/tun\n");
+    return;
+  }
+  // The generator's destination, so the tap takes frames as its own.
+  const unsigned char bits[6] = {0x02, 0x62, 0x67, 0, 0, 0x02};
+  MacAddress mac(bits);
+  Tap tap(mac);
+  Tun tun;
+
+  for (size_t i = 0; i < options.frame_sizes.size(); ++i) {
+    PktgenOptions pktgen;
+    pktgen.frame_size = options.frame_sizes[i];
+    pktgen.flows = options.flows;
+    pktgen.burst = options.burst;
+    if (pktgen.frame_size > tap.mtu() + 14)
+      continue;
+
+    char name[64];
+    snprintf(name, sizeof(name), "tap/%uB", pktgen.frame_size);
+    BenchResult r = RunWriteBench(name, &tap, pktgen, options.duration_ms);
+    double tap_mpps = r.Mpps();
+    results->push_back(r);
+
+    snprintf(name, sizeof(name), "tun/%uB", pktgen.frame_size - 14);
+    r = RunWriteBench(name, &tun, pktgen, options.duration_ms);
+    if (tap_mpps > 0)
+      r.AddExtra("mpps-vs-tap", r.Mpps() / tap_mpps);
+    results->push_back(r);
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,84 @@
+#include "src/tun.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "src/capture.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+namespace {
+
+TEST(TunTest, Destination) {
+  unsigned char p[40] = {0};
+  p[0] = 0x45;
+  p[16] = 10;
+  p[17] = 98;
+  p[19] = 2;
+  InetAddress dst = Tun::Destination(p, 20);
+  ASSERT_TRUE(dst.IsV4());
+  EXPECT_EQ("10.98.0.2", dst.ToIpString());
+
+  p[0] = 0x60;
+  p[24] = 0xfd;
+  p[39] = 1;
+  dst = Tun::Destination(p, 40);
+  ASSERT_TRUE(dst.IsV6());
+  EXPECT_EQ("fd00::1", dst.ToIpString());
+
+  // Too short, or not ip.
+  EXPECT_FALSE(Tun::Destination(p, 39));
+  p[0] = 0;
+  EXPECT_FALSE(Tun::Destination(p, 40));
+}
+
+// Value of a metric of device, -1 if missing.
+int64_t Sampled(const string& name, const string& device) {
+  vector<MetricSample> samples = MetricsRegistry::Instance()->Snapshot();
+  for (size_t i = 0; i < samples.size(); ++i) {
+    if (samples[i].name == name &&
+        samples[i].labels == "device=\"" + device + "\"")
+      return samples[i].value;
+  }
+  return -1;
+}
+
+TEST(TunTest, MetricsAndCapture) {
+  if (geteuid() != 0) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  char path[] = "/tmp/bangnet_capture_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  close(fd);
+  CaptureOptions options;
+  options.path = path;
+  ASSERT_TRUE(Capture::Instance()->Start(options));
+
+  Tun tun;
+  unsigned char p[28] = {0};
+  p[0] = 0x45;
+  p[3] = sizeof(p);
+  p[8] = 64;
+  p[9] = 17;
+  p[12] = 10;
+  p[15] = 1;
+  p[16] = 10;
+  p[19] = 2;
+  EXPECT_TRUE(tun.WriteFrame(p, sizeof(p)));
+  Capture::Instance()->Stop();
+  unlink(path);
+
+  // Tun packets have no ethernet header to capture.
+  EXPECT_EQ(0u, Capture::Instance()->frames_written());
+  // Metric families are named after the kind of device.
+  EXPECT_EQ(1, Sampled("bangnet_tun_tx_frames_total", tun.device_name()));
+  EXPECT_EQ(-1, Sampled("bangnet_tap_tx_frames_total", tun.device_name()));
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,157 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "src/udp_device.h"
+
+namespace bangnet {
+
+UdpDevice::UdpDevice(const InetAddress& local, const InetAddress& peer,
+                     unsigned int mtu)
+    : fd_(-1), mtu_(mtu), port_(0) {
+  if (!local || local.family() != peer.family()) {
+    LOG(ERROR) << "Invalid udp addresses " << local.ToString() << " and "
+               << peer.ToString();
+    return;
+  }
+  fd_ = socket(local.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Unable to create udp socket: " << strerror(errno);
+    return;
+  }
+  // Room for a few thousand frames in flight, like a device queue.
+  int bufsize = 4 << 20;
+  setsockopt(fd_, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+  setsockopt(fd_, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+
+  InetAddress bound(local);
+  socklen_t len = bound.saddr_space_len();
+  if (bind(fd_, local.saddr(), local.saddr_len()) < 0 ||
+      connect(fd_, peer.saddr(), peer.saddr_len()) < 0 ||
+      getsockname(fd_, bound.saddr(), &len) < 0) {
+    LOG(ERROR) << "Unable to bind udp socket to " << local.ToString()
+               << " for " << peer.ToString() << ": " << strerror(errno);
+    this->close();
+    return;
+  }
+  port_ = bound.port();
+  char name[32];
+  snprintf(name, sizeof(name), "udp%u", port_);
+  name_ = name;
+}
+
+UdpDevice::~UdpDevice() {
+  this->close();
+}
+
+void UdpDevice::close() {
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+bool UdpDevice::WriteFrame(const void* frame, unsigned int len) {
+  if (fd_ < 0 || len > mtu_ + header_len())
+    return false;
+  FrameSlot slot;
+  slot.data = (unsigned char*)frame;
+  slot.len = len;
+  slot.cap = len;
+  return WriteBurst(&slot, 1) == 1;
+}
+
+unsigned int UdpDevice::ReadFrame(void* buf, unsigned int cap) {
+  FrameSlot frame;
+  frame.data = (unsigned char*)buf;
+  frame.cap = cap;
+  frame.len = 0;
+  return ReadBurst(&frame, 1) ? frame.len : 0;
+}
+
+int UdpDevice::ReadBurst(FrameSlot* frames, int n) {
+  while (fd_ >= 0) {
+    int got = RecvBurst(frames, n, MSG_DONTWAIT);
+    if (got)
+      return got;
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR &&
+        errno != ECONNREFUSED)
+      return 0;
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+      return 0;
+  }
+  return 0;
+}
+
+int UdpDevice::TryReadBurst(FrameSlot* frames, int n) {
+  return RecvBurst(frames, n, MSG_DONTWAIT);
+}
+
+int UdpDevice::RecvBurst(FrameSlot* frames, int n, int flags) {
+  if (fd_ < 0 || n <= 0)
+    return 0;
+  if (n > kMaxBurst)
+    n = kMaxBurst;
+
+  struct mmsghdr msgs[kMaxBurst];
+  struct iovec iovs[kMaxBurst];
+  memset(msgs, 0, sizeof(msgs[0]) * n);
+  for (int i = 0; i < n; ++i) {
+    iovs[i].iov_base = frames[i].data;
+    iovs[i].iov_len = frames[i].cap;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int got;
+  do {
+    got = recvmmsg(fd_, msgs, n, flags, NULL);
+  } while (got < 0 && errno == EINTR);
+  if (got <= 0)
+    return 0;
+  for (int i = 0; i < got; ++i)
+    frames[i].len = msgs[i].msg_len;
+  return got;
+}
+
+int UdpDevice::WriteBurst(const FrameSlot* frames, int n) {
+  if (fd_ < 0 || n <= 0)
+    return 0;
+  if (n > kMaxBurst)
+    n = kMaxBurst;
+
+  struct mmsghdr msgs[kMaxBurst];
+  struct iovec iovs[kMaxBurst];
+  memset(msgs, 0, sizeof(msgs[0]) * n);
+  for (int i = 0; i < n; ++i) {
+    iovs[i].iov_base = frames[i].data;
+    iovs[i].iov_len = frames[i].len;
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // An earlier datagram the peer refused, while it was down, fails the
+  // next call once.
+  int sent = 0;
+  bool refused = false;
+  while (sent < n) {
+    int r = sendmmsg(fd_, msgs + sent, n - sent, 0);
+    if (r < 0 && errno == ECONNREFUSED && !refused) {
+      refused = true;
+      continue;
+    }
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      break;
+    sent += r;
+  }
+  return sent;
+}
+
+}  // namespace bangnet
@@ -0,0 +1,54 @@
+#ifndef BANGNET_UDP_DEVICE_H_
+#define BANGNET_UDP_DEVICE_H_
+
+#include "src/common.h"
+#include "src/frame_device.h"
+#include "src/inet_addr.h"
+
+namespace bangnet {
+
+// Ethernet frames carried one per datagram to a peer over a connected UDP
+// socket, the underlay between two bangnet hosts. Bursts take a single
+// recvmmsg/sendmmsg call.
+class UdpDevice : public FrameDevice {
+public:
+  // Binds local, port 0 for any, and sends to peer. Check IsOpen() for
+  // errors. mtu is the largest payload of the frames carried.
+  UdpDevice(const InetAddress& local, const InetAddress& peer,
+            unsigned int mtu);
+  ~UdpDevice();
+
+  string device_name() const { return name_; }
+  unsigned int mtu() const { return mtu_; }
+  bool SetMtu(unsigned int mtu) { mtu_ = mtu; return true; }
+  int fd() const { return fd_; }
+  bool IsOpen() const { return fd_ >= 0; }
+  void close();
+
+  // Port the socket is bound to.
+  unsigned int local_port() const { return port_; }
+
+  bool WriteFrame(const void* frame, unsigned int len);
+  unsigned int ReadFrame(void* buf, unsigned int cap);
+  int ReadBurst(FrameSlot* frames, int n);
+  int TryReadBurst(FrameSlot* frames, int n);
+  int WriteBurst(const FrameSlot* frames, int n);
+
+private:
+  // recvmmsg() with flags, returns the frames read or 0.
+  int RecvBurst(FrameSlot* frames, int n, int flags);
+
+  // Largest burst handled by one call.
+  static const int kMaxBurst = 64;
+
+  int fd_;
+  unsigned int mtu_;
+  unsigned int port_;
+  string name_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(UdpDevice);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_UDP_DEVICE_H_
@@ -0,0 +1,63 @@
+#include "src/udp_device.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+TEST(UdpDeviceTest, CarriesFramesToPeer) {
+  // Two devices on loopback, each sending to the other's port, and a third
+  // which is not the peer of either.
+  unsigned int port = 20000 + getpid() % 20000;
+  UdpDevice a(InetAddress("127.0.0.1", port),
+              InetAddress("127.0.0.1", port + 1), 1500);
+  ASSERT_TRUE(a.IsOpen());
+  EXPECT_EQ(port, a.local_port());
+  UdpDevice b(InetAddress("127.0.0.1", port + 1),
+              InetAddress("127.0.0.1", port), 1500);
+  ASSERT_TRUE(b.IsOpen());
+  UdpDevice c(InetAddress("127.0.0.1", 0),
+              InetAddress("127.0.0.1", port), 1500);
+  ASSERT_TRUE(c.IsOpen());
+
+  unsigned char frames[4][100];
+  FrameSlot slots[4];
+  for (int i = 0; i < 4; ++i) {
+    memset(frames[i], i, sizeof(frames[i]));
+    slots[i].data = frames[i];
+    slots[i].len = 60 + i;
+  }
+  // Those of c are not from a's peer, and refused.
+  c.WriteBurst(slots, 4);
+  EXPECT_EQ(4, b.WriteBurst(slots, 4));
+
+  unsigned char buf[4][2048];
+  for (int i = 0; i < 4; ++i) {
+    slots[i].data = buf[i];
+    slots[i].cap = sizeof(buf[i]);
+  }
+  EXPECT_EQ(4, a.ReadBurst(slots, 4));
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(60u + i, slots[i].len);
+    EXPECT_EQ(i, buf[i][59]);
+  }
+  EXPECT_EQ(0, a.TryReadBurst(slots, 4));
+  EXPECT_EQ(0, b.TryReadBurst(slots, 4));
+
+  unsigned char big[1600];
+  memset(big, 0, sizeof(big));
+  EXPECT_FALSE(b.WriteFrame(big, sizeof(big)));
+  EXPECT_TRUE(b.WriteFrame(big, 1514));
+  EXPECT_EQ(1514u, a.ReadFrame(buf[0], sizeof(buf[0])));
+}
+
+TEST(UdpDeviceTest, FailsOnMismatchedFamilies) {
+  UdpDevice dev(InetAddress("127.0.0.1", 0), InetAddress("::1", 9), 1500);
+  EXPECT_FALSE(dev.IsOpen());
+}
+
+}  // namespace
+}  // namespace bangnet
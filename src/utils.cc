@@ -1,5 +1,11 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
 #include "utils.h"
 
+#define IP_COMMAND "/sbin/ip"
+
 namespace bangnet {
 namespace utils {
 
@@ -23,5 +29,19 @@ namespace utils {
     return r;
   }
 
+  bool RunIp(const char* a0, const char* a1, const char* a2, const char* a3,
+             const char* a4, const char* a5, const char* a6, const char* a7) {
+    int cpid;
+    if ((cpid = fork()) == 0) {
+      execl(IP_COMMAND, IP_COMMAND, a0, a1, a2, a3, a4, a5, a6, a7,
+            (const char*)0);
+      exit(1);
+    }
+    int exit_code = 1;
+    if (cpid < 0 || waitpid(cpid, &exit_code, 0) < 0)
+      return false;
+    return exit_code == 0;
+  }
+
 }  // namespace utils
 }  // namespace bangnet
\ No newline at end of file
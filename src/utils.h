@@ -9,7 +9,14 @@ namespace bangnet {
     // Unhex a string, combine two chars to from a hex number. ignore
     // other chars.
     string unhex(const char* hex);
-    string unhex(const string& hex) { unhex(hex.c_str()); };
+    inline string unhex(const string& hex) { return unhex(hex.c_str()); }
+
+    // Runs the ip command with up to 8 arguments, like RunIp("addr", "add",
+    // "10.0.0.1/24", "dev", "tap0"). Returns true if it exited with 0.
+    bool RunIp(const char* a0, const char* a1, const char* a2,
+               const char* a3 = NULL, const char* a4 = NULL,
+               const char* a5 = NULL, const char* a6 = NULL,
+               const char* a7 = NULL);
 
   }  // namespace utils
 }  // namespace bangnet
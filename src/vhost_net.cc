@@ -0,0 +1,431 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+
+// The legacy ring helpers do not build as C++.
+#define VIRTIO_RING_NO_LEGACY
+#include <linux/vhost.h>
+#include <linux/virtio_ring.h>
+
+#include "src/vhost_net.h"
+
+namespace bangnet {
+
+namespace {
+
+const size_t kPage = 4096;
+
+// struct virtio_net_hdr, whose header does not build as C++. No offloads
+// are negotiated, so it is always zero.
+const unsigned int kVirtioNetHdrLen = 10;
+
+inline size_t RoundUp(size_t n, size_t to) {
+  return (n + to - 1) & ~(to - 1);
+}
+
+// Bytes of one queue's rings in the legacy layout, the used ring on a page
+// of its own after the descriptors and the available ring.
+inline size_t UsedOffset(unsigned int size) {
+  return RoundUp(sizeof(struct vring_desc) * size +
+                 sizeof(uint16_t) * (3 + size), kPage);
+}
+
+inline size_t QueueBytes(unsigned int size) {
+  return UsedOffset(size) +
+         RoundUp(sizeof(uint16_t) * 3 +
+                 sizeof(struct vring_used_elem) * size, kPage);
+}
+
+}  // namespace
+
+bool VhostNet::Available() {
+  return access("/dev/vhost-net", R_OK | W_OK) == 0;
+}
+
+VhostNet::VhostNet(TunTapDevice* tap, const VhostNetOptions& options)
+    : tap_(tap), fd_(-1), size_(options.ring_size), hdr_len_(0), arena_(0),
+      pool_(NULL) {
+  kick_fds_[0] = kick_fds_[1] = -1;
+  call_fds_[0] = call_fds_[1] = -1;
+  memset(queues_, 0, sizeof(queues_));
+
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "device=\"" + device_name() + "\",path=\"vhost\"";
+  metrics_.rx_frames = r->NewCounter("bangnet_vhost_rx_frames_total",
+      "Frames the vhost worker received into the receive queue.", labels);
+  metrics_.rx_bytes = r->NewCounter("bangnet_vhost_rx_bytes_total",
+      "Bytes the vhost worker received into the receive queue.", labels);
+  metrics_.tx_frames = r->NewCounter("bangnet_vhost_tx_frames_total",
+      "Frames posted to the transmit queue.", labels);
+  metrics_.tx_bytes = r->NewCounter("bangnet_vhost_tx_bytes_total",
+      "Bytes posted to the transmit queue.", labels);
+  metrics_.tx_drops = r->NewCounter("bangnet_vhost_tx_drops_total",
+      "Frames dropped on a full transmit queue or for their size.", labels);
+  metrics_.kicks = r->NewCounter("bangnet_vhost_kicks_total",
+      "Wakeups of the vhost worker.", labels);
+  metrics_.kicks_saved = r->NewCounter("bangnet_vhost_kicks_saved_total",
+      "Wakeups skipped because the worker was busy.", labels);
+
+  if (!Setup(options)) {
+    this->close();
+    return;
+  }
+  LOG(INFO) << "Device " << device_name() << " moved by vhost-net, "
+            << size_ << " descriptors per queue";
+}
+
+VhostNet::~VhostNet() {
+  this->close();
+  // The buffers posted to the queues go with the pool.
+  delete pool_;
+  MetricsRegistry::Instance()->RemoveLabeled(
+      "device=\"" + device_name() + "\",path=\"vhost\"");
+}
+
+bool VhostNet::Setup(const VhostNetOptions& options) {
+  if (size_ < 2 || size_ > 1024 || (size_ & (size_ - 1))) {
+    LOG(ERROR) << "Invalid vhost ring size " << size_;
+    return false;
+  }
+  fd_ = open("/dev/vhost-net", O_RDWR);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Unable to open /dev/vhost-net: " << strerror(errno);
+    return false;
+  }
+  if (ioctl(fd_, VHOST_SET_OWNER, NULL) < 0) {
+    LOG(ERROR) << "Unable to own vhost-net: " << strerror(errno);
+    return false;
+  }
+
+  // The worker adds and strips the virtio header itself, the tap carries
+  // bare frames.
+  uint64_t features = 0;
+  if (ioctl(fd_, VHOST_GET_FEATURES, &features) < 0 ||
+      !(features & (1ull << VHOST_NET_F_VIRTIO_NET_HDR))) {
+    LOG(ERROR) << "Unsupported vhost-net features";
+    return false;
+  }
+  features = 1ull << VHOST_NET_F_VIRTIO_NET_HDR;
+  if (ioctl(fd_, VHOST_SET_FEATURES, &features) < 0) {
+    LOG(ERROR) << "Unable to set vhost-net features: " << strerror(errno);
+    return false;
+  }
+  hdr_len_ = kVirtioNetHdrLen;
+
+  // Buffers for the receive queue, frames in flight on the transmit one
+  // and as many held by the caller.
+  pool_ = new BufferPool(tap_->max_frame_len(), 4 * size_,
+                         BufferPool::kDefaultHeadroom, &arena_);
+  unsigned char* rings = (unsigned char*)arena_.Allocate(
+      2 * QueueBytes(size_), kPage);
+
+  // The worker reads and writes our memory at the addresses of this
+  // process, so it is mapped one to one.
+  char table[sizeof(struct vhost_memory) +
+             2 * sizeof(struct vhost_memory_region)];
+  memset(table, 0, sizeof(table));
+  struct vhost_memory* mem = (struct vhost_memory*)table;
+  mem->nregions = 2;
+  mem->regions[0].guest_phys_addr = (uint64_t)pool_->memory();
+  mem->regions[0].userspace_addr = (uint64_t)pool_->memory();
+  mem->regions[0].memory_size = RoundUp(pool_->memory_len(), kPage);
+  mem->regions[1].guest_phys_addr = (uint64_t)rings;
+  mem->regions[1].userspace_addr = (uint64_t)rings;
+  mem->regions[1].memory_size = 2 * QueueBytes(size_);
+  if (ioctl(fd_, VHOST_SET_MEM_TABLE, mem) < 0) {
+    LOG(ERROR) << "Unable to set vhost memory: " << strerror(errno);
+    return false;
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    Queue* q = &queues_[i];
+    unsigned char* base = rings + i * QueueBytes(size_);
+    q->desc = (struct vring_desc*)base;
+    q->avail = (struct vring_avail*)(base + sizeof(struct vring_desc) * size_);
+    q->used = (struct vring_used*)(base + UsedOffset(size_));
+    q->buffers = arena_.NewArray<Buffer*>(size_);
+    q->free = arena_.NewArray<uint16_t>(size_);
+    if (!SetupQueue(i, options))
+      return false;
+  }
+
+  // The receive queue starts out full of buffers. Sent frames are reaped
+  // when sending more, so the worker need not signal them.
+  for (unsigned int id = 0; id < size_; ++id)
+    PostRx(id, pool_->Get());
+  __atomic_store_n(&queues_[kRxQueue].avail->idx,
+                   queues_[kRxQueue].avail_idx, __ATOMIC_RELEASE);
+  Queue* tx = &queues_[kTxQueue];
+  tx->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+  for (unsigned int id = 0; id < size_; ++id)
+    tx->free[tx->nfree++] = (uint16_t)(size_ - 1 - id);
+
+  for (int i = 0; i < 2; ++i) {
+    struct vhost_vring_file backend;
+    backend.index = i;
+    backend.fd = tap_->fd();
+    if (ioctl(fd_, VHOST_NET_SET_BACKEND, &backend) < 0) {
+      LOG(ERROR) << "Unable to hand " << device_name()
+                 << " to vhost-net: " << strerror(errno);
+      return false;
+    }
+  }
+  Kick(kRxQueue);
+  return true;
+}
+
+bool VhostNet::SetupQueue(int index, const VhostNetOptions& options) {
+  Queue* q = &queues_[index];
+  kick_fds_[index] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  call_fds_[index] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (kick_fds_[index] < 0 || call_fds_[index] < 0) {
+    LOG(ERROR) << "Unable to create eventfds: " << strerror(errno);
+    return false;
+  }
+
+  struct vhost_vring_state state;
+  state.index = index;
+  state.num = size_;
+  struct vhost_vring_state base;
+  base.index = index;
+  base.num = 0;
+  struct vhost_vring_addr addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.index = index;
+  addr.desc_user_addr = (uint64_t)q->desc;
+  addr.avail_user_addr = (uint64_t)q->avail;
+  addr.used_user_addr = (uint64_t)q->used;
+  struct vhost_vring_file kick;
+  kick.index = index;
+  kick.fd = kick_fds_[index];
+  struct vhost_vring_file call;
+  call.index = index;
+  call.fd = call_fds_[index];
+  if (ioctl(fd_, VHOST_SET_VRING_NUM, &state) < 0 ||
+      ioctl(fd_, VHOST_SET_VRING_BASE, &base) < 0 ||
+      ioctl(fd_, VHOST_SET_VRING_ADDR, &addr) < 0 ||
+      ioctl(fd_, VHOST_SET_VRING_KICK, &kick) < 0 ||
+      ioctl(fd_, VHOST_SET_VRING_CALL, &call) < 0) {
+    LOG(ERROR) << "Unable to set up vhost queue " << index << ": "
+               << strerror(errno);
+    return false;
+  }
+
+  if (options.busyloop_us) {
+    struct vhost_vring_state busyloop;
+    busyloop.index = index;
+    busyloop.num = options.busyloop_us;
+    if (ioctl(fd_, VHOST_SET_VRING_BUSYLOOP_TIMEOUT, &busyloop) < 0)
+      LOG(WARNING) << "No vhost busy polling: " << strerror(errno);
+  }
+  return true;
+}
+
+void VhostNet::close() {
+  if (fd_ >= 0) {
+    // Takes the tap back from the worker.
+    for (int i = 0; i < 2; ++i) {
+      struct vhost_vring_file backend;
+      backend.index = i;
+      backend.fd = -1;
+      ioctl(fd_, VHOST_NET_SET_BACKEND, &backend);
+    }
+    ::close(fd_);
+    fd_ = -1;
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (kick_fds_[i] >= 0)
+      ::close(kick_fds_[i]);
+    if (call_fds_[i] >= 0)
+      ::close(call_fds_[i]);
+    kick_fds_[i] = call_fds_[i] = -1;
+  }
+}
+
+void VhostNet::PostRx(uint16_t id, Buffer* b) {
+  Queue* q = &queues_[kRxQueue];
+  b->Reset();
+  // The worker writes the header into the headroom, the frame at data().
+  struct vring_desc* d = &q->desc[id];
+  d->addr = (uint64_t)(b->data() - hdr_len_);
+  d->len = hdr_len_ + b->capacity();
+  d->flags = VRING_DESC_F_WRITE;
+  d->next = 0;
+  q->buffers[id] = b;
+  q->avail->ring[q->avail_idx++ & (size_ - 1)] = id;
+}
+
+uint16_t VhostNet::Ready(Queue* q) {
+  return (uint16_t)(__atomic_load_n(&q->used->idx, __ATOMIC_ACQUIRE) -
+                    q->used_idx);
+}
+
+void VhostNet::Kick(int index) {
+  // The worker sets no notify while it runs, and reads the new
+  // descriptors anyway.
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&queues_[index].used->flags, __ATOMIC_RELAXED) &
+      VRING_USED_F_NO_NOTIFY) {
+    metrics_.kicks_saved->Increment();
+    return;
+  }
+  uint64_t one = 1;
+  if (write(kick_fds_[index], &one, sizeof(one)) == sizeof(one))
+    metrics_.kicks->Increment();
+}
+
+void VhostNet::Complete() {
+  Queue* q = &queues_[kTxQueue];
+  uint16_t n = Ready(q);
+  for (uint16_t i = 0; i < n; ++i) {
+    uint16_t id = (uint16_t)q->used->ring[q->used_idx++ & (size_ - 1)].id;
+    q->buffers[id]->Unref();
+    q->buffers[id] = NULL;
+    q->free[q->nfree++] = id;
+  }
+}
+
+bool VhostNet::ClearCall() {
+  uint64_t count;
+  if (read(call_fds_[kRxQueue], &count, sizeof(count)) < 0 &&
+      errno != EAGAIN) {
+    return false;
+  }
+  // Frames used before the read signalled, those after signal again.
+  return Ready(&queues_[kRxQueue]) > 0;
+}
+
+bool VhostNet::Wait(int timeout_ms) {
+  while (fd_ >= 0 && !Ready(&queues_[kRxQueue])) {
+    struct pollfd pfd;
+    pfd.fd = call_fds_[kRxQueue];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int r = poll(&pfd, 1, timeout_ms);
+    if (r == 0 || (r < 0 && errno != EINTR))
+      return false;
+    if (r > 0)
+      ClearCall();
+  }
+  return fd_ >= 0;
+}
+
+int VhostNet::ReadBuffers(Buffer** buffers, int n) {
+  if (fd_ < 0 || n <= 0)
+    return 0;
+  Queue* q = &queues_[kRxQueue];
+  uint16_t ready = Ready(q);
+  if (!ready && ClearCall())
+    ready = Ready(q);
+  int got = 0;
+  uint64_t bytes = 0;
+  while (got < n && got < ready) {
+    const struct vring_used_elem& e = q->used->ring[q->used_idx & (size_ - 1)];
+    // Each descriptor taken needs a buffer in its place.
+    Buffer* fresh = pool_->Get();
+    if (!fresh)
+      break;
+    Buffer* b = q->buffers[e.id];
+    b->set_len(e.len - hdr_len_);
+    bytes += b->len();
+    buffers[got++] = b;
+    PostRx((uint16_t)e.id, fresh);
+    q->used_idx++;
+  }
+  if (got) {
+    __atomic_store_n(&q->avail->idx, q->avail_idx, __ATOMIC_RELEASE);
+    Kick(kRxQueue);
+    metrics_.rx_frames->Add(got);
+    metrics_.rx_bytes->Add(bytes);
+  }
+  return got;
+}
+
+int VhostNet::TryReadBurst(FrameSlot* frames, int n) {
+  if (fd_ < 0 || n <= 0)
+    return 0;
+  Queue* q = &queues_[kRxQueue];
+  uint16_t ready = Ready(q);
+  if (!ready && ClearCall())
+    ready = Ready(q);
+  int got = 0;
+  uint64_t bytes = 0;
+  while (got < n && got < ready) {
+    const struct vring_used_elem& e = q->used->ring[q->used_idx++ &
+                                                    (size_ - 1)];
+    Buffer* b = q->buffers[e.id];
+    unsigned int len = e.len - hdr_len_;
+    // Frames larger than the slot are truncated, like a short read.
+    if (len > frames[got].cap)
+      len = frames[got].cap;
+    memcpy(frames[got].data, b->data(), len);
+    frames[got].len = len;
+    bytes += len;
+    ++got;
+    // The buffer goes straight back to the worker.
+    PostRx((uint16_t)e.id, b);
+  }
+  if (got) {
+    __atomic_store_n(&q->avail->idx, q->avail_idx, __ATOMIC_RELEASE);
+    Kick(kRxQueue);
+    metrics_.rx_frames->Add(got);
+    metrics_.rx_bytes->Add(bytes);
+  }
+  return got;
+}
+
+int VhostNet::WriteBuffers(Buffer** buffers, int n) {
+  if (fd_ < 0 || n <= 0) {
+    for (int i = 0; i < n; ++i)
+      buffers[i]->Unref();
+    return 0;
+  }
+  Complete();
+  Queue* q = &queues_[kTxQueue];
+  int sent = 0;
+  uint64_t bytes = 0;
+  for (int i = 0; i < n; ++i) {
+    Buffer* b = buffers[i];
+    if (!q->nfree || b->len() > tap_->max_frame_len()) {
+      metrics_.tx_drops->Increment();
+      b->Unref();
+      continue;
+    }
+    // The worker can only reach our pool, and needs room for the header.
+    if (b->pool() != pool_ || b->headroom() < hdr_len_) {
+      Buffer* copy = pool_->Get();
+      if (!copy) {
+        metrics_.tx_drops->Increment();
+        b->Unref();
+        continue;
+      }
+      memcpy(copy->data(), b->data(), b->len());
+      copy->set_len(b->len());
+      b->Unref();
+      b = copy;
+    }
+    memset(b->data() - hdr_len_, 0, hdr_len_);
+    uint16_t id = q->free[--q->nfree];
+    struct vring_desc* d = &q->desc[id];
+    d->addr = (uint64_t)(b->data() - hdr_len_);
+    d->len = hdr_len_ + b->len();
+    d->flags = 0;
+    d->next = 0;
+    q->buffers[id] = b;
+    q->avail->ring[q->avail_idx++ & (size_ - 1)] = id;
+    bytes += b->len();
+    ++sent;
+  }
+  if (sent) {
+    __atomic_store_n(&q->avail->idx, q->avail_idx, __ATOMIC_RELEASE);
+    Kick(kTxQueue);
+    metrics_.tx_frames->Add(sent);
+    metrics_.tx_bytes->Add(bytes);
+  }
+  return sent;
+}
+
+}  // namespace bangnet
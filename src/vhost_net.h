@@ -0,0 +1,129 @@
+#ifndef BANGNET_VHOST_NET_H_
+#define BANGNET_VHOST_NET_H_
+
+#include <stdint.h>
+
+#include "src/arena.h"
+#include "src/buffer_device.h"
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/metrics.h"
+#include "src/tun_tap.h"
+
+struct vring_desc;
+struct vring_avail;
+struct vring_used;
+
+namespace bangnet {
+
+struct VhostNetOptions {
+  VhostNetOptions() : ring_size(256), busyloop_us(0) {}
+
+  // Descriptors of the receive and the transmit queue, a power of 2 of up
+  // to 1024.
+  unsigned int ring_size;
+
+  // Microseconds the vhost worker polls a queue for more work before it
+  // sleeps, 0 to sleep right away.
+  unsigned int busyloop_us;
+};
+
+// Frames of a tap moved by the kernel's vhost-net worker, the path of a
+// virtual machine's network card. The tap's descriptor is handed to
+// /dev/vhost-net, which copies frames between the tap and two virtqueues,
+// rings in our memory: received frames show up in buffers posted to the
+// receive queue and frames to send are posted to the transmit queue, with
+// no system call per frame. The worker is woken once per burst, and not
+// even that while it is busy. The tap must not be read or written while
+// the device is open.
+class VhostNet : public BufferDevice {
+public:
+  // Attaches to tap, check IsOpen() for errors. The tap must outlive the
+  // device.
+  VhostNet(TunTapDevice* tap, const VhostNetOptions& options);
+  ~VhostNet();
+
+  // True if the host has vhost-net.
+  static bool Available();
+
+  string device_name() const { return tap_->device_name(); }
+  unsigned int mtu() const { return tap_->mtu(); }
+  unsigned int header_len() const { return tap_->header_len(); }
+  // Polls readable when the worker received frames.
+  int fd() const { return call_fds_[kRxQueue]; }
+  bool IsOpen() const { return fd_ >= 0; }
+  void close();
+
+  int TryReadBurst(FrameSlot* frames, int n);
+  int ReadBuffers(Buffer** buffers, int n);
+
+  // Frames with less headroom than the virtio header are copied too.
+  int WriteBuffers(Buffer** buffers, int n);
+
+  // Buffers the worker receives into and sends from.
+  BufferPool* pool() const { return pool_; }
+
+private:
+  static const int kRxQueue = 0;
+  static const int kTxQueue = 1;
+
+  // A split virtqueue and our side of it.
+  struct Queue {
+    struct vring_desc* desc;
+    struct vring_avail* avail;
+    struct vring_used* used;
+    // Buffer of each descriptor.
+    Buffer** buffers;
+    // Transmit descriptors not in use.
+    uint16_t* free;
+    unsigned int nfree;
+    uint16_t avail_idx;
+    uint16_t used_idx;
+  };
+
+  bool Setup(const VhostNetOptions& options);
+  bool SetupQueue(int index, const VhostNetOptions& options);
+
+  // Posts b to the receive queue as descriptor id.
+  void PostRx(uint16_t id, Buffer* b);
+  // Received frames waiting in the used ring.
+  uint16_t Ready(Queue* q);
+  // Tells the worker about new descriptors, unless it is polling anyway.
+  void Kick(int index);
+  // Returns sent buffers to the pool.
+  void Complete();
+
+  bool Wait(int timeout_ms);
+  void CountTxDrops(uint64_t n) { metrics_.tx_drops->Add(n); }
+
+  // Clears the receive notification, true if frames came meanwhile.
+  bool ClearCall();
+
+  TunTapDevice* tap_;
+  int fd_;
+  int kick_fds_[2];
+  int call_fds_[2];
+  unsigned int size_;
+  // Bytes of the virtio header in front of each frame.
+  unsigned int hdr_len_;
+
+  Arena arena_;
+  BufferPool* pool_;
+  Queue queues_[2];
+
+  struct Metrics {
+    Counter* rx_frames;
+    Counter* rx_bytes;
+    Counter* tx_frames;
+    Counter* tx_bytes;
+    Counter* tx_drops;
+    Counter* kicks;
+    Counter* kicks_saved;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(VhostNet);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_VHOST_NET_H_
@@ -0,0 +1,102 @@
+#include "src/vhost_net.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "src/tap.h"
+
+namespace bangnet {
+namespace {
+
+// IPv4 from 10.0.0.1 to 10.0.0.2, with its header checksum.
+void MakeFrame(unsigned char* frame, unsigned int len, unsigned char id) {
+  memset(frame, 0, len);
+  memset(frame, 0xff, 6);
+  frame[6] = 0x02;
+  frame[12] = 0x08;
+  frame[14] = 0x45;
+  frame[16] = (len - 14) >> 8;
+  frame[17] = (len - 14) & 0xff;
+  frame[18] = id;
+  frame[22] = 64;
+  frame[23] = 253;
+  frame[26] = 10;
+  frame[29] = 1;
+  frame[30] = 10;
+  frame[33] = 2;
+  uint32_t sum = 0;
+  for (int i = 14; i < 34; i += 2)
+    sum += (frame[i] << 8) | frame[i + 1];
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  frame[24] = ~sum >> 8;
+  frame[25] = ~sum & 0xff;
+}
+
+const unsigned char kMac[6] = {0x02, 0x62, 0x67, 0, 0, 0x0c};
+
+bool Skip() {
+  if (geteuid() != 0 || !VhostNet::Available()) {
+    printf("skipped, needs root and /dev/vhost-net\n");
+    return true;
+  }
+  return false;
+}
+
+TEST(VhostNetTest, FailsOnBadRingSize) {
+  if (Skip())
+    return;
+  Tap tap((MacAddress(kMac)));
+  ASSERT_TRUE(tap.IsOpen());
+  VhostNetOptions options;
+  options.ring_size = 100;
+  VhostNet dev(&tap, options);
+  EXPECT_FALSE(dev.IsOpen());
+}
+
+TEST(VhostNetTest, SendsAndReceivesThroughTap) {
+  if (Skip())
+    return;
+  Tap tap((MacAddress(kMac)));
+  ASSERT_TRUE(tap.IsOpen());
+  VhostNetOptions options;
+  options.ring_size = 64;
+  VhostNet dev(&tap, options);
+  ASSERT_TRUE(dev.IsOpen());
+  EXPECT_EQ(tap.device_name(), dev.device_name());
+
+  // Frames sent are taken by the kernel, more than the queue holds so
+  // descriptors are reused.
+  unsigned char frame[98];
+  for (int i = 0; i < 200; ++i) {
+    MakeFrame(frame, sizeof(frame), (unsigned char)i);
+    EXPECT_TRUE(dev.WriteFrame(frame, sizeof(frame)));
+    if (i % 32 == 31)
+      usleep(1000);
+  }
+
+  // The kernel sends the tap frames of its own once it is up, like
+  // router solicitations, which arrive in pool buffers.
+  BufferPool* pool = dev.pool();
+  Buffer* buffers[8];
+  int n = 0;
+  struct pollfd pfd;
+  pfd.fd = dev.fd();
+  pfd.events = POLLIN;
+  for (int tries = 0; !n && tries < 50; ++tries) {
+    poll(&pfd, 1, 100);
+    n = dev.ReadBuffers(buffers, 8);
+  }
+  if (n) {
+    EXPECT_EQ(pool, buffers[0]->pool());
+    EXPECT_GE(buffers[0]->len(), 14u);
+    for (int i = 0; i < n; ++i)
+      buffers[i]->Unref();
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
@@ -0,0 +1,106 @@
+#ifndef BANGNET_VLAN_H_
+#define BANGNET_VLAN_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "src/buffer_pool.h"
+
+namespace bangnet {
+
+// 802.1Q customer tags, and the 802.1ad service tags QinQ stacks on them.
+const uint16_t kEtherTypeVlan = 0x8100;
+const uint16_t kEtherTypeQinQ = 0x88a8;
+// Pre 802.1ad QinQ, still used by some switches.
+const uint16_t kEtherTypeQinQLegacy = 0x9100;
+
+// Max tags parsed, a service tag and a customer tag.
+const int kMaxVlanTags = 2;
+
+inline bool IsVlanTpid(uint16_t type) {
+  return type == kEtherTypeVlan || type == kEtherTypeQinQ ||
+         type == kEtherTypeQinQLegacy;
+}
+
+// The tags and ethertype of an ethernet frame.
+struct EthernetTags {
+  // Tags in wire order, the outer one first.
+  int count;
+  uint16_t tpid[kMaxVlanTags];
+  uint16_t tci[kMaxVlanTags];
+
+  // Ethertype of the payload, after the tags.
+  uint16_t ethertype;
+
+  // Offset of the payload.
+  unsigned int payload_offset;
+
+  // Vlan id of the outer tag, 0 if untagged or priority tagged.
+  uint16_t vlan() const { return count ? tci[0] & 0xfff : 0; }
+};
+
+// Parses the tags of a frame. Returns false if it is truncated or has more
+// than kMaxVlanTags tags.
+inline bool ParseEthernet(const unsigned char* frame, unsigned int len,
+                          EthernetTags* tags) {
+  unsigned int off = 12;
+  tags->count = 0;
+  for (;;) {
+    if (len < off + 2)
+      return false;
+    uint16_t type = (uint16_t)((frame[off] << 8) | frame[off + 1]);
+    if (!IsVlanTpid(type)) {
+      tags->ethertype = type;
+      tags->payload_offset = off + 2;
+      return true;
+    }
+    if (tags->count == kMaxVlanTags || len < off + 4)
+      return false;
+    tags->tpid[tags->count] = type;
+    tags->tci[tags->count] =
+        (uint16_t)((frame[off + 2] << 8) | frame[off + 3]);
+    ++tags->count;
+    off += 4;
+  }
+}
+
+// Tags and untags frames in place: only the 12 bytes of mac addresses move,
+// into the 4 bytes in front of the frame or over the outer tag.
+
+// Inserts an outer tag, frame must have 4 bytes of room in front. Returns
+// the new start of the frame.
+inline unsigned char* PushVlanTag(unsigned char* frame, uint16_t tpid,
+                                  uint16_t tci) {
+  unsigned char* f = frame - 4;
+  memmove(f, frame, 12);
+  f[12] = (unsigned char)(tpid >> 8);
+  f[13] = (unsigned char)tpid;
+  f[14] = (unsigned char)(tci >> 8);
+  f[15] = (unsigned char)tci;
+  return f;
+}
+
+// Removes the outer tag, returns the new start of the frame.
+inline unsigned char* PopVlanTag(unsigned char* frame) {
+  memmove(frame + 4, frame, 12);
+  return frame + 4;
+}
+
+// Same for frames in pool buffers, using their headroom. Returns false if
+// there is none left.
+inline bool PushVlanTag(Buffer* b, uint16_t tpid, uint16_t tci) {
+  if (b->headroom() < 4)
+    return false;
+  PushVlanTag(b->data(), tpid, tci);
+  b->Push(4);
+  return true;
+}
+
+inline void PopVlanTag(Buffer* b) {
+  PopVlanTag(b->data());
+  b->Pull(4);
+}
+
+}  // namespace bangnet
+
+#endif  // BANGNET_VLAN_H_
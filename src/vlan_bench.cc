@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "src/bench.h"
+#include "src/clock.h"
+#include "src/vlan.h"
+
+namespace bangnet {
+namespace {
+
+// Parses frames carrying ntags tags, then pops and pushes their outer tag
+// back, as a switch between a trunk and an access port does. Frames live in
+// a ring of 256 buffers so the parse reads memory, not registers.
+BenchResult RunVlanBench(int ntags, unsigned int frame_size,
+                         uint64_t duration_ms) {
+  static const int kFrames = 256;
+  static const uint16_t kTpids[] = {kEtherTypeQinQ, kEtherTypeVlan};
+  BufferPool pool(frame_size, kFrames, 8);
+  Buffer* bufs[kFrames];
+  for (int i = 0; i < kFrames; ++i) {
+    bufs[i] = pool.Get();
+    unsigned char* d = bufs[i]->data();
+    memset(d, 0, frame_size);
+    memset(d, 0x0c, 6);
+    memset(d + 6, 0x0a, 6);
+    d[12] = 0x08;
+    d[13] = 0x00;
+    bufs[i]->set_len(frame_size - 4 * ntags);
+    for (int t = ntags - 1; t >= 0; --t)
+      PushVlanTag(bufs[i], kTpids[2 - ntags + t], (uint16_t)(i + t + 1));
+  }
+
+  StageClock stages;
+  int parse_stage = stages.AddStage("parse");
+  int tag_stage = stages.AddStage("pop-push");
+
+  BenchResult result;
+  char name[64];
+  static const char* kNames[] = {"untagged", "802.1q", "qinq"};
+  snprintf(name, sizeof(name), "vlan/%s/%uB", kNames[ntags], frame_size);
+  result.name = name;
+  uint64_t payload = 0;
+  uint64_t start = MonotonicNs();
+  uint64_t end = start + duration_ms * 1000000ull;
+  uint64_t now = start;
+
+  while (now < end) {
+    uint16_t vlans[kFrames];
+    uint64_t c0 = CycleCount();
+    for (int i = 0; i < kFrames; ++i) {
+      EthernetTags tags;
+      if (!ParseEthernet(bufs[i]->data(), bufs[i]->len(), &tags))
+        LOG(FATAL) << "unparsable frame";
+      vlans[i] = tags.count ? tags.tci[0] : 0;
+      payload += tags.payload_offset;
+    }
+    uint64_t c1 = CycleCount();
+    if (ntags) {
+      for (int i = 0; i < kFrames; ++i) {
+        PopVlanTag(bufs[i]);
+        PushVlanTag(bufs[i], kTpids[2 - ntags], vlans[i]);
+      }
+    }
+    uint64_t c2 = CycleCount();
+    stages.Add(parse_stage, c1 - c0);
+    stages.Add(tag_stage, c2 - c1);
+    result.packets += kFrames;
+    result.bytes += (uint64_t)kFrames * frame_size;
+    now = MonotonicNs();
+  }
+
+  result.seconds = (now - start) / 1e9;
+  stages.Fill(&result);
+  result.AddExtra("payload_offset", (double)payload / result.packets);
+  for (int i = 0; i < kFrames; ++i)
+    bufs[i]->Unref();
+  return result;
+}
+
+BENCHMARK(VlanParse) {
+  for (size_t i = 0; i < options.frame_sizes.size(); ++i) {
+    unsigned int size = options.frame_sizes[i];
+    if (size < 64)
+      continue;
+    for (int ntags = 0; ntags <= kMaxVlanTags; ++ntags)
+      results->push_back(RunVlanBench(ntags, size, options.duration_ms));
+  }
+}
+
+}  // namespace
+}  // namespace bangnet
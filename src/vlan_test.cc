@@ -0,0 +1,102 @@
+#include "src/vlan.h"
+
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+namespace bangnet {
+namespace {
+
+// An ipv4 frame from mac 0x0a to 0x0c, with room for 3 tags in front.
+class VlanTest : public ::testing::Test {
+protected:
+  VlanTest() {
+    memset(buf_, 0, sizeof(buf_));
+    frame_ = buf_ + 12;
+    memset(frame_, 0x0c, 6);
+    memset(frame_ + 6, 0x0a, 6);
+    frame_[12] = 0x08;
+    frame_[13] = 0x00;
+    frame_[14] = 0x45;
+    len_ = 60;
+  }
+
+  unsigned char buf_[128];
+  unsigned char* frame_;
+  unsigned int len_;
+};
+
+TEST_F(VlanTest, ParsesUntagged) {
+  EthernetTags tags;
+  ASSERT_TRUE(ParseEthernet(frame_, len_, &tags));
+  EXPECT_EQ(0, tags.count);
+  EXPECT_EQ(0x0800, tags.ethertype);
+  EXPECT_EQ(14u, tags.payload_offset);
+  EXPECT_EQ(0, tags.vlan());
+}
+
+TEST_F(VlanTest, PushesAndParsesQinQ) {
+  unsigned char* f = PushVlanTag(frame_, kEtherTypeVlan, 0x2007);
+  f = PushVlanTag(f, kEtherTypeQinQ, 100);
+  EXPECT_EQ(frame_ - 8, f);
+
+  EthernetTags tags;
+  ASSERT_TRUE(ParseEthernet(f, len_ + 8, &tags));
+  ASSERT_EQ(2, tags.count);
+  EXPECT_EQ(kEtherTypeQinQ, tags.tpid[0]);
+  EXPECT_EQ(100, tags.tci[0]);
+  EXPECT_EQ(kEtherTypeVlan, tags.tpid[1]);
+  EXPECT_EQ(0x2007, tags.tci[1]);
+  EXPECT_EQ(100, tags.vlan());
+  EXPECT_EQ(0x0800, tags.ethertype);
+  EXPECT_EQ(22u, tags.payload_offset);
+  EXPECT_EQ(0x0c, f[0]);
+  EXPECT_EQ(0x0a, f[11]);
+
+  f = PopVlanTag(f);
+  ASSERT_TRUE(ParseEthernet(f, len_ + 4, &tags));
+  EXPECT_EQ(1, tags.count);
+  EXPECT_EQ(7, tags.vlan());
+  f = PopVlanTag(f);
+  EXPECT_EQ(frame_, f);
+  ASSERT_TRUE(ParseEthernet(f, len_, &tags));
+  EXPECT_EQ(0, tags.count);
+  EXPECT_EQ(0x0a, f[6]);
+}
+
+TEST_F(VlanTest, RejectsMalformed) {
+  EthernetTags tags;
+  EXPECT_FALSE(ParseEthernet(frame_, 13, &tags));
+
+  unsigned char* f = PushVlanTag(frame_, kEtherTypeVlan, 5);
+  EXPECT_FALSE(ParseEthernet(f, 15, &tags));
+  EXPECT_FALSE(ParseEthernet(f, 17, &tags));
+
+  // More tags than parsed.
+  f = PushVlanTag(f, kEtherTypeQinQLegacy, 6);
+  f = PushVlanTag(f, kEtherTypeQinQ, 7);
+  EXPECT_FALSE(ParseEthernet(f, len_ + 12, &tags));
+}
+
+TEST_F(VlanTest, TagsBuffers) {
+  BufferPool pool(128, 1, 4);
+  Buffer* b = pool.Get();
+  memcpy(b->data(), frame_, len_);
+  b->set_len(len_);
+
+  ASSERT_TRUE(PushVlanTag(b, kEtherTypeVlan, 9));
+  EXPECT_EQ(len_ + 4, b->len());
+  EthernetTags tags;
+  ASSERT_TRUE(ParseEthernet(b->data(), b->len(), &tags));
+  EXPECT_EQ(9, tags.vlan());
+  // The headroom is used up.
+  EXPECT_FALSE(PushVlanTag(b, kEtherTypeQinQ, 9));
+
+  PopVlanTag(b);
+  EXPECT_EQ(len_, b->len());
+  EXPECT_EQ(0, memcmp(b->data(), frame_, len_));
+  b->Unref();
+}
+
+}  // namespace
+}  // namespace bangnet
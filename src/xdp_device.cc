@@ -0,0 +1,514 @@
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+
+#include "src/xdp_device.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace bangnet {
+
+namespace {
+
+inline int Bpf(int cmd, union bpf_attr* attr) {
+  return (int)syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+inline struct bpf_insn Insn(uint8_t code, uint8_t dst, uint8_t src,
+                            int16_t off, int32_t imm) {
+  struct bpf_insn insn;
+  memset(&insn, 0, sizeof(insn));
+  insn.code = code;
+  insn.dst_reg = dst;
+  insn.src_reg = src;
+  insn.off = off;
+  insn.imm = imm;
+  return insn;
+}
+
+inline bool IsPowerOf2(unsigned int n) {
+  return n && !(n & (n - 1));
+}
+
+}  // namespace
+
+XdpDevice::XdpDevice(const string& ifname, const XdpDeviceOptions& options)
+    : ifname_(ifname), mtu_(0), fd_(-1), map_fd_(-1), prog_fd_(-1),
+      link_fd_(-1), native_(false), zero_copy_(false), pool_(NULL),
+      peeked_(0) {
+  RegisterMetrics();
+  if (!Setup(options)) {
+    this->close();
+    return;
+  }
+  LOG(INFO) << "Device " << device_name() << " attached to queue "
+            << options.queue << (native_ ? ", native" : ", generic")
+            << (zero_copy_ ? " zero copy" : " copy") << " mode";
+}
+
+XdpDevice::~XdpDevice() {
+  this->close();
+  delete pool_;
+  MetricsRegistry::Instance()->RemoveLabeled(
+      "device=\"" + device_name() + "\"");
+}
+
+void XdpDevice::RegisterMetrics() {
+  MetricsRegistry* r = MetricsRegistry::Instance();
+  string labels = "device=\"" + device_name() + "\"";
+  metrics_.rx_frames = r->NewCounter("bangnet_xdp_rx_frames_total",
+      "Frames read from the receive ring.", labels);
+  metrics_.rx_bytes = r->NewCounter("bangnet_xdp_rx_bytes_total",
+      "Bytes read from the receive ring.", labels);
+  metrics_.rx_empty = r->NewCounter("bangnet_xdp_rx_empty_total",
+      "Times the fill ring ran out of buffers to receive into.", labels);
+  metrics_.tx_frames = r->NewCounter("bangnet_xdp_tx_frames_total",
+      "Frames queued in the transmit ring.", labels);
+  metrics_.tx_bytes = r->NewCounter("bangnet_xdp_tx_bytes_total",
+      "Bytes queued in the transmit ring.", labels);
+  metrics_.tx_drops = r->NewCounter("bangnet_xdp_tx_drops_total",
+      "Frames dropped on a full transmit ring or for their size.", labels);
+  metrics_.tx_copies = r->NewCounter("bangnet_xdp_tx_copies_total",
+      "Frames copied into the shared memory to be sent.", labels);
+  metrics_.kicks = r->NewCounter("bangnet_xdp_kicks_total",
+      "System calls waking the kernel to send or receive.", labels);
+}
+
+bool XdpDevice::Setup(const XdpDeviceOptions& options) {
+  if ((options.frame_size != 2048 && options.frame_size != 4096) ||
+      !options.frames || !IsPowerOf2(options.ring_size) ||
+      options.frames < 2 * options.ring_size) {
+    LOG(ERROR) << "Invalid frame memory or ring sizes for " << ifname_;
+    return false;
+  }
+  unsigned int ifindex = if_nametoindex(ifname_.c_str());
+  if (!ifindex) {
+    LOG(ERROR) << "No interface " << ifname_;
+    return false;
+  }
+
+  int sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0) {
+    LOG(ERROR) << "Unable to open socket";
+    return false;
+  }
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, ifname_.c_str(), IFNAMSIZ - 1);
+  int r = ioctl(sock, SIOCGIFMTU, &ifr);
+  ::close(sock);
+  if (r < 0) {
+    LOG(ERROR) << "Unable to get mtu of " << ifname_;
+    return false;
+  }
+  mtu_ = ifr.ifr_mtu;
+  if (mtu_ + header_len() > options.frame_size - XDP_PACKET_HEADROOM) {
+    LOG(ERROR) << "Mtu " << mtu_ << " of " << ifname_
+               << " does not fit frames of " << options.frame_size;
+    return false;
+  }
+
+  // The pool's buffers are the chunks of the shared memory, their headroom
+  // where the kernel leaves room in front of received frames.
+  pool_ = new BufferPool(options.frame_size - XDP_PACKET_HEADROOM,
+                         options.frames, XDP_PACKET_HEADROOM);
+  CHECK_EQ(options.frame_size, pool_->stride());
+
+  fd_ = socket(AF_XDP, SOCK_RAW, 0);
+  if (fd_ < 0) {
+    LOG(ERROR) << "Unable to open xdp socket: " << strerror(errno);
+    return false;
+  }
+
+  struct xdp_umem_reg umem;
+  memset(&umem, 0, sizeof(umem));
+  umem.addr = (uint64_t)pool_->memory();
+  umem.len = pool_->memory_len();
+  umem.chunk_size = options.frame_size;
+  if (setsockopt(fd_, SOL_XDP, XDP_UMEM_REG, &umem, sizeof(umem)) < 0) {
+    LOG(ERROR) << "Unable to register frame memory: " << strerror(errno);
+    return false;
+  }
+
+  struct xdp_mmap_offsets off;
+  socklen_t len = sizeof(off);
+  int size = options.ring_size;
+  if (setsockopt(fd_, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(fd_, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size,
+                 sizeof(size)) < 0 ||
+      setsockopt(fd_, SOL_XDP, XDP_RX_RING, &size, sizeof(size)) < 0 ||
+      setsockopt(fd_, SOL_XDP, XDP_TX_RING, &size, sizeof(size)) < 0 ||
+      getsockopt(fd_, SOL_XDP, XDP_MMAP_OFFSETS, &off, &len) < 0) {
+    LOG(ERROR) << "Unable to set up rings: " << strerror(errno);
+    return false;
+  }
+  if (!MapRing(&fill_, options.ring_size, XDP_UMEM_PGOFF_FILL_RING, off.fr,
+               sizeof(uint64_t)) ||
+      !MapRing(&completion_, options.ring_size,
+               XDP_UMEM_PGOFF_COMPLETION_RING, off.cr, sizeof(uint64_t)) ||
+      !MapRing(&rx_, options.ring_size, XDP_PGOFF_RX_RING, off.rx,
+               sizeof(struct xdp_desc)) ||
+      !MapRing(&tx_, options.ring_size, XDP_PGOFF_TX_RING, off.tx,
+               sizeof(struct xdp_desc))) {
+    LOG(ERROR) << "Unable to map rings: " << strerror(errno);
+    return false;
+  }
+  // Our indexes into the kernel's, which may not start at 0.
+  fill_.cached = *fill_.producer;
+  completion_.cached = *completion_.consumer;
+  rx_.cached = *rx_.consumer;
+  tx_.cached = *tx_.producer;
+
+  if (!LoadProgram(ifindex, options.mode))
+    return false;
+
+  // Zero copy needs a driver moving frames into the memory itself.
+  struct sockaddr_xdp addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sxdp_family = AF_XDP;
+  addr.sxdp_ifindex = ifindex;
+  addr.sxdp_queue_id = options.queue;
+  addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+  zero_copy_ = native_ &&
+               bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+  if (!zero_copy_) {
+    addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+    if (bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+      LOG(ERROR) << "Unable to bind to queue " << options.queue << " of "
+                 << ifname_ << ": " << strerror(errno);
+      return false;
+    }
+  }
+
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  uint32_t key = options.queue;
+  uint32_t value = fd_;
+  attr.map_fd = map_fd_;
+  attr.key = (uint64_t)&key;
+  attr.value = (uint64_t)&value;
+  if (Bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+    LOG(ERROR) << "Unable to redirect queue " << options.queue << " of "
+               << ifname_ << ": " << strerror(errno);
+    return false;
+  }
+
+  Refill();
+  return true;
+}
+
+bool XdpDevice::MapRing(Ring* ring, int ring_size, uint64_t pgoff,
+                        const struct xdp_ring_offset& off,
+                        size_t desc_size) {
+  ring->map_len = off.desc + ring_size * desc_size;
+  void* map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd_, pgoff);
+  if (map == MAP_FAILED) {
+    ring->map_len = 0;
+    return false;
+  }
+  unsigned char* base = (unsigned char*)map;
+  ring->map = map;
+  ring->producer = (uint32_t*)(base + off.producer);
+  ring->consumer = (uint32_t*)(base + off.consumer);
+  ring->flags = (uint32_t*)(base + off.flags);
+  ring->descs = base + off.desc;
+  ring->size = ring_size;
+  return true;
+}
+
+bool XdpDevice::LoadProgram(unsigned int ifindex, XdpDeviceMode mode) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = 64;
+  map_fd_ = Bpf(BPF_MAP_CREATE, &attr);
+  if (map_fd_ < 0) {
+    LOG(ERROR) << "Unable to create socket map: " << strerror(errno);
+    return false;
+  }
+
+  // return bpf_redirect_map(&map, ctx->rx_queue_index, XDP_PASS);
+  struct bpf_insn prog[] = {
+    Insn(BPF_LDX | BPF_MEM | BPF_W, BPF_REG_2, BPF_REG_1,
+         offsetof(struct xdp_md, rx_queue_index), 0),
+    Insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0,
+         map_fd_),
+    Insn(0, 0, 0, 0, 0),
+    Insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS),
+    Insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+    Insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+  };
+  static const char kLicense[] = "GPL";
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.insns = (uint64_t)prog;
+  attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+  attr.license = (uint64_t)kLicense;
+  prog_fd_ = Bpf(BPF_PROG_LOAD, &attr);
+  if (prog_fd_ < 0) {
+    LOG(ERROR) << "Unable to load xdp program: " << strerror(errno);
+    return false;
+  }
+
+  // Attached through a link, which detaches the program when closed, even
+  // if the process dies.
+  for (int native = 1; native >= 0; --native) {
+    if (native && mode == XDP_DEVICE_GENERIC)
+      continue;
+    if (!native && mode == XDP_DEVICE_NATIVE)
+      break;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = prog_fd_;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    link_fd_ = Bpf(BPF_LINK_CREATE, &attr);
+    if (link_fd_ >= 0) {
+      native_ = native;
+      return true;
+    }
+  }
+  LOG(ERROR) << "Unable to attach xdp program to " << ifname_ << ": "
+             << strerror(errno);
+  return false;
+}
+
+void XdpDevice::close() {
+  Ring* rings[] = {&fill_, &completion_, &rx_, &tx_};
+  for (int i = 0; i < 4; ++i) {
+    if (rings[i]->map) {
+      munmap(rings[i]->map, rings[i]->map_len);
+      rings[i]->map = NULL;
+    }
+  }
+  int* fds[] = {&link_fd_, &prog_fd_, &map_fd_, &fd_};
+  for (int i = 0; i < 4; ++i) {
+    if (*fds[i] >= 0) {
+      ::close(*fds[i]);
+      *fds[i] = -1;
+    }
+  }
+}
+
+uint32_t XdpDevice::Ready(Ring* ring) {
+  return __atomic_load_n(ring->producer, __ATOMIC_ACQUIRE) - ring->cached;
+}
+
+uint32_t XdpDevice::Free(Ring* ring) {
+  return ring->size -
+         (ring->cached - __atomic_load_n(ring->consumer, __ATOMIC_ACQUIRE));
+}
+
+void XdpDevice::Refill() {
+  Buffer* buffers[64];
+  uint64_t* addrs = (uint64_t*)fill_.descs;
+  uint32_t free = Free(&fill_);
+  while (free > 0) {
+    int n = pool_->GetBurst(buffers, free < 64 ? free : 64);
+    for (int i = 0; i < n; ++i)
+      addrs[fill_.cached++ & (fill_.size - 1)] = pool_->OffsetOf(buffers[i]);
+    free -= n;
+    if (n < 64)
+      break;
+  }
+  __atomic_store_n(fill_.producer, fill_.cached, __ATOMIC_RELEASE);
+  if (Free(&fill_) == fill_.size)
+    metrics_.rx_empty->Increment();
+}
+
+void XdpDevice::Complete() {
+  uint32_t n = Ready(&completion_);
+  const uint64_t* addrs = (const uint64_t*)completion_.descs;
+  for (uint32_t i = 0; i < n; ++i) {
+    uint64_t addr = addrs[completion_.cached++ & (completion_.size - 1)];
+    pool_->BufferAt(addr)->Unref();
+  }
+  if (n)
+    __atomic_store_n(completion_.consumer, completion_.cached,
+                     __ATOMIC_RELEASE);
+}
+
+void XdpDevice::Kick() {
+  if (!(__atomic_load_n(tx_.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP))
+    return;
+  metrics_.kicks->Increment();
+  // Sends until done in copy mode, so there is nothing to retry.
+  sendto(fd_, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+bool XdpDevice::Wait(int timeout_ms) {
+  while (fd_ >= 0 && !Ready(&rx_)) {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int r = poll(&pfd, 1, timeout_ms);
+    if (r == 0 || (r < 0 && errno != EINTR))
+      return false;
+  }
+  return fd_ >= 0;
+}
+
+int XdpDevice::PeekBurst(FrameSlot* frames, int n) {
+  if (fd_ < 0 || n <= 0)
+    return 0;
+  uint32_t ready = Ready(&rx_) - peeked_;
+  if (!ready &&
+      (__atomic_load_n(fill_.flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP)) {
+    // The driver waits for a system call to go on receiving.
+    metrics_.kicks->Increment();
+    recvfrom(fd_, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    ready = Ready(&rx_) - peeked_;
+  }
+  if ((uint32_t)n > ready)
+    n = ready;
+  const struct xdp_desc* descs = (const struct xdp_desc*)rx_.descs;
+  uint64_t bytes = 0;
+  for (int i = 0; i < n; ++i) {
+    const struct xdp_desc& d = descs[(rx_.cached + peeked_++) &
+                                     (rx_.size - 1)];
+    frames[i].data = pool_->memory() + d.addr;
+    frames[i].len = d.len;
+    frames[i].cap = d.len;
+    bytes += d.len;
+  }
+  metrics_.rx_frames->Add(n);
+  metrics_.rx_bytes->Add(bytes);
+  return n;
+}
+
+void XdpDevice::Release() {
+  if (!peeked_)
+    return;
+  // The chunks of the frames go straight back to the fill ring, which has
+  // room since the kernel took them from it.
+  const struct xdp_desc* descs = (const struct xdp_desc*)rx_.descs;
+  uint64_t* addrs = (uint64_t*)fill_.descs;
+  uint32_t free = Free(&fill_);
+  size_t stride = pool_->stride();
+  for (uint32_t i = 0; i < peeked_; ++i) {
+    uint64_t addr = descs[rx_.cached++ & (rx_.size - 1)].addr;
+    addr -= addr % stride;
+    if (free) {
+      addrs[fill_.cached++ & (fill_.size - 1)] = addr;
+      --free;
+    } else {
+      pool_->BufferAt(addr)->Unref();
+    }
+  }
+  peeked_ = 0;
+  __atomic_store_n(rx_.consumer, rx_.cached, __ATOMIC_RELEASE);
+  __atomic_store_n(fill_.producer, fill_.cached, __ATOMIC_RELEASE);
+}
+
+int XdpDevice::ReadBuffers(Buffer** buffers, int n) {
+  Release();
+  FrameSlot frames[64];
+  int got = 0;
+  while (got < n) {
+    int m = PeekBurst(frames, n - got < 64 ? n - got : 64);
+    if (!m)
+      break;
+    const struct xdp_desc* descs = (const struct xdp_desc*)rx_.descs;
+    size_t stride = pool_->stride();
+    for (int i = 0; i < m; ++i) {
+      const struct xdp_desc& d = descs[rx_.cached++ & (rx_.size - 1)];
+      // The buffer's reference is the one it was given to the kernel with.
+      Buffer* b = pool_->BufferAt(d.addr);
+      b->SetData(d.addr % stride, d.len);
+      buffers[got++] = b;
+    }
+    peeked_ = 0;
+    __atomic_store_n(rx_.consumer, rx_.cached, __ATOMIC_RELEASE);
+  }
+  Refill();
+  return got;
+}
+
+int XdpDevice::TryReadBurst(FrameSlot* frames, int n) {
+  if (n <= 0)
+    return 0;
+  Release();
+  FrameSlot peeked[64];
+  int got = 0;
+  while (got < n) {
+    int m = PeekBurst(peeked, n - got < 64 ? n - got : 64);
+    if (!m)
+      break;
+    for (int i = 0; i < m; ++i, ++got) {
+      unsigned int len = peeked[i].len;
+      // Frames larger than the slot are truncated, like a short read.
+      if (len > frames[got].cap)
+        len = frames[got].cap;
+      memcpy(frames[got].data, peeked[i].data, len);
+      frames[got].len = len;
+    }
+    Release();
+  }
+  return got;
+}
+
+int XdpDevice::WriteBuffers(Buffer** buffers, int n) {
+  if (fd_ < 0 || n <= 0) {
+    for (int i = 0; i < n; ++i)
+      buffers[i]->Unref();
+    return 0;
+  }
+  Complete();
+  struct xdp_desc* descs = (struct xdp_desc*)tx_.descs;
+  uint32_t free = Free(&tx_);
+  int sent = 0;
+  uint64_t bytes = 0;
+  for (int i = 0; i < n; ++i) {
+    Buffer* b = buffers[i];
+    if (!free || b->len() > mtu_ + header_len()) {
+      metrics_.tx_drops->Increment();
+      b->Unref();
+      continue;
+    }
+    if (b->pool() != pool_) {
+      Buffer* copy = pool_->Get();
+      if (!copy) {
+        metrics_.tx_drops->Increment();
+        b->Unref();
+        continue;
+      }
+      memcpy(copy->data(), b->data(), b->len());
+      copy->set_len(b->len());
+      b->Unref();
+      b = copy;
+      metrics_.tx_copies->Increment();
+    }
+    struct xdp_desc& d = descs[tx_.cached++ & (tx_.size - 1)];
+    d.addr = b->data() - pool_->memory();
+    d.len = b->len();
+    d.options = 0;
+    bytes += b->len();
+    --free;
+    ++sent;
+  }
+  __atomic_store_n(tx_.producer, tx_.cached, __ATOMIC_RELEASE);
+  Kick();
+  metrics_.tx_frames->Add(sent);
+  metrics_.tx_bytes->Add(bytes);
+  return sent;
+}
+
+}  // namespace bangnet
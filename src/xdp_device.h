@@ -0,0 +1,156 @@
+#ifndef BANGNET_XDP_DEVICE_H_
+#define BANGNET_XDP_DEVICE_H_
+
+#include <stdint.h>
+
+#include <linux/if_xdp.h>
+
+#include "src/buffer_device.h"
+#include "src/buffer_pool.h"
+#include "src/common.h"
+#include "src/metrics.h"
+
+namespace bangnet {
+
+// How the redirect program is attached to the interface.
+enum XdpDeviceMode {
+  // In the driver if it supports XDP, else generic.
+  XDP_DEVICE_AUTO,
+  // In the driver only, fails on drivers without XDP.
+  XDP_DEVICE_NATIVE,
+  // Generic XDP, on the kernel's receive path after the driver, which
+  // works on any interface but copies every frame.
+  XDP_DEVICE_GENERIC
+};
+
+struct XdpDeviceOptions {
+  XdpDeviceOptions()
+      : frame_size(4096), frames(4096), ring_size(2048), queue(0),
+        mode(XDP_DEVICE_AUTO) {}
+
+  // The frame memory is frames chunks of frame_size bytes, 2048 or 4096.
+  // Received frames start XDP_PACKET_HEADROOM bytes into their chunk.
+  unsigned int frame_size;
+  unsigned int frames;
+
+  // Entries of each of the four rings, a power of 2.
+  unsigned int ring_size;
+
+  // Receive queue of the interface the device reads.
+  unsigned int queue;
+
+  XdpDeviceMode mode;
+};
+
+// A frame device on an existing interface through an AF_XDP socket. A
+// small XDP program redirects the frames of one receive queue to the
+// socket, other queues' frames and those of no socket go on to the
+// kernel. Frames live in memory shared with the kernel, the buffers of
+// pool(): received frames are read in place, and frames built in pool
+// buffers are sent without a copy where the driver supports zero copy.
+// The interface can have only one device, as it has one XDP program.
+class XdpDevice : public BufferDevice {
+public:
+  // Attaches to the interface ifname, check IsOpen() for errors. Needs
+  // root.
+  XdpDevice(const string& ifname, const XdpDeviceOptions& options);
+  ~XdpDevice();
+
+  string device_name() const { return ifname_; }
+  unsigned int mtu() const { return mtu_; }
+  int fd() const { return fd_; }
+  bool IsOpen() const { return fd_ >= 0; }
+  void close();
+
+  // True if the program runs in the driver, and if frames move without
+  // copies.
+  bool native() const { return native_; }
+  bool zero_copy() const { return zero_copy_; }
+
+  // Buffers in the memory shared with the kernel.
+  BufferPool* pool() const { return pool_; }
+
+  int TryReadBurst(FrameSlot* frames, int n);
+  int ReadBuffers(Buffer** buffers, int n);
+  int WriteBuffers(Buffer** buffers, int n);
+
+  // Points up to n frames at the received ones without copying, returns
+  // their count. The frames stay valid until Release().
+  int PeekBurst(FrameSlot* frames, int n);
+
+  // Hands the frames peeked back to the kernel to receive into.
+  void Release();
+
+private:
+  // One of the rings shared with the kernel, its producer and consumer
+  // indexes running freely and masked on access.
+  struct Ring {
+    Ring() : producer(NULL), consumer(NULL), flags(NULL), descs(NULL),
+             map(NULL), map_len(0), size(0), cached(0) {}
+
+    uint32_t* producer;
+    uint32_t* consumer;
+    uint32_t* flags;
+    void* descs;
+    void* map;
+    size_t map_len;
+    uint32_t size;
+    // Our own index, the producer one of rings we fill.
+    uint32_t cached;
+  };
+
+  bool Setup(const XdpDeviceOptions& options);
+  bool MapRing(Ring* ring, int ring_size, uint64_t pgoff,
+               const struct xdp_ring_offset& off, size_t desc_size);
+  bool LoadProgram(unsigned int ifindex, XdpDeviceMode mode);
+  void RegisterMetrics();
+
+  // Entries of a ring filled by the kernel waiting to be read.
+  uint32_t Ready(Ring* ring);
+  // Entries of a ring we fill left free.
+  uint32_t Free(Ring* ring);
+
+  // Gives the kernel pool buffers to receive into.
+  void Refill();
+  // Returns sent buffers to the pool.
+  void Complete();
+  // Gets the kernel to send what is in the transmit ring.
+  void Kick();
+
+  bool Wait(int timeout_ms);
+  void CountTxDrops(uint64_t n) { metrics_.tx_drops->Add(n); }
+
+  string ifname_;
+  unsigned int mtu_;
+  int fd_;
+  int map_fd_;
+  int prog_fd_;
+  int link_fd_;
+  bool native_;
+  bool zero_copy_;
+
+  BufferPool* pool_;
+  Ring fill_;
+  Ring completion_;
+  Ring rx_;
+  Ring tx_;
+  // Received frames peeked but not released.
+  uint32_t peeked_;
+
+  struct Metrics {
+    Counter* rx_frames;
+    Counter* rx_bytes;
+    Counter* rx_empty;
+    Counter* tx_frames;
+    Counter* tx_bytes;
+    Counter* tx_drops;
+    Counter* tx_copies;
+    Counter* kicks;
+  } metrics_;
+
+  BN_DISALLOW_COPY_AND_ASSIGN(XdpDevice);
+};
+
+}  // namespace bangnet
+
+#endif  // BANGNET_XDP_DEVICE_H_
@@ -0,0 +1,183 @@
+#include "src/xdp_device.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+
+#include <gtest/gtest.h>
+
+#include "src/packet_device.h"
+
+namespace bangnet {
+namespace {
+
+void MakeFrame(unsigned char* frame, unsigned int len, unsigned char id) {
+  memset(frame, 0, len);
+  memset(frame, 0xff, 6);
+  frame[6] = 0x02;
+  frame[12] = 0x88;
+  frame[13] = 0xb5;
+  frame[14] = id;
+}
+
+bool IsOurs(const unsigned char* frame, unsigned int len) {
+  return len >= 15 && frame[12] == 0x88 && frame[13] == 0xb5;
+}
+
+// A veth pair with a packet device on one end, created for each test when
+// running as root, and xdp devices on the other.
+class XdpDeviceTest : public ::testing::Test {
+protected:
+  XdpDeviceTest() : ok_(false), peer_(NULL) {
+    char name[IFNAMSIZ];
+    snprintf(name, sizeof(name), "bnx%da", (int)getpid());
+    a_ = name;
+    snprintf(name, sizeof(name), "bnx%db", (int)getpid());
+    b_ = name;
+    options_.frames = 256;
+    options_.ring_size = 64;
+  }
+
+  void SetUp() {
+    ok_ = geteuid() == 0 && PacketDevice::CreateVethPair(a_, b_);
+    if (ok_)
+      peer_ = new PacketDevice(a_, PacketDeviceOptions());
+  }
+
+  void TearDown() {
+    delete peer_;
+    if (ok_)
+      PacketDevice::DeleteVethPair(a_);
+  }
+
+  // Sends n of our frames from the peer to dev and reads them back.
+  void RoundTrip(XdpDevice* dev, int n) {
+    unsigned char frame[100];
+    for (int i = 0; i < n; ++i) {
+      MakeFrame(frame, sizeof(frame), (unsigned char)i);
+      ASSERT_TRUE(peer_->WriteFrame(frame, sizeof(frame)));
+    }
+    unsigned char mem[8][2048];
+    FrameSlot frames[8];
+    for (int i = 0; i < 8; ++i) {
+      frames[i].data = mem[i];
+      frames[i].cap = sizeof(mem[i]);
+    }
+    int got = 0;
+    while (got < n) {
+      struct pollfd pfd;
+      pfd.fd = dev->fd();
+      pfd.events = POLLIN;
+      if (poll(&pfd, 1, 1000) <= 0)
+        break;
+      int m = dev->TryReadBurst(frames, 8);
+      for (int i = 0; i < m; ++i) {
+        if (IsOurs(frames[i].data, frames[i].len)) {
+          EXPECT_EQ(sizeof(frame), frames[i].len);
+          EXPECT_EQ(got++, frames[i].data[14]);
+        }
+      }
+    }
+    EXPECT_EQ(n, got);
+  }
+
+  bool ok_;
+  string a_;
+  string b_;
+  XdpDeviceOptions options_;
+  PacketDevice* peer_;
+};
+
+TEST_F(XdpDeviceTest, FailsOnMissingInterface) {
+  XdpDevice dev("bnx-missing", options_);
+  EXPECT_FALSE(dev.IsOpen());
+  options_.frame_size = 1000;
+  XdpDevice bad(b_, options_);
+  EXPECT_FALSE(bad.IsOpen());
+}
+
+TEST_F(XdpDeviceTest, ReceivesFrames) {
+  if (!ok_) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  XdpDevice dev(b_, options_);
+  ASSERT_TRUE(dev.IsOpen());
+  EXPECT_EQ(1500u, dev.mtu());
+  // More frames than the fill ring holds, so buffers are recycled.
+  for (int i = 0; i < 4; ++i)
+    RoundTrip(&dev, 40);
+}
+
+TEST_F(XdpDeviceTest, FallsBackToGenericMode) {
+  if (!ok_) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  options_.mode = XDP_DEVICE_GENERIC;
+  XdpDevice dev(b_, options_);
+  ASSERT_TRUE(dev.IsOpen());
+  EXPECT_FALSE(dev.native());
+  EXPECT_FALSE(dev.zero_copy());
+  RoundTrip(&dev, 10);
+}
+
+TEST_F(XdpDeviceTest, SharesBuffersWithPool) {
+  if (!ok_) {
+    printf("skipped, needs root\n");
+    return;
+  }
+  XdpDevice dev(b_, options_);
+  ASSERT_TRUE(dev.IsOpen());
+  BufferPool* pool = dev.pool();
+  // The fill ring holds the rest.
+  unsigned int available = pool->available();
+  EXPECT_EQ(options_.frames - options_.ring_size, available);
+
+  unsigned char frame[64];
+  MakeFrame(frame, sizeof(frame), 7);
+  ASSERT_TRUE(peer_->WriteFrame(frame, sizeof(frame)));
+  Buffer* buffers[8];
+  int n = 0;
+  for (int tries = 0; !n && tries < 100; ++tries) {
+    usleep(1000);
+    n = dev.ReadBuffers(buffers, 8);
+  }
+  ASSERT_GE(n, 1);
+  Buffer* b = buffers[n - 1];
+  EXPECT_EQ(pool, b->pool());
+  EXPECT_EQ(sizeof(frame), b->len());
+  EXPECT_EQ(7, b->data()[14]);
+  EXPECT_GE(b->headroom(), 128u);
+  // The fill ring took new buffers in their place.
+  EXPECT_EQ(available - n, pool->available());
+
+  // Sent back from the pool without a copy, and to the pool once sent.
+  b->data()[14] = 8;
+  for (int i = 0; i < n - 1; ++i)
+    buffers[i]->Unref();
+  EXPECT_EQ(1, dev.WriteBuffers(&b, 1));
+  unsigned char buf[2048];
+  bool echoed = false;
+  for (int tries = 0; !echoed && tries < 100; ++tries) {
+    FrameSlot slot;
+    slot.data = buf;
+    slot.cap = sizeof(buf);
+    struct pollfd pfd;
+    pfd.fd = peer_->fd();
+    pfd.events = POLLIN;
+    poll(&pfd, 1, 10);
+    if (peer_->TryReadBurst(&slot, 1) == 1 && IsOurs(buf, slot.len))
+      echoed = buf[14] == 8;
+  }
+  EXPECT_TRUE(echoed);
+
+  // Copied frames reclaim the sent buffers first, and are in flight.
+  MakeFrame(frame, sizeof(frame), 9);
+  EXPECT_TRUE(dev.WriteFrame(frame, sizeof(frame)));
+  EXPECT_EQ(available - 1, pool->available());
+}
+
+}  // namespace
+}  // namespace bangnet